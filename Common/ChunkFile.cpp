@@ -15,9 +15,107 @@
 // Official SVN repository and contact information can be found at
 // http://code.google.com/p/dolphin-emu/
 
+#include <algorithm>
 #include <cstring>
+#include <functional>
+#include <vector>
 
+#include "base/basictypes.h"
+#include "thread/thread.h"
 #include "ChunkFile.h"
+#include "CPUDetect.h"
+
+// Values of SChunkHeader::Compress.  Older versions only know about the first two.
+enum {
+	COMPRESS_NONE = 0,
+	// The whole state as one snappy block.
+	COMPRESS_SNAPPY = 1,
+	// A ChunkedHeader and a table of u32 compressed sizes, followed by the snappy compressed chunks.
+	// Each chunk is independent, so they can be compressed and decompressed in parallel.
+	COMPRESS_SNAPPY_CHUNKED = 2,
+};
+
+static const u32 COMPRESS_CHUNK_SIZE = 1024 * 1024;
+
+struct ChunkedHeader {
+	u32 chunkSize;
+	u32 numChunks;
+};
+
+// Runs loop over [0, count) split across a few short lived threads.
+// Savestates are written from the save thread while the emu thread may be using GlobalThreadPool
+// (spline tessellation, ISO block decompression), so we don't share that pool here.
+static void ParallelChunkLoop(const std::function<void(int,int)> &loop, int count) {
+	const int numThreads = std::min(count, std::max(1, cpu_info.logical_cpu_count));
+	if (numThreads <= 1) {
+		loop(0, count);
+		return;
+	}
+
+	std::vector<std::thread *> threads;
+	for (int i = 1; i < numThreads; ++i) {
+		const int lower = (int)((s64)count * i / numThreads);
+		const int upper = (int)((s64)count * (i + 1) / numThreads);
+		threads.push_back(new std::thread(std::bind(loop, lower, upper)));
+	}
+	loop(0, count / numThreads);
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i]->join();
+		delete threads[i];
+	}
+}
+
+static void CompressChunks(const u8 *src, size_t sz, u8 *dst, size_t dstStride, size_t *dstSizes, int lower, int upper) {
+	for (int i = lower; i < upper; ++i) {
+		const size_t offset = (size_t)i * COMPRESS_CHUNK_SIZE;
+		const size_t len = std::min((size_t)COMPRESS_CHUNK_SIZE, sz - offset);
+		dstSizes[i] = dstStride;
+		snappy_compress((const char *)src + offset, len, (char *)dst + i * dstStride, &dstSizes[i]);
+	}
+}
+
+static void DecompressChunkRange(const u8 *src, const size_t *srcOffsets, const u32 *srcSizes, u32 chunkSize, u8 *dst, size_t dstSize, bool *ok, int lower, int upper) {
+	for (int i = lower; i < upper; ++i) {
+		const size_t offset = (size_t)i * chunkSize;
+		const size_t expected = std::min((size_t)chunkSize, dstSize - offset);
+		size_t len = expected;
+		ok[i] = snappy_uncompress((const char *)src + srcOffsets[i], srcSizes[i], (char *)dst + offset, &len) == SNAPPY_OK && len == expected;
+	}
+}
+
+// Validates the chunk table against the payload size, then decompresses the chunks in parallel.
+static bool DecompressChunks(const u8 *src, size_t srcSize, u8 *dst, size_t dstSize) {
+	ChunkedHeader chunked;
+	if (srcSize < sizeof(chunked))
+		return false;
+	memcpy(&chunked, src, sizeof(chunked));
+	if (chunked.chunkSize == 0 || chunked.numChunks != (dstSize + chunked.chunkSize - 1) / chunked.chunkSize)
+		return false;
+	const size_t tableSize = (size_t)chunked.numChunks * sizeof(u32);
+	if (srcSize - sizeof(chunked) < tableSize)
+		return false;
+
+	std::vector<u32> sizes(chunked.numChunks);
+	std::vector<size_t> offsets(chunked.numChunks);
+	if (tableSize != 0)
+		memcpy(&sizes[0], src + sizeof(chunked), tableSize);
+	size_t pos = sizeof(chunked) + tableSize;
+	for (u32 i = 0; i < chunked.numChunks; ++i) {
+		if (srcSize - pos < sizes[i])
+			return false;
+		offsets[i] = pos;
+		pos += sizes[i];
+	}
+	if (chunked.numChunks == 0)
+		return true;
+
+	// vector<bool> is packed, and we write these from several threads.
+	bool *ok = new bool[chunked.numChunks];
+	ParallelChunkLoop(std::bind(&DecompressChunkRange, src, &offsets[0], &sizes[0], chunked.chunkSize, dst, dstSize, ok, placeholder::_1, placeholder::_2), chunked.numChunks);
+	bool success = std::find(ok, ok + chunked.numChunks, false) == ok + chunked.numChunks;
+	delete [] ok;
+	return success;
+}
 
 PointerWrapSection PointerWrap::Section(const char *title, int ver) {
 	return Section(title, ver, ver);
@@ -161,7 +259,7 @@ PointerWrapSection::~PointerWrapSection() {
 	}
 }
 
-CChunkFileReader::Error CChunkFileReader::LoadFile(const std::string& _rFilename, int _Revision, const char *_VersionString, u8 *&_buffer, size_t &sz, std::string *_failureReason) {
+CChunkFileReader::Error CChunkFileReader::LoadFile(const std::string& _rFilename, int _MinRevision, int _Revision, const char *_VersionString, u8 *&_buffer, size_t &sz, std::string *_failureReason) {
 	if (!File::Exists(_rFilename)) {
 		*_failureReason = "LoadStateDoesntExist";
 		ERROR_LOG(COMMON, "ChunkReader: File doesn't exist");
@@ -193,9 +291,9 @@ CChunkFileReader::Error CChunkFileReader::LoadFile(const std::string& _rFilename
 	}
 
 	// Check revision
-	if (header.Revision != _Revision)
+	if (header.Revision < _MinRevision || header.Revision > _Revision)
 	{
-		ERROR_LOG(COMMON, "ChunkReader: Wrong file revision, got %d expected %d", header.Revision, _Revision);
+		ERROR_LOG(COMMON, "ChunkReader: Wrong file revision, got %d expected %d-%d", header.Revision, _MinRevision, _Revision);
 		return ERROR_BAD_FILE;
 	}
 
@@ -216,7 +314,18 @@ CChunkFileReader::Error CChunkFileReader::LoadFile(const std::string& _rFilename
 	}
 
 	_buffer = buffer;
-	if (header.Compress) {
+	if (header.Compress == COMPRESS_SNAPPY_CHUNKED) {
+		u8 *uncomp_buffer = new u8[header.UncompressedSize];
+		if (!DecompressChunks(buffer, sz, uncomp_buffer, header.UncompressedSize)) {
+			ERROR_LOG(COMMON, "ChunkReader: Corrupt compressed state");
+			delete [] uncomp_buffer;
+			delete [] buffer;
+			return ERROR_BAD_FILE;
+		}
+		_buffer = uncomp_buffer;
+		sz = header.UncompressedSize;
+		delete [] buffer;
+	} else if (header.Compress) {
 		u8 *uncomp_buffer = new u8[header.UncompressedSize];
 		size_t uncomp_size = header.UncompressedSize;
 		snappy_uncompress((const char *)buffer, sz, (char *)uncomp_buffer, &uncomp_size);
@@ -232,7 +341,7 @@ CChunkFileReader::Error CChunkFileReader::LoadFile(const std::string& _rFilename
 	return ERROR_NONE;
 }
 
-CChunkFileReader::Error CChunkFileReader::SaveFile(const std::string& _rFilename, int _Revision, const char *_VersionString, u8 *buffer, size_t sz) {
+CChunkFileReader::Error CChunkFileReader::SaveFile(const std::string& _rFilename, int _Revision, const char *_VersionString, const u8 *buffer, size_t sz) {
 	INFO_LOG(COMMON, "ChunkReader: Writing %s" , _rFilename.c_str());
 
 	File::IOFile pFile(_rFilename, "wb");
@@ -242,50 +351,54 @@ CChunkFileReader::Error CChunkFileReader::SaveFile(const std::string& _rFilename
 		return ERROR_BAD_FILE;
 	}
 
-	bool compress = true;
-
 	// Create header
 	SChunkHeader header;
-	header.Compress = compress ? 1 : 0;
+	header.Compress = COMPRESS_SNAPPY_CHUNKED;
 	header.Revision = _Revision;
-	header.ExpectedSize = (u32)sz;
 	header.UncompressedSize = (u32)sz;
 	strncpy(header.GitVersion, _VersionString, 32);
 	header.GitVersion[31] = '\0';
 
+	const u32 numChunks = (u32)((sz + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE);
+	const size_t maxChunkSize = snappy_max_compressed_length(COMPRESS_CHUNK_SIZE);
+	std::vector<u8> compressed(maxChunkSize * numChunks);
+	std::vector<size_t> chunkSizes(numChunks);
+	if (numChunks != 0)
+		ParallelChunkLoop(std::bind(&CompressChunks, buffer, sz, &compressed[0], maxChunkSize, &chunkSizes[0], placeholder::_1, placeholder::_2), numChunks);
+
+	ChunkedHeader chunked;
+	chunked.chunkSize = COMPRESS_CHUNK_SIZE;
+	chunked.numChunks = numChunks;
+	std::vector<u32> table(numChunks);
+	size_t compressedSize = 0;
+	for (u32 i = 0; i < numChunks; ++i)
+	{
+		table[i] = (u32)chunkSizes[i];
+		compressedSize += chunkSizes[i];
+	}
+	header.ExpectedSize = (u32)(sizeof(chunked) + table.size() * sizeof(u32) + compressedSize);
+
 	// Write to file
-	if (compress) {
-		size_t comp_len = snappy_max_compressed_length(sz);
-		u8 *compressed_buffer = new u8[comp_len];
-		snappy_compress((const char *)buffer, sz, (char *)compressed_buffer, &comp_len);
-		delete [] buffer;
-		header.ExpectedSize = (u32)comp_len;
-		if (!pFile.WriteArray(&header, 1))
+	if (!pFile.WriteArray(&header, 1) || !pFile.WriteArray(&chunked, 1))
+	{
+		ERROR_LOG(COMMON, "ChunkReader: Failed writing header");
+		return ERROR_BAD_FILE;
+	}
+	if (numChunks != 0 && !pFile.WriteArray(&table[0], table.size()))
+	{
+		ERROR_LOG(COMMON, "ChunkReader: Failed writing chunk table");
+		return ERROR_BAD_FILE;
+	}
+	for (u32 i = 0; i < numChunks; ++i)
+	{
+		if (!pFile.WriteBytes(&compressed[i * maxChunkSize], chunkSizes[i]))
 		{
-			ERROR_LOG(COMMON, "ChunkReader: Failed writing header");
-			return ERROR_BAD_FILE;
-		}
-		if (!pFile.WriteBytes(&compressed_buffer[0], comp_len)) {
 			ERROR_LOG(COMMON, "ChunkReader: Failed writing compressed data");
 			return ERROR_BAD_FILE;
-		}	else {
-			INFO_LOG(COMMON, "Savestate: Compressed %i bytes into %i", (int)sz, (int)comp_len);
 		}
-		delete [] compressed_buffer;
-	} else {
-		if (!pFile.WriteArray(&header, 1))
-		{
-			ERROR_LOG(COMMON, "ChunkReader: Failed writing header");
-			return ERROR_BAD_FILE;
-		}
-		if (!pFile.WriteBytes(&buffer[0], sz))
-		{
-			ERROR_LOG(COMMON, "ChunkReader: Failed writing data");
-			return ERROR_BAD_FILE;
-		}
-		delete [] buffer;
 	}
 
+	INFO_LOG(COMMON, "Savestate: Compressed %i bytes into %i in %i chunks", (int)sz, (int)compressedSize, (int)numChunks);
 	INFO_LOG(COMMON, "ChunkReader: Done writing %s",  _rFilename.c_str());
 	return ERROR_NONE;
 }
@@ -578,13 +578,13 @@ public:
 
 	// Load file template
 	template<class T>
-	static Error Load(const std::string& _rFilename, int _Revision, const char *_VersionString, T& _class, std::string* _failureReason) 
+	static Error Load(const std::string& _rFilename, int _MinRevision, int _Revision, const char *_VersionString, T& _class, std::string* _failureReason) 
 	{
 		*_failureReason = "LoadStateWrongVersion";
 
 		u8 *ptr;
 		size_t sz;
-		Error error = LoadFile(_rFilename, _Revision, _VersionString, ptr, sz, _failureReason);
+		Error error = LoadFile(_rFilename, _MinRevision, _Revision, _VersionString, ptr, sz, _failureReason);
 		if (error == ERROR_NONE) {
 			u8 *buf = ptr;
 			error = LoadPtr(ptr, _class);
@@ -610,6 +610,7 @@ public:
 		if (error == ERROR_NONE)
 			error = SaveFile(_rFilename, _Revision, _VersionString, buffer, sz);
 
+		delete [] buffer;
 		return error;
 	}
 	
@@ -637,9 +638,11 @@ public:
 		return ERROR_NONE;
 	}
 
+	// Compresses and writes an already serialized state (from SavePtr.)  Safe to call from any thread.
+	static CChunkFileReader::Error SaveFile(const std::string& _rFilename, int _Revision, const char *_VersionString, const u8 *buffer, size_t sz);
+
 private:
-	static CChunkFileReader::Error LoadFile(const std::string& _rFilename, int _Revision, const char *_VersionString, u8 *&buffer, size_t &sz, std::string *_failureReason);
-	static CChunkFileReader::Error SaveFile(const std::string& _rFilename, int _Revision, const char *_VersionString, u8 *buffer, size_t sz);
+	static CChunkFileReader::Error LoadFile(const std::string& _rFilename, int _MinRevision, int _Revision, const char *_VersionString, u8 *&buffer, size_t &sz, std::string *_failureReason);
 
 	struct SChunkHeader
 	{
@@ -18,7 +18,10 @@
 #ifndef _FIXED_SIZE_QUEUE_H_
 #define _FIXED_SIZE_QUEUE_H_
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <vector>
 #include "ChunkFile.h"
 #include "MemoryUtil.h"
 
@@ -170,6 +173,116 @@ private:
 };
 
 
+// Wait-free ring buffer for exactly one producer thread and one consumer thread.
+// The positions only ever count up (wrapping at 2^32, which is why N must be a power of two),
+// and each is only written by its own side.  They sit on separate cache lines so the two
+// threads don't keep stealing the line from each other.
+template <class T, int N>
+class SPSCRingBuffer {
+public:
+	SPSCRingBuffer() {
+		static_assert((N & (N - 1)) == 0, "SPSCRingBuffer size must be a power of two");
+		storage_ = new T[N];
+		head_ = 0;
+		tail_ = 0;
+	}
+
+	~SPSCRingBuffer() {
+		delete [] storage_;
+	}
+
+	// Only safe when neither side is running.
+	void clear() {
+		head_ = 0;
+		tail_ = 0;
+	}
+
+	// Either side may call these, the answer is just a snapshot.
+	size_t size() const {
+		return (u32)(tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire));
+	}
+
+	size_t capacity() const {
+		return N;
+	}
+
+	// Producer side.
+	size_t room() const {
+		return N - (u32)(tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire));
+	}
+
+	// Gets pointers to write up to size items to (fewer if there's less room.)  Nothing is
+	// visible to the consumer until commitPush().
+	void pushPointers(size_t size, T **dest1, size_t *sz1, T **dest2, size_t *sz2) {
+		const u32 tail = tail_.load(std::memory_order_relaxed);
+		size = std::min(size, room());
+		const size_t pos = tail & (N - 1);
+		*dest1 = &storage_[pos];
+		*sz1 = std::min(size, N - pos);
+		*sz2 = size - *sz1;
+		*dest2 = *sz2 ? &storage_[0] : 0;
+	}
+
+	void commitPush(size_t size) {
+		tail_.store(tail_.load(std::memory_order_relaxed) + (u32)size, std::memory_order_release);
+	}
+
+	// Consumer side.  Gets pointers to up to size items, which stay valid until commitPop().
+	void popPointers(size_t size, const T **src1, size_t *sz1, const T **src2, size_t *sz2) {
+		const u32 head = head_.load(std::memory_order_relaxed);
+		size = std::min(size, (size_t)(u32)(tail_.load(std::memory_order_acquire) - head));
+		const size_t pos = head & (N - 1);
+		*src1 = &storage_[pos];
+		*sz1 = std::min(size, N - pos);
+		*sz2 = size - *sz1;
+		*src2 = *sz2 ? &storage_[0] : 0;
+	}
+
+	void commitPop(size_t size) {
+		head_.store(head_.load(std::memory_order_relaxed) + (u32)size, std::memory_order_release);
+	}
+
+	// Must be called from the producer side.  Uses the same layout as FixedSizeQueue.
+	// Since the consumer may be running, loading doesn't replace what's queued - it's at most
+	// a few ms of audio anyway.
+	void DoState(PointerWrap &p) {
+		int size = N;
+		p.Do(size);
+		if (size != N)
+		{
+			ERROR_LOG(COMMON, "Savestate failure: Incompatible queue size.");
+			return;
+		}
+
+		const u32 tail = tail_.load(std::memory_order_relaxed);
+		const u32 head = head_.load(std::memory_order_acquire);
+		int headPos = head & (N - 1);
+		int tailPos = tail & (N - 1);
+		int count = (int)(tail - head);
+		if (p.mode == PointerWrap::MODE_READ) {
+			std::vector<T> discard(N);
+			p.DoArray<T>(&discard[0], N);
+		} else {
+			p.DoArray<T>(storage_, N);
+		}
+		p.Do(headPos);
+		p.Do(tailPos);
+		p.Do(count);
+		p.DoMarker("FixedSizeQueue");
+	}
+
+private:
+	T *storage_;
+	std::atomic<u32> head_;
+	u8 padHead_[64 - sizeof(std::atomic<u32>)];
+	std::atomic<u32> tail_;
+	u8 padTail_[64 - sizeof(std::atomic<u32>)];
+
+	SPSCRingBuffer(const SPSCRingBuffer &other);
+	void operator =(const SPSCRingBuffer &other);
+};
+
+
 // I'm not sure this is 100% safe but it might be "Good Enough" :)
 // TODO: Use this, maybe make it safer first by using proper atomics
 // instead of volatile
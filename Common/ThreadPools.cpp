@@ -3,17 +3,23 @@
 #include "../Core/Config.h"
 
 std::shared_ptr<ThreadPool> GlobalThreadPool::pool;
-bool  GlobalThreadPool::initialized = false;
+std::atomic<bool> GlobalThreadPool::initialized(false);
+recursive_mutex GlobalThreadPool::initLock;
 
 void GlobalThreadPool::Loop(const std::function<void(int,int)>& loop, int lower, int upper) {
 	Inititialize();
 	pool->ParallelLoop(loop, lower, upper);
 }
 
+// Loop() can be called from the emu, GPU and I/O threads, so the first calls may race.
 void GlobalThreadPool::Inititialize() {
-	if(!initialized) {
+	if (initialized.load(std::memory_order_acquire))
+		return;
+
+	lock_guard guard(initLock);
+	if (!initialized.load(std::memory_order_relaxed)) {
 		pool = std::make_shared<ThreadPool>(g_Config.iNumWorkerThreads);
-		initialized = true;
+		initialized.store(true, std::memory_order_release);
 	}
 }
 
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <atomic>
+
+#include "base/mutex.h"
 #include "thread/threadpool.h"
 
 class GlobalThreadPool {
@@ -10,6 +13,7 @@ public:
 
 private:
 	static std::shared_ptr<ThreadPool> pool;
-	static bool initialized;
+	static std::atomic<bool> initialized;
+	static recursive_mutex initLock;
 	static void Inititialize();
 };
@@ -289,6 +289,7 @@ static ConfigSetting generalSettings[] = {
 	ConfigSetting("ScreenshotsAsPNG", &g_Config.bScreenshotsAsPNG, false),
 	ConfigSetting("StateSlot", &g_Config.iCurrentStateSlot, 0),
 	ConfigSetting("RewindFlipFrequency", &g_Config.iRewindFlipFrequency, 0),
+	ConfigSetting("RewindMemoryBudgetMB", &g_Config.iRewindMemoryBudgetMB, 64),
 
 	ConfigSetting("GridView1", &g_Config.bGridView1, true),
 	ConfigSetting("GridView2", &g_Config.bGridView2, true),
@@ -318,9 +319,10 @@ static ConfigSetting generalSettings[] = {
 static ConfigSetting cpuSettings[] = {
 	ReportedConfigSetting("Jit", &g_Config.bJit, &DefaultJit),
 	ReportedConfigSetting("SeparateCPUThread", &g_Config.bSeparateCPUThread, false),
-	ConfigSetting("AtomicAudioLocks", &g_Config.bAtomicAudioLocks, false),
 
 	ReportedConfigSetting("SeparateIOThread", &g_Config.bSeparateIOThread, true),
+	ConfigSetting("IOCacheSize", &g_Config.iIOCacheSize, 4096),
+	ConfigSetting("MemoryMapISO", &g_Config.bMemoryMapISO, true),
 	ConfigSetting("FastMemoryAccess", &g_Config.bFastMemory, true),
 	ReportedConfigSetting("FuncReplacements", &g_Config.bFuncReplacements, true),
 	ReportedConfigSetting("CPUSpeed", &g_Config.iLockedCPUSpeed, 0),
@@ -440,6 +442,8 @@ static ConfigSetting graphicsSettings[] = {
 
 	ReportedConfigSetting("MemBlockTransferGPU", &g_Config.bBlockTransferGPU, true),
 	ReportedConfigSetting("DisableSlowFramebufEffects", &g_Config.bDisableSlowFramebufEffects, false),
+	ConfigSetting("ShaderCache", &g_Config.bShaderCache, true),
+	ConfigSetting("VideoDecodeAhead", &g_Config.bVideoDecodeAhead, true),
 
 	ConfigSetting(false),
 };
@@ -450,6 +454,7 @@ static ConfigSetting soundSettings[] = {
 	ConfigSetting("VolumeSFX", &g_Config.iSFXVolume, 7),
 	ConfigSetting("AudioLatency", &g_Config.IaudioLatency, 1),
 	ConfigSetting("SoundSpeedHack", &g_Config.bSoundSpeedHack, false),
+	ConfigSetting("AudioDecodeAhead", &g_Config.bAudioDecodeAhead, true),
 
 	ConfigSetting(false),
 };
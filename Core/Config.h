@@ -91,7 +91,8 @@ public:
 	// Definitely cannot be changed while game is running.
 	bool bSeparateCPUThread;
 	bool bSeparateIOThread;
-	bool bAtomicAudioLocks;
+	int iIOCacheSize;  // In KB, 0 disables the UMD block cache.
+	bool bMemoryMapISO;
 	int iLockedCPUSpeed;
 	bool bAutoSaveSymbolMap;
 	int iScreenRotation;
@@ -140,6 +141,8 @@ public:
 	int iMaxRecent;
 	int iCurrentStateSlot;
 	int iRewindFlipFrequency;
+	// How much memory rewind snapshots may use, on top of the two full base states.
+	int iRewindMemoryBudgetMB;
 	bool bEnableAutoLoad;
 	bool bEnableCheats;
 	bool bReloadCheats;
@@ -149,6 +152,9 @@ public:
 	bool bAlphaMaskHack;
 	bool bBlockTransferGPU;
 	bool bDisableSlowFramebufEffects;
+	bool bShaderCache;
+	// Decode the next video frames on a worker thread while the game shows the current one.
+	bool bVideoDecodeAhead;
 	int iSplineBezierQuality; // 0 = low , 1 = Intermediate , 2 = High
 	std::string sPostShaderName;  // Off for off.
 
@@ -157,6 +163,8 @@ public:
 	int IaudioLatency; // 0 = low , 1 = medium(default) , 2 = high
 	int iSFXVolume;
 	int iBGMVolume;
+	// Decode the next Atrac/MP3 frame on a worker thread between calls.
+	bool bAudioDecodeAhead;
 
 	// Audio Hack
 	bool bSoundSpeedHack;
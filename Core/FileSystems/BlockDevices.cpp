@@ -16,11 +16,29 @@
 // https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
 
 
+#include "base/basictypes.h"
 #include "Common/FileUtil.h"
+#include "Common/ThreadPools.h"
+#include "Core/Config.h"
 #include "Core/FileSystems/BlockDevices.h"
+#include <algorithm>
 #include <cstdio>
+#include <functional>
 #include <cstring>
 
+#ifdef HAVE_MMAP_BLOCK_DEVICE
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#else
+#include <sys/param.h>
+#include <sys/mount.h>
+#endif
+#endif
+
+#include "ext/snappy/snappy-c.h"
+
 extern "C"
 {
 #include "zlib.h"
@@ -28,7 +46,7 @@ extern "C"
 #include "ext/libkirk/kirk_engine.h"
 };
 
-BlockDevice *constructBlockDevice(const char *filename) {
+static BlockDevice *constructRawBlockDevice(const char *filename) {
 	// Check for CISO
 	FILE *f = File::OpenCFile(filename, "rb");
 	if (!f)
@@ -38,10 +56,38 @@ BlockDevice *constructBlockDevice(const char *filename) {
 	fseek(f, 0, SEEK_SET);
 	if (!memcmp(buffer, "CISO", 4) && size == 4)
 		return new CISOFileBlockDevice(f);
+	else if (!memcmp(buffer, "PPSZ", 4) && size == 4)
+		return new PSZFileBlockDevice(f);
 	else if (!memcmp(buffer, "\x00PBP", 4) && size == 4)
 		return new NPDRMDemoBlockDevice(f);
-	else
-		return new FileBlockDevice(f);
+
+#ifdef HAVE_MMAP_BLOCK_DEVICE
+	if (g_Config.bMemoryMapISO) {
+		BlockDevice *mapped = MmapFileBlockDevice::Create(f);
+		if (mapped)
+			return mapped;
+	}
+#endif
+	return new FileBlockDevice(f);
+}
+
+BlockDevice *constructBlockDevice(const char *filename) {
+	BlockDevice *device = constructRawBlockDevice(filename);
+	// A mapped file is already served from memory, caching it again would only cost.
+	if (device && device->PeekBlocks(0, 1) == 0 && g_Config.iIOCacheSize > 0) {
+		u32 cacheBlocks = (u32)g_Config.iIOCacheSize * 1024 / device->GetBlockSize();
+		return new CachedBlockDevice(device, cacheBlocks);
+	}
+	return device;
+}
+
+bool BlockDevice::ReadBlocks(u32 minBlock, int count, u8 *outPtr) {
+	bool success = true;
+	for (int i = 0; i < count; ++i) {
+		if (!ReadBlock(minBlock + i, outPtr + i * GetBlockSize()))
+			success = false;
+	}
+	return success;
 }
 
 
@@ -74,6 +120,16 @@ bool FileBlockDevice::ReadBlock(int blockNumber, u8 *outPtr)
 	return true;
 }
 
+bool FileBlockDevice::ReadBlocks(u32 minBlock, int count, u8 *outPtr)
+{
+	const ssize_t bytes = (ssize_t)count * GetBlockSize();
+	lseek64(fd, (u64)minBlock * (u64)GetBlockSize(), SEEK_SET);
+	if (read(fd, outPtr, bytes) != bytes) {
+		ERROR_LOG(FILESYS, "Could not read() %d bytes from block %d", (int)bytes, minBlock);
+	}
+	return true;
+}
+
 #else
 
 FileBlockDevice::FileBlockDevice(FILE *file)
@@ -98,6 +154,153 @@ bool FileBlockDevice::ReadBlock(int blockNumber, u8 *outPtr)
 	return true;
 }
 
+bool FileBlockDevice::ReadBlocks(u32 minBlock, int count, u8 *outPtr)
+{
+	fseeko(f, (u64)minBlock * (u64)GetBlockSize(), SEEK_SET);
+	if (fread(outPtr, GetBlockSize(), count, f) != (size_t)count)
+		DEBUG_LOG(FILESYS, "Could not read %d blocks from block %d", count, minBlock);
+
+	return true;
+}
+
+#endif
+
+#ifdef HAVE_MMAP_BLOCK_DEVICE
+
+// How far ahead to ask the OS to page in, once reads look sequential.
+static const u64 MMAP_READAHEAD_BYTES = 1024 * 1024;
+
+// If a mapped file is truncated or its media goes away, touching the mapping raises SIGBUS
+// instead of returning a read error. So we only map files on local disk filesystems, and
+// read everything else (SD cards, USB sticks, network shares, FUSE) normally.
+static bool IsSafeToMap(int fd)
+{
+#if defined(__linux__)
+	struct statfs st;
+	if (fstatfs(fd, &st) != 0)
+		return false;
+	// From linux/magic.h, which older NDKs don't have.
+	switch ((u32)st.f_type)
+	{
+	case 0xEF53:      // ext2/3/4
+	case 0x9123683E:  // btrfs
+	case 0x58465342:  // xfs
+	case 0xF2F52010:  // f2fs
+	case 0x01021994:  // tmpfs
+	case 0x2FC12FC1:  // zfs
+		return true;
+	default:
+		return false;
+	}
+#else
+	struct statfs st;
+	if (fstatfs(fd, &st) != 0)
+		return false;
+	if ((st.f_flags & MNT_LOCAL) == 0)
+		return false;
+#ifdef MNT_REMOVABLE
+	if ((st.f_flags & MNT_REMOVABLE) != 0)
+		return false;
+#endif
+	return true;
+#endif
+}
+
+MmapFileBlockDevice *MmapFileBlockDevice::Create(FILE *file)
+{
+	const int fd = fileno(file);
+	if (!IsSafeToMap(fd))
+	{
+		INFO_LOG(LOADER, "Not mapping ISO on removable or remote storage");
+		return 0;
+	}
+
+	const off_t size = lseek(fd, 0, SEEK_END);
+	lseek(fd, 0, SEEK_SET);
+	if (size <= 0)
+		return 0;
+
+	void *data = mmap(0, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		WARN_LOG(LOADER, "Unable to map ISO into memory, reading it normally");
+		return 0;
+	}
+	return new MmapFileBlockDevice(file, (const u8 *)data, (u64)size);
+}
+
+MmapFileBlockDevice::MmapFileBlockDevice(FILE *file, const u8 *data_, u64 size_)
+	: f(file), data(data_), size(size_), nextSequential(0), advisedEnd(0)
+{
+	INFO_LOG(LOADER, "Mapped %lld byte ISO into memory", (long long)size);
+}
+
+MmapFileBlockDevice::~MmapFileBlockDevice()
+{
+	munmap((void *)data, (size_t)size);
+	fclose(f);
+}
+
+bool MmapFileBlockDevice::ReadBlock(int blockNumber, u8 *outPtr)
+{
+	return ReadBlocks((u32)blockNumber, 1, outPtr);
+}
+
+bool MmapFileBlockDevice::ReadBlocks(u32 minBlock, int count, u8 *outPtr)
+{
+	const u32 numBlocks = GetNumBlocks();
+	int validCount = count;
+	if (minBlock >= numBlocks)
+		validCount = 0;
+	else if (minBlock + count > numBlocks)
+		validCount = numBlocks - minBlock;
+
+	if (validCount > 0)
+	{
+		AdviseReadahead(minBlock, validCount);
+		memcpy(outPtr, data + (u64)minBlock * GetBlockSize(), validCount * GetBlockSize());
+	}
+	if (validCount < count)
+	{
+		memset(outPtr + validCount * GetBlockSize(), 0, (count - validCount) * GetBlockSize());
+		DEBUG_LOG(FILESYS, "Could not read %d blocks from block %d", count, minBlock);
+	}
+	return true;
+}
+
+const u8 *MmapFileBlockDevice::PeekBlocks(u32 minBlock, int count)
+{
+	if (minBlock + count > GetNumBlocks())
+		return 0;
+	AdviseReadahead(minBlock, count);
+	return data + (u64)minBlock * GetBlockSize();
+}
+
+void MmapFileBlockDevice::AdviseReadahead(u32 minBlock, int count)
+{
+	// Several threads may read at once. These are only hints, so relaxed atomics are enough.
+	const u32 next = minBlock + count;
+	const bool sequential = nextSequential.exchange(next, std::memory_order_relaxed) == minBlock;
+	if (!sequential)
+	{
+		advisedEnd.store(0, std::memory_order_relaxed);
+		return;
+	}
+
+	const u64 end = (u64)next * GetBlockSize();
+	const u64 prevAdvised = advisedEnd.load(std::memory_order_relaxed);
+	// Only ask again once we've used up about half of the last hint.
+	if (end + MMAP_READAHEAD_BYTES / 2 <= prevAdvised || end >= size)
+		return;
+
+	const u64 pageMask = (u64)sysconf(_SC_PAGESIZE) - 1;
+	const u64 start = std::max(end, prevAdvised) & ~pageMask;
+	const u64 stop = std::min(end + MMAP_READAHEAD_BYTES, size);
+	if (stop > start)
+		madvise((void *)(data + start), (size_t)(stop - start), MADV_WILLNEED);
+	advisedEnd.store(stop, std::memory_order_relaxed);
+}
+
 #endif
 
 // .CSO format
@@ -129,7 +332,7 @@ typedef struct ciso_header
 // TODO: Need much better error handling.
 
 CISOFileBlockDevice::CISOFileBlockDevice(FILE *file)
-	: f(file)
+	: f(file), parallelDecompress(true)
 {
 	// CISO format is EXTREMELY crappy and incomplete. All tools make broken CISO.
 
@@ -183,76 +386,420 @@ CISOFileBlockDevice::CISOFileBlockDevice(FILE *file)
 
 	delete[] indexTemp;
 #endif
+
+	readBuffer.resize(blockSize * 2);
 }
 
 CISOFileBlockDevice::~CISOFileBlockDevice()
 {
 	fclose(f);
 	delete [] index;
+	for (size_t i = 0; i < freeStreams.size(); ++i)
+	{
+		inflateEnd(freeStreams[i]);
+		delete freeStreams[i];
+	}
+}
+
+z_stream *CISOFileBlockDevice::AcquireStream()
+{
+	{
+		lock_guard guard(streamLock);
+		if (!freeStreams.empty())
+		{
+			z_stream *z = freeStreams.back();
+			freeStreams.pop_back();
+			return z;
+		}
+	}
+
+	z_stream *z = new z_stream;
+	z->zalloc = Z_NULL;
+	z->zfree = Z_NULL;
+	z->opaque = Z_NULL;
+	if (inflateInit2(z, -15) != Z_OK)
+	{
+		ERROR_LOG(LOADER, "inflateInit2 ERROR : %s", z->msg ? z->msg : "???");
+		delete z;
+		return 0;
+	}
+	return z;
+}
+
+void CISOFileBlockDevice::ReleaseStream(z_stream *z)
+{
+	if (z)
+	{
+		lock_guard guard(streamLock);
+		freeStreams.push_back(z);
+	}
 }
 
 bool CISOFileBlockDevice::ReadBlock(int blockNumber, u8 *outPtr) 
 {
-	if ((u32)blockNumber >= numBlocks)
+	return ReadBlocks((u32)blockNumber, 1, outPtr);
+}
+
+bool CISOFileBlockDevice::ReadBlocks(u32 minBlock, int count, u8 *outPtr)
+{
+	if (count <= 0)
+		return true;
+	lock_guard guard(readLock);
+	if (minBlock >= numBlocks)
 	{
-		memset(outPtr, 0, 2048);
+		memset(outPtr, 0, count * 2048);
 		return false;
 	}
 
-	u32 idx = index[blockNumber];
-	u32 idx2 = index[blockNumber+1];
-	u8 inbuffer[4096]; //too big
-	z_stream z;
+	bool success = true;
+	if (minBlock + count > numBlocks)
+	{
+		const int validCount = numBlocks - minBlock;
+		memset(outPtr + validCount * 2048, 0, (count - validCount) * 2048);
+		count = validCount;
+		success = false;
+	}
 
-	int plain = idx & 0x80000000;
+	// The blocks are stored in order, so the whole range can be read at once.
+	const u64 readPos = (u64)(index[minBlock] & 0x7FFFFFFF) << indexShift;
+	const u64 readEnd = (u64)(index[minBlock + count] & 0x7FFFFFFF) << indexShift;
+	if (readEnd < readPos || readEnd - readPos > (u64)count * (2 * blockSize + (1 << indexShift)))
+	{
+		ERROR_LOG(LOADER, "block %d : bad index in CSO", minBlock);
+		memset(outPtr, 0, count * 2048);
+		return false;
+	}
 
-	u64 compressedReadPos = (u64)(idx & 0x7FFFFFFF) << indexShift;
-	size_t compressedReadSize = (size_t)(((u64)(idx2 & 0x7FFFFFFF) << indexShift) - compressedReadPos);
+	const size_t compressedSize = (size_t)(readEnd - readPos);
+	if (readBuffer.size() < compressedSize)
+		readBuffer.resize(compressedSize);
 
-	fseeko(f, compressedReadPos, SEEK_SET);
-	u32 readSize = (u32)fread(inbuffer, 1, compressedReadSize, f);
+	fseeko(f, readPos, SEEK_SET);
+	const size_t readSize = compressedSize == 0 ? 0 : fread(&readBuffer[0], 1, compressedSize, f);
 
-	if (plain)
+	// Each block is only written by one thread, so this needs no locking.
+	u8 resultsBuf[16];
+	std::vector<u8> resultsVec;
+	u8 *results = resultsBuf;
+	if (count > (int)sizeof(resultsBuf))
 	{
-		memset(outPtr, 0, 2048);
-		memcpy(outPtr, inbuffer, readSize);
+		resultsVec.resize(count);
+		results = &resultsVec[0];
 	}
+
+	// Small reads aren't worth waking up the other threads for.
+	if (parallelDecompress && count >= 16)
+		GlobalThreadPool::Loop(std::bind(&CISOFileBlockDevice::DecompressBlocks, this, minBlock, readPos, readSize, outPtr, results, placeholder::_1, placeholder::_2), 0, count);
 	else
+		DecompressBlocks(minBlock, readPos, readSize, outPtr, results, 0, count);
+
+	for (int i = 0; i < count; ++i)
+	{
+		if (!results[i])
+			success = false;
+	}
+	return success;
+}
+
+void CISOFileBlockDevice::DecompressBlocks(u32 minBlock, u64 readPos, size_t readSize, u8 *outPtr, u8 *results, int lower, int upper)
+{
+	z_stream *z = 0;
+	for (int i = lower; i < upper; ++i)
 	{
-		memset(outPtr, 0, 2048);
-		z.zalloc = Z_NULL;
-		z.zfree = Z_NULL;
-		z.opaque = Z_NULL;
-		if(inflateInit2(&z, -15) != Z_OK)
+		const u32 blockNumber = minBlock + i;
+		const u32 idx = index[blockNumber];
+		const u32 idx2 = index[blockNumber + 1];
+		u8 *out = outPtr + i * 2048;
+		results[i] = 0;
+
+		const size_t blockPos = (size_t)(((u64)(idx & 0x7FFFFFFF) << indexShift) - readPos);
+		size_t blockReadSize = (size_t)(((u64)(idx2 & 0x7FFFFFFF) << indexShift) - readPos) - blockPos;
+		// A short read leaves the last blocks incomplete.
+		if (blockPos + blockReadSize > readSize)
+			blockReadSize = blockPos > readSize ? 0 : readSize - blockPos;
+
+		memset(out, 0, 2048);
+		if (idx & 0x80000000)
 		{
-			ERROR_LOG(LOADER, "deflateInit ERROR : %s\n", (z.msg) ? z.msg : "???");
-			return false;
+			memcpy(out, &readBuffer[0] + blockPos, std::min(blockReadSize, (size_t)2048));
+			results[i] = 1;
+			continue;
 		}
-		z.avail_in = readSize;
-		z.next_out = outPtr;
-		z.avail_out = blockSize;
-		z.next_in = inbuffer;
-
-		int status = inflate(&z, Z_FULL_FLUSH);
-		if(status != Z_STREAM_END)
-			//if (status != Z_OK)
+
+		if (!z)
+			z = AcquireStream();
+		if (!z || inflateReset(z) != Z_OK)
 		{
-			ERROR_LOG(LOADER, "block %d:inflate : %s[%d]\n", blockNumber, (z.msg) ? z.msg : "error", status);
-			inflateEnd(&z);
-			return 1;  // TODO: This seems like the wrong return value? Surely we are screwed here (corrupt CSO) ?
+			ERROR_LOG(LOADER, "block %d : unable to reset inflate", blockNumber);
+			continue;
 		}
-		int cmp_size = blockSize - z.avail_out;
+		z->avail_in = (uInt)blockReadSize;
+		z->next_in = &readBuffer[0] + blockPos;
+		z->avail_out = blockSize;
+		z->next_out = out;
+
+		int status = inflate(z, Z_FULL_FLUSH);
+		if (status != Z_STREAM_END)
+		{
+			ERROR_LOG(LOADER, "block %d:inflate : %s[%d]\n", blockNumber, (z->msg) ? z->msg : "error", status);
+			continue;
+		}
+		int cmp_size = blockSize - z->avail_out;
 		if (cmp_size != (int)blockSize)
 		{
 			ERROR_LOG(LOADER, "block %d : block size error %d != %d\n", blockNumber, cmp_size, blockSize);
-			inflateEnd(&z);
+			continue;
+		}
+		results[i] = 1;
+	}
+	ReleaseStream(z);
+}
+
+// .PSZ format
+
+struct PSZHeader
+{
+	char magic[4];          // +00 : 'P','P','S','Z'
+	u32_le version;         // +04 : 1
+	u64_le total_bytes;     // +08 : size of the original image
+	u32_le frame_size;      // +10 : uncompressed bytes per frame
+	u32_le num_frames;      // +14
+	// +18 : num_frames + 1 file offsets (u64_le) of the frames, the last one is the end of data
+};
+
+static const u32 PSZ_VERSION = 1;
+static const u32 PSZ_MAX_FRAME_SIZE = 1024 * 1024;
+
+PSZFileBlockDevice::PSZFileBlockDevice(FILE *file)
+	: f(file), totalBytes(0), frameSize(0), blocksPerFrame(0), numFrames(0), numBlocks(0), currentFrame(-1)
+{
+	PSZHeader hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, "PPSZ", 4) != 0)
+	{
+		ERROR_LOG(LOADER, "Invalid PSZ!");
+		return;
+	}
+	if (hdr.version != PSZ_VERSION)
+	{
+		ERROR_LOG(LOADER, "Unsupported PSZ version %d", (int)hdr.version);
+		return;
+	}
+
+	const u32 blockSize = GetBlockSize();
+	if (hdr.frame_size == 0 || (hdr.frame_size % blockSize) != 0 || hdr.frame_size > PSZ_MAX_FRAME_SIZE)
+	{
+		ERROR_LOG(LOADER, "PSZ has an unsupported frame size %d", (int)hdr.frame_size);
+		return;
+	}
+	if ((u64)hdr.num_frames * hdr.frame_size < hdr.total_bytes)
+	{
+		ERROR_LOG(LOADER, "PSZ is missing frames");
+		return;
+	}
+
+	// Don't trust num_frames for the allocation, the index has to fit in the file.
+	const u64 indexPos = sizeof(hdr);
+	fseeko(f, 0, SEEK_END);
+	const u64 fileSize = (u64)ftello(f);
+	fseeko(f, indexPos, SEEK_SET);
+	if (fileSize < indexPos || (u64)hdr.num_frames + 1 > (fileSize - indexPos) / sizeof(u64_le))
+	{
+		ERROR_LOG(LOADER, "PSZ index is truncated");
+		return;
+	}
+
+	std::vector<u64_le> indexTemp((size_t)hdr.num_frames + 1);
+	if (fread(&indexTemp[0], sizeof(u64_le), indexTemp.size(), f) != indexTemp.size())
+	{
+		ERROR_LOG(LOADER, "PSZ index is truncated");
+		return;
+	}
+	index.resize(indexTemp.size());
+	for (size_t i = 0; i < indexTemp.size(); ++i)
+	{
+		index[i] = indexTemp[i];
+		if ((i > 0 && index[i] < index[i - 1]) || index[i] > fileSize)
+		{
+			ERROR_LOG(LOADER, "PSZ index is corrupt");
+			index.clear();
+			return;
+		}
+	}
+
+	totalBytes = hdr.total_bytes;
+	frameSize = hdr.frame_size;
+	blocksPerFrame = frameSize / blockSize;
+	numFrames = hdr.num_frames;
+	numBlocks = (u32)(totalBytes / blockSize);
+	frameBuffer.resize(frameSize);
+	compressedBuffer.resize(snappy_max_compressed_length(frameSize));
+	VERBOSE_LOG(LOADER, "PSZ numBlocks=%i frameSize=%i", numBlocks, frameSize);
+}
+
+PSZFileBlockDevice::~PSZFileBlockDevice()
+{
+	fclose(f);
+}
+
+bool PSZFileBlockDevice::ReadBlock(int blockNumber, u8 *outPtr)
+{
+	return ReadBlocks((u32)blockNumber, 1, outPtr);
+}
+
+bool PSZFileBlockDevice::ReadBlocks(u32 minBlock, int count, u8 *outPtr)
+{
+	lock_guard guard(readLock);
+	const int blockSize = GetBlockSize();
+	bool success = true;
+	while (count > 0)
+	{
+		if (minBlock >= numBlocks)
+		{
+			memset(outPtr, 0, count * blockSize);
 			return false;
 		}
-		inflateEnd(&z);
+
+		const u32 frame = minBlock / blocksPerFrame;
+		const u32 offset = minBlock % blocksPerFrame;
+		const int n = std::min((u32)count, blocksPerFrame - offset);
+
+		if (offset == 0 && (u32)n == blocksPerFrame && (int)frame != currentFrame)
+		{
+			// Whole frames can go straight to the destination.
+			if (!ReadFrame(frame, outPtr))
+				success = false;
+		}
+		else
+		{
+			if ((int)frame != currentFrame)
+			{
+				currentFrame = frame;
+				if (!ReadFrame(frame, &frameBuffer[0]))
+				{
+					currentFrame = -1;
+					success = false;
+				}
+			}
+			memcpy(outPtr, &frameBuffer[offset * blockSize], n * blockSize);
+		}
+
+		minBlock += n;
+		outPtr += n * blockSize;
+		count -= n;
+	}
+	return success;
+}
+
+bool PSZFileBlockDevice::ReadFrame(u32 frame, u8 *outPtr)
+{
+	// The last frame may be short.
+	const u64 frameStart = (u64)frame * frameSize;
+	const size_t rawSize = (size_t)std::min((u64)frameSize, totalBytes - frameStart);
+	const size_t storedSize = (size_t)(index[frame + 1] - index[frame]);
+	memset(outPtr + rawSize, 0, frameSize - rawSize);
+
+	if (storedSize > compressedBuffer.size())
+	{
+		ERROR_LOG(LOADER, "frame %d : PSZ frame too large", frame);
+		memset(outPtr, 0, rawSize);
+		return false;
+	}
+
+	fseeko(f, index[frame], SEEK_SET);
+	if (storedSize == rawSize)
+	{
+		// Didn't compress, stored as is.
+		if (fread(outPtr, 1, rawSize, f) != rawSize)
+		{
+			ERROR_LOG(LOADER, "frame %d : PSZ is truncated", frame);
+			return false;
+		}
+		return true;
+	}
+
+	if (fread(&compressedBuffer[0], 1, storedSize, f) != storedSize)
+	{
+		ERROR_LOG(LOADER, "frame %d : PSZ is truncated", frame);
+		memset(outPtr, 0, rawSize);
+		return false;
+	}
+
+	size_t outSize = frameSize;
+	if (snappy_uncompress((const char *)&compressedBuffer[0], storedSize, (char *)outPtr, &outSize) != SNAPPY_OK || outSize != rawSize)
+	{
+		ERROR_LOG(LOADER, "frame %d : PSZ decompression failed", frame);
+		memset(outPtr, 0, rawSize);
+		return false;
 	}
 	return true;
 }
 
+bool WritePSZImage(BlockDevice *source, const char *filename, u32 frameSize)
+{
+	const u32 blockSize = source->GetBlockSize();
+	if (frameSize == 0 || (frameSize % blockSize) != 0 || frameSize > PSZ_MAX_FRAME_SIZE)
+	{
+		ERROR_LOG(LOADER, "Invalid PSZ frame size %d", frameSize);
+		return false;
+	}
+
+	const u32 numBlocks = source->GetNumBlocks();
+	const u32 blocksPerFrame = frameSize / blockSize;
+	const u32 numFrames = (numBlocks + blocksPerFrame - 1) / blocksPerFrame;
+
+	FILE *out = File::OpenCFile(filename, "wb");
+	if (!out)
+	{
+		ERROR_LOG(LOADER, "Unable to create %s", filename);
+		return false;
+	}
+
+	PSZHeader hdr;
+	memcpy(hdr.magic, "PPSZ", 4);
+	hdr.version = PSZ_VERSION;
+	hdr.total_bytes = (u64)numBlocks * blockSize;
+	hdr.frame_size = frameSize;
+	hdr.num_frames = numFrames;
+
+	// The index is filled in as we go and written at the end.
+	std::vector<u64_le> index(numFrames + 1);
+	u64 pos = sizeof(hdr) + index.size() * sizeof(u64_le);
+	fseeko(out, pos, SEEK_SET);
+
+	std::vector<u8> raw(frameSize);
+	std::vector<u8> compressed(snappy_max_compressed_length(frameSize));
+	bool success = true;
+	for (u32 frame = 0; frame < numFrames && success; ++frame)
+	{
+		const u32 firstBlock = frame * blocksPerFrame;
+		const u32 frameBlocks = std::min(blocksPerFrame, numBlocks - firstBlock);
+		const size_t rawSize = frameBlocks * blockSize;
+		if (!source->ReadBlocks(firstBlock, frameBlocks, &raw[0]))
+			WARN_LOG(LOADER, "Error reading blocks %d-%d, continuing", firstBlock, firstBlock + frameBlocks - 1);
+
+		size_t compressedSize = compressed.size();
+		const u8 *data = &compressed[0];
+		if (snappy_compress((const char *)&raw[0], rawSize, (char *)&compressed[0], &compressedSize) != SNAPPY_OK || compressedSize >= rawSize)
+		{
+			data = &raw[0];
+			compressedSize = rawSize;
+		}
+
+		index[frame] = pos;
+		success = fwrite(data, 1, compressedSize, out) == compressedSize;
+		pos += compressedSize;
+	}
+	index[numFrames] = pos;
+
+	fseeko(out, 0, SEEK_SET);
+	success = success && fwrite(&hdr, sizeof(hdr), 1, out) == 1;
+	success = success && fwrite(&index[0], sizeof(u64_le), index.size(), out) == index.size();
+	success = fclose(out) == 0 && success;
+	if (!success)
+		ERROR_LOG(LOADER, "Error writing %s", filename);
+	return success;
+}
+
 
 NPDRMDemoBlockDevice::NPDRMDemoBlockDevice(FILE *file)
 	: f(file)
@@ -394,3 +941,170 @@ bool NPDRMDemoBlockDevice::ReadBlock(int blockNumber, u8 *outPtr)
 
 	return true;
 }
+
+// Readahead starts at this many blocks once reads look sequential, and doubles up to the max.
+static const int MIN_READAHEAD_BLOCKS = 8;
+static const int MAX_READAHEAD_BLOCKS = 128;
+
+CachedBlockDevice::CachedBlockDevice(BlockDevice *device, u32 maxBlocks)
+	: device_(device), maxBlocks_(std::max(maxBlocks, (u32)4)), head_(-1), tail_(-1),
+	  nextSequential_(0), readahead_(0), hits_(0), misses_(0), deviceReads_(0)
+{
+}
+
+CachedBlockDevice::~CachedBlockDevice()
+{
+	delete device_;
+}
+
+bool CachedBlockDevice::ReadBlock(int blockNumber, u8 *outPtr)
+{
+	return ReadBlocks((u32)blockNumber, 1, outPtr);
+}
+
+bool CachedBlockDevice::ReadBlocks(u32 minBlock, int count, u8 *outPtr)
+{
+	lock_guard guard(lock_);
+
+	// ISOFileSystem reads don't line up with blocks, so a stream usually picks up in the last block
+	// of the previous read.  That's still sequential.
+	if (minBlock <= nextSequential_ && minBlock + 1 >= nextSequential_)
+		readahead_ = readahead_ == 0 ? MIN_READAHEAD_BLOCKS : std::min(readahead_ * 2, MAX_READAHEAD_BLOCKS);
+	else
+		readahead_ = 0;
+	nextSequential_ = minBlock + count;
+
+	const int blockSize = GetBlockSize();
+	bool success = true;
+	int i = 0;
+	while (i < count)
+	{
+		int slot = FindSlot(minBlock + i);
+		if (slot >= 0)
+		{
+			memcpy(outPtr + i * blockSize, &data_[slot * blockSize], blockSize);
+			Unlink(slot);
+			LinkFront(slot);
+			hits_++;
+			i++;
+			continue;
+		}
+
+		// Gather up the whole run of missing blocks, to read them in one go.
+		int end = i + 1;
+		while (end < count && FindSlot(minBlock + end) < 0)
+			end++;
+
+		// Only read ahead past the end of the request, and not past the end of the device.
+		int readahead = 0;
+		const u32 numBlocks = GetNumBlocks();
+		if (end == count && readahead_ > 0 && minBlock + count < numBlocks)
+			readahead = (int)std::min(std::min((u32)readahead_, maxBlocks_ / 4), numBlocks - (minBlock + count));
+
+		if (!ReadMissing(minBlock + i, end - i, readahead, outPtr + i * blockSize))
+			success = false;
+		misses_ += end - i;
+		i = end;
+	}
+	return success;
+}
+
+bool CachedBlockDevice::ReadMissing(u32 minBlock, int count, int readahead, u8 *outPtr)
+{
+	const int blockSize = GetBlockSize();
+	bool success;
+	deviceReads_++;
+
+	if ((u32)count >= maxBlocks_ / 2)
+	{
+		// Too big to be worth caching, it would just push everything else out.
+		success = device_->ReadBlocks(minBlock, count, outPtr);
+		if (readahead > 0)
+		{
+			readBuffer_.resize(readahead * blockSize);
+			device_->ReadBlocks(minBlock + count, readahead, &readBuffer_[0]);
+			for (int i = 0; i < readahead; ++i)
+				StoreBlock(minBlock + count + i, &readBuffer_[i * blockSize]);
+			deviceReads_++;
+		}
+		return success;
+	}
+
+	if (readahead == 0)
+	{
+		success = device_->ReadBlocks(minBlock, count, outPtr);
+		for (int i = 0; i < count; ++i)
+			StoreBlock(minBlock + i, outPtr + i * blockSize);
+		return success;
+	}
+
+	// Still a single read from the device, the readahead just comes along with it.
+	const int total = count + readahead;
+	readBuffer_.resize(total * blockSize);
+	success = device_->ReadBlocks(minBlock, total, &readBuffer_[0]);
+	for (int i = 0; i < total; ++i)
+		StoreBlock(minBlock + i, &readBuffer_[i * blockSize]);
+	memcpy(outPtr, &readBuffer_[0], count * blockSize);
+	return success;
+}
+
+int CachedBlockDevice::FindSlot(u32 block) const
+{
+	std::map<u32, int>::const_iterator it = lookup_.find(block);
+	return it == lookup_.end() ? -1 : it->second;
+}
+
+void CachedBlockDevice::StoreBlock(u32 block, const u8 *data)
+{
+	const int blockSize = GetBlockSize();
+	int slot = FindSlot(block);
+	if (slot >= 0)
+	{
+		Unlink(slot);
+	}
+	else if (slots_.size() < maxBlocks_)
+	{
+		slot = (int)slots_.size();
+		slots_.push_back(Slot());
+		data_.resize(slots_.size() * blockSize);
+	}
+	else
+	{
+		// Evict the least recently used block.
+		slot = tail_;
+		Unlink(slot);
+		lookup_.erase(slots_[slot].block);
+	}
+
+	slots_[slot].block = block;
+	lookup_[block] = slot;
+	memcpy(&data_[slot * blockSize], data, blockSize);
+	LinkFront(slot);
+}
+
+void CachedBlockDevice::Unlink(int slot)
+{
+	Slot &s = slots_[slot];
+	if (s.prev >= 0)
+		slots_[s.prev].next = s.next;
+	else
+		head_ = s.next;
+	if (s.next >= 0)
+		slots_[s.next].prev = s.prev;
+	else
+		tail_ = s.prev;
+	s.prev = -1;
+	s.next = -1;
+}
+
+void CachedBlockDevice::LinkFront(int slot)
+{
+	Slot &s = slots_[slot];
+	s.prev = -1;
+	s.next = head_;
+	if (head_ >= 0)
+		slots_[head_].prev = slot;
+	head_ = slot;
+	if (tail_ < 0)
+		tail_ = slot;
+}
@@ -19,18 +19,39 @@
 
 // Abstractions around read-only blockdevices, such as PSP UMD discs.
 // CISOFileBlockDevice implements compressed iso images, CISO format.
+// PSZFileBlockDevice implements our own compressed format, with larger snappy compressed frames.
 //
 // The ISOFileSystemReader reads from a BlockDevice, so it automatically works
 // with CISO images.
 
+#include <atomic>
+#include <map>
+#include <vector>
+
+#include "base/mutex.h"
 #include "Common/CommonTypes.h"
 #include "Core/ELF/PBPReader.h"
 
+struct z_stream_s;
+
+// Mapping a whole image only makes sense where there's address space to spare.
+#if !defined(_WIN32) && !defined(__SYMBIAN32__) && (defined(_M_X64) || defined(__LP64__))
+#define HAVE_MMAP_BLOCK_DEVICE 1
+#endif
+
 class BlockDevice
 {
 public:
 	virtual ~BlockDevice() {}
 	virtual bool ReadBlock(int blockNumber, u8 *outPtr) = 0;
+	// Reads count consecutive blocks. The default just calls ReadBlock() for each, devices
+	// that can do it in one go should override it.
+	virtual bool ReadBlocks(u32 minBlock, int count, u8 *outPtr);
+	// Returns the data of count blocks directly, if the device has it in memory for its whole
+	// lifetime. Otherwise returns NULL and ReadBlocks() must be used.
+	virtual const u8 *PeekBlocks(u32 minBlock, int count) { return 0; }
+	// Whether reads may come from several threads at once.
+	virtual bool IsThreadSafe() { return false; }
 	int GetBlockSize() const { return 2048;}  // forced, it cannot be changed by subclasses
 	virtual u32 GetNumBlocks() = 0;
 };
@@ -42,14 +63,31 @@ public:
 	CISOFileBlockDevice(FILE *file);
 	~CISOFileBlockDevice();
 	bool ReadBlock(int blockNumber, u8 *outPtr);
+	bool ReadBlocks(u32 minBlock, int count, u8 *outPtr);
 	u32 GetNumBlocks() { return numBlocks;}
 
+	// Larger reads are decompressed on the global thread pool unless this is turned off.
+	void SetParallelDecompress(bool parallel) { parallelDecompress = parallel; }
+
 private:
+	void DecompressBlocks(u32 minBlock, u64 readPos, size_t readSize, u8 *outPtr, u8 *results, int lower, int upper);
+	z_stream_s *AcquireStream();
+	void ReleaseStream(z_stream_s *stream);
+
 	FILE *f;
 	u32 *index;
 	int indexShift;
 	u32 blockSize;
 	u32 numBlocks;
+	bool parallelDecompress;
+
+	// Inflate contexts are reused between reads, one per thread decompressing at the time.
+	std::vector<z_stream_s *> freeStreams;
+	recursive_mutex streamLock;
+	// Held for the whole of ReadBlocks(), since the file position and readBuffer are shared.
+	// Reads are serialized, so this still doesn't claim IsThreadSafe().
+	recursive_mutex readLock;
+	std::vector<u8> readBuffer;
 };
 
 
@@ -59,6 +97,7 @@ public:
 	FileBlockDevice(FILE *file);
 	~FileBlockDevice();
 	bool ReadBlock(int blockNumber, u8 *outPtr);
+	bool ReadBlocks(u32 minBlock, int count, u8 *outPtr);
 	u32 GetNumBlocks() {return (u32)(filesize / GetBlockSize());}
 
 private:
@@ -70,6 +109,73 @@ private:
 };
 
 
+// .psz images are split into frames of frameSize bytes (a multiple of the block size), each
+// compressed with snappy on its own, or stored as is if that didn't make it smaller. Much faster
+// to decompress than CSO's deflate, and the bigger frames compress better too.
+class PSZFileBlockDevice : public BlockDevice
+{
+public:
+	PSZFileBlockDevice(FILE *file);
+	~PSZFileBlockDevice();
+	bool ReadBlock(int blockNumber, u8 *outPtr);
+	bool ReadBlocks(u32 minBlock, int count, u8 *outPtr);
+	u32 GetNumBlocks() { return numBlocks; }
+
+private:
+	bool ReadFrame(u32 frame, u8 *outPtr);
+
+	FILE *f;
+	std::vector<u64> index;
+	u64 totalBytes;
+	u32 frameSize;
+	u32 blocksPerFrame;
+	u32 numFrames;
+	u32 numBlocks;
+
+	std::vector<u8> compressedBuffer;
+	// The last frame we decompressed, for reads smaller than a frame.
+	std::vector<u8> frameBuffer;
+	int currentFrame;
+
+	// The file position, buffers and currentFrame are shared, so reads are serialized.
+	recursive_mutex readLock;
+};
+
+// Writes the contents of a block device out as a .psz image.
+bool WritePSZImage(BlockDevice *source, const char *filename, u32 frameSize);
+
+
+#ifdef HAVE_MMAP_BLOCK_DEVICE
+// Plain ISOs mapped into memory, so reads are just a memcpy and the OS does the caching.
+// Sequential reads ask the OS to start paging in what comes next.
+class MmapFileBlockDevice : public BlockDevice
+{
+public:
+	MmapFileBlockDevice(FILE *file, const u8 *data, u64 size);
+	~MmapFileBlockDevice();
+	bool ReadBlock(int blockNumber, u8 *outPtr);
+	bool ReadBlocks(u32 minBlock, int count, u8 *outPtr);
+	const u8 *PeekBlocks(u32 minBlock, int count);
+	// Only the readahead hints are shared, they're atomic and it doesn't matter if they're a bit off.
+	bool IsThreadSafe() { return true; }
+	u32 GetNumBlocks() { return (u32)(size / GetBlockSize()); }
+
+	// Maps the file, returning NULL (and leaving the file open) if that isn't possible or the
+	// file isn't on a local disk, since a mapping faults if the file goes away underneath it.
+	static MmapFileBlockDevice *Create(FILE *file);
+
+private:
+	void AdviseReadahead(u32 minBlock, int count);
+
+	FILE *f;
+	const u8 *data;
+	u64 size;
+	std::atomic<u32> nextSequential;
+	std::atomic<u64> advisedEnd;
+};
+#endif
+
+
 // For encrypted ISOs in PBP files.
 
 struct table_info {
@@ -108,4 +214,59 @@ private:
 };
 
 
+// Keeps recently used blocks in memory and reads ahead when access looks sequential, so
+// streaming and repeated small reads don't each turn into a read from the underlying device.
+// Takes ownership of the device.
+class CachedBlockDevice : public BlockDevice
+{
+public:
+	CachedBlockDevice(BlockDevice *device, u32 maxBlocks);
+	~CachedBlockDevice();
+
+	bool ReadBlock(int blockNumber, u8 *outPtr);
+	bool ReadBlocks(u32 minBlock, int count, u8 *outPtr);
+	bool IsThreadSafe() { return true; }
+	u32 GetNumBlocks() { return device_->GetNumBlocks(); }
+
+	u64 HitCount() const { return hits_; }
+	u64 MissCount() const { return misses_; }
+	u64 DeviceReadCount() const { return deviceReads_; }
+
+private:
+	struct Slot {
+		u32 block;
+		int prev;
+		int next;
+	};
+
+	bool ReadMissing(u32 minBlock, int count, int readahead, u8 *outPtr);
+	int FindSlot(u32 block) const;
+	void StoreBlock(u32 block, const u8 *data);
+	void Unlink(int slot);
+	void LinkFront(int slot);
+
+	BlockDevice *device_;
+	u32 maxBlocks_;
+
+	// Slot i's data is at data_[i * 2048]. Both grow on demand up to maxBlocks_.
+	std::vector<u8> data_;
+	std::vector<Slot> slots_;
+	std::map<u32, int> lookup_;
+	// Most and least recently used slots.
+	int head_;
+	int tail_;
+
+	u32 nextSequential_;
+	int readahead_;
+	std::vector<u8> readBuffer_;
+
+	u64 hits_;
+	u64 misses_;
+	u64 deviceReads_;
+
+	recursive_mutex lock_;
+};
+
+
+// Opens the image, wrapped in a CachedBlockDevice unless the cache is disabled.
 BlockDevice *constructBlockDevice(const char *filename);
@@ -32,55 +32,146 @@
 #include <sys/stat.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <time.h>
 #endif
 
 #if HOST_IS_CASE_SENSITIVE
-static bool FixFilenameCase(const std::string &path, std::string &filename)
+// Directory listings, so that fixing the case of each path component doesn't mean reading the
+// whole directory every time. Keyed by the directory path, with its trailing slash.
+struct CaseFoldDirectory
 {
-	// Are we lucky?
-	if (File::Exists(path + filename))
-		return true;
+	// Lowercased name -> name on disk.
+	std::map<std::string, std::string> names;
+	time_t mtime;
+	time_t scanTime;
+};
 
-	size_t filenameSize = filename.size();  // size in bytes, not characters
+// Plenty for any game, the limit only keeps a long session from growing this forever.
+static const size_t MAX_CASE_FOLD_DIRECTORIES = 1024;
+
+static std::map<std::string, CaseFoldDirectory> caseFoldCache;
+static recursive_mutex caseFoldLock;
+static FixPathCaseStats caseFoldStats;
+
+static std::string LowerCaseFilename(const std::string &filename)
+{
+	std::string lower = filename;
+	size_t filenameSize = lower.size();  // size in bytes, not characters
 	for (size_t i = 0; i < filenameSize; i++)
 	{
-		filename[i] = tolower(filename[i]);
+		lower[i] = tolower(lower[i]);
 	}
+	return lower;
+}
 
-	//TODO: lookup filename in cache for "path"
+static bool ScanDirectoryCase(const std::string &path, CaseFoldDirectory &dir)
+{
+	// Stat first, so anything changing during the scan shows up as a newer mtime later.
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return false;
 
 	struct dirent_large { struct dirent entry; char padding[FILENAME_MAX+1]; } diren;
-	struct dirent_large;
 	struct dirent *result = NULL;
 
 	DIR *dirp = opendir(path.c_str());
 	if (!dirp)
 		return false;
 
-	bool retValue = false;
+	caseFoldStats.directoryScans++;
+	dir.names.clear();
+	dir.mtime = st.st_mtime;
+	dir.scanTime = time(NULL);
 
+	// If several names only differ by case, the last one wins, as it always has.
 	while (!readdir_r(dirp, (dirent*) &diren, &result) && result)
-	{
-		if (strlen(result->d_name) != filenameSize)
-			continue;
+		dir.names[LowerCaseFilename(result->d_name)] = result->d_name;
+
+	closedir(dirp);
+	return true;
+}
+
+static bool DirectoryChangedSinceScan(const std::string &path, const CaseFoldDirectory &dir)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return true;
+	// mtime only has a resolution of a second, so a change in the same second as the scan may not show.
+	return st.st_mtime != dir.mtime || dir.mtime >= dir.scanTime;
+}
+
+// Forgets the listing of the directory containing localPath, and if it's a directory, of
+// everything under it. Misses notice new files anyway, so this is for removes and renames.
+static void InvalidateCaseCache(const std::string &localPath)
+{
+	std::string path = localPath;
+	while (!path.empty() && path[path.size() - 1] == '/')
+		path.resize(path.size() - 1);
+
+	lock_guard guard(caseFoldLock);
+	size_t slash = path.find_last_of('/');
+	if (slash != path.npos)
+		caseFoldCache.erase(path.substr(0, slash + 1));
+
+	const std::string prefix = path + "/";
+	std::map<std::string, CaseFoldDirectory>::iterator it = caseFoldCache.lower_bound(prefix);
+	while (it != caseFoldCache.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+		caseFoldCache.erase(it++);
+}
+
+FixPathCaseStats GetFixPathCaseStats()
+{
+	lock_guard guard(caseFoldLock);
+	return caseFoldStats;
+}
+
+static bool FixFilenameCase(const std::string &path, std::string &filename)
+{
+	// Are we lucky?
+	if (File::Exists(path + filename))
+		return true;
 
-		size_t i;
-		for (i = 0; i < filenameSize; i++)
+	const std::string lower = LowerCaseFilename(filename);
+
+	lock_guard guard(caseFoldLock);
+	caseFoldStats.lookups++;
+
+	bool scanned = false;
+	std::map<std::string, CaseFoldDirectory>::iterator dir = caseFoldCache.find(path);
+	if (dir == caseFoldCache.end())
+	{
+		if (caseFoldCache.size() >= MAX_CASE_FOLD_DIRECTORIES)
+			caseFoldCache.clear();
+		dir = caseFoldCache.insert(std::make_pair(path, CaseFoldDirectory())).first;
+		if (!ScanDirectoryCase(path, dir->second))
 		{
-			if (filename[i] != tolower(result->d_name[i]))
-				break;
+			caseFoldCache.erase(dir);
+			return false;
 		}
+		scanned = true;
+	}
 
-		if (i < filenameSize)
-			continue;
-
-		filename = result->d_name;
-		retValue = true;
+	std::map<std::string, std::string>::iterator name = dir->second.names.find(lower);
+	if (name == dir->second.names.end() && !scanned && DirectoryChangedSinceScan(path, dir->second))
+	{
+		// Created since we looked, possibly by someone else.
+		if (!ScanDirectoryCase(path, dir->second))
+		{
+			caseFoldCache.erase(dir);
+			return false;
+		}
+		scanned = true;
+		name = dir->second.names.find(lower);
 	}
 
-	closedir(dirp);
+	if (!scanned)
+		caseFoldStats.scansAvoided++;
 
-	return retValue;
+	if (name == dir->second.names.end())
+		return false;
+
+	filename = name->second;
+	return true;
 }
 
 bool FixPathCase(std::string& basePath, std::string &path, FixPathCaseBehavior behavior)
@@ -332,6 +423,7 @@ void DirectoryFileHandle::Close()
 }
 
 void DirectoryFileSystem::CloseAll() {
+	lock_guard guard(entriesLock);
 	for (auto iter = entries.begin(); iter != entries.end(); ++iter) {
 		iter->second.hFile.Close();
 	}
@@ -368,7 +460,10 @@ bool DirectoryFileSystem::MkDir(const std::string &dirname) {
 	if ( ! FixPathCase(basePath,fixedCase, FPC_PARTIAL_ALLOWED) )
 		return false;
 
-	return File::CreateFullPath(GetLocalPath(fixedCase));
+	const std::string fullName = GetLocalPath(fixedCase);
+	bool success = File::CreateFullPath(fullName);
+	InvalidateCaseCache(fullName);
+	return success;
 #else
 	return File::CreateFullPath(GetLocalPath(dirname));
 #endif
@@ -379,8 +474,10 @@ bool DirectoryFileSystem::RmDir(const std::string &dirname) {
 
 #if HOST_IS_CASE_SENSITIVE
 	// Maybe we're lucky?
-	if (File::DeleteDirRecursively(fullName))
+	if (File::DeleteDirRecursively(fullName)) {
+		InvalidateCaseCache(fullName);
 		return true;
+	}
 
 	// Nope, fix case and try again
 	fullName = dirname;
@@ -395,7 +492,11 @@ bool DirectoryFileSystem::RmDir(const std::string &dirname) {
 #else
 	return 0 == rmdir(fullName.c_str());
 #endif*/
-	return File::DeleteDirRecursively(fullName);
+	bool retValue = File::DeleteDirRecursively(fullName);
+#if HOST_IS_CASE_SENSITIVE
+	InvalidateCaseCache(fullName);
+#endif
+	return retValue;
 }
 
 int DirectoryFileSystem::RenameFile(const std::string &from, const std::string &to) {
@@ -447,6 +548,11 @@ int DirectoryFileSystem::RenameFile(const std::string &from, const std::string &
 		retValue = (0 == rename(fullFrom.c_str(), fullToC));
 #endif
 	}
+
+	if (retValue) {
+		InvalidateCaseCache(fullFrom);
+		InvalidateCaseCache(fullTo);
+	}
 #endif
 
 	// TODO: Better error codes.
@@ -476,6 +582,9 @@ bool DirectoryFileSystem::RemoveFile(const std::string &filename) {
 		retValue = (0 == unlink(fullName.c_str()));
 #endif
 	}
+
+	if (retValue)
+		InvalidateCaseCache(fullName);
 #endif
 
 	return retValue;
@@ -504,6 +613,7 @@ u32 DirectoryFileSystem::OpenFile(std::string filename, FileAccess access, const
 		entry.guestFilename = filename;
 		entry.access = access;
 
+		lock_guard guard(entriesLock);
 		entries[newHandle] = entry;
 
 		return newHandle;
@@ -511,6 +621,7 @@ u32 DirectoryFileSystem::OpenFile(std::string filename, FileAccess access, const
 }
 
 void DirectoryFileSystem::CloseFile(u32 handle) {
+	lock_guard guard(entriesLock);
 	EntryMap::iterator iter = entries.find(handle);
 	if (iter != entries.end()) {
 		hAlloc->FreeHandle(handle);
@@ -523,10 +634,17 @@ void DirectoryFileSystem::CloseFile(u32 handle) {
 }
 
 bool DirectoryFileSystem::OwnsHandle(u32 handle) {
+	lock_guard guard(entriesLock);
 	EntryMap::iterator iter = entries.find(handle);
 	return (iter != entries.end());
 }
 
+DirectoryFileSystem::OpenFileEntry *DirectoryFileSystem::FindEntry(u32 handle) {
+	lock_guard guard(entriesLock);
+	EntryMap::iterator iter = entries.find(handle);
+	return iter != entries.end() ? &iter->second : NULL;
+}
+
 int DirectoryFileSystem::Ioctl(u32 handle, u32 cmd, u32 indataPtr, u32 inlen, u32 outdataPtr, u32 outlen, int &usec) {
 	return SCE_KERNEL_ERROR_ERRNO_FUNCTION_NOT_SUPPORTED;
 }
@@ -536,10 +654,10 @@ int DirectoryFileSystem::DevType(u32 handle) {
 }
 
 size_t DirectoryFileSystem::ReadFile(u32 handle, u8 *pointer, s64 size) {
-	EntryMap::iterator iter = entries.find(handle);
-	if (iter != entries.end())
+	OpenFileEntry *entry = FindEntry(handle);
+	if (entry)
 	{
-		size_t bytesRead = iter->second.hFile.Read(pointer,size);
+		size_t bytesRead = entry->hFile.Read(pointer,size);
 		return bytesRead;
 	} else {
 		//This shouldn't happen...
@@ -549,10 +667,10 @@ size_t DirectoryFileSystem::ReadFile(u32 handle, u8 *pointer, s64 size) {
 }
 
 size_t DirectoryFileSystem::WriteFile(u32 handle, const u8 *pointer, s64 size) {
-	EntryMap::iterator iter = entries.find(handle);
-	if (iter != entries.end())
+	OpenFileEntry *entry = FindEntry(handle);
+	if (entry)
 	{
-		size_t bytesWritten = iter->second.hFile.Write(pointer,size);
+		size_t bytesWritten = entry->hFile.Write(pointer,size);
 		return bytesWritten;
 	} else {
 		//This shouldn't happen...
@@ -562,9 +680,9 @@ size_t DirectoryFileSystem::WriteFile(u32 handle, const u8 *pointer, s64 size) {
 }
 
 size_t DirectoryFileSystem::SeekFile(u32 handle, s32 position, FileMove type) {
-	EntryMap::iterator iter = entries.find(handle);
-	if (iter != entries.end()) {
-		return iter->second.hFile.Seek(position,type);
+	OpenFileEntry *entry = FindEntry(handle);
+	if (entry) {
+		return entry->hFile.Seek(position,type);
 	} else {
 		//This shouldn't happen...
 		ERROR_LOG(FILESYS,"Cannot seek in file that hasn't been opened: %08x", handle);
@@ -724,6 +842,7 @@ void DirectoryFileSystem::DoState(PointerWrap &p) {
 	//     u32               seek position
 	//     s64               current truncate position (v2+ only)
 
+	lock_guard guard(entriesLock);
 	u32 num = (u32) entries.size();
 	p.Do(num);
 
@@ -21,6 +21,7 @@
 
 #include <map>
 
+#include "native/base/mutex.h"
 #include "../Core/FileSystems/FileSystem.h"
 
 #ifdef _WIN32
@@ -55,6 +56,17 @@ enum FixPathCaseBehavior {
 };
 
 bool FixPathCase(std::string& basePath, std::string &path, FixPathCaseBehavior behavior);
+
+struct FixPathCaseStats {
+	// Path components that didn't exist as given, and needed their case fixed.
+	u64 lookups;
+	// Times a directory actually had to be listed.
+	u64 directoryScans;
+	// Lookups answered from already listed directories.
+	u64 scansAvoided;
+};
+
+FixPathCaseStats GetFixPathCaseStats();
 #endif
 
 struct DirectoryFileHandle
@@ -108,7 +120,7 @@ public:
 	int  RenameFile(const std::string &from, const std::string &to);
 	bool RemoveFile(const std::string &filename);
 	bool GetHostPath(const std::string &inpath, std::string &outpath);
-	int Flags() { return flags; }
+	int Flags() { return flags | FILESYSTEM_CONCURRENT_IO; }
 
 private:
 	struct OpenFileEntry {
@@ -117,8 +129,12 @@ private:
 		FileAccess access;
 	};
 
+	OpenFileEntry *FindEntry(u32 handle);
+
 	typedef std::map<u32, OpenFileEntry> EntryMap;
 	EntryMap entries;
+	// Only guards the map itself, each handle is used by one thread at a time.
+	recursive_mutex entriesLock;
 	std::string basePath;
 	IHandleAllocator *hAlloc;
 	int flags;
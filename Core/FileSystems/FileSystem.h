@@ -53,6 +53,8 @@ enum DevType
 enum FileSystemFlags
 {
 	FILESYSTEM_SIMULATE_FAT32 = 1,
+	// ReadFile/WriteFile may be called from several threads at once, for different handles.
+	FILESYSTEM_CONCURRENT_IO = 2,
 };
 
 class IHandleAllocator {
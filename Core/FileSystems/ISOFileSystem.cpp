@@ -15,6 +15,7 @@
 // Official git repository and contact information can be found at
 // https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
 
+#include <algorithm>
 #include <cstring>
 #include <cstdio>
 #include <ctype.h>
@@ -29,6 +30,32 @@
 
 
 const int sectorSize = 2048;
+// Games that probe lots of missing files shouldn't make the path cache grow forever.
+const size_t MAX_PATH_CACHE_ENTRIES = 8192;
+
+static u32 HashNameLower(const char *name, size_t len)
+{
+	// FNV-1a.
+	u32 hash = 2166136261U;
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash ^= (u8)tolower(name[i]);
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static bool EqualsLower(const std::string &a, const std::string &b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if (tolower(a[i]) != tolower(b[i]))
+			return false;
+	}
+	return true;
+}
 
 bool parseLBN(std::string filename, u32 *sectorStart, u32 *readSize)
 {
@@ -295,6 +322,35 @@ void ISOFileSystem::ReadDirectory(u32 startsector, u32 dirsize, TreeEntry *root,
 			root->children.push_back(e);
 		}
 	}
+
+	root->BuildChildIndex();
+}
+
+void ISOFileSystem::TreeEntry::BuildChildIndex()
+{
+	childIndex.resize(children.size());
+	for (size_t i = 0; i < children.size(); ++i)
+	{
+		childIndex[i].hash = HashNameLower(children[i]->name.c_str(), children[i]->name.size());
+		childIndex[i].entry = children[i];
+	}
+	// Stable, so that duplicate names still resolve to the first one.
+	std::stable_sort(childIndex.begin(), childIndex.end());
+}
+
+ISOFileSystem::TreeEntry *ISOFileSystem::TreeEntry::LookupChild(const std::string &childName) const
+{
+	ChildIndexEntry key;
+	key.hash = HashNameLower(childName.c_str(), childName.size());
+	key.entry = NULL;
+
+	std::vector<ChildIndexEntry>::const_iterator it = std::lower_bound(childIndex.begin(), childIndex.end(), key);
+	for (; it != childIndex.end() && it->hash == key.hash; ++it)
+	{
+		if (EqualsLower(it->entry->name, childName))
+			return it->entry;
+	}
+	return 0;
 }
 
 ISOFileSystem::TreeEntry *ISOFileSystem::GetFromPath(std::string path, bool catchError)
@@ -314,31 +370,29 @@ ISOFileSystem::TreeEntry *ISOFileSystem::GetFromPath(std::string path, bool catc
 	if (path.length() == 0)
 		return e;
 
+	std::string key = path;
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+	PathCache::iterator cached = pathCache.find(key);
+	if (cached != pathCache.end())
+	{
+		if (!cached->second && catchError)
+		{
+			ERROR_LOG(FILESYS,"File %s not found", path.c_str());
+		}
+		return cached->second;
+	}
+
+	if (pathCache.size() >= MAX_PATH_CACHE_ENTRIES)
+		pathCache.clear();
+
 	while (true)
 	{
 		TreeEntry *ne = 0;
 		std::string name = "";
 		if (path.length()>0)
 		{
-			for (size_t i=0; i<e->children.size(); i++)
-			{
-				std::string n = (e->children[i]->name);
-				for (size_t j = 0; j < n.size(); j++) {
-					n[j] = tolower(n[j]);
-				}
-				std::string curPath = path.substr(0, path.find_first_of('/'));
-				for (size_t j = 0; j < curPath.size(); j++) {
-					curPath[j] = tolower(curPath[j]);
-				}
-
-				if (curPath == n)
-				{
-					//yay we got it
-					ne = e->children[i];
-					name = n;
-					break;
-				}
-			}
+			name = path.substr(0, path.find_first_of('/'));
+			ne = e->LookupChild(name);
 		}
 		if (ne)
 		{
@@ -346,7 +400,10 @@ ISOFileSystem::TreeEntry *ISOFileSystem::GetFromPath(std::string path, bool catc
 			size_t l = name.length();
 			path.erase(0, l);
 			if (path.length() == 0 || (path.length()==1 && path[0] == '/'))
+			{
+				pathCache[key] = e;
 				return e;
+			}
 			path.erase(0, 1);
 			while (path[0] == '/')
 				path.erase(0, 1);
@@ -357,6 +414,7 @@ ISOFileSystem::TreeEntry *ISOFileSystem::GetFromPath(std::string path, bool catc
 			{
 				ERROR_LOG(FILESYS,"File %s not found", path.c_str());
 			}
+			pathCache[key] = 0;
 			return 0;
 		}
 	}
@@ -404,6 +462,7 @@ u32 ISOFileSystem::OpenFile(std::string filename, FileAccess access, const char
 		if(strncmp(devicename, "umd0:", 5)==0 || strncmp(devicename, "umd1:", 5)==0)
 			entry.isBlockSectorMode = true;
 
+		lock_guard guard(entriesLock);
 		entries[newHandle] = entry;
 		return newHandle;
 	}
@@ -426,12 +485,14 @@ u32 ISOFileSystem::OpenFile(std::string filename, FileAccess access, const char
 	entry.seekPos = 0;
 
 	u32 newHandle = hAlloc->GetNewHandle();
+	lock_guard guard(entriesLock);
 	entries[newHandle] = entry;
 	return newHandle;
 }
 
 void ISOFileSystem::CloseFile(u32 handle)
 {
+	lock_guard guard(entriesLock);
 	EntryMap::iterator iter = entries.find(handle);
 	if (iter != entries.end())
 	{
@@ -448,18 +509,26 @@ void ISOFileSystem::CloseFile(u32 handle)
 
 bool ISOFileSystem::OwnsHandle(u32 handle)
 {
+	lock_guard guard(entriesLock);
 	EntryMap::iterator iter = entries.find(handle);
 	return (iter != entries.end());
 }
 
-int ISOFileSystem::Ioctl(u32 handle, u32 cmd, u32 indataPtr, u32 inlen, u32 outdataPtr, u32 outlen, int &usec) {
+ISOFileSystem::OpenFileEntry *ISOFileSystem::FindEntry(u32 handle)
+{
+	lock_guard guard(entriesLock);
 	EntryMap::iterator iter = entries.find(handle);
-	if (iter == entries.end()) {
+	return iter != entries.end() ? &iter->second : NULL;
+}
+
+int ISOFileSystem::Ioctl(u32 handle, u32 cmd, u32 indataPtr, u32 inlen, u32 outdataPtr, u32 outlen, int &usec) {
+	OpenFileEntry *entry = FindEntry(handle);
+	if (!entry) {
 		ERROR_LOG(FILESYS, "Ioctl on a bad file handle");
 		return SCE_KERNEL_ERROR_BADF;
 	}
 
-	OpenFileEntry &e = iter->second;
+	OpenFileEntry &e = *entry;
 
 	switch (cmd) {
 	// Get ISO9660 volume descriptor (from open ISO9660 file.)
@@ -494,9 +563,12 @@ int ISOFileSystem::Ioctl(u32 handle, u32 cmd, u32 indataPtr, u32 inlen, u32 outd
 			u32 size = (u32)desc.pathTableLengthLE;
 			u8 *out = Memory::GetPointer(outdataPtr);
 
-			while (size >= 2048) {
-				blockDevice->ReadBlock(block++, out);
-				out += 2048;
+			int fullBlocks = size / 2048;
+			if (fullBlocks > 0) {
+				blockDevice->ReadBlocks(block, fullBlocks, out);
+				block += fullBlocks;
+				out += fullBlocks * 2048;
+				size -= fullBlocks * 2048;
 			}
 
 			// The remaining (or, usually, only) partial sector.
@@ -513,25 +585,22 @@ int ISOFileSystem::Ioctl(u32 handle, u32 cmd, u32 indataPtr, u32 inlen, u32 outd
 
 int ISOFileSystem::DevType(u32 handle)
 {
-	EntryMap::iterator iter = entries.find(handle);
-	return iter->second.isBlockSectorMode ? PSP_DEV_TYPE_BLOCK : PSP_DEV_TYPE_FILE;
+	OpenFileEntry *entry = FindEntry(handle);
+	return entry->isBlockSectorMode ? PSP_DEV_TYPE_BLOCK : PSP_DEV_TYPE_FILE;
 }
 
 size_t ISOFileSystem::ReadFile(u32 handle, u8 *pointer, s64 size)
 {
-	EntryMap::iterator iter = entries.find(handle);
-	if (iter != entries.end())
+	OpenFileEntry *entry = FindEntry(handle);
+	if (entry)
 	{
-		OpenFileEntry &e = iter->second;
+		OpenFileEntry &e = *entry;
 		
 		if (e.isBlockSectorMode)
 		{
 			// Whole sectors! Shortcut to this simple code.
-			for (int i = 0; i < size; i++)
-			{
-				blockDevice->ReadBlock(e.seekPos, pointer + i * 2048);
-				e.seekPos++;
-			}
+			blockDevice->ReadBlocks(e.seekPos, (int)size, pointer);
+			e.seekPos += (unsigned int)size;
 			return (size_t)size;
 		}
 
@@ -568,12 +637,29 @@ size_t ISOFileSystem::ReadFile(u32 handle, u8 *pointer, s64 size)
 
 		while (remain > 0)
 		{
-			blockDevice->ReadBlock(secNum, theSector);
+			// Whole sectors go straight to the destination, all at once.
+			if (posInSector == 0 && remain >= 2048)
+			{
+				int sectors = (int)(remain / 2048);
+				blockDevice->ReadBlocks(secNum, sectors, pointer);
+				totalRead += sectors * 2048;
+				pointer += sectors * 2048;
+				remain -= sectors * 2048;
+				secNum += sectors;
+				continue;
+			}
+
+			const u8 *sector = blockDevice->PeekBlocks(secNum, 1);
+			if (!sector)
+			{
+				blockDevice->ReadBlock(secNum, theSector);
+				sector = theSector;
+			}
 			size_t bytesToCopy = 2048 - posInSector;
 			if ((s64)bytesToCopy > remain)
 				bytesToCopy = (size_t)remain;
 
-			memcpy(pointer, theSector + posInSector, bytesToCopy);
+			memcpy(pointer, sector + posInSector, bytesToCopy);
 			totalRead += (u32)bytesToCopy;
 			pointer += bytesToCopy;
 			remain -= bytesToCopy;
@@ -599,10 +685,10 @@ size_t ISOFileSystem::WriteFile(u32 handle, const u8 *pointer, s64 size)
 
 size_t ISOFileSystem::SeekFile(u32 handle, s32 position, FileMove type) 
 {
-	EntryMap::iterator iter = entries.find(handle);
-	if (iter != entries.end())
+	OpenFileEntry *entry = FindEntry(handle);
+	if (entry)
 	{
-		OpenFileEntry &e = iter->second;
+		OpenFileEntry &e = *entry;
 		switch (type)
 		{
 		case FILEMOVE_BEGIN:
@@ -734,6 +820,7 @@ void ISOFileSystem::DoState(PointerWrap &p)
 	if (!s)
 		return;
 
+	lock_guard guard(entriesLock);
 	int n = (int) entries.size();
 	p.Do(n);
 
@@ -20,6 +20,7 @@
 #include <map>
 #include <list>
 
+#include "native/base/mutex.h"
 #include "FileSystem.h"
 
 #include "BlockDevices.h"
@@ -42,7 +43,7 @@ public:
 	bool     OwnsHandle(u32 handle) override;
 	int      Ioctl(u32 handle, u32 cmd, u32 indataPtr, u32 inlen, u32 outdataPtr, u32 outlen, int &usec) override;
 	int      DevType(u32 handle) override;
-	int      Flags() override { return 0; }
+	int      Flags() override { return blockDevice->IsThreadSafe() ? FILESYSTEM_CONCURRENT_IO : 0; }
 
 	size_t WriteFile(u32 handle, const u8 *pointer, s64 size) override;
 	bool GetHostPath(const std::string &inpath, std::string &outpath) {return false;}
@@ -65,6 +66,23 @@ private:
 
 		TreeEntry *parent;
 		std::vector<TreeEntry*> children;
+
+		// Case insensitive, returns the first child with that name like a linear search would.
+		TreeEntry *LookupChild(const std::string &childName) const;
+		void BuildChildIndex();
+
+	private:
+		struct ChildIndexEntry {
+			u32 hash;
+			TreeEntry *entry;
+
+			bool operator <(const ChildIndexEntry &other) const {
+				return hash < other.hash;
+			}
+		};
+
+		// children sorted by the hash of their lowercased name.
+		std::vector<ChildIndexEntry> childIndex;
 	};
 
 	struct OpenFileEntry
@@ -77,14 +95,23 @@ private:
 		u32 openSize;
 	};
 	
+	OpenFileEntry *FindEntry(u32 handle);
+
 	typedef std::map<u32,OpenFileEntry> EntryMap;
 	EntryMap entries;
+	// Only guards the map itself, each handle is used by one thread at a time.
+	recursive_mutex entriesLock;
 	IHandleAllocator *hAlloc;
 	TreeEntry *treeroot;
 	BlockDevice *blockDevice;
 
 	TreeEntry entireISO;
 
+	// Lowercased paths that have been looked up before, including ones that weren't found.
+	// The tree never changes after mounting, so this never needs invalidating.
+	typedef std::map<std::string, TreeEntry *> PathCache;
+	PathCache pathCache;
+
 	// Don't use this in the emu, not savestated.
 	std::vector<std::string> restrictTree;
 
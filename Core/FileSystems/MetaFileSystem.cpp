@@ -21,6 +21,7 @@
 #include "Common/ChunkFile.h"
 #include "Common/StringUtils.h"
 #include "Core/FileSystems/MetaFileSystem.h"
+#include "Core/HLE/sceIo.h"
 #include "Core/HLE/sceKernelThread.h"
 #include "Core/Reporting.h"
 #include "Core/System.h"
@@ -280,6 +281,8 @@ void MetaFileSystem::Mount(std::string prefix, IFileSystem *system)
 
 void MetaFileSystem::Unmount(std::string prefix, IFileSystem *system)
 {
+	// Concurrent IO systems are read without the lock, so let those reads finish first.
+	__IoSync();
 	lock_guard guard(lock);
 	MountPoint x;
 	x.prefix = prefix;
@@ -288,6 +291,7 @@ void MetaFileSystem::Unmount(std::string prefix, IFileSystem *system)
 }
 
 void MetaFileSystem::Remount(IFileSystem *oldSystem, IFileSystem *newSystem) {
+	lock_guard guard(lock);
 	for (auto it = fileSystems.begin(); it != fileSystems.end(); ++it) {
 		if (it->system == oldSystem) {
 			it->system = newSystem;
@@ -546,8 +550,12 @@ void MetaFileSystem::CloseFile(u32 handle)
 
 size_t MetaFileSystem::ReadFile(u32 handle, u8 *pointer, s64 size)
 {
-	lock_guard guard(lock);
+	// Don't hold up the IO threads on each other if the file system can handle it.
 	IFileSystem *sys = GetHandleOwner(handle);
+	if (sys && (sys->Flags() & FILESYSTEM_CONCURRENT_IO))
+		return sys->ReadFile(handle,pointer,size);
+
+	lock_guard guard(lock);
 	if (sys)
 		return sys->ReadFile(handle,pointer,size);
 	else
@@ -556,8 +564,11 @@ size_t MetaFileSystem::ReadFile(u32 handle, u8 *pointer, s64 size)
 
 size_t MetaFileSystem::WriteFile(u32 handle, const u8 *pointer, s64 size)
 {
-	lock_guard guard(lock);
 	IFileSystem *sys = GetHandleOwner(handle);
+	if (sys && (sys->Flags() & FILESYSTEM_CONCURRENT_IO))
+		return sys->WriteFile(handle,pointer,size);
+
+	lock_guard guard(lock);
 	if (sys)
 		return sys->WriteFile(handle,pointer,size);
 	else
@@ -15,27 +15,30 @@
 // Official git repository and contact information can be found at
 // https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
 
-#include "base/mutex.h"
+#include <algorithm>
+#include <atomic>
+
+#include "base/basictypes.h"
+#include "base/timeutil.h"
 
 #include "Globals.h" // only for clamp_s16
 #include "Common/CommonTypes.h"
 #include "Common/ChunkFile.h"
 #include "Common/FixedSizeQueue.h"
-#include "Common/Atomics.h"
 
 #include "Core/CoreTiming.h"
 #include "Core/MemMap.h"
 #include "Core/Host.h"
 #include "Core/Config.h"
+#include "Core/HW/StereoResampler.h"
 #include "Core/HLE/__sceAudio.h"
 #include "Core/HLE/sceAudio.h"
 #include "Core/HLE/sceKernel.h"
 #include "Core/HLE/sceKernelThread.h"
 
-// Should be used to lock anything related to the outAudioQueue.
-// atomic locks are used on the lock. TODO: make this lock-free
-atomic_flag atomicLock_;
-recursive_mutex mutex_;
+#ifdef _M_SSE
+#include <emmintrin.h>
+#endif
 
 enum latency {
 	LOW_LATENCY = 0,
@@ -62,13 +65,37 @@ static s32 *mixBuffer;
 static int chanQueueMaxSizeFactor;
 static int chanQueueMinSizeFactor;
 
-// TODO: Need to replace this with something lockless. Mutexes in the audio pipeline
-// is bad mojo.
-FixedSizeQueue<s16, 512 * 16> outAudioQueue;
-
-bool __gainAudioQueueLock();
-void __releaseAcquiredLock();
-void __blockForAudioQueueLock();
+// Written by __AudioUpdate on the emu thread, read by __AudioMix on the host's audio thread.
+static SPSCRingBuffer<s16, 512 * 16> outAudioQueue;
+// Only used by __AudioMix.
+static StereoResampler outResampler;
+// How much __AudioMix tries to keep in outAudioQueue, set by the latency setting.
+static int outTargetFrames;
+
+// When each block in outAudioQueue was mixed, so we can measure how long audio waits before the
+// host takes it.  Enough entries for a full queue of the smallest (16 frame) blocks, so the emu
+// thread can't overwrite one the host still needs.
+struct OutAudioStamp {
+	double time;
+	// Position in the queue just after the block.  Written last, the host side checks it first.
+	std::atomic<u32> end;
+};
+static const int OUT_AUDIO_STAMPS = 512 * 16 / (16 * 2);
+static OutAudioStamp outAudioStamps[OUT_AUDIO_STAMPS];
+// Total samples pushed and popped, and stamps written and read.  Each only used by its own side.
+static u32 outAudioPushed;
+static u32 outAudioPopped;
+static u32 outAudioStampWrite;
+static u32 outAudioStampRead;
+// The last stamp __AudioMix got to.
+static u32 outAudioStampEnd;
+static double outAudioStampTime;
+
+// Each is only written by one side, but read by the host.
+static std::atomic<u32> outAudioUnderruns;
+static std::atomic<u32> outAudioOverruns;
+static std::atomic<u32> outAudioTargetFrames;
+static std::atomic<u32> outAudioMeasuredLatencyUs;
 
 static inline s16 adjustvolume(s16 sample, int vol) {
 #ifdef ARM
@@ -78,8 +105,108 @@ static inline s16 adjustvolume(s16 sample, int vol) {
 	             : "=r"(r) : "r"(vol), "r"(sample));
 	return r;
 #else
-	return clamp_s16((sample * vol) >> 16);
+	// Doubled volumes go past 16 bits, so like smulwb, don't let the product overflow.
+	return clamp_s16((int)(((s64)sample * vol) >> 16));
+#endif
+}
+
+#ifdef _M_SSE
+// The volumes are unsigned, so mulhi_epi16 gets the high half wrong by the sample for volumes of
+// 0x8000 and up.  fixup selects the lanes to add it back in.  Returns the products >> 15, saturated.
+static inline __m128i ScaleSamplesSSE(__m128i s, __m128i vol, __m128i fixup) {
+	const __m128i lo = _mm_mullo_epi16(s, vol);
+	const __m128i hi = _mm_add_epi16(_mm_mulhi_epi16(s, vol), _mm_and_si128(s, fixup));
+	const __m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+	const __m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+	return _mm_packs_epi32(p0, p1);
+}
 #endif
+
+// adjustvolume() over interleaved stereo samples.  The volumes are already doubled, like for adjustvolume().
+static void AdjustVolumeStereo(s16 *out, const s16_le *in, size_t count, int leftVol, int rightVol) {
+	size_t i = 0;
+#ifdef _M_SSE
+	// Only the regular channels' volumes fit in 16 bits, the SRC and OUTPUT2 ones can go higher.
+	// They're treated as unsigned, so anything negative (from a huge u32 volume) stays scalar too.
+	if (leftVol >= 0 && rightVol >= 0 && leftVol <= 0x1FFFE && rightVol <= 0x1FFFE) {
+		const s16 l = (s16)(leftVol >> 1), r = (s16)(rightVol >> 1);
+		const __m128i vol = _mm_set_epi16(r, l, r, l, r, l, r, l);
+		const __m128i fixup = _mm_srai_epi16(vol, 15);
+		for (; i + 8 <= count; i += 8) {
+			const __m128i s = _mm_loadu_si128((const __m128i *)(in + i));
+			_mm_storeu_si128((__m128i *)(out + i), ScaleSamplesSSE(s, vol, fixup));
+		}
+	}
+#endif
+	for (; i < count; i += 2) {
+		out[i] = adjustvolume(in[i], leftVol);
+		out[i + 1] = adjustvolume(in[i + 1], rightVol);
+	}
+}
+
+// Same, but expands mono samples to stereo, writing frames * 2 samples.
+static void AdjustVolumeMono(s16 *out, const s16_le *in, size_t frames, int leftVol, int rightVol) {
+	size_t i = 0;
+#ifdef _M_SSE
+	if (leftVol >= 0 && rightVol >= 0 && leftVol <= 0x1FFFE && rightVol <= 0x1FFFE) {
+		const s16 l = (s16)(leftVol >> 1), r = (s16)(rightVol >> 1);
+		const __m128i vol = _mm_set_epi16(r, l, r, l, r, l, r, l);
+		const __m128i fixup = _mm_srai_epi16(vol, 15);
+		for (; i + 8 <= frames; i += 8) {
+			const __m128i s = _mm_loadu_si128((const __m128i *)(in + i));
+			_mm_storeu_si128((__m128i *)(out + i * 2), ScaleSamplesSSE(_mm_unpacklo_epi16(s, s), vol, fixup));
+			_mm_storeu_si128((__m128i *)(out + i * 2 + 8), ScaleSamplesSSE(_mm_unpackhi_epi16(s, s), vol, fixup));
+		}
+	}
+#endif
+	for (; i < frames; i++) {
+		const s16 sample = in[i];
+		out[i * 2] = adjustvolume(sample, leftVol);
+		out[i * 2 + 1] = adjustvolume(sample, rightVol);
+	}
+}
+
+// The mix is kept in 32 bits, so it only saturates once at the end, like the PSP.
+static void MixCopy(s32 *mix, const s16 *in, size_t count) {
+	size_t i = 0;
+#ifdef _M_SSE
+	for (; i + 8 <= count; i += 8) {
+		const __m128i s = _mm_loadu_si128((const __m128i *)(in + i));
+		// Putting each sample in the high half and shifting down sign extends it.
+		_mm_storeu_si128((__m128i *)(mix + i), _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+		_mm_storeu_si128((__m128i *)(mix + i + 4), _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+	}
+#endif
+	for (; i < count; i++)
+		mix[i] = in[i];
+}
+
+static void MixAdd(s32 *mix, const s16 *in, size_t count) {
+	size_t i = 0;
+#ifdef _M_SSE
+	for (; i + 8 <= count; i += 8) {
+		const __m128i s = _mm_loadu_si128((const __m128i *)(in + i));
+		const __m128i m0 = _mm_loadu_si128((const __m128i *)(mix + i));
+		const __m128i m1 = _mm_loadu_si128((const __m128i *)(mix + i + 4));
+		_mm_storeu_si128((__m128i *)(mix + i), _mm_add_epi32(m0, _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16)));
+		_mm_storeu_si128((__m128i *)(mix + i + 4), _mm_add_epi32(m1, _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16)));
+	}
+#endif
+	for (; i < count; i++)
+		mix[i] += in[i];
+}
+
+static void MixClamp(s16 *out, const s32 *mix, size_t count) {
+	size_t i = 0;
+#ifdef _M_SSE
+	for (; i + 8 <= count; i += 8) {
+		const __m128i m0 = _mm_loadu_si128((const __m128i *)(mix + i));
+		const __m128i m1 = _mm_loadu_si128((const __m128i *)(mix + i + 4));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(m0, m1));
+	}
+#endif
+	for (; i < count; i++)
+		out[i] = clamp_s16(mix[i]);
 }
 
 void hleAudioUpdate(u64 userdata, int cyclesLate) {
@@ -127,6 +254,7 @@ void __AudioInit() {
 		break;
 
 	}
+	outTargetFrames = hostAttemptBlockSize * 2;
 
 	__AudioCPUMHzChange();
 
@@ -141,9 +269,21 @@ void __AudioInit() {
 	mixBuffer = new s32[hwBlockSize * 2];
 	memset(mixBuffer, 0, hwBlockSize * 2 * sizeof(s32));
 
-	__blockForAudioQueueLock();
+	// The host isn't mixing yet at this point.
 	outAudioQueue.clear();
-	__releaseAcquiredLock();
+	outResampler.Clear();
+	outAudioUnderruns = 0;
+	outAudioOverruns = 0;
+	outAudioPushed = 0;
+	outAudioPopped = 0;
+	outAudioStampWrite = 0;
+	for (int i = 0; i < OUT_AUDIO_STAMPS; ++i)
+		outAudioStamps[i].end = 0;
+	outAudioStampRead = 0;
+	outAudioStampEnd = 0;
+	outAudioStampTime = 0.0;
+	outAudioTargetFrames = 0;
+	outAudioMeasuredLatencyUs = 0;
 	CoreTiming::RegisterMHzChangeCallback(&__AudioCPUMHzChange);
 }
 
@@ -159,17 +299,7 @@ void __AudioDoState(PointerWrap &p) {
 
 	p.Do(mixFrequency);
 
-	{	
-		//block until a lock is achieved. Not a good idea at all, but
-		//can't think of a better one...
-		__blockForAudioQueueLock();
-
-		outAudioQueue.DoState(p);
-
-		//release the atomic lock
-		__releaseAcquiredLock();
-		
-	}
+	outAudioQueue.DoState(p);
 
 	int chanCount = ARRAY_SIZE(chans);
 	p.Do(chanCount);
@@ -266,25 +396,31 @@ u32 __AudioEnqueue(AudioChannel &chan, int chanNum, bool blocking) {
 				size_t sz1, sz2;
 				chan.sampleQueue.pushPointers(totalSamples, &buf1, &sz1, &buf2, &sz2);
 
-				// TODO: SSE/NEON (VQDMULH) implementations
-				for (u32 i = 0; i < sz1; i += 2) {
-					buf1[i] = adjustvolume(sampleData[i], leftVol);
-					buf1[i + 1] = adjustvolume(sampleData[i + 1], rightVol);
-				}
-				if (buf2) {
-					sampleData += sz1;
-					for (u32 i = 0; i < sz2; i += 2) {
-						buf2[i] = adjustvolume(sampleData[i], leftVol);
-						buf2[i + 1] = adjustvolume(sampleData[i + 1], rightVol);
-					}
-				}
+				// TODO: NEON (VQDMULH) implementation
+				AdjustVolumeStereo(buf1, sampleData, sz1, leftVol, rightVol);
+				if (buf2)
+					AdjustVolumeStereo(buf2, sampleData + sz1, sz2, leftVol, rightVol);
 			}
 		} else if (chan.format == PSP_AUDIO_FORMAT_MONO) {
-			for (u32 i = 0; i < chan.sampleCount; i++) {
-				// Expand to stereo
-				s16 sample = (s16)Memory::Read_U16(chan.sampleAddress + 2 * i);
-				chan.sampleQueue.push(adjustvolume(sample, leftVol));
-				chan.sampleQueue.push(adjustvolume(sample, rightVol));
+			const s16_le *sampleData = (const s16_le *) Memory::GetPointer(chan.sampleAddress);
+
+			if (Memory::IsValidAddress(chan.sampleAddress + (chan.sampleCount - 1) * sizeof(s16_le))) {
+				// Expand to stereo, straight into the queue.  Both parts are whole frames, since we
+				// only ever push stereo.
+				s16 *buf1 = 0, *buf2 = 0;
+				size_t sz1, sz2;
+				chan.sampleQueue.pushPointers(chan.sampleCount * 2, &buf1, &sz1, &buf2, &sz2);
+
+				AdjustVolumeMono(buf1, sampleData, sz1 / 2, leftVol, rightVol);
+				if (buf2)
+					AdjustVolumeMono(buf2, sampleData + sz1 / 2, sz2 / 2, leftVol, rightVol);
+			} else {
+				for (u32 i = 0; i < chan.sampleCount; i++) {
+					// Expand to stereo
+					s16 sample = (s16)Memory::Read_U16(chan.sampleAddress + 2 * i);
+					chan.sampleQueue.push(adjustvolume(sample, leftVol));
+					chan.sampleQueue.push(adjustvolume(sample, rightVol));
+				}
 			}
 		}
 	}
@@ -356,20 +492,14 @@ void __AudioUpdate() {
 		chans[i].sampleQueue.popPointers(hwBlockSize * 2, &buf1, &sz1, &buf2, &sz2);
 
 		if (firstChannel) {
-			for (size_t s = 0; s < sz1; s++)
-				mixBuffer[s] = buf1[s];
-			if (buf2) {
-				for (size_t s = 0; s < sz2; s++)
-					mixBuffer[s + sz1] = buf2[s];
-			}
+			MixCopy(mixBuffer, buf1, sz1);
+			if (buf2)
+				MixCopy(mixBuffer + sz1, buf2, sz2);
 			firstChannel = false;
 		} else {
-			for (size_t s = 0; s < sz1; s++)
-				mixBuffer[s] += buf1[s];
-			if (buf2) {
-				for (size_t s = 0; s < sz2; s++)
-					mixBuffer[s + sz1] += buf2[s];
-			}
+			MixAdd(mixBuffer, buf1, sz1);
+			if (buf2)
+				MixAdd(mixBuffer + sz1, buf2, sz2);
 		}
 	}
 
@@ -378,108 +508,97 @@ void __AudioUpdate() {
 	}
 
 	if (g_Config.bEnableSound) {
-
-		__blockForAudioQueueLock();
-		/*
-		if (!__gainAudioQueueLock()){
-			return;
-		}
-		*/
-
-		if (outAudioQueue.room() >= hwBlockSize * 2) {
+		if (outAudioQueue.room() >= (size_t)hwBlockSize * 2) {
 			s16 *buf1 = 0, *buf2 = 0;
 			size_t sz1, sz2;
 			outAudioQueue.pushPointers(hwBlockSize * 2, &buf1, &sz1, &buf2, &sz2);
-			
-			for (size_t s = 0; s < sz1; s++)
-				buf1[s] = clamp_s16(mixBuffer[s]);
-			if (buf2) {
-				for (size_t s = 0; s < sz2; s++)
-					buf2[s] = clamp_s16(mixBuffer[s + sz1]);
-			}
+
+			MixClamp(buf1, mixBuffer, sz1);
+			if (buf2)
+				MixClamp(buf2, mixBuffer + sz1, sz2);
+
+			outAudioPushed += (u32)(sz1 + sz2);
+			OutAudioStamp &stamp = outAudioStamps[outAudioStampWrite++ % OUT_AUDIO_STAMPS];
+			stamp.time = real_time_now();
+			stamp.end.store(outAudioPushed, std::memory_order_release);
+			outAudioQueue.commitPush(sz1 + sz2);
 		} else {
 			// This happens quite a lot. There's still something slightly off
 			// about the amount of audio we produce.
+			outAudioOverruns.fetch_add(1, std::memory_order_relaxed);
 		}
-		//release the atomic lock
-		__releaseAcquiredLock();
 	}
 }
 
 // numFrames is number of stereo frames.
 // This is called from *outside* the emulator thread.
-int __AudioMix(short *outstereo, int numFrames)
+int __AudioMix(short *outstereo, int numFrames, int sampleRate)
 {
+	// Aim to keep this much queued, so the bursts of samples we get when the emulator runs a frame
+	// ahead and then waits don't run us dry.  Any further from it and we adjust the rate.
+	const int targetFrames = std::min(std::max(numFrames * 2, outTargetFrames), (int)outAudioQueue.capacity() / 4);
+	outAudioTargetFrames.store(targetFrames, std::memory_order_relaxed);
 
-	// TODO: if mixFrequency != the actual output frequency, resample!
-	int underrun = -1;
-	s16 sampleL = 0;
-	s16 sampleR = 0;
+	// We always produce samples at hwSampleRate, regardless of mixFrequency.
+	int needed = outResampler.PrepareResample(numFrames, hwSampleRate, sampleRate, (int)outAudioQueue.size() / 2, targetFrames);
 
 	const s16 *buf1 = 0, *buf2 = 0;
 	size_t sz1, sz2;
-	{
-		
-		//TODO: do rigorous testing to see whether just blind locking will improve speed.
-		if (!__gainAudioQueueLock()){
-			 memset(outstereo, 0, numFrames * 2 * sizeof(short)); 
-			 return 0;
-		}
-		
-		outAudioQueue.popPointers(numFrames * 2, &buf1, &sz1, &buf2, &sz2);
-
-		memcpy(outstereo, buf1, sz1 * sizeof(s16));
-		if (buf2) {
-			memcpy(outstereo + sz1, buf2, sz2 * sizeof(s16));
-		}
-
-		//release the atomic lock
-		__releaseAcquiredLock();
+	outAudioQueue.popPointers(needed * 2, &buf1, &sz1, &buf2, &sz2);
+	outResampler.Feed(buf1, (int)sz1 / 2);
+	if (buf2) {
+		outResampler.Feed(buf2, (int)sz2 / 2);
 	}
 
-	int remains = (int)(numFrames * 2 - sz1 - sz2);
-	if (remains > 0)
-		memset(outstereo + numFrames * 2 - remains, 0, remains*sizeof(s16));
-
-	if (sz1 + sz2 < (size_t)numFrames) {
-		underrun = (int)(sz1 + sz2) / 2;
-		VERBOSE_LOG(SCEAUDIO, "Audio out buffer UNDERRUN at %i of %i", underrun, numFrames);
+	// Find the newest block we've now taken all of.  Must happen before commitPop(), so they
+	// can't be overwritten yet.  A slot that hasn't been written yet this time around holds an
+	// older block, which we've already passed.
+	outAudioPopped += (u32)(sz1 + sz2);
+	bool tookBlock = false;
+	while (true) {
+		const OutAudioStamp &stamp = outAudioStamps[outAudioStampRead % OUT_AUDIO_STAMPS];
+		const u32 end = stamp.end.load(std::memory_order_acquire);
+		if ((s32)(end - outAudioStampEnd) <= 0 || (s32)(end - outAudioPopped) > 0)
+			break;
+		outAudioStampEnd = end;
+		outAudioStampTime = stamp.time;
+		outAudioStampRead++;
+		tookBlock = true;
 	}
-	return underrun >= 0 ? underrun : numFrames;
-}
-
-
-
-/*returns whether the lock was successfully gained or not.
-i.e - whether the lock belongs to you 
-*/
-inline bool __gainAudioQueueLock(){
-	if (g_Config.bAtomicAudioLocks){
-		/*if the previous state was 0, that means the lock was "unlocked". So,
-		we return !0, which is true thanks to C's int to bool conversion
-
-		One the other hand, if it was locked, then the lock would return 1.
-		so, !1 = 0 = false.
-		*/		
-		return atomicLock_.test_and_set() == 0;
-	} else {
-		mutex_.lock();
-		return true;
+	if (tookBlock) {
+		const double waited = real_time_now() - outAudioStampTime;
+		const u32 previous = outAudioMeasuredLatencyUs.load(std::memory_order_relaxed);
+		const u32 latest = (u32)std::max(0.0, waited * 1000000.0);
+		outAudioMeasuredLatencyUs.store(previous == 0 ? latest : previous + ((s32)(latest - previous) >> 3), std::memory_order_relaxed);
 	}
-};
+	outAudioQueue.commitPop(sz1 + sz2);
 
-inline void __releaseAcquiredLock(){
-	if (g_Config.bAtomicAudioLocks){
-		atomicLock_.clear();
-	} else {
-		mutex_.unlock();
+	int produced = outResampler.Resample(outstereo, numFrames);
+	if (produced < numFrames) {
+		memset(outstereo + produced * 2, 0, (numFrames - produced) * 2 * sizeof(s16));
+		outAudioUnderruns.fetch_add(1, std::memory_order_relaxed);
+		VERBOSE_LOG(SCEAUDIO, "Audio out buffer UNDERRUN at %i of %i", produced, numFrames);
 	}
+	return produced;
 }
 
-inline void __blockForAudioQueueLock(){
-	if (g_Config.bAtomicAudioLocks){
-		while ((atomicLock_.test_and_set() == 0)){ }
-	} else {
-		mutex_.lock();
-	}
+int __AudioTakeMixed(short *outstereo, int numFrames) {
+	const s16 *buf1 = 0, *buf2 = 0;
+	size_t sz1, sz2;
+	outAudioQueue.popPointers(numFrames * 2, &buf1, &sz1, &buf2, &sz2);
+	memcpy(outstereo, buf1, sz1 * sizeof(s16));
+	if (buf2)
+		memcpy(outstereo + sz1, buf2, sz2 * sizeof(s16));
+	// Keeps the latency stamps in step, __AudioMix() skips past these blocks next time.
+	outAudioPopped += (u32)(sz1 + sz2);
+	outAudioQueue.commitPop(sz1 + sz2);
+	return (int)(sz1 + sz2) / 2;
+}
+
+void __AudioGetQueueStats(AudioQueueStats *stats) {
+	stats->underruns = outAudioUnderruns.load(std::memory_order_relaxed);
+	stats->overruns = outAudioOverruns.load(std::memory_order_relaxed);
+	stats->queuedFrames = (u32)outAudioQueue.size() / 2;
+	stats->targetLatencyMs = outAudioTargetFrames.load(std::memory_order_relaxed) * 1000.0f / hwSampleRate;
+	stats->measuredLatencyMs = outAudioMeasuredLatencyUs.load(std::memory_order_relaxed) / 1000.0f;
 }
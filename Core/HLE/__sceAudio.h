@@ -32,4 +32,24 @@ u32 __AudioEnqueue(AudioChannel &chan, int chanNum, bool blocking);
 void __AudioWakeThreads(AudioChannel &chan, int result, int step);
 void __AudioWakeThreads(AudioChannel &chan, int result);
 
-int __AudioMix(short *outstereo, int numSamples);
+// sampleRate is the rate the host plays at, we resample to that.
+int __AudioMix(short *outstereo, int numSamples, int sampleRate = 44100);
+
+// Takes up to numFrames of the mixed output as it is, without resampling, and returns how many.
+// For tools that check the mix itself - a host plays through __AudioMix().
+int __AudioTakeMixed(short *outstereo, int numFrames);
+
+struct AudioQueueStats {
+	// Times __AudioMix ran out of samples, and times a mixed block was dropped because the host
+	// wasn't taking them fast enough.
+	u32 underruns;
+	u32 overruns;
+	u32 queuedFrames;
+	// What __AudioMix aims to keep queued, and how long the audio it took last actually waited
+	// since __AudioUpdate mixed it (smoothed.)
+	float targetLatencyMs;
+	float measuredLatencyMs;
+};
+
+// Safe to call from any thread.
+void __AudioGetQueueStats(AudioQueueStats *stats);
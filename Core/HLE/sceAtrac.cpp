@@ -25,6 +25,7 @@
 #include "Core/Config.h"
 #include "Core/HW/MediaEngine.h"
 #include "Core/HW/BufferQueue.h"
+#include "Core/HW/DecodeAheadWorker.h"
 #include "Common/ChunkFile.h"
 
 #include "sceKernel.h"
@@ -33,6 +34,7 @@
 #include "sceAtrac.h"
 
 #include <algorithm>
+#include <vector>
 
 #define ATRAC_ERROR_API_FAIL                 0x80630002
 #define ATRAC_ERROR_NO_ATRACID               0x80630003
@@ -120,12 +122,17 @@ struct Atrac {
 		pSwrCtx = 0;
 		pFrame = 0;
 		audio_stream_index = 0;
+		decodeAhead = 0;
+		aheadSample = -1;
 #endif // USE_FFMPEG
 		atracContext = 0;
 	}
 
 	~Atrac() {
 		CleanStuff();
+#ifdef USE_FFMPEG
+		delete decodeAhead;
+#endif // USE_FFMPEG
 	}
 
 	void CleanStuff() {
@@ -146,6 +153,14 @@ struct Atrac {
 		if (!s)
 			return;
 
+#ifdef USE_FFMPEG
+		// A frame decoded ahead isn't saved, it's simply decoded again after loading.
+		if (p.mode == p.MODE_READ)
+			DiscardDecodeAhead();
+		else
+			WaitDecodeAhead();
+#endif // USE_FFMPEG
+
 		p.Do(atracChannels);
 		p.Do(atracOutputChannels);
 
@@ -257,7 +272,34 @@ struct Atrac {
 	AVFrame         *pFrame;
 	int audio_stream_index;
 
+	// Decodes the next frame on a worker while the game does other things, see StartDecodeAhead().
+	DecodeAheadWorker *decodeAhead;
+	// Only valid once the worker is done.  aheadSample is -1 when nothing was started.
+	int aheadSample;
+	int aheadOutputChannels;
+	bool aheadOk;
+	bool aheadGotFrame;
+	u32 aheadNumSamples;
+	std::vector<s16> aheadPcm;
+
+	bool DecodeFrame(u8 *outbuf, u32 &numSamples, bool &gotFrame);
+	void StartDecodeAhead();
+	void DecodeAheadJob();
+	bool TakeDecodedAhead(u8 *outbuf, u32 &numSamples, bool &gotFrame, bool &ok);
+
+	void WaitDecodeAhead() {
+		if (decodeAhead)
+			decodeAhead->Wait();
+	}
+
+	// Must be used before anything other than _AtracDecodeData moves the decoder.
+	void DiscardDecodeAhead() {
+		WaitDecodeAhead();
+		aheadSample = -1;
+	}
+
 	void ReleaseFFMPEGContext() {
+		DiscardDecodeAhead();
 		if (pFrame)
 			av_free(pFrame);
 		if (pAVIOCtx && pAVIOCtx->buffer)
@@ -349,7 +391,13 @@ Atrac *getAtrac(int atracID) {
 	if (atracID < 0 || atracID >= PSP_NUM_ATRAC_IDS) {
 		return NULL;
 	}
-	return atracIDs[atracID];
+	Atrac *atrac = atracIDs[atracID];
+#ifdef USE_FFMPEG
+	// Everything else might touch what the worker is using, so let it finish first.
+	if (atrac)
+		atrac->WaitDecodeAhead();
+#endif // USE_FFMPEG
+	return atrac;
 }
 
 int createAtrac(Atrac *atrac, int codecType) {
@@ -605,62 +653,24 @@ u32 _AtracDecodeData(int atracID, u8* outbuf, u32 *SamplesNum, u32* finish, int
 			u32 atracSamplesPerFrame = (atrac->codecType == PSP_MODE_AT_3_PLUS ? ATRAC3PLUS_MAX_SAMPLES : ATRAC3_MAX_SAMPLES);
 #ifdef USE_FFMPEG
 			if (!atrac->failedDecode && (atrac->codecType == PSP_MODE_AT_3 || atrac->codecType == PSP_MODE_AT_3_PLUS) && atrac->pCodecCtx) {
-				int forceseekSample = atrac->currentSample * 2 > atrac->endSample ? 0 : atrac->endSample;
-				atrac->SeekToSample(forceseekSample);
-				atrac->SeekToSample(atrac->currentSample);
-				AVPacket packet;
-				av_init_packet(&packet);
-				int got_frame, avret;
-				while (av_read_frame(atrac->pFormatCtx, &packet) >= 0) {
-					if (packet.stream_index != atrac->audio_stream_index) {
-						av_free_packet(&packet);
-						continue;
-					}
-
-					got_frame = 0;
-					int bytes_in_packet = packet.size;
-					avret = avcodec_decode_audio4(atrac->pCodecCtx, atrac->pFrame, &got_frame, &packet);
-					if (avret == AVERROR_PATCHWELCOME) {
-						ERROR_LOG(ME, "Unsupported feature in ATRAC audio.");
-						// Let's try the next frame.
-					} else if (avret < 0) {
-						ERROR_LOG(ME, "avcodec_decode_audio4: Error decoding audio %d", avret);
-						av_free_packet(&packet);
-						atrac->failedDecode = true;
-						// No need to free the packet if decode_audio4 fails.
-						// Avoid getting stuck in a loop (Virtua Tennis)
-						*SamplesNum = 0;
-						*finish = 1;
-						*remains = 0;
-						return ATRAC_ERROR_ALL_DATA_DECODED;
-					}
-					// FFmpeg seems to return packet.size / 10.
-					// However, advancing the packet by this causes decode errors.  Bug?
-					if (avret != packet.size && avret != packet.size / 10) {
-						ERROR_LOG_REPORT_ONCE(multipacket, ME, "WARNING: Remaining data in packet - we currently only decode one frame per packet");
-					}
-
-					if (got_frame) {
-						// got a frame
-						// Use a small buffer and keep overwriting it with file data constantly
-						atrac->first.writableBytes += atrac->atracBytesPerFrame;	
-						int decoded = av_samples_get_buffer_size(NULL, atrac->pFrame->channels,
-							atrac->pFrame->nb_samples, (AVSampleFormat)atrac->pFrame->format, 1);
-						u8 *out = outbuf;
-						if (out != NULL) {
-							numSamples = atrac->pFrame->nb_samples;
-							avret = swr_convert(atrac->pSwrCtx, &out, atrac->pFrame->nb_samples,
-								(const u8 **)atrac->pFrame->extended_data, atrac->pFrame->nb_samples);
-							if (avret < 0) {
-								ERROR_LOG(ME, "swr_convert: Error while converting %d", avret);
-							}
-							__AdjustBGMVolume((s16 *)out, numSamples * atrac->atracOutputChannels);
-						}
-					}
-					av_free_packet(&packet);
-					if (got_frame) {
-						// We only want one frame per call, let's continue the next time.
-						break;
+				bool gotFrame = false;
+				bool ok;
+				if (!atrac->TakeDecodedAhead(outbuf, numSamples, gotFrame, ok)) {
+					ok = atrac->DecodeFrame(outbuf, numSamples, gotFrame);
+				}
+				if (!ok) {
+					atrac->failedDecode = true;
+					// Avoid getting stuck in a loop (Virtua Tennis)
+					*SamplesNum = 0;
+					*finish = 1;
+					*remains = 0;
+					return ATRAC_ERROR_ALL_DATA_DECODED;
+				}
+				if (gotFrame) {
+					// Use a small buffer and keep overwriting it with file data constantly
+					atrac->first.writableBytes += atrac->atracBytesPerFrame;
+					if (outbuf != NULL) {
+						__AdjustBGMVolume((s16 *)outbuf, numSamples * atrac->atracOutputChannels);
 					}
 				}
 			}
@@ -684,6 +694,9 @@ u32 _AtracDecodeData(int atracID, u8* outbuf, u32 *SamplesNum, u32* finish, int
 
 			*finish = finishFlag;
 			*remains = atrac->getRemainFrames();
+#ifdef USE_FFMPEG
+			atrac->StartDecodeAhead();
+#endif // USE_FFMPEG
 		}
 		if (atrac->atracContext.IsValid()) {
 			// refresh atracContext
@@ -694,6 +707,115 @@ u32 _AtracDecodeData(int atracID, u8* outbuf, u32 *SamplesNum, u32* finish, int
 	return ret;
 }
 
+#ifdef USE_FFMPEG
+// Decodes the frame at currentSample.  Returns false if the decoder gave up on the stream.
+bool Atrac::DecodeFrame(u8 *outbuf, u32 &numSamples, bool &gotFrame) {
+	int forceseekSample = currentSample * 2 > endSample ? 0 : endSample;
+	SeekToSample(forceseekSample);
+	SeekToSample(currentSample);
+	AVPacket packet;
+	av_init_packet(&packet);
+	int got_frame, avret;
+	while (av_read_frame(pFormatCtx, &packet) >= 0) {
+		if (packet.stream_index != audio_stream_index) {
+			av_free_packet(&packet);
+			continue;
+		}
+
+		got_frame = 0;
+		avret = avcodec_decode_audio4(pCodecCtx, pFrame, &got_frame, &packet);
+		if (avret == AVERROR_PATCHWELCOME) {
+			ERROR_LOG(ME, "Unsupported feature in ATRAC audio.");
+			// Let's try the next frame.
+		} else if (avret < 0) {
+			ERROR_LOG(ME, "avcodec_decode_audio4: Error decoding audio %d", avret);
+			// No need to free the packet if decode_audio4 fails.
+			av_free_packet(&packet);
+			return false;
+		}
+		// FFmpeg seems to return packet.size / 10.
+		// However, advancing the packet by this causes decode errors.  Bug?
+		if (avret != packet.size && avret != packet.size / 10) {
+			ERROR_LOG_REPORT_ONCE(multipacket, ME, "WARNING: Remaining data in packet - we currently only decode one frame per packet");
+		}
+
+		if (got_frame) {
+			// got a frame
+			gotFrame = true;
+			u8 *out = outbuf;
+			if (out != NULL) {
+				numSamples = pFrame->nb_samples;
+				avret = swr_convert(pSwrCtx, &out, pFrame->nb_samples,
+					(const u8 **)pFrame->extended_data, pFrame->nb_samples);
+				if (avret < 0) {
+					ERROR_LOG(ME, "swr_convert: Error while converting %d", avret);
+				}
+			}
+		}
+		av_free_packet(&packet);
+		if (got_frame) {
+			// We only want one frame per call, let's continue the next time.
+			break;
+		}
+	}
+	return true;
+}
+
+// Games streaming BGM call sceAtracDecodeData about once per frame of audio, with nothing else
+// touching the decoder in between.  So after each call, if the next frame is already all in the
+// buffer, decode it on the worker and hand it out on the next call.
+//
+// This decodes exactly the frames, in exactly the order, that the calls would have anyway, as
+// long as the next call asks for the sample we guessed.  If it doesn't (the game seeked or reset),
+// the frame is dropped, and the codec has simply seen one frame more before the jump.
+void Atrac::StartDecodeAhead() {
+	aheadSample = -1;
+	if (!g_Config.bAudioDecodeAhead || failedDecode || !pCodecCtx || (codecType != PSP_MODE_AT_3 && codecType != PSP_MODE_AT_3_PLUS))
+		return;
+	// Past the end without a loop, the next call won't decode anything.
+	if (currentSample >= endSample && loopNum == 0)
+		return;
+	// The rest might still be on its way from the game.
+	if (atracBytesPerFrame == 0 || getDecodePosBySample(currentSample) + atracBytesPerFrame > first.size)
+		return;
+
+	if (!decodeAhead)
+		decodeAhead = new DecodeAheadWorker();
+	const int samplesPerFrame = codecType == PSP_MODE_AT_3_PLUS ? ATRAC3PLUS_MAX_SAMPLES : ATRAC3_MAX_SAMPLES;
+	aheadPcm.resize(samplesPerFrame * atracOutputChannels);
+	aheadSample = currentSample;
+	aheadOutputChannels = atracOutputChannels;
+	decodeAhead->Start(std::bind(&Atrac::DecodeAheadJob, this));
+}
+
+void Atrac::DecodeAheadJob() {
+	// Reading moves decodePos, but everything else expects it to stay put between calls.
+	const u32 savedDecodePos = decodePos;
+	aheadGotFrame = false;
+	aheadNumSamples = 0;
+	aheadOk = DecodeFrame((u8 *)&aheadPcm[0], aheadNumSamples, aheadGotFrame);
+	decodePos = savedDecodePos;
+}
+
+bool Atrac::TakeDecodedAhead(u8 *outbuf, u32 &numSamples, bool &gotFrame, bool &ok) {
+	if (aheadSample < 0)
+		return false;
+	WaitDecodeAhead();
+	const bool match = aheadSample == currentSample && aheadOutputChannels == atracOutputChannels;
+	aheadSample = -1;
+	if (!match)
+		return false;
+
+	ok = aheadOk;
+	gotFrame = aheadGotFrame;
+	if (outbuf != NULL && aheadNumSamples != 0) {
+		numSamples = aheadNumSamples;
+		memcpy(outbuf, &aheadPcm[0], numSamples * atracOutputChannels * sizeof(s16));
+	}
+	return true;
+}
+#endif // USE_FFMPEG
+
 u32 sceAtracDecodeData(int atracID, u32 outAddr, u32 numSamplesAddr, u32 finishFlagAddr, u32 remainAddr) {
 	int ret = -1;
 	if (!Memory::IsValidAddress(outAddr)) {
@@ -1034,6 +1156,7 @@ u32 sceAtracResetPlayPosition(int atracID, int sample, int bytesWrittenFirstBuf,
 			sceAtracAddStreamData(atracID, bytesWrittenFirstBuf);
 		atrac->currentSample = sample;
 #ifdef USE_FFMPEG
+		atrac->DiscardDecodeAhead();
 		if ((atrac->codecType == PSP_MODE_AT_3 || atrac->codecType == PSP_MODE_AT_3_PLUS) && atrac->pCodecCtx) {
 			atrac->SeekToSample(sample);
 		} else
@@ -1830,6 +1953,7 @@ int sceAtracLowLevelDecode(int atracID, u32 sourceAddr, u32 sourceBytesConsumedA
 			atrac->first.size += sourcebytes;
 		}
 
+		atrac->DiscardDecodeAhead();
 		int numSamples = 0;
 		int forceseekSample = 0x200000;
 		atrac->SeekToSample(forceseekSample);
@@ -45,6 +45,7 @@
 #include "Core/HLE/HLE.h"
 #include "Core/HLE/FunctionWrappers.h"
 #include "Core/HLE/sceDisplay.h"
+#include "Core/HLE/__sceAudio.h"
 #include "Core/HLE/sceKernel.h"
 #include "Core/HLE/sceKernelThread.h"
 #include "Core/HLE/sceKernelInterrupt.h"
@@ -411,6 +412,10 @@ void __DisplayGetDebugStats(char stats[2048]) {
 	gpu->UpdateStats();
 
 	float vertexAverageCycles = gpuStats.numVertsSubmitted > 0 ? (float)gpuStats.vertexGPUCycles / (float)gpuStats.numVertsSubmitted : 0.0f;
+	int decodedCacheLookups = gpuStats.numDecodedCacheHits + gpuStats.numDecodedCacheMisses;
+	float decodedCacheHitRate = decodedCacheLookups > 0 ? 100.0f * (float)gpuStats.numDecodedCacheHits / (float)decodedCacheLookups : 0.0f;
+	AudioQueueStats audioStats;
+	__AudioGetQueueStats(&audioStats);
 
 	snprintf(stats, 2047,
 		"Frames: %i\n"
@@ -418,11 +423,14 @@ void __DisplayGetDebugStats(char stats[2048]) {
 		"Kernel processing time: %0.2f ms\n"
 		"Slowest syscall: %s : %0.2f ms\n"
 		"Most active syscall: %s : %0.2f ms\n"
-		"Draw calls: %i, flushes %i\n"
+		"Draw calls: %i, flushes %i, avoided %i\n"
+		"Draws per flush: 1:%i 2+:%i 4+:%i 8+:%i 16+:%i 32+:%i 64+:%i 128+:%i\n"
 		"Cached Draw calls: %i\n"
 		"Alpha Tested draws: %i\n"
 		"Non Alpha Tested draws: %i\n"
 		"Num Tracked Vertex Arrays: %i\n"
+		"Decoded vertex cache: %i hits, %i misses (%0.1f%% hit rate)\n"
+		"Vertex bytes decoded: %i KB, reused: %i KB\n"
 		"Cycles executed: %d (%f per vertex)\n"
 		"Commands per call level: %i %i %i %i\n"
 		"Vertices Submitted: %i\n"
@@ -433,7 +441,9 @@ void __DisplayGetDebugStats(char stats[2048]) {
 		"Texture invalidations: %i\n"
 		"Vertex shaders loaded: %i\n"
 		"Fragment shaders loaded: %i\n"
-		"Combined shaders loaded: %i\n",
+		"Combined shaders loaded: %i\n"
+		"Audio queue: %i frames, underruns %i, overruns %i\n"
+		"Audio latency: %0.1f ms target, %0.1f ms measured\n",
 		gpuStats.numVBlanks,
 		gpuStats.msProcessingDisplayLists * 1000.0f,
 		kernelStats.msInSyscalls * 1000.0f,
@@ -443,10 +453,18 @@ void __DisplayGetDebugStats(char stats[2048]) {
 		kernelStats.summedSlowestSyscallTime * 1000.0f,
 		gpuStats.numDrawCalls,
 		gpuStats.numFlushes,
+		gpuStats.numFlushesAvoided,
+		gpuStats.drawsPerFlush[0], gpuStats.drawsPerFlush[1], gpuStats.drawsPerFlush[2], gpuStats.drawsPerFlush[3],
+		gpuStats.drawsPerFlush[4], gpuStats.drawsPerFlush[5], gpuStats.drawsPerFlush[6], gpuStats.drawsPerFlush[7],
 		gpuStats.numCachedDrawCalls,
 		gpuStats.numAlphaTestedDraws,
 		gpuStats.numNonAlphaTestedDraws,
 		gpuStats.numTrackedVertexArrays,
+		gpuStats.numDecodedCacheHits,
+		gpuStats.numDecodedCacheMisses,
+		decodedCacheHitRate,
+		gpuStats.numDecodedBytes / 1024,
+		gpuStats.numDecodedBytesReused / 1024,
 		gpuStats.vertexGPUCycles + gpuStats.otherGPUCycles,
 		vertexAverageCycles,
 		gpuStats.gpuCommandsAtCallLevel[0],gpuStats.gpuCommandsAtCallLevel[1],gpuStats.gpuCommandsAtCallLevel[2],gpuStats.gpuCommandsAtCallLevel[3],
@@ -459,7 +477,12 @@ void __DisplayGetDebugStats(char stats[2048]) {
 		gpuStats.numTextureInvalidations,
 		gpuStats.numVertexShaders,
 		gpuStats.numFragmentShaders,
-		gpuStats.numShaders
+		gpuStats.numShaders,
+		audioStats.queuedFrames,
+		audioStats.underruns,
+		audioStats.overruns,
+		audioStats.targetLatencyMs,
+		audioStats.measuredLatencyMs
 		);
 	stats[2047] = '\0';
 	gpuStats.ResetFrame();
@@ -18,8 +18,6 @@
 #include <cstdlib>
 #include <set>
 
-#include "native/thread/thread.h"
-#include "native/thread/threadutil.h"
 #include "Core/Core.h"
 #include "Core/Config.h"
 #include "Core/Debugger/Breakpoints.h"
@@ -121,11 +119,12 @@ static std::set<SceUID> memStickCallbacks;
 static std::set<SceUID> memStickFatCallbacks;
 static AsyncIOManager ioManager;
 static bool ioManagerThreadEnabled = false;
-static std::thread *ioManagerThread;
 
 // TODO: Is it better to just put all on the thread?
 // Let's try. (was 256)
 const int IO_THREAD_MIN_DATA_SIZE = 0;
+// Enough to overlap reads on a few files, e.g. streamed audio and video alongside data.
+const int IO_THREAD_WORKERS = 3;
 
 #define SCE_STM_FDIR 0x1000
 #define SCE_STM_FREG 0x2000
@@ -424,19 +423,6 @@ static DirectoryFileSystem *flash0System = NULL;
 static VFSFileSystem *flash0System = NULL;
 #endif
 
-void __IoManagerThread() {
-	setCurrentThreadName("IO");
-	while (ioManagerThreadEnabled && coreState != CORE_ERROR && coreState != CORE_POWERDOWN) {
-		ioManager.RunEventsUntil(CoreTiming::GetTicks() + msToCycles(1000));
-	}
-}
-
-void __IoWakeManager() {
-	// Ping the thread so that it knows to check coreState.
-	ioManagerThreadEnabled = false;
-	ioManager.FinishEventLoop();
-}
-
 void __IoInit() {
 	MemoryStick_SetFatState(PSP_FAT_MEMORYSTICK_STATE_ASSIGNED);
 
@@ -460,17 +446,8 @@ void __IoInit() {
 	memset(fds, 0, sizeof(fds));
 
 	ioManagerThreadEnabled = g_Config.bSeparateIOThread;
-	ioManager.SetThreadEnabled(ioManagerThreadEnabled);
-	if (ioManagerThreadEnabled) {
-		Core_ListenShutdown(&__IoWakeManager);
-		ioManagerThread = new std::thread(&__IoManagerThread);
-#ifdef _XBOX
-		SuspendThread(ioManagerThread->native_handle());
-		XSetThreadProcessor(ioManagerThread->native_handle(), 4);
-		ResumeThread(ioManagerThread->native_handle());
-#endif
-		ioManagerThread->detach();
-	}
+	// These mostly sit waiting on the disk, so they don't need to match the core count.
+	ioManager.Init(ioManagerThreadEnabled ? IO_THREAD_WORKERS : 0);
 
 	__KernelRegisterWaitTypeFuncs(WAITTYPE_ASYNCIO, __IoAsyncBeginCallback, __IoAsyncEndCallback);
 }
@@ -490,15 +467,22 @@ void __IoDoState(PointerWrap &p) {
 	p.Do(memStickFatCallbacks);
 }
 
+void __IoSync() {
+	ioManager.SyncThread();
+}
+
 void __IoShutdown() {
 	ioManagerThreadEnabled = false;
 	ioManager.SyncThread();
-	ioManager.FinishEventLoop();
-	if (ioManagerThread != NULL) {
-		delete ioManagerThread;
-		ioManagerThread = NULL;
-		ioManager.Shutdown();
+	ioManager.Shutdown();
+
+#if HOST_IS_CASE_SENSITIVE
+	const FixPathCaseStats caseStats = GetFixPathCaseStats();
+	if (caseStats.lookups != 0) {
+		INFO_LOG(SCEIO, "Path case fixes: %lld lookups, %lld directory scans, %lld scans avoided",
+			(long long)caseStats.lookups, (long long)caseStats.directoryScans, (long long)caseStats.scansAvoided);
 	}
+#endif
 
 	pspFileSystem.Unmount("ms0:", memstickSystem);
 	pspFileSystem.Unmount("fatms0:", memstickSystem);
@@ -742,6 +726,10 @@ bool __IoRead(int &result, int id, u32 data_addr, int size) {
 					ioManager.SyncThread();
 				}
 			}
+			// When the queue is full, it's no slower to just do it now.
+			if (useThread && !ioManager.CanScheduleOperation(f->handle)) {
+				useThread = false;
+			}
 			if (useThread) {
 				AsyncIOEvent ev = IO_EVENT_READ;
 				ev.handle = f->handle;
@@ -868,6 +856,9 @@ bool __IoWrite(int &result, int id, u32 data_addr, int size) {
 				ioManager.SyncThread();
 			}
 		}
+		if (useThread && !ioManager.CanScheduleOperation(f->handle)) {
+			useThread = false;
+		}
 		if (useThread) {
 			AsyncIOEvent ev = IO_EVENT_WRITE;
 			ev.handle = f->handle;
@@ -25,6 +25,9 @@ class KernelObject;
 void __IoInit();
 void __IoDoState(PointerWrap &p);
 void __IoShutdown();
+// Waits for reads and writes still running on the IO worker threads.  Call before unmounting or
+// replacing a mounted file system, since those may read it without the MetaFileSystem lock.
+void __IoSync();
 
 struct ScePspDateTime;
 
@@ -189,6 +189,7 @@ void __KernelShutdown()
 	__InterruptsShutdown();
 	__CheatShutdown();
 	__KernelModuleShutdown();
+	SaveState::Shutdown();
 
 	CoreTiming::ClearPendingEvents();
 	CoreTiming::UnregisterAllEvents();
@@ -333,6 +333,7 @@ int sceMp3Init(u32 mp3) {
 
 	// for mp3, if required freq is 48000, reset resampling Frequency to 48000 seems get better sound quality (e.g. Miku Custom BGM)
 	if (ctx->freq == 48000) {
+		ctx->AuDiscardDecodeAhead();
 		ctx->decoder->SetResampleFrequency(ctx->freq);
 	}
 
@@ -555,6 +556,7 @@ u32 sceMp3LowLevelDecode(u32 mp3, u32 sourceAddr, u32 sourceBytesConsumedAddr, u
 	auto outbuff = Memory::GetPointer(samplesAddr);
 	
 	int outpcmbytes = 0;
+	ctx->AuDiscardDecodeAhead();
 	ctx->decoder->Decode((void*)inbuff, 4096, outbuff, &outpcmbytes);
 	
 	Memory::Write_U32(ctx->decoder->GetSourcePos(), sourceBytesConsumedAddr);
@@ -249,7 +249,11 @@ MpegContext *getMpegCtx(u32 mpegAddr) {
 	if (mpegMap.find(mpeg) == mpegMap.end())
 		return NULL;
 
-	return mpegMap[mpeg];
+	MpegContext *ctx = mpegMap[mpeg];
+	// We poke at the media engine directly in places, so make sure it's not decoding ahead.
+	if (ctx->mediaengine)
+		ctx->mediaengine->waitDecodeAhead();
+	return ctx;
 }
 
 static void InitRingbuffer(SceMpegRingBuffer *buf, int packets, int data, int size, int callback_addr, int callback_args) {
@@ -79,6 +79,7 @@ void __SasDoState(PointerWrap &p) {
 void __SasShutdown() {
 	delete sas;
 	sas = 0;
+	VagDecoder::ClearCache();
 }
 
 
@@ -28,6 +28,7 @@
 #include "Core/HLE/HLE.h"
 #include "Core/HLE/FunctionWrappers.h"
 #include "Core/HLE/sceUmd.h"
+#include "Core/HLE/sceIo.h"
 #include "Core/HLE/sceKernelThread.h"
 #include "Core/HLE/sceKernelInterrupt.h"
 #include "Core/HLE/sceKernelMemory.h"
@@ -460,6 +461,9 @@ u32 sceUmdGetErrorStat()
 }
 
 void __UmdReplace(std::string filepath) {
+	// The old disc gets deleted below, so nothing may still be reading from it.
+	__IoSync();
+
 	// Only get system from disc0 seems have been enough.
 	IFileSystem* currentUMD = pspFileSystem.GetSystem("disc0:");
 	IFileSystem* currentISOBlock = pspFileSystem.GetSystem("umd0:");
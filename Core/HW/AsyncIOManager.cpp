@@ -15,98 +15,220 @@
 // Official git repository and contact information can be found at
 // https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
 
+#include <functional>
+#include <map>
+#include <set>
+
+#include "native/thread/threadutil.h"
 #include "Common/ChunkFile.h"
 #include "Core/Reporting.h"
 #include "Core/System.h"
 #include "Core/HW/AsyncIOManager.h"
 #include "Core/FileSystems/MetaFileSystem.h"
 
-bool AsyncIOManager::HasOperation(u32 handle) {
-	if (resultsPending_.find(handle) != resultsPending_.end()) {
-		return true;
-	}
-	if (results_.find(handle) != results_.end()) {
-		return true;
-	}
-	return false;
+AsyncIOManager::AsyncIOManager() : numWorkers_(0), running_(false), waiters_(0) {
 }
 
-void AsyncIOManager::ScheduleOperation(AsyncIOEvent ev) {
-	{
-		lock_guard guard(resultsLock_);
-		if (!resultsPending_.insert(ev.handle).second) {
-			ERROR_LOG_REPORT(SCEIO, "Scheduling operation for file %d while one is pending (type %d)", ev.handle, ev.type);
-		}
-	}
-	ScheduleEvent(ev);
+AsyncIOManager::~AsyncIOManager() {
+	Shutdown();
 }
 
-void AsyncIOManager::Shutdown() {
-	lock_guard guard(resultsLock_);
-	resultsPending_.clear();
-	results_.clear();
-}
+void AsyncIOManager::Init(int numWorkers) {
+	Shutdown();
 
-bool AsyncIOManager::PopResult(u32 handle, AsyncIOResult &result) {
-	lock_guard guard(resultsLock_);
-	if (results_.find(handle) != results_.end()) {
-		result = results_[handle];
-		results_.erase(handle);
-		resultsPending_.erase(handle);
-		return true;
-	} else {
-		return false;
+	if (numWorkers > MAX_WORKERS) {
+		numWorkers = MAX_WORKERS;
+	}
+	numWorkers_ = numWorkers < 0 ? 0 : numWorkers;
+	running_ = true;
+	for (int i = 0; i < numWorkers_; ++i) {
+		workers_[i].thread = new std::thread(std::bind(&AsyncIOManager::WorkerThread, this, i));
+#ifdef _XBOX
+		SuspendThread(workers_[i].thread->native_handle());
+		XSetThreadProcessor(workers_[i].thread->native_handle(), 4);
+		ResumeThread(workers_[i].thread->native_handle());
+#endif
 	}
 }
 
-bool AsyncIOManager::WaitResult(u32 handle, AsyncIOResult &result) {
-	lock_guard guard(resultsLock_);
-	ScheduleEvent(IO_EVENT_SYNC);
-	while (HasEvents() && ThreadEnabled() && resultsPending_.find(handle) != resultsPending_.end()) {
-		if (PopResult(handle, result)) {
-			return true;
+void AsyncIOManager::Shutdown() {
+	// Workers drain their queues before exiting, so nothing is left half done.
+	running_ = false;
+	for (int i = 0; i < numWorkers_; ++i) {
+		Worker &w = workers_[i];
+		{
+			lock_guard guard(w.lock);
+			w.wait.notify_one();
 		}
-		resultsWait_.wait_for(resultsLock_, 16);
+		w.thread->join();
+		delete w.thread;
+		w.thread = NULL;
 	}
-	if (PopResult(handle, result)) {
-		return true;
+	numWorkers_ = 0;
+
+	for (int i = 0; i < MAX_SLOTS; ++i) {
+		slots_[i].state = SLOT_FREE;
 	}
+}
 
-	return false;
+void AsyncIOManager::WorkerThread(int index) {
+	setCurrentThreadName("IO");
+
+	Worker &w = workers_[index];
+	while (true) {
+		int slot;
+		{
+			lock_guard guard(w.lock);
+			while (w.queue.empty() && running_) {
+				w.wait.wait(w.lock);
+			}
+			if (w.queue.empty()) {
+				break;
+			}
+			slot = w.queue.front();
+			w.queue.pop_front();
+		}
+
+		RunSlot(slot);
+		w.outstanding--;
+	}
 }
 
-void AsyncIOManager::ProcessEvent(AsyncIOEvent ev) {
+void AsyncIOManager::RunSlot(int slot) {
+	Slot &s = slots_[slot];
+	const AsyncIOEvent &ev = s.ev;
 	switch (ev.type) {
 	case IO_EVENT_READ:
-		Read(ev.handle, ev.buf, ev.bytes);
+		s.result = pspFileSystem.ReadFile(ev.handle, ev.buf, ev.bytes);
 		break;
 
 	case IO_EVENT_WRITE:
-		Write(ev.handle, ev.buf, ev.bytes);
+		s.result = pspFileSystem.WriteFile(ev.handle, ev.buf, ev.bytes);
 		break;
 
 	default:
 		ERROR_LOG_REPORT(SCEIO, "Unsupported IO event type");
+		s.result = 0;
+	}
+
+	s.state = SLOT_DONE;
+	if (waiters_ != 0) {
+		lock_guard guard(doneLock_);
+		doneWait_.notify_all();
+	}
+}
+
+int AsyncIOManager::FindSlot(u32 handle) {
+	// Slots only become free on the emu thread, so a stale state here is never SLOT_FREE.
+	for (int i = 0; i < MAX_SLOTS; ++i) {
+		if (slots_[i].state.load(std::memory_order_relaxed) != SLOT_FREE && slots_[i].handle == handle) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int AsyncIOManager::AllocSlot(u32 handle) {
+	for (int i = 0; i < MAX_SLOTS; ++i) {
+		if (slots_[i].state.load(std::memory_order_relaxed) == SLOT_FREE) {
+			slots_[i].handle = handle;
+			return i;
+		}
+	}
+	return -1;
+}
+
+void AsyncIOManager::WaitSlot(int slot) {
+	if (slots_[slot].state == SLOT_DONE) {
+		return;
+	}
+
+	waiters_++;
+	{
+		lock_guard guard(doneLock_);
+		while (slots_[slot].state != SLOT_DONE) {
+			doneWait_.wait(doneLock_);
+		}
+	}
+	waiters_--;
+}
+
+bool AsyncIOManager::HasOperation(u32 handle) {
+	return FindSlot(handle) != -1;
+}
+
+bool AsyncIOManager::CanScheduleOperation(u32 handle) {
+	if (!ThreadEnabled()) {
+		return true;
+	}
+	if (WorkerFor(handle).outstanding >= MAX_QUEUE_DEPTH) {
+		return false;
+	}
+	for (int i = 0; i < MAX_SLOTS; ++i) {
+		if (slots_[i].state.load(std::memory_order_relaxed) == SLOT_FREE) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void AsyncIOManager::ScheduleOperation(AsyncIOEvent ev) {
+	int slot = FindSlot(ev.handle);
+	if (slot != -1) {
+		ERROR_LOG_REPORT(SCEIO, "Scheduling operation for file %d while one is pending (type %d)", ev.handle, ev.type);
+		// Keep the file's operations in order, and drop the old result like before.
+		WaitSlot(slot);
+	} else {
+		slot = AllocSlot(ev.handle);
+		if (slot == -1) {
+			ERROR_LOG_REPORT(SCEIO, "Too many pending IO operations, dropping operation on file %d", ev.handle);
+			return;
+		}
 	}
+
+	Slot &s = slots_[slot];
+	s.ev = ev;
+	s.state = SLOT_QUEUED;
+
+	if (!ThreadEnabled()) {
+		RunSlot(slot);
+		return;
+	}
+
+	Worker &w = WorkerFor(ev.handle);
+	w.outstanding++;
+	lock_guard guard(w.lock);
+	w.queue.push_back(slot);
+	w.wait.notify_one();
 }
 
-void AsyncIOManager::Read(u32 handle, u8 *buf, size_t bytes) {
-	size_t result = pspFileSystem.ReadFile(handle, buf, bytes);
-	EventResult(handle, result);
+void AsyncIOManager::SyncThread() {
+	for (int i = 0; i < MAX_SLOTS; ++i) {
+		if (slots_[i].state.load(std::memory_order_relaxed) == SLOT_QUEUED) {
+			WaitSlot(i);
+		}
+	}
 }
 
-void AsyncIOManager::Write(u32 handle, u8 *buf, size_t bytes) {
-	size_t result = pspFileSystem.WriteFile(handle, buf, bytes);
-	EventResult(handle, result);
+bool AsyncIOManager::PopResult(u32 handle, AsyncIOResult &result) {
+	int slot = FindSlot(handle);
+	if (slot == -1 || slots_[slot].state != SLOT_DONE) {
+		return false;
+	}
+
+	result = slots_[slot].result;
+	slots_[slot].state = SLOT_FREE;
+	return true;
 }
 
-void AsyncIOManager::EventResult(u32 handle, AsyncIOResult result) {
-	lock_guard guard(resultsLock_);
-	if (results_.find(handle) != results_.end()) {
-		ERROR_LOG_REPORT(SCEIO, "Overwriting previous result for file action on handle %d", handle);
+bool AsyncIOManager::WaitResult(u32 handle, AsyncIOResult &result) {
+	int slot = FindSlot(handle);
+	if (slot == -1) {
+		return false;
 	}
-	results_[handle] = result;
-	resultsWait_.notify_one();
+
+	WaitSlot(slot);
+	return PopResult(handle, result);
 }
 
 void AsyncIOManager::DoState(PointerWrap &p) {
@@ -115,7 +237,32 @@ void AsyncIOManager::DoState(PointerWrap &p) {
 		return;
 
 	SyncThread();
-	lock_guard guard(resultsLock_);
-	p.Do(resultsPending_);
-	p.Do(results_);
+
+	// Same layout as when results were kept in a set and a map, once synced everything is done.
+	std::set<u32> resultsPending;
+	std::map<u32, AsyncIOResult> results;
+	for (int i = 0; i < MAX_SLOTS; ++i) {
+		if (slots_[i].state == SLOT_DONE) {
+			resultsPending.insert(slots_[i].handle);
+			results[slots_[i].handle] = slots_[i].result;
+		}
+	}
+
+	p.Do(resultsPending);
+	p.Do(results);
+
+	if (p.mode == p.MODE_READ) {
+		for (int i = 0; i < MAX_SLOTS; ++i) {
+			slots_[i].state = SLOT_FREE;
+		}
+		for (auto it = results.begin(), end = results.end(); it != end; ++it) {
+			int slot = AllocSlot(it->first);
+			if (slot == -1) {
+				ERROR_LOG(SCEIO, "Too many IO results in savestate");
+				break;
+			}
+			slots_[slot].result = it->second;
+			slots_[slot].state = SLOT_DONE;
+		}
+	}
 }
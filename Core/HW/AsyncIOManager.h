@@ -15,18 +15,18 @@
 // Official git repository and contact information can be found at
 // https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
 
-#include <map>
-#include <set>
+#pragma once
+
+#include <atomic>
+#include <deque>
 #include "native/base/mutex.h"
-#include "Core/ThreadEventQueue.h"
+#include "native/thread/thread.h"
+#include "Common/CommonTypes.h"
 
-class NoBase {
-};
+class PointerWrap;
 
 enum AsyncIOEventType {
 	IO_EVENT_INVALID,
-	IO_EVENT_SYNC,
-	IO_EVENT_FINISH,
 	IO_EVENT_READ,
 	IO_EVENT_WRITE,
 };
@@ -37,41 +37,93 @@ struct AsyncIOEvent {
 	u32 handle;
 	u8 *buf;
 	size_t bytes;
-
-	operator AsyncIOEventType() const {
-		return type;
-	}
 };
 
 // TODO: Something better.
 typedef size_t AsyncIOResult;
 
-typedef ThreadEventQueue<NoBase, AsyncIOEvent, AsyncIOEventType, IO_EVENT_INVALID, IO_EVENT_SYNC, IO_EVENT_FINISH> IOThreadEventQueue;
-class AsyncIOManager : public IOThreadEventQueue {
+// Runs file operations on a small pool of worker threads, so that async reads on different
+// files can overlap. Each handle always goes to the same worker, so operations on one file
+// stay in order. Only the emu thread may schedule or collect results.
+class AsyncIOManager {
 public:
+	enum {
+		MAX_WORKERS = 4,
+		// Operations queued or running per worker. Beyond this, callers should do the work directly.
+		MAX_QUEUE_DEPTH = 8,
+		// Results stay around until collected, so this must cover every open fd.
+		MAX_SLOTS = 64,
+	};
+
+	AsyncIOManager();
+	~AsyncIOManager();
+
+	// With zero workers, operations run immediately on the calling thread.
+	void Init(int numWorkers);
+	void Shutdown();
 	void DoState(PointerWrap &p);
 
+	bool ThreadEnabled() const {
+		return numWorkers_ != 0;
+	}
+
 	bool HasOperation(u32 handle);
+	// False if the worker for this handle is saturated, or no result slot is free.
+	bool CanScheduleOperation(u32 handle);
 	void ScheduleOperation(AsyncIOEvent ev);
-	void Shutdown();
+	// Waits for every operation scheduled so far to finish. Results are kept.
+	void SyncThread();
 
 	bool PopResult(u32 handle, AsyncIOResult &result);
 	bool WaitResult(u32 handle, AsyncIOResult &result);
 
-protected:
-	virtual void ProcessEvent(AsyncIOEvent ref);
-	virtual bool ShouldExitEventLoop() {
-		return coreState == CORE_ERROR || coreState == CORE_POWERDOWN;
-	}
-
 private:
-	void Read(u32 handle, u8 *buf, size_t bytes);
-	void Write(u32 handle, u8 *buf, size_t bytes);
+	enum SlotState {
+		SLOT_FREE,
+		SLOT_QUEUED,
+		SLOT_DONE,
+	};
+
+	// The emu thread fills in everything but result, then hands the slot to a worker.
+	// The worker only ever writes result and flips state to SLOT_DONE, so collecting a
+	// finished result needs no lock.
+	struct Slot {
+		u32 handle;
+		AsyncIOEvent ev;
+		AsyncIOResult result;
+		std::atomic<int> state;
+
+		Slot() : handle(0), ev(IO_EVENT_INVALID), result(0), state(SLOT_FREE) {}
+	};
+
+	struct Worker {
+		std::thread *thread;
+		recursive_mutex lock;
+		condition_variable wait;
+		std::deque<int> queue;
+		// Queued plus running, only decremented by the worker itself.
+		std::atomic<int> outstanding;
+
+		Worker() : thread(NULL), outstanding(0) {}
+	};
+
+	void WorkerThread(int index);
+	void RunSlot(int slot);
+
+	int FindSlot(u32 handle);
+	int AllocSlot(u32 handle);
+	void WaitSlot(int slot);
+	Worker &WorkerFor(u32 handle) {
+		return workers_[handle % numWorkers_];
+	}
 
-	void EventResult(u32 handle, AsyncIOResult result);
+	int numWorkers_;
+	std::atomic<bool> running_;
+	Worker workers_[MAX_WORKERS];
+	Slot slots_[MAX_SLOTS];
 
-	recursive_mutex resultsLock_;
-	condition_variable resultsWait_;
-	std::set<u32> resultsPending_;
-	std::map<u32, AsyncIOResult> results_;
-};
\ No newline at end of file
+	// Only used to sleep while waiting on a result, workers skip it when nobody is waiting.
+	std::atomic<int> waiters_;
+	recursive_mutex doneLock_;
+	condition_variable doneWait_;
+};
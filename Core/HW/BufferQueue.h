@@ -124,6 +124,33 @@ struct BufferQueue {
 		return bytesgot;
 	}
 
+	// Puts data back in front of what's queued, like it was never popped.
+	bool push_front(const unsigned char *buf, int addsize) {
+		// Leave a byte free, a full queue would look empty.
+		if (addsize < 0 || addsize >= getRemainSize())
+			return false;
+		int newStart = start - addsize;
+		if (newStart < 0)
+			newStart += bufQueueSize;
+		if (newStart + addsize <= bufQueueSize) {
+			memcpy(bufQueue + newStart, buf, addsize);
+		} else {
+			int firstSize = bufQueueSize - newStart;
+			memcpy(bufQueue + newStart, buf, firstSize);
+			memcpy(bufQueue, buf + firstSize, addsize - firstSize);
+		}
+		start = newStart;
+		return true;
+	}
+
+	// Lets the caller look at the front of the queue in place, if wantedsize bytes are queued and
+	// don't wrap around.  Only valid until the next push.
+	const unsigned char *peek_front(int wantedsize) {
+		if (wantedsize <= 0 || wantedsize > getQueueSize() || start + wantedsize > bufQueueSize)
+			return NULL;
+		return bufQueue + start;
+	}
+
 	void DoState(PointerWrap &p) {
 		auto s = p.Section("BufferQueue", 0, 1);
 
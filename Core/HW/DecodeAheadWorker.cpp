@@ -0,0 +1,76 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+#include "native/thread/threadutil.h"
+#include "Core/HW/DecodeAheadWorker.h"
+
+DecodeAheadWorker::DecodeAheadWorker() : busy_(false), running_(true) {
+	thread_ = new std::thread(std::bind(&DecodeAheadWorker::WorkerThread, this));
+}
+
+DecodeAheadWorker::~DecodeAheadWorker() {
+	{
+		lock_guard guard(lock_);
+		while (busy_) {
+			done_.wait(lock_);
+		}
+		running_ = false;
+		wake_.notify_one();
+	}
+	thread_->join();
+	delete thread_;
+}
+
+void DecodeAheadWorker::Start(const std::function<void()> &job) {
+	lock_guard guard(lock_);
+	while (busy_) {
+		done_.wait(lock_);
+	}
+	job_ = job;
+	busy_ = true;
+	wake_.notify_one();
+}
+
+void DecodeAheadWorker::Wait() {
+	lock_guard guard(lock_);
+	while (busy_) {
+		done_.wait(lock_);
+	}
+}
+
+void DecodeAheadWorker::WorkerThread() {
+	setCurrentThreadName("DecodeAhead");
+
+	lock_guard guard(lock_);
+	while (true) {
+		while (!busy_ && running_) {
+			wake_.wait(lock_);
+		}
+		if (!busy_) {
+			break;
+		}
+
+		std::function<void()> job = job_;
+		lock_.unlock();
+		job();
+		lock_.lock();
+
+		job_ = std::function<void()>();
+		busy_ = false;
+		done_.notify_one();
+	}
+}
@@ -0,0 +1,48 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+#pragma once
+
+#include <functional>
+
+#include "native/base/mutex.h"
+#include "native/thread/thread.h"
+
+// Runs one job at a time on a thread of its own, so an audio or video stream can decode its next frame
+// while the game gets on with other things.  Only the emu thread may start or wait for jobs,
+// and it must not touch anything the job uses until Wait() has returned.
+class DecodeAheadWorker {
+public:
+	DecodeAheadWorker();
+	~DecodeAheadWorker();
+
+	// Waits for the previous job first, so there's never more than one in flight.
+	void Start(const std::function<void()> &job);
+	void Wait();
+
+private:
+	void WorkerThread();
+
+	std::thread *thread_;
+	recursive_mutex lock_;
+	condition_variable wake_;
+	condition_variable done_;
+	std::function<void()> job_;
+	// Both protected by lock_.
+	bool busy_;
+	bool running_;
+};
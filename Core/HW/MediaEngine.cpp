@@ -17,6 +17,7 @@
 
 #include "Core/Config.h"
 #include "Core/Debugger/Breakpoints.h"
+#include "Core/HW/DecodeAheadWorker.h"
 #include "Core/HW/MediaEngine.h"
 #include "Core/MemMap.h"
 #include "Core/MIPS/MIPS.h"
@@ -25,6 +26,11 @@
 #include "Core/HW/SimpleAudioDec.h"
 
 #include <algorithm>
+#include <functional>
+
+#ifdef _M_SSE
+#include <emmintrin.h>
+#endif
 
 #ifdef USE_FFMPEG
 
@@ -39,25 +45,11 @@ extern "C" {
 
 int g_iNumVideos = 0;
 
-#ifdef USE_FFMPEG
-static AVPixelFormat getSwsFormat(int pspFormat)
-{
-	switch (pspFormat)
-	{
-	case GE_CMODE_16BIT_BGR5650:
-		return AV_PIX_FMT_BGR565LE;
-	case GE_CMODE_16BIT_ABGR5551:
-		return AV_PIX_FMT_BGR555LE;
-	case GE_CMODE_16BIT_ABGR4444:
-		return AV_PIX_FMT_BGR444LE;
-	case GE_CMODE_32BIT_ABGR8888:
-		return AV_PIX_FMT_RGBA;
-	default:
-		ERROR_LOG(ME, "Unknown pixel format");
-		return (AVPixelFormat)0;
-	}
-}
+// Don't decode ahead unless there's at least this much queued, or twice the biggest frame so far.
+// Running dry while decoding ahead can't be undone, so be conservative.
+static const int VIDEO_AHEAD_MIN_QUEUED = 0x10000;
 
+#ifdef USE_FFMPEG
 void ffmpeg_logger(void *, int level, const char *format, va_list va_args) {
 	// We're still called even if the level doesn't match.
 	if (level > av_log_get_level())
@@ -98,23 +90,6 @@ bool InitFFmpeg() {
 }
 #endif
 
-static int getPixelFormatBytes(int pspFormat)
-{
-	switch (pspFormat)
-	{
-	case GE_CMODE_16BIT_BGR5650:
-	case GE_CMODE_16BIT_ABGR5551:
-	case GE_CMODE_16BIT_ABGR4444:
-		return 2;
-	case GE_CMODE_32BIT_ABGR8888:
-		return 4;
-
-	default:
-		ERROR_LOG(ME, "Unknown pixel format");
-		return 4;
-	}
-}
-
 void __AdjustBGMVolume(s16 *samples, u32 count) {
 	if (g_Config.iBGMVolume < 0 || g_Config.iBGMVolume >= MAX_CONFIG_VOLUME) {
 		return;
@@ -158,14 +133,32 @@ MediaEngine::MediaEngine(): m_pdata(0) {
 	m_ringbuffersize = 0;
 	m_mpegheaderReadPos = 0;
 	m_audioType = PSP_CODEC_AT3PLUS; // in movie, we use only AT3+ audio
+
+	m_readBytes = 0;
+	m_shownReadBytes = 0;
+	m_lastReadSize = 0;
+	m_readingAhead = false;
+	m_decodeAhead = 0;
+	for (int i = 0; i < VIDEO_AHEAD_FRAMES; ++i)
+		m_aheadFrames[i].buffer = 0;
+	m_aheadCount = 0;
+	m_aheadStarved = false;
+	m_maxFrameBytes = 0;
+	m_frameReadStart = 0;
 	g_iNumVideos++;
 }
 
 MediaEngine::~MediaEngine() {
 	closeMedia();
+	delete m_decodeAhead;
 	g_iNumVideos--;
 }
 
+void MediaEngine::waitDecodeAhead() {
+	if (m_decodeAhead)
+		m_decodeAhead->Wait();
+}
+
 void MediaEngine::closeMedia() {
 	closeContext();
 	if (m_pdata)
@@ -183,6 +176,13 @@ void MediaEngine::DoState(PointerWrap &p){
 	if (!s)
 		return;
 
+	// Frames decoded ahead aren't saved, but the data they were decoded from is, below.
+	waitDecodeAhead();
+	if (p.mode == p.MODE_READ) {
+		discardDecodeAhead();
+		m_aheadData.clear();
+	}
+
 	p.Do(m_videoStream);
 	p.Do(m_audioStream);
 
@@ -202,8 +202,16 @@ void MediaEngine::DoState(PointerWrap &p){
 	p.Do(hasopencontext);
 	if (hasopencontext && p.mode == p.MODE_READ)
 		openContext();
-	if (m_pdata)
+	if (m_pdata) {
+		// The game hasn't seen the frames decoded ahead yet, so save their data as still queued.
+		const int aheadBytes = p.mode != p.MODE_READ ? (int)m_aheadData.size() : 0;
+		bool putBack = aheadBytes > 0 && m_pdata->push_front(&m_aheadData[0], aheadBytes);
+		if (aheadBytes > 0 && !putBack)
+			WARN_LOG_REPORT(ME, "No room to save %d bytes of video decoded ahead", aheadBytes);
 		m_pdata->DoState(p);
+		if (putBack)
+			m_pdata->pop_front(NULL, aheadBytes);
+	}
 	if (m_demux)
 		m_demux->DoState(p);
 
@@ -239,8 +247,12 @@ int _MpegReadbuffer(void *opaque, uint8_t *buf, int buf_size)
 		return 0;
 	} else {
 		size = mpeg->m_pdata->pop_front(buf, buf_size);
-		if (size > 0)
-			mpeg->m_decodingsize = size;
+		if (size > 0) {
+			mpeg->m_lastReadSize = size;
+			mpeg->m_readBytes += size;
+			if (mpeg->m_readingAhead)
+				mpeg->m_aheadData.insert(mpeg->m_aheadData.end(), buf, buf + size);
+		}
 	}
 	return size;
 }
@@ -248,11 +260,13 @@ int _MpegReadbuffer(void *opaque, uint8_t *buf, int buf_size)
 bool MediaEngine::openContext() {
 #ifdef USE_FFMPEG
 	InitFFmpeg();
+	waitDecodeAhead();
 
 	if (m_pFormatCtx || !m_pdata)
 		return false;
 	m_mpegheaderReadPos = 0;
 	m_decodingsize = 0;
+	m_lastReadSize = 0;
 
 	u8* tempbuf = (u8*)av_malloc(m_bufSize);
 
@@ -294,13 +308,25 @@ bool MediaEngine::openContext() {
 	m_isVideoEnd = false;
 	m_mpegheaderReadPos++;
 	av_seek_frame(m_pFormatCtx, m_videoStream, 0, 0);
+	m_decodingsize = m_lastReadSize;
+	m_shownReadBytes = m_readBytes;
+	m_aheadData.clear();
 #endif // USE_FFMPEG
 	return true;
 }
 
 void MediaEngine::closeContext()
 {
+	waitDecodeAhead();
+	m_aheadCount = 0;
+	m_aheadStarved = false;
+	m_aheadData.clear();
 #ifdef USE_FFMPEG
+	for (int i = 0; i < VIDEO_AHEAD_FRAMES; ++i) {
+		if (m_aheadFrames[i].buffer)
+			av_free(m_aheadFrames[i].buffer);
+		m_aheadFrames[i].buffer = 0;
+	}
 	if (m_buffer)
 		av_free(m_buffer);
 	if (m_pFrameRGB)
@@ -329,6 +355,11 @@ bool MediaEngine::loadStream(const u8 *buffer, int readSize, int RingbufferSize)
 
 	m_videopts = 0;
 	m_audiopts = 0;
+	m_readBytes = 0;
+	m_shownReadBytes = 0;
+	m_aheadData.clear();
+	m_maxFrameBytes = 0;
+	m_frameReadStart = 0;
 	m_ringbuffersize = RingbufferSize;
 	m_pdata = new BufferQueue(RingbufferSize + 2048);
 	m_pdata->push(buffer, readSize);
@@ -341,6 +372,7 @@ bool MediaEngine::loadStream(const u8 *buffer, int readSize, int RingbufferSize)
 }
 
 int MediaEngine::addStreamData(const u8 *buffer, int addSize) {
+	waitDecodeAhead();
 	int size = addSize;
 	if (size > 0 && m_pdata) {
 		if (!m_pdata->push(buffer, size)) 
@@ -359,6 +391,7 @@ int MediaEngine::addStreamData(const u8 *buffer, int addSize) {
 
 		// We added data, so... not the end anymore?
 		m_isVideoEnd = false;
+		m_aheadStarved = false;
 	}
 	return size;
 }
@@ -399,6 +432,8 @@ bool MediaEngine::setVideoStream(int streamNum, bool force) {
 		// Yay, nothing to do.
 		return true;
 	}
+	// Anything decoded ahead was from the old stream.
+	discardDecodeAhead();
 
 #ifdef USE_FFMPEG
 	if (m_pFormatCtx && m_pCodecCtxs.find(streamNum) == m_pCodecCtxs.end()) {
@@ -430,6 +465,8 @@ bool MediaEngine::setVideoStream(int streamNum, bool force) {
 bool MediaEngine::setVideoDim(int width, int height)
 {
 #ifdef USE_FFMPEG
+	discardDecodeAhead();
+
 	auto codecIter = m_pCodecCtxs.find(m_videoStream);
 	if (codecIter == m_pCodecCtxs.end())
 		return false;
@@ -450,10 +487,23 @@ bool MediaEngine::setVideoDim(int width, int height)
 	// Allocate video frame
 	m_pFrame = av_frame_alloc();
 
-	sws_freeContext(m_sws_ctx);
-	m_sws_ctx = NULL;
-	m_sws_fmt = -1;
-	updateSwsFormat(GE_CMODE_32BIT_ABGR8888);
+	// We always convert to RGBA and pack down to the game's format when writing it out, so frames
+	// can be decoded ahead without knowing what format they'll be wanted in.
+	m_sws_fmt = AV_PIX_FMT_RGBA;
+	m_sws_ctx = sws_getCachedContext
+		(
+			m_sws_ctx,
+			m_pCodecCtx->width,
+			m_pCodecCtx->height,
+			m_pCodecCtx->pix_fmt,
+			m_desWidth,
+			m_desHeight,
+			(AVPixelFormat)m_sws_fmt,
+			SWS_BILINEAR,
+			NULL,
+			NULL,
+			NULL
+		);
 
 	// Allocate video frame for RGB24
 	m_pFrameRGB = av_frame_alloc();
@@ -462,52 +512,22 @@ bool MediaEngine::setVideoDim(int width, int height)
 
 	// Assign appropriate parts of buffer to image planes in m_pFrameRGB
 	avpicture_fill((AVPicture *)m_pFrameRGB, m_buffer, (AVPixelFormat)m_sws_fmt, m_desWidth, m_desHeight);
-#endif // USE_FFMPEG
-	return true;
-}
-
-void MediaEngine::updateSwsFormat(int videoPixelMode) {
-#ifdef USE_FFMPEG
-	auto codecIter = m_pCodecCtxs.find(m_videoStream);
-	AVCodecContext *m_pCodecCtx = codecIter == m_pCodecCtxs.end() ? 0 : codecIter->second;
 
-	AVPixelFormat swsDesired = getSwsFormat(videoPixelMode);
-	if (swsDesired != m_sws_fmt && m_pCodecCtx != 0) {
-		m_sws_fmt = swsDesired;
-		m_sws_ctx = sws_getCachedContext
-			(
-				m_sws_ctx,
-				m_pCodecCtx->width,
-				m_pCodecCtx->height,
-				m_pCodecCtx->pix_fmt,
-				m_desWidth,
-				m_desHeight,
-				(AVPixelFormat)m_sws_fmt,
-				SWS_BILINEAR,
-				NULL,
-				NULL,
-				NULL
-			);
+	for (int i = 0; i < VIDEO_AHEAD_FRAMES; ++i) {
+		if (m_aheadFrames[i].buffer)
+			av_free(m_aheadFrames[i].buffer);
+		m_aheadFrames[i].buffer = (u8*)av_malloc(numBytes * sizeof(uint8_t));
 	}
-#endif
+#endif // USE_FFMPEG
+	return true;
 }
 
-bool MediaEngine::stepVideo(int videoPixelMode, bool skipFrame) {
+// Decodes the next video frame into dest as RGBA, or just skips past it if dest is NULL.
+// When decoding ahead, we stop instead of draining the decoder if the data runs out.
+bool MediaEngine::decodeFrame(u8 *dest, s64 &pts, bool ahead, bool &reachedEnd) {
+	reachedEnd = false;
 #ifdef USE_FFMPEG
-	auto codecIter = m_pCodecCtxs.find(m_videoStream);
-	AVCodecContext *m_pCodecCtx = codecIter == m_pCodecCtxs.end() ? 0 : codecIter->second;
-
-	if (!m_pFormatCtx)
-		return false;
-	if (!m_pCodecCtx)
-		return false;
-	if ((!m_pFrame)||(!m_pFrameRGB))
-		return false;
-
-	updateSwsFormat(videoPixelMode);
-	// TODO: Technically we could set this to frameWidth instead of m_desWidth for better perf.
-	// Update the linesize for the new format too.  We started with the largest size, so it should fit.
-	m_pFrameRGB->linesize[0] = getPixelFormatBytes(videoPixelMode) * m_desWidth;
+	AVCodecContext *m_pCodecCtx = m_pCodecCtxs[m_videoStream];
 
 	AVPacket packet;
 	av_init_packet(&packet);
@@ -515,6 +535,10 @@ bool MediaEngine::stepVideo(int videoPixelMode, bool skipFrame) {
 	bool bGetFrame = false;
 	while (!bGetFrame) {
 		bool dataEnd = av_read_frame(m_pFormatCtx, &packet) < 0;
+		if (dataEnd && ahead) {
+			av_free_packet(&packet);
+			break;
+		}
 		// Even if we've read all frames, some may have been re-ordered frames at the end.
 		// Still need to decode those, so keep calling avcodec_decode_video2().
 		if (dataEnd || packet.stream_index == m_videoStream) {
@@ -524,29 +548,73 @@ bool MediaEngine::stepVideo(int videoPixelMode, bool skipFrame) {
 
 			int result = avcodec_decode_video2(m_pCodecCtx, m_pFrame, &frameFinished, &packet);
 			if (frameFinished) {
-				if (!skipFrame) {
+				if (dest) {
+					u8 *destData[4] = { dest, 0, 0, 0 };
+					int destLinesize[4] = { m_desWidth * (int)sizeof(u32), 0, 0, 0 };
 					sws_scale(m_sws_ctx, m_pFrame->data, m_pFrame->linesize, 0,
-						m_pCodecCtx->height, m_pFrameRGB->data, m_pFrameRGB->linesize);
+						m_pCodecCtx->height, destData, destLinesize);
 				}
 
 				if (av_frame_get_best_effort_timestamp(m_pFrame) != AV_NOPTS_VALUE)
-					m_videopts = av_frame_get_best_effort_timestamp(m_pFrame) + av_frame_get_pkt_duration(m_pFrame) - m_firstTimeStamp;
+					pts = av_frame_get_best_effort_timestamp(m_pFrame) + av_frame_get_pkt_duration(m_pFrame) - m_firstTimeStamp;
 				else
-					m_videopts += av_frame_get_pkt_duration(m_pFrame);
+					pts += av_frame_get_pkt_duration(m_pFrame);
+
+				m_maxFrameBytes = std::max(m_maxFrameBytes, (int)(m_readBytes - m_frameReadStart));
+				m_frameReadStart = m_readBytes;
 				bGetFrame = true;
 			}
 			if (result <= 0 && dataEnd) {
-				// Sometimes, m_readSize is less than m_streamSize at the end, but not by much.
-				// This is kinda a hack, but the ringbuffer would have to be prematurely empty too.
-				m_isVideoEnd = !bGetFrame && (m_pdata->getQueueSize() == 0);
-				if (m_isVideoEnd)
-					m_decodingsize = 0;
+				reachedEnd = true;
 				break;
 			}
 		}
 		av_free_packet(&packet);
 	}
 	return bGetFrame;
+#else
+	return false;
+#endif // USE_FFMPEG
+}
+
+bool MediaEngine::stepVideo(int videoPixelMode, bool skipFrame) {
+#ifdef USE_FFMPEG
+	waitDecodeAhead();
+
+	auto codecIter = m_pCodecCtxs.find(m_videoStream);
+	AVCodecContext *m_pCodecCtx = codecIter == m_pCodecCtxs.end() ? 0 : codecIter->second;
+
+	if (!m_pFormatCtx)
+		return false;
+	if (!m_pCodecCtx)
+		return false;
+	if ((!m_pFrame)||(!m_pFrameRGB))
+		return false;
+
+	if (m_aheadCount > 0) {
+		takeDecodedAhead(skipFrame);
+		startDecodeAhead();
+		return true;
+	}
+
+	bool reachedEnd;
+	bool bGetFrame = decodeFrame(skipFrame ? NULL : m_buffer, m_videopts, false, reachedEnd);
+	m_decodingsize = m_lastReadSize;
+	m_shownReadBytes = m_readBytes;
+	m_aheadData.clear();
+	if (reachedEnd) {
+		// Sometimes, m_readSize is less than m_streamSize at the end, but not by much.
+		// This is kinda a hack, but the ringbuffer would have to be prematurely empty too.
+		m_isVideoEnd = !bGetFrame && (m_pdata->getQueueSize() == 0);
+		if (m_isVideoEnd) {
+			m_decodingsize = 0;
+			m_lastReadSize = 0;
+		}
+	}
+
+	if (bGetFrame)
+		startDecodeAhead();
+	return bGetFrame;
 #else
 	// If video engine is not available, just add to the timestamp at least.
 	m_videopts += 3003;
@@ -554,43 +622,143 @@ bool MediaEngine::stepVideo(int videoPixelMode, bool skipFrame) {
 #endif // USE_FFMPEG
 }
 
+// While the game is busy with the frame it just got, decode the next couple on a worker.  Only
+// the pts and how much of the ringbuffer was used are visible to the game, and those are kept
+// as they would've been until it actually asks for the frames, see takeDecodedAhead().
+void MediaEngine::startDecodeAhead() {
+#ifdef USE_FFMPEG
+	if (!g_Config.bVideoDecodeAhead || m_aheadStarved || m_aheadCount >= VIDEO_AHEAD_FRAMES || !m_aheadFrames[0].buffer)
+		return;
+	if (m_pdata->getQueueSize() < std::max(VIDEO_AHEAD_MIN_QUEUED, m_maxFrameBytes * 2))
+		return;
+
+	if (!m_decodeAhead)
+		m_decodeAhead = new DecodeAheadWorker();
+	m_decodeAhead->Start(std::bind(&MediaEngine::decodeAheadJob, this));
+#endif
+}
+
+void MediaEngine::decodeAheadJob() {
+	m_readingAhead = true;
+	s64 pts = m_aheadCount > 0 ? m_aheadFrames[m_aheadCount - 1].pts : m_videopts;
+	while (m_aheadCount < VIDEO_AHEAD_FRAMES) {
+		if (m_pdata->getQueueSize() < std::max(VIDEO_AHEAD_MIN_QUEUED, m_maxFrameBytes * 2))
+			break;
+
+		AheadFrame &frame = m_aheadFrames[m_aheadCount];
+		bool reachedEnd;
+		if (!decodeFrame(frame.buffer, pts, true, reachedEnd)) {
+			m_aheadStarved = true;
+			break;
+		}
+		frame.pts = pts;
+		frame.readBytes = m_readBytes;
+		frame.readSize = m_lastReadSize;
+		++m_aheadCount;
+	}
+	m_readingAhead = false;
+}
+
+void MediaEngine::takeDecodedAhead(bool skipFrame) {
+	AheadFrame frame = m_aheadFrames[0];
+	for (int i = 1; i < m_aheadCount; ++i)
+		m_aheadFrames[i - 1] = m_aheadFrames[i];
+	--m_aheadCount;
+
+	if (!skipFrame) {
+		std::swap(m_buffer, frame.buffer);
+#ifdef USE_FFMPEG
+		m_pFrameRGB->data[0] = m_buffer;
+#endif
+	}
+	// The game has now seen this frame's data go.
+	const size_t shownBytes = (size_t)(frame.readBytes - m_shownReadBytes);
+	m_aheadData.erase(m_aheadData.begin(), m_aheadData.begin() + std::min(shownBytes, m_aheadData.size()));
+	m_videopts = frame.pts;
+	m_decodingsize = frame.readSize;
+	m_shownReadBytes = frame.readBytes;
+
+	// Keep the spare buffer for the next frame.
+	m_aheadFrames[m_aheadCount] = frame;
+}
+
+// Frames decoded ahead are already gone from the stream, so this acts like they were skipped.
+void MediaEngine::discardDecodeAhead() {
+	waitDecodeAhead();
+	while (m_aheadCount > 0)
+		takeDecodedAhead(true);
+}
+
 // Helpers that null out alpha (which seems to be the case on the PSP.)
 // Some games depend on this, for example Sword Art Online (doesn't clear A's from buffer.)
+// The source is always RGBA, for the 16-bit formats we just drop the low bits of each channel.
 inline void writeVideoLineRGBA(void *destp, const void *srcp, int width) {
-	// TODO: Use SSE/NEON, investigate why AV_PIX_FMT_RGB0 does not work.
+	// TODO: Investigate why AV_PIX_FMT_RGB0 does not work.
 	u32_le *dest = (u32_le *)destp;
 	const u32_le *src = (u32_le *)srcp;
 
 	u32 mask = 0x00FFFFFF;
-	for (int i = 0; i < width; ++i) {
+	int i = 0;
+#ifdef _M_SSE
+	const __m128i maskx4 = _mm_set1_epi32(mask);
+	for (; i + 4 <= width; i += 4) {
+		__m128i pixels = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dest + i), _mm_and_si128(pixels, maskx4));
+	}
+#endif
+	for (; i < width; ++i) {
 		dest[i] = src[i] & mask;
 	}
 }
 
-inline void writeVideoLineABGR5650(void *destp, const void *srcp, int width) {
-	memcpy(destp, srcp, width * sizeof(u16));
+#ifdef _M_SSE
+// Narrows two registers of 32-bit values that fit in 16 bits.  packs saturates, so sign extend
+// the low halves first to get them through unchanged.
+inline __m128i PackLow16(__m128i lo, __m128i hi) {
+	lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+	hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+	return _mm_packs_epi32(lo, hi);
 }
+#endif
 
-inline void writeVideoLineABGR5551(void *destp, const void *srcp, int width) {
-	// TODO: Use SSE/NEON.
+// Each channel's top bits just need shifting down into place and masking.  R is the low byte of
+// the source, and also ends up in the low bits.
+template <int shiftR, u32 maskR, int shiftG, u32 maskG, int shiftB, u32 maskB>
+inline void writeVideoLine16(void *destp, const void *srcp, int width) {
 	u16_le *dest = (u16_le *)destp;
-	const u16_le *src = (u16_le *)srcp;
-
-	u16 mask = 0x7FFF;
-	for (int i = 0; i < width; ++i) {
-		dest[i] = src[i] & mask;
+	const u32_le *src = (const u32_le *)srcp;
+
+	int i = 0;
+#ifdef _M_SSE
+	const __m128i r = _mm_set1_epi32(maskR);
+	const __m128i g = _mm_set1_epi32(maskG);
+	const __m128i b = _mm_set1_epi32(maskB);
+	for (; i + 8 <= width; i += 8) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(src + i + 4));
+		lo = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(lo, shiftR), r),
+			_mm_and_si128(_mm_srli_epi32(lo, shiftG), g)), _mm_and_si128(_mm_srli_epi32(lo, shiftB), b));
+		hi = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(hi, shiftR), r),
+			_mm_and_si128(_mm_srli_epi32(hi, shiftG), g)), _mm_and_si128(_mm_srli_epi32(hi, shiftB), b));
+		_mm_storeu_si128((__m128i *)(dest + i), PackLow16(lo, hi));
+	}
+#endif
+	for (; i < width; ++i) {
+		u32 c = src[i];
+		dest[i] = ((c >> shiftR) & maskR) | ((c >> shiftG) & maskG) | ((c >> shiftB) & maskB);
 	}
 }
 
-inline void writeVideoLineABGR4444(void *destp, const void *srcp, int width) {
-	// TODO: Use SSE/NEON.
-	u16_le *dest = (u16_le *)destp;
-	const u16_le *src = (u16_le *)srcp;
+inline void writeVideoLineABGR5650(void *destp, const void *srcp, int width) {
+	writeVideoLine16<3, 0x001F, 5, 0x07E0, 8, 0xF800>(destp, srcp, width);
+}
 
-	u16 mask = 0x0FFF;
-	for (int i = 0; i < width; ++i) {
-		dest[i] = src[i] & mask;
-	}
+inline void writeVideoLineABGR5551(void *destp, const void *srcp, int width) {
+	writeVideoLine16<3, 0x001F, 6, 0x03E0, 9, 0x7C00>(destp, srcp, width);
+}
+
+inline void writeVideoLineABGR4444(void *destp, const void *srcp, int width) {
+	writeVideoLine16<4, 0x000F, 8, 0x00F0, 12, 0x0F00>(destp, srcp, width);
 }
 
 int MediaEngine::writeVideoImage(u32 bufferPtr, int frameWidth, int videoPixelMode) {
@@ -603,6 +771,7 @@ int MediaEngine::writeVideoImage(u32 bufferPtr, int frameWidth, int videoPixelMo
 	u8 *buffer = Memory::GetPointer(bufferPtr);
 
 #ifdef USE_FFMPEG
+	waitDecodeAhead();
 	if ((!m_pFrame)||(!m_pFrameRGB))
 		return false;
 	int videoImageSize = 0;
@@ -625,7 +794,7 @@ int MediaEngine::writeVideoImage(u32 bufferPtr, int frameWidth, int videoPixelMo
 	case GE_CMODE_16BIT_BGR5650:
 		for (int y = 0; y < height; y++) {
 			writeVideoLineABGR5650(imgbuf, data, width);
-			data += width * sizeof(u16);
+			data += width * sizeof(u32);
 			imgbuf += frameWidth * sizeof(u16);
 		}
 		videoImageSize = frameWidth * sizeof(u16) * height;
@@ -634,7 +803,7 @@ int MediaEngine::writeVideoImage(u32 bufferPtr, int frameWidth, int videoPixelMo
 	case GE_CMODE_16BIT_ABGR5551:
 		for (int y = 0; y < height; y++) {
 			writeVideoLineABGR5551(imgbuf, data, width);
-			data += width * sizeof(u16);
+			data += width * sizeof(u32);
 			imgbuf += frameWidth * sizeof(u16);
 		}
 		videoImageSize = frameWidth * sizeof(u16) * height;
@@ -643,7 +812,7 @@ int MediaEngine::writeVideoImage(u32 bufferPtr, int frameWidth, int videoPixelMo
 	case GE_CMODE_16BIT_ABGR4444:
 		for (int y = 0; y < height; y++) {
 			writeVideoLineABGR4444(imgbuf, data, width);
-			data += width * sizeof(u16);
+			data += width * sizeof(u32);
 			imgbuf += frameWidth * sizeof(u16);
 		}
 		videoImageSize = frameWidth * sizeof(u16) * height;
@@ -673,6 +842,7 @@ int MediaEngine::writeVideoImageWithRange(u32 bufferPtr, int frameWidth, int vid
 	u8 *buffer = Memory::GetPointer(bufferPtr);
 
 #ifdef USE_FFMPEG
+	waitDecodeAhead();
 	if ((!m_pFrame)||(!m_pFrameRGB))
 		return false;
 	int videoImageSize = 0;
@@ -700,10 +870,10 @@ int MediaEngine::writeVideoImageWithRange(u32 bufferPtr, int frameWidth, int vid
 		break;
 
 	case GE_CMODE_16BIT_BGR5650:
-		data += (ypos * m_desWidth + xpos) * sizeof(u16);
+		data += (ypos * m_desWidth + xpos) * sizeof(u32);
 		for (int y = 0; y < height; y++) {
 			writeVideoLineABGR5650(imgbuf, data, width);
-			data += m_desWidth * sizeof(u16);
+			data += m_desWidth * sizeof(u32);
 			imgbuf += frameWidth * sizeof(u16);
 #ifndef MOBILE_DEVICE
 			CBreakPoints::ExecMemCheck(bufferPtr + y * frameWidth * sizeof(u16), true, width * sizeof(u16), currentMIPS->pc);
@@ -713,10 +883,10 @@ int MediaEngine::writeVideoImageWithRange(u32 bufferPtr, int frameWidth, int vid
 		break;
 
 	case GE_CMODE_16BIT_ABGR5551:
-		data += (ypos * m_desWidth + xpos) * sizeof(u16);
+		data += (ypos * m_desWidth + xpos) * sizeof(u32);
 		for (int y = 0; y < height; y++) {
 			writeVideoLineABGR5551(imgbuf, data, width);
-			data += m_desWidth * sizeof(u16);
+			data += m_desWidth * sizeof(u32);
 			imgbuf += frameWidth * sizeof(u16);
 #ifndef MOBILE_DEVICE
 			CBreakPoints::ExecMemCheck(bufferPtr + y * frameWidth * sizeof(u16), true, width * sizeof(u16), currentMIPS->pc);
@@ -726,10 +896,10 @@ int MediaEngine::writeVideoImageWithRange(u32 bufferPtr, int frameWidth, int vid
 		break;
 
 	case GE_CMODE_16BIT_ABGR4444:
-		data += (ypos * m_desWidth + xpos) * sizeof(u16);
+		data += (ypos * m_desWidth + xpos) * sizeof(u32);
 		for (int y = 0; y < height; y++) {
 			writeVideoLineABGR4444(imgbuf, data, width);
-			data += m_desWidth * sizeof(u16);
+			data += m_desWidth * sizeof(u32);
 			imgbuf += frameWidth * sizeof(u16);
 #ifndef MOBILE_DEVICE
 			CBreakPoints::ExecMemCheck(bufferPtr + y * frameWidth * sizeof(u16), true, width * sizeof(u16), currentMIPS->pc);
@@ -749,6 +919,7 @@ int MediaEngine::writeVideoImageWithRange(u32 bufferPtr, int frameWidth, int vid
 
 u8 *MediaEngine::getFrameImage() {
 #ifdef USE_FFMPEG
+	waitDecodeAhead();
 	return m_pFrameRGB->data[0];
 #else
 	return NULL;
@@ -756,9 +927,12 @@ u8 *MediaEngine::getFrameImage() {
 }
 
 int MediaEngine::getRemainSize() {
+	waitDecodeAhead();
 	if (!m_pdata)
 		return 0;
-	return std::max(m_pdata->getRemainSize() - m_decodingsize - 2048, 0);
+	// Don't count space freed up by frames the game hasn't asked for yet.
+	const int aheadBytes = (int)(m_readBytes - m_shownReadBytes);
+	return std::max(m_pdata->getRemainSize() - m_decodingsize - aheadBytes - 2048, 0);
 }
 
 int MediaEngine::getAudioRemainSize() {
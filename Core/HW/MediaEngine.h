@@ -25,6 +25,7 @@
 // An approximation of what the interface will look like. Similar to JPCSP's.
 
 #include <map>
+#include <vector>
 #include "Common/CommonTypes.h"
 #include "Core/HLE/sceMpeg.h"
 #include "Core/HW/MpegDemux.h"
@@ -32,6 +33,7 @@
 
 class PointerWrap;
 class SimpleAudio;
+class DecodeAheadWorker;
 
 #ifdef USE_FFMPEG
 struct SwsContext;
@@ -94,9 +96,16 @@ public:
 
 	void DoState(PointerWrap &p);
 
+	// Must be called before touching anything below directly, the decoder may be busy on its own thread.
+	void waitDecodeAhead();
+
 private:
-	void updateSwsFormat(int videoPixelMode);
 	int getNextAudioFrame(u8 **buf, int *headerCode1, int *headerCode2);
+	bool decodeFrame(u8 *dest, s64 &pts, bool ahead, bool &reachedEnd);
+	void startDecodeAhead();
+	void decodeAheadJob();
+	void takeDecodedAhead(bool skipFrame);
+	void discardDecodeAhead();
 
 public:  // TODO: Very little of this below should be public.
 
@@ -139,4 +148,35 @@ public:  // TODO: Very little of this below should be public.
 
 	// used for audio type 
 	int m_audioType;
+
+	// Stream data the decoder has taken from m_pdata, and the size of the last read.
+	// m_decodingsize and m_shownReadBytes are what the game gets to see, see getRemainSize().
+	u64 m_readBytes;
+	u64 m_shownReadBytes;
+	int m_lastReadSize;
+	// Copy of the stream data read since m_shownReadBytes, while decoding ahead.  It's put back
+	// into m_pdata when saving, so the frames are decoded again after loading.
+	std::vector<u8> m_aheadData;
+	bool m_readingAhead;
+
+private:
+	enum { VIDEO_AHEAD_FRAMES = 2 };
+
+	struct AheadFrame {
+		u8 *buffer;
+		s64 pts;
+		// m_readBytes and m_lastReadSize right after decoding this frame.
+		u64 readBytes;
+		int readSize;
+	};
+
+	// Frames decoded on m_decodeAhead before the game asked for them, oldest first.
+	DecodeAheadWorker *m_decodeAhead;
+	AheadFrame m_aheadFrames[VIDEO_AHEAD_FRAMES];
+	int m_aheadCount;
+	// Set when decoding ahead ran out of data, until more is added.
+	bool m_aheadStarved;
+	// The most stream data a single frame has needed so far, and where the last frame ended.
+	int m_maxFrameBytes;
+	u64 m_frameReadStart;
 };
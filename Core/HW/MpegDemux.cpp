@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cstring>
+
 #include "MpegDemux.h"
 
 const int PACKET_START_CODE_MASK   = 0xffffff00;
@@ -137,6 +140,25 @@ int MpegDemux::readPesHeader(PesHeader &pesHeader, int length, int startCode) {
 	return length;
 }
 
+// Returns the position of the byte following the next 00 00 01 prefix, or -1.  Looks for the 01
+// with memchr() and checks for the zeros before it, so most bytes are never looked at one by one.
+int MpegDemux::findStartCode(int pos, int end) const
+{
+	// The code itself comes after the prefix, so the 01 must be at least 2 bytes before the end.
+	const u8 *p = m_buf + pos + 2;
+	const u8 *last = m_buf + end - 1;
+	while (p < last) {
+		p = (const u8 *)memchr(p, 0x01, last - p);
+		if (!p)
+			return -1;
+		if (p[-1] == 0 && p[-2] == 0)
+			return (int)(p + 1 - m_buf);
+		// The 01 we're on can't be one of the zeros, so the next prefix ends at least 3 bytes on.
+		p += 3;
+	}
+	return -1;
+}
+
 int MpegDemux::demuxStream(bool bdemux, int startCode, int channel)
 {
 	int length = read16();
@@ -163,10 +185,13 @@ void MpegDemux::demux(int audioChannel)
 		if (m_index + 2048 > m_readSize)
 			break;
 		// Search for start code
-		int startCode = 0xFF;
-		while ((startCode & PACKET_START_CODE_MASK) != PACKET_START_CODE_PREFIX && !isEOF()) {
-			startCode = (startCode << 8) | read8();
+		int codePos = findStartCode(m_index, m_len);
+		if (codePos < 0) {
+			m_index = m_len;
+			break;
 		}
+		int startCode = PACKET_START_CODE_PREFIX | m_buf[codePos];
+		m_index = codePos + 1;
 		switch (startCode) {
 		case PACK_START_CODE:
 			skip(10);
@@ -202,7 +227,7 @@ void MpegDemux::demux(int audioChannel)
 	}
 	if (m_index < m_readSize) {
 		int size = m_readSize - m_index;
-		memcpy(m_buf, m_buf + m_index, size);
+		memmove(m_buf, m_buf + m_index, size);
 		m_index = 0;
 		m_readSize = size;
 	} else {
@@ -211,14 +236,14 @@ void MpegDemux::demux(int audioChannel)
 	}
 }
 
-static bool isHeader(u8* audioStream, int offset)
+static bool isHeader(const u8 *audioStream, int offset)
 {
 	const u8 header1 = (u8)0x0F;
 	const u8 header2 = (u8)0xD0;
 	return (audioStream[offset] == header1) && (audioStream[offset+1] == header2);
 }
 
-static int getNextHeaderPosition(u8* audioStream, int curpos, int limit, int frameSize)
+static int getNextHeaderPosition(const u8 *audioStream, int curpos, int limit, int frameSize)
 {
 	int endScan = limit - 1;
 
@@ -227,6 +252,10 @@ static int getNextHeaderPosition(u8* audioStream, int curpos, int limit, int fra
 	if (offset < endScan && isHeader(audioStream, offset))
 		return offset;
 	for (int scan = curpos; scan < endScan; scan++) {
+		const u8 *found = (const u8 *)memchr(audioStream + scan, 0x0F, endScan - scan);
+		if (!found)
+			break;
+		scan = (int)(found - audioStream);
 		if (isHeader(audioStream, scan))
 			return scan;
 	}
@@ -240,27 +269,50 @@ int MpegDemux::getNextAudioFrame(u8 **buf, int *headerCode1, int *headerCode2, s
 	int frameSize;
 	if (!hasNextAudioFrame(&gotsize, &frameSize, headerCode1, headerCode2))
 		return 0;
-	int audioPos = 8;
-	int nextHeader = getNextHeaderPosition(m_audioFrame, audioPos, gotsize, frameSize);
-	if (nextHeader >= 0) {
-		audioPos = nextHeader;
+
+	// Normally the next frame follows right on, and then we only need to look at this one.  Hand
+	// it out straight from the queue if it's in one piece, it stays valid until we demux again.
+	const u8 *frame = NULL;
+	if (frameSize + 2 <= gotsize) {
+		frame = m_audioStream.peek_front(frameSize + 2);
+		if (!frame) {
+			m_audioStream.get_front(m_audioFrame, frameSize + 2);
+			frame = m_audioFrame;
+		}
+		if (!isHeader(frame, frameSize))
+			frame = NULL;
+	}
+
+	int audioPos;
+	if (frame) {
+		audioPos = frameSize;
 	} else {
-		audioPos = gotsize;
+		m_audioStream.get_front(m_audioFrame, gotsize);
+		frame = m_audioFrame;
+		audioPos = 8;
+		int nextHeader = getNextHeaderPosition(m_audioFrame, audioPos, gotsize, frameSize);
+		if (nextHeader >= 0) {
+			audioPos = nextHeader;
+		} else {
+			audioPos = gotsize;
+		}
 	}
 	m_audioStream.pop_front(0, audioPos, pts);
 	if (buf) {
-		*buf = m_audioFrame + 8;
+		*buf = const_cast<u8 *>(frame) + 8;
 	}
 	return frameSize - 8;
 }
 
 bool MpegDemux::hasNextAudioFrame(int *gotsizeOut, int *frameSizeOut, int *headerCode1, int *headerCode2)
 {
-	int gotsize = m_audioStream.get_front(m_audioFrame, 0x2000);
-	if (gotsize == 0 || !isHeader(m_audioFrame, 0))
+	// Only the header is needed to know if the whole frame is there.
+	u8 header[4];
+	int gotsize = std::min(m_audioStream.getQueueSize(), (int)sizeof(m_audioFrame));
+	if (gotsize < (int)sizeof(header) || m_audioStream.get_front(header, sizeof(header)) != sizeof(header) || !isHeader(header, 0))
 		return false;
-	u8 code1 = m_audioFrame[2];
-	u8 code2 = m_audioFrame[3];
+	u8 code1 = header[2];
+	u8 code2 = header[3];
 	int frameSize = (((code1 & 0x03) << 8) | ((code2 & 0xFF) * 8)) + 0x10;
 	if (frameSize > gotsize)
 		return false;
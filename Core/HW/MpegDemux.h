@@ -52,14 +52,12 @@ private:
 	s64 readPts(int c) {
 		return (((s64) (c & 0x0E)) << 29) | ((read16() >> 1) << 15) | (read16() >> 1);
 	}
-	bool isEOF() {
-		return m_index >= m_len;
-	}
 	void skip(int n) {
 		if (n > 0) {
 			m_index += n;
 		}
 	}
+	int findStartCode(int pos, int end) const;
 	int readPesHeader(PesHeader &pesHeader, int length, int startCode);
 	int demuxStream(bool bdemux, int startCode, int channel);
 
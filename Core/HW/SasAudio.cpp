@@ -24,6 +24,12 @@
 #include "SasAudio.h"
 
 #include <algorithm>
+#include <cstring>
+#include <vector>
+
+#ifdef _M_SSE
+#include <emmintrin.h>
+#endif
 
 // #define AUDIO_TO_FILE
 
@@ -48,7 +54,72 @@ static const u8 f[16][2] = {
 	{   0, 151 },
 };
 
+// Only small VAGs are worth caching, anything bigger is most likely music that plays once.
+static const u32 VAG_CACHE_MAX_SIZE = 32 * 1024;
+static const int VAG_CACHE_SLOTS = 32;
+
+struct VagCacheSlot {
+	VagCacheSlot() : addr(0), size(0), numBlocks(0), version(0), lastUse(0) {}
+
+	u32 addr;
+	u32 size;
+	// How many blocks from the start have been decoded so far.
+	int numBlocks;
+	// Changes whenever the slot is reused or truncated, so decoders know their view is stale.
+	u32 version;
+	u32 lastUse;
+	std::vector<u8> raw;
+	std::vector<s16> samples;
+};
+
+static VagCacheSlot vagCache[VAG_CACHE_SLOTS];
+static u32 vagCacheCounter = 0;
+static bool vagCacheEnabled = true;
+
+void VagDecoder::SetCacheEnabled(bool enabled) {
+	vagCacheEnabled = enabled;
+	if (!enabled) {
+		ClearCache();
+	}
+}
+
+void VagDecoder::ClearCache() {
+	for (int i = 0; i < VAG_CACHE_SLOTS; ++i) {
+		VagCacheSlot &slot = vagCache[i];
+		slot.addr = 0;
+		slot.size = 0;
+		slot.numBlocks = 0;
+		slot.version = ++vagCacheCounter;
+		std::vector<u8>().swap(slot.raw);
+		std::vector<s16>().swap(slot.samples);
+	}
+}
+
 void VagDecoder::Start(u32 data, u32 vagSize, bool loopEnabled) {
+	cacheSlot_ = -1;
+	if (vagCacheEnabled && vagSize >= 16 && vagSize <= VAG_CACHE_MAX_SIZE) {
+		int oldest = 0;
+		for (int i = 0; i < VAG_CACHE_SLOTS; ++i) {
+			if (vagCache[i].addr == data && vagCache[i].size == vagSize) {
+				cacheSlot_ = i;
+				break;
+			}
+			if (vagCache[i].lastUse < vagCache[oldest].lastUse) {
+				oldest = i;
+			}
+		}
+		if (cacheSlot_ < 0) {
+			VagCacheSlot &slot = vagCache[oldest];
+			slot.addr = data;
+			slot.size = vagSize;
+			slot.numBlocks = 0;
+			slot.version = ++vagCacheCounter;
+			cacheSlot_ = oldest;
+		}
+		vagCache[cacheSlot_].lastUse = ++vagCacheCounter;
+		cacheVersion_ = vagCache[cacheSlot_].version;
+	}
+
 	loopEnabled_ = loopEnabled;
 	loopAtNextBlock_ = false;
 	loopStartBlock_ = -1;
@@ -82,32 +153,122 @@ void VagDecoder::DecodeBlock(u8 *&read_pointer) {
 		}
 	}
 
+	if (!ReadCachedBlock(read_pointer)) {
+		DecodeSamples(read_pointer);
+		WriteCachedBlock(read_pointer);
+	}
+	readp += 14;
+
+	curSample = 0;
+	curBlock_++;
+	if (curBlock_ == numBlocks_) {
+		end_ = true;
+	}
+
+	read_pointer = readp;
+}
+
+void VagDecoder::DecodeSamples(const u8 *block) {
+	const int predict_nr = block[0] >> 4;
+	const int shift_factor = block[0] & 0xf;
+
+	// Expand the nibbles up front, it's only the filter that has to go one sample at a time.
+	s16 nibbles[32];
+#ifdef _M_SSE
+	// Each data byte becomes two s16s with the nibble at the top, low nibble first.
+	const __m128i data = _mm_srli_si128(_mm_loadu_si128((const __m128i *)block), 2);
+	const __m128i lo = _mm_slli_epi16(_mm_and_si128(data, _mm_set1_epi8(0x0F)), 4);
+	const __m128i hi = _mm_and_si128(data, _mm_set1_epi8((char)0xF0));
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i shift = _mm_cvtsi32_si128(shift_factor);
+	const __m128i first = _mm_unpacklo_epi8(lo, hi);
+	const __m128i second = _mm_unpackhi_epi8(lo, hi);
+	_mm_storeu_si128((__m128i *)&nibbles[0], _mm_sra_epi16(_mm_unpacklo_epi8(zero, first), shift));
+	_mm_storeu_si128((__m128i *)&nibbles[8], _mm_sra_epi16(_mm_unpackhi_epi8(zero, first), shift));
+	_mm_storeu_si128((__m128i *)&nibbles[16], _mm_sra_epi16(_mm_unpacklo_epi8(zero, second), shift));
+	_mm_storeu_si128((__m128i *)&nibbles[24], _mm_sra_epi16(_mm_unpackhi_epi8(zero, second), shift));
+#else
+	for (int i = 0; i < 14; ++i) {
+		const u8 d = block[2 + i];
+		nibbles[i * 2] = (short)((d & 0xf) << 12) >> shift_factor;
+		nibbles[i * 2 + 1] = (short)((d & 0xf0) << 8) >> shift_factor;
+	}
+#endif
+
 	// Keep state in locals to avoid bouncing to memory.
 	int s1 = s_1;
 	int s2 = s_2;
 
-	int coef1 = f[predict_nr][0];
-	int coef2 = -f[predict_nr][1];
+	const int coef1 = f[predict_nr][0];
+	const int coef2 = -f[predict_nr][1];
 
 	for (int i = 0; i < 28; i += 2) {
-		u8 d = *readp++;
-		int sample1 = (short)((d & 0xf) << 12) >> shift_factor;
-		int sample2 = (short)((d & 0xf0) << 8) >> shift_factor;
-		s2 = clamp_s16(sample1 + ((s1 * coef1 + s2 * coef2) >> 6));
-		s1 = clamp_s16(sample2 + ((s2 * coef1 + s1 * coef2) >> 6));
+		s2 = clamp_s16(nibbles[i] + ((s1 * coef1 + s2 * coef2) >> 6));
+		s1 = clamp_s16(nibbles[i + 1] + ((s2 * coef1 + s1 * coef2) >> 6));
 		samples[i] = s2;
 		samples[i + 1] = s1;
 	}
 
 	s_1 = s1;
 	s_2 = s2;
-	curSample = 0;
-	curBlock_++;
-	if (curBlock_ == numBlocks_) {
-		end_ = true;
+}
+
+bool VagDecoder::ReadCachedBlock(const u8 *block) {
+	if (cacheSlot_ < 0) {
+		return false;
+	}
+	VagCacheSlot &slot = vagCache[cacheSlot_];
+	if (slot.version != cacheVersion_) {
+		cacheSlot_ = -1;
+		return false;
 	}
 
-	read_pointer = readp;
+	// curBlock_ hasn't been incremented yet.
+	const int index = curBlock_ + 1;
+	if (index >= slot.numBlocks) {
+		return false;
+	}
+	if (memcmp(&slot.raw[index * 16], block, 16) != 0) {
+		// The game wrote new data here, so everything from this block on is stale.
+		slot.numBlocks = index;
+		slot.version = ++vagCacheCounter;
+		cacheVersion_ = slot.version;
+		return false;
+	}
+
+	const s16 *cached = &slot.samples[index * 28];
+	for (int i = 0; i < 28; ++i) {
+		samples[i] = cached[i];
+	}
+	s_1 = cached[27];
+	s_2 = cached[26];
+	return true;
+}
+
+void VagDecoder::WriteCachedBlock(const u8 *block) {
+	if (cacheSlot_ < 0) {
+		return;
+	}
+	VagCacheSlot &slot = vagCache[cacheSlot_];
+	const int index = curBlock_ + 1;
+	if (slot.version != cacheVersion_ || index != slot.numBlocks) {
+		return;
+	}
+
+	// The decoder can run one block past vagSize / 16, since data_ starts at block -1.
+	const size_t blocks = slot.size / 16 + 1;
+	if ((size_t)index >= blocks) {
+		return;
+	}
+	if (slot.raw.size() != blocks * 16) {
+		slot.raw.resize(blocks * 16);
+		slot.samples.resize(blocks * 28);
+	}
+	memcpy(&slot.raw[index * 16], block, 16);
+	for (int i = 0; i < 28; ++i) {
+		slot.samples[index * 28 + i] = (s16)samples[i];
+	}
+	slot.numBlocks++;
 }
 
 void VagDecoder::GetSamples(s16 *outSamples, int numSamples) {
@@ -122,7 +283,7 @@ void VagDecoder::GetSamples(s16 *outSamples, int numSamples) {
 	}
 	u8 *origp = readp;
 
-	for (int i = 0; i < numSamples; i++) {
+	for (int i = 0; i < numSamples; ) {
 		if (curSample == 28) {
 			if (loopAtNextBlock_) {
 				VERBOSE_LOG(SASMIX, "Looping VAG from block %d/%d to %d", curBlock_, numBlocks_, loopStartBlock_);
@@ -132,6 +293,8 @@ void VagDecoder::GetSamples(s16 *outSamples, int numSamples) {
 				origp = readp;
 				curBlock_ = loopStartBlock_;
 				loopAtNextBlock_ = false;
+				// The filter state carries over the loop, so the cache doesn't match from here on.
+				cacheSlot_ = -1;
 			}
 			DecodeBlock(readp);
 			if (end_) {
@@ -140,7 +303,12 @@ void VagDecoder::GetSamples(s16 *outSamples, int numSamples) {
 				return;
 			}
 		}
-		outSamples[i] = samples[curSample++];
+		const int count = std::min(28 - curSample, numSamples - i);
+		for (int j = 0; j < count; ++j) {
+			outSamples[i + j] = samples[curSample + j];
+		}
+		curSample += count;
+		i += count;
 	}
 
 	if (readp > origp) {
@@ -168,6 +336,11 @@ void VagDecoder::DoState(PointerWrap &p) {
 	p.Do(loopEnabled_);
 	p.Do(loopAtNextBlock_);
 	p.Do(end_);
+
+	// We don't know whether we've looped already, so just decode from memory until the next Start.
+	if (p.mode == PointerWrap::MODE_READ) {
+		cacheSlot_ = -1;
+	}
 }
 
 int SasAtrac3::setContext(u32 context) {
@@ -319,6 +492,7 @@ SasInstance::SasInstance()
 		mixBuffer(0),
 		sendBuffer(0),
 		resampleBuffer(0),
+		voiceBuffer(0),
 		grainSize(0) {
 #ifdef AUDIO_TO_FILE
 	audioDump = fopen("D:\\audio.raw", "wb");
@@ -339,9 +513,12 @@ void SasInstance::ClearGrainSize() {
 		delete [] sendBuffer;
 	if (resampleBuffer)
 		delete [] resampleBuffer;
+	if (voiceBuffer)
+		delete [] voiceBuffer;
 	mixBuffer = NULL;
 	sendBuffer = NULL;
 	resampleBuffer = NULL;
+	voiceBuffer = NULL;
 }
 
 void SasInstance::SetGrainSize(int newGrainSize) {
@@ -358,10 +535,13 @@ void SasInstance::SetGrainSize(int newGrainSize) {
 	memset(sendBuffer, 0, sizeof(int) * grainSize * 2);
 	if (resampleBuffer)
 		delete [] resampleBuffer;
+	if (voiceBuffer)
+		delete [] voiceBuffer;
 
 	// 2 samples padding at the start, that's where we copy the two last samples from the channel
-	// so that we can do bicubic resampling if necessary.  Plus 1 for smoothness hackery.
+	// so that we can interpolate across grains.  The extra 1 is unused, but savestates have it.
 	resampleBuffer = new s16[grainSize * 4 + 3];
+	voiceBuffer = new s16[grainSize];
 }
 
 void SasVoice::ReadSamples(s16 *output, int numSamples) {
@@ -433,6 +613,63 @@ bool SasVoice::HaveSamplesEnded() {
 	}
 }
 
+// Resamples to exactly count samples.  Output sample i sits at frac + i * pitch (12.12 fixed
+// point) and is interpolated between src[idx - 1] and src[idx], so src[-1] and src[-2] must hold
+// the history from the previous grain.  The common pitches get their own loops, which produce the
+// same result as the general one.
+static void ResampleVoice(s16 *out, const s16 *src, int frac, int pitch, int count) {
+	if ((frac & (PSP_SAS_PITCH_BASE - 1)) == 0) {
+		const s16 *in = src + (frac >> PSP_SAS_PITCH_BASE_SHIFT) - 1;
+		if (pitch == PSP_SAS_PITCH_BASE) {
+			memcpy(out, in, count * sizeof(s16));
+			return;
+		} else if (pitch == PSP_SAS_PITCH_BASE * 2) {
+			for (int i = 0; i < count; ++i)
+				out[i] = in[i * 2];
+			return;
+		} else if (pitch == PSP_SAS_PITCH_BASE / 2) {
+			for (int i = 0; i < count; i += 2) {
+				out[i] = in[i / 2];
+				if (i + 1 < count)
+					out[i + 1] = in[i / 2] + ((in[i / 2 + 1] - in[i / 2]) >> 1);
+			}
+			return;
+		}
+	}
+
+	for (int i = 0; i < count; ++i) {
+		const int idx = frac >> PSP_SAS_PITCH_BASE_SHIFT;
+		const int f = frac & (PSP_SAS_PITCH_BASE - 1);
+		const int a = src[idx - 1];
+		const int b = src[idx];
+		out[i] = a + (((b - a) * f) >> PSP_SAS_PITCH_BASE_SHIFT);
+		frac += pitch;
+	}
+}
+
+// Adds samples * volume >> shift to an interleaved stereo s32 buffer.
+static void MixSamplesStereo(s32 *dest, const s16 *samples, int count, int volLeft, int volRight, int shift) {
+	int i = 0;
+#ifdef _M_SSE
+	// madd with (sample, 0) pairs against (vol, 0) pairs gives exact 32-bit products.  Volumes are
+	// at most PSP_SAS_VOL_MAX, so they fit in 16 bits.
+	const __m128i vol = _mm_set_epi16(0, (s16)volRight, 0, (s16)volLeft, 0, (s16)volRight, 0, (s16)volLeft);
+	const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+	for (; i + 4 <= count; i += 4) {
+		__m128i in = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(samples + i)), _mm_setzero_si128());
+		__m128i lo = _mm_sra_epi32(_mm_madd_epi16(_mm_unpacklo_epi32(in, in), vol), shiftCount);
+		__m128i hi = _mm_sra_epi32(_mm_madd_epi16(_mm_unpackhi_epi32(in, in), vol), shiftCount);
+		__m128i *d = (__m128i *)(dest + i * 2);
+		_mm_storeu_si128(d, _mm_add_epi32(_mm_loadu_si128(d), lo));
+		_mm_storeu_si128(d + 1, _mm_add_epi32(_mm_loadu_si128(d + 1), hi));
+	}
+#endif
+	for (; i < count; ++i) {
+		dest[i * 2] += (samples[i] * volLeft) >> shift;
+		dest[i * 2 + 1] += (samples[i] * volRight) >> shift;
+	}
+}
+
 void SasInstance::MixVoice(SasVoice &voice) {
 	switch (voice.type) {
 	case VOICETYPE_VAG:
@@ -444,16 +681,14 @@ void SasInstance::MixVoice(SasVoice &voice) {
 			break;
 		// else fallthrough! Don't change the check above.
 	default:
-		// Load resample history (so we can use a wide filter)
+		// Load resample history, so we can interpolate across grains.
 		resampleBuffer[0] = voice.resampleHist[0];
 		resampleBuffer[1] = voice.resampleHist[1];
 
-		// Figure out number of samples to read.
-		// Actually this is not entirely correct - we need to get one extra sample, and store it
-		// for the next time around. A little complicated...
-		// But for now, see Smoothness HACKERY below :P
-		u32 numSamples = ((u32)voice.sampleFrac + (u32)grainSize * (u32)voice.pitch) >> PSP_SAS_PITCH_BASE_SHIFT;
-		if ((int)numSamples > grainSize * 4) {
+		// Read exactly as many samples as the last output position needs.  sampleFrac may go
+		// negative by up to one sample, that's what the history is for.
+		int numSamples = ((voice.sampleFrac + (grainSize - 1) * voice.pitch) >> PSP_SAS_PITCH_BASE_SHIFT) + 1;
+		if (numSamples > grainSize * 4) {
 			ERROR_LOG(SASMIX, "numSamples too large, clamping: %i vs %i", numSamples, grainSize * 4);
 			numSamples = grainSize * 4;
 		}
@@ -465,31 +700,23 @@ void SasInstance::MixVoice(SasVoice &voice) {
 			// VAG seems to have an extra sample delay (not shared by PCM.)
 			if (voice.type == VOICETYPE_VAG)
 				++delay;
+			delay = std::min(delay, numSamples);
+			memset(resampleBuffer + 2, 0, delay * sizeof(s16));
 			voice.ReadSamples(resampleBuffer + 2 + delay, numSamples - delay);
 		} else {
 			voice.ReadSamples(resampleBuffer + 2, numSamples);
 		}
 
-		// Smoothness HACKERY
-		resampleBuffer[2 + numSamples] = resampleBuffer[2 + numSamples - 1];
-
 		// Save resample history
 		voice.resampleHist[0] = resampleBuffer[2 + numSamples - 2];
 		voice.resampleHist[1] = resampleBuffer[2 + numSamples - 1];
 
 		// Resample to the correct pitch, writing exactly "grainSize" samples.
-		// This is a HORRIBLE resampler by the way.
-		// TODO: Special case no-resample case (and 2x and 0.5x) for speed, it's not uncommon
+		ResampleVoice(voiceBuffer, resampleBuffer + 2, voice.sampleFrac, voice.pitch, grainSize);
+		voice.sampleFrac += grainSize * voice.pitch - numSamples * PSP_SAS_PITCH_BASE;
 
-		u32 sampleFrac = voice.sampleFrac;
-		// We need to shift by 12 anyway, so combine that with the volume shift.
-		int volumeShift = (12 + MAX_CONFIG_VOLUME - g_Config.iSFXVolume);
-		if (volumeShift < 0) volumeShift = 0;
+		// The envelope has to be stepped one sample at a time anyway, so scale by it here.
 		for (int i = 0; i < grainSize; i++) {
-			// For now: nearest neighbour, not even using the resample history at all.
-			int sample = resampleBuffer[sampleFrac / PSP_SAS_PITCH_BASE + 2];
-			sampleFrac += voice.pitch;
-
 			// The maximum envelope height (PSP_SAS_ENVELOPE_HEIGHT_MAX) is (1 << 30) - 1.
 			// Reduce it to 14 bits, by shifting off 15.  Round up by adding (1 << 14) first.
 			int envelopeValue = voice.envelope.GetHeight();
@@ -497,22 +724,16 @@ void SasInstance::MixVoice(SasVoice &voice) {
 
 			// We just scale by the envelope before we scale by volumes.
 			// Again, we round up by adding (1 << 14) first (*after* multiplying.)
-			sample = ((sample * envelopeValue) + (1 << 14)) >> 15;
-
-			// We mix into this 32-bit temp buffer and clip in a second loop
-			// Ideally, the shift right should be there too but for now I'm concerned about
-			// not overflowing.
-			mixBuffer[i * 2] += (sample * voice.volumeLeft ) >> volumeShift; // Max = 16 and Min = 12(default)
-			mixBuffer[i * 2 + 1] += (sample * voice.volumeRight) >> volumeShift; // Max = 16 and Min = 12(default)
-			sendBuffer[i * 2] += sample * voice.effectLeft >> volumeShift;
-			sendBuffer[i * 2 + 1] += sample * voice.effectRight >> volumeShift;
+			voiceBuffer[i] = (s16)(((voiceBuffer[i] * envelopeValue) + (1 << 14)) >> 15);
 			voice.envelope.Step();
 		}
 
-		voice.sampleFrac = sampleFrac;
-		// Let's hope grainSize is a power of 2.
-		//voice.sampleFrac &= grainSize * PSP_SAS_PITCH_BASE - 1;
-		voice.sampleFrac -= numSamples * PSP_SAS_PITCH_BASE;
+		// We mix into 32-bit temp buffers and clip when writing the output.
+		// We need to shift by 12 anyway, so combine that with the volume shift.
+		int volumeShift = (12 + MAX_CONFIG_VOLUME - g_Config.iSFXVolume);
+		if (volumeShift < 0) volumeShift = 0;
+		MixSamplesStereo(mixBuffer, voiceBuffer, grainSize, voice.volumeLeft, voice.volumeRight, volumeShift);
+		MixSamplesStereo(sendBuffer, voiceBuffer, grainSize, voice.effectLeft, voice.effectRight, volumeShift);
 
 		if (voice.HaveSamplesEnded())
 			voice.envelope.End();
@@ -556,10 +777,17 @@ void SasInstance::Mix(u32 outAddr, u32 inAddr, int leftVol, int rightVol) {
 				*outp++ = clamp_s16(sampleR);
 			}
 		} else {
-			for (int i = 0; i < grainSize * 2; i += 2) {
-				*outp++ = clamp_s16(mixBuffer[i + 0]);
-				*outp++ = clamp_s16(mixBuffer[i + 1]);
+			int i = 0;
+#ifdef _M_SSE
+			// packs saturates, which is exactly clamp_s16.
+			for (; i + 8 <= grainSize * 2; i += 8) {
+				__m128i lo = _mm_loadu_si128((const __m128i *)(mixBuffer + i));
+				__m128i hi = _mm_loadu_si128((const __m128i *)(mixBuffer + i + 4));
+				_mm_storeu_si128((__m128i *)(outp + i), _mm_packs_epi32(lo, hi));
 			}
+#endif
+			for (; i < grainSize * 2; ++i)
+				outp[i] = clamp_s16(mixBuffer[i]);
 		}
 	} else {
 		s16 *outpL = outp + grainSize * 0;
@@ -651,6 +879,9 @@ void SasVoice::KeyOn() {
 	on = true;
 	paused = false;
 	sampleFrac = 0;
+	// Don't interpolate against whatever played before.
+	resampleHist[0] = 0;
+	resampleHist[1] = 0;
 }
 
 void SasVoice::KeyOff() {
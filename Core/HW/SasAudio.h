@@ -89,9 +89,13 @@ enum VoiceType {
 
 // VAG is a Sony ADPCM audio compression format, which goes all the way back to the PSX.
 // It compresses 28 16-bit samples into a block of 16 bytes.
+//
+// Short sound effects tend to get keyed on over and over, so the first pass through each small VAG
+// is remembered in a cache along with the raw blocks it came from.  Replaying it only has to check
+// each block is unchanged and copy out the samples.
 class VagDecoder {
 public:
-	VagDecoder() : data_(0), read_(0), end_(true) {}
+	VagDecoder() : data_(0), read_(0), end_(true), cacheSlot_(-1), cacheVersion_(0) {}
 	void Start(u32 dataPtr, u32 vagSize, bool loopEnabled);
 
 	void GetSamples(s16 *outSamples, int numSamples);
@@ -101,7 +105,14 @@ public:
 
 	void DoState(PointerWrap &p);
 
+	static void SetCacheEnabled(bool enabled);
+	static void ClearCache();
+
 private:
+	void DecodeSamples(const u8 *block);
+	bool ReadCachedBlock(const u8 *block);
+	void WriteCachedBlock(const u8 *block);
+
 	int samples[28];
 	int curSample;
 
@@ -118,6 +129,11 @@ private:
 	bool loopEnabled_;
 	bool loopAtNextBlock_;
 	bool end_;
+
+	// Which decoded sample cache slot this voice reads and fills, if any.  Only valid while
+	// the slot's version still matches, and only for the first pass through the data.
+	int cacheSlot_;
+	u32 cacheVersion_;
 };
 
 class SasAtrac3 {
@@ -190,8 +206,6 @@ private:
 };
 
 // A SAS voice.
-// TODO: Look into pre-decoding the VAG samples on SetVoice instead of decoding them on the fly.
-// It's not very likely that games encode VAG dynamically.
 struct SasVoice {
 	SasVoice()
 		: playing(false),
@@ -274,6 +288,8 @@ public:
 	int *mixBuffer;
 	int *sendBuffer;
 	s16 *resampleBuffer;
+	// One voice's samples after resampling and envelope, before volume.  Not saved.
+	s16 *voiceBuffer;
 
 	FILE *audioDump;
 
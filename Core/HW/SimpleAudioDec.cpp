@@ -22,6 +22,7 @@
 #include "Core/HW/SimpleAudioDec.h"
 #include "Core/HW/MediaEngine.h"
 #include "Core/HW/BufferQueue.h"
+#include "Core/HW/DecodeAheadWorker.h"
 
 #ifdef USE_FFMPEG
 
@@ -176,6 +177,13 @@ bool SimpleAudio::IsOK() const {
 #endif
 }
 
+void SimpleAudio::Flush() {
+#ifdef USE_FFMPEG
+	if (codecCtx_)
+		avcodec_flush_buffers(codecCtx_);
+#endif  // USE_FFMPEG
+}
+
 void SaveAudio(const char filename[], uint8_t *outbuf, int size){
 	FILE * pf;
 	pf = fopen(filename, "ab+");
@@ -316,9 +324,17 @@ AuCtx::AuCtx() {
 	realReadSize = 0;
 	audioType = 0;
 	FrameNum = 0;
+	decodeAhead = NULL;
+	aheadPending = false;
+	aheadPcmBytes = 0;
+	aheadSrcPos = 0;
+	aheadOutSamples = 0;
+	maxFrameBytes = 0;
 };
 
 AuCtx::~AuCtx(){
+	AuDiscardDecodeAhead();
+	delete decodeAhead;
 	if (decoder){
 		AudioClose(&decoder);
 		decoder = NULL;
@@ -347,8 +363,14 @@ u32 AuCtx::AuDecode(u32 pcmAddr)
 	while (sourcebuff.size() > 0 && outpcmbufsize < PCMBufSize && i < repeat){
 		i++;
 		int pcmframesize;
-		// decode
-		decoder->Decode((void*)sourcebuff.c_str(), (int)sourcebuff.size(), outbuf, &pcmframesize);
+		int srcPos;
+		int outSamples;
+		// decode, unless the worker already did
+		if (!AuTakeDecodedAhead(outbuf, pcmframesize, srcPos, outSamples)) {
+			decoder->Decode((void*)sourcebuff.c_str(), (int)sourcebuff.size(), outbuf, &pcmframesize);
+			srcPos = decoder->GetSourcePos();
+			outSamples = decoder->GetOutSamples();
+		}
 		if (pcmframesize == 0){
 			// no output pcm, we are at the end of the stream
 			AuBufAvailable = 0;
@@ -362,9 +384,10 @@ u32 AuCtx::AuDecode(u32 pcmAddr)
 		// count total output pcm size 
 		outpcmbufsize += pcmframesize;
 		// count total output samples
-		SumDecodedSamples += decoder->GetOutSamples();
-		// get consumed source length
-		int srcPos = decoder->GetSourcePos();
+		SumDecodedSamples += outSamples;
+		maxFrameBytes = std::max(maxFrameBytes, srcPos);
+		if (g_Config.bAudioDecodeAhead)
+			lastFrame.assign(sourcebuff, 0, srcPos);
 		// remove the consumed source
 		sourcebuff.erase(0, srcPos);
 		// reduce the available Aubuff size
@@ -376,9 +399,81 @@ u32 AuCtx::AuDecode(u32 pcmAddr)
 		FrameNum++;
 	}
 	Memory::Write_U32(PCMBuf, pcmAddr);
+	AuStartDecodeAhead();
 	return outpcmbufsize;
 }
 
+// Same idea as for Atrac: decode the next frame on the worker now, and use it on the next call if
+// the source it came from is still there.  Games only ever append to the source between calls,
+// and a frame decodes the same no matter what follows it, so that's the usual case.
+void AuCtx::AuStartDecodeAhead() {
+	aheadPending = false;
+	if (!g_Config.bAudioDecodeAhead || !decoder || maxFrameBytes == 0)
+		return;
+	// Don't speculate on a frame that's probably still incomplete, a failed decode may still
+	// disturb the decoder.
+	if ((int)sourcebuff.size() < maxFrameBytes * 2)
+		return;
+
+	if (!decodeAhead)
+		decodeAhead = new DecodeAheadWorker();
+	aheadSource.assign(sourcebuff, 0, std::min(sourcebuff.size(), (size_t)maxFrameBytes * 4));
+	aheadPcm.resize(std::max((u32)PCMBufSize, (u32)8192));
+	aheadPending = true;
+	decodeAhead->Start(std::bind(&AuCtx::AuDecodeAheadJob, this));
+}
+
+void AuCtx::AuDecodeAheadJob() {
+	aheadPcmBytes = 0;
+	decoder->Decode((void*)aheadSource.c_str(), (int)aheadSource.size(), &aheadPcm[0], &aheadPcmBytes);
+	aheadSrcPos = decoder->GetSourcePos();
+	aheadOutSamples = decoder->GetOutSamples();
+}
+
+bool AuCtx::AuTakeDecodedAhead(u8 *outbuf, int &pcmframesize, int &srcPos, int &outSamples) {
+	if (!aheadPending)
+		return false;
+	decodeAhead->Wait();
+	aheadPending = false;
+
+	// The decoder only looks at the frame itself, so the copy works as long as the frame was
+	// complete in it, or nothing was added since.
+	const bool sameSource = sourcebuff.size() == aheadSource.size();
+	if (sourcebuff.compare(0, aheadSource.size(), aheadSource) != 0 ||
+		(!sameSource && (aheadPcmBytes == 0 || aheadSrcPos >= (int)aheadSource.size()))) {
+		AuUndoDecodeAhead();
+		return false;
+	}
+
+	pcmframesize = aheadPcmBytes;
+	srcPos = aheadSrcPos;
+	outSamples = aheadOutSamples;
+	if (pcmframesize > 0)
+		memcpy(outbuf, &aheadPcm[0], pcmframesize);
+	return true;
+}
+
+void AuCtx::AuDiscardDecodeAhead() {
+	if (!aheadPending)
+		return;
+	decodeAhead->Wait();
+	aheadPending = false;
+	AuUndoDecodeAhead();
+}
+
+// The worker's decode already moved the decoder past the frame we're dropping.  FFmpeg can't
+// snapshot a codec, so reset it and decode the last frame the game got again, which gives it back
+// the overlap that frame left behind, like a seek would.
+void AuCtx::AuUndoDecodeAhead() {
+	if (!decoder)
+		return;
+	decoder->Flush();
+	if (!lastFrame.empty()) {
+		int pcmBytes = 0;
+		decoder->Decode((void*)lastFrame.c_str(), (int)lastFrame.size(), &aheadPcm[0], &pcmBytes);
+	}
+}
+
 u32 AuCtx::AuGetLoopNum()
 {
 	return LoopNum;
@@ -484,6 +579,7 @@ void AuCtx::DoState(PointerWrap &p) {
 	p.Do(FrameNum);
 
 	if (p.mode == p.MODE_READ) {
+		AuDiscardDecodeAhead();
 		decoder = new SimpleAudio(audioType);
 		AuBufAvailable = 0; // reset to read from file at position readPos
 	}
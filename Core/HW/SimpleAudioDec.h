@@ -18,6 +18,8 @@
 #pragma once
 
 #include <cmath>
+#include <string>
+#include <vector>
 
 #include "base/basictypes.h"
 #include "Core/HW/MediaEngine.h"
@@ -27,6 +29,7 @@ struct AVFrame;
 struct AVCodec;
 struct AVCodecContext;
 struct SwrContext;
+class DecodeAheadWorker;
 
 // Wraps FFMPEG for audio decoding in a nice interface.
 // Decodes packet by packet - does NOT demux.
@@ -48,6 +51,8 @@ public:
 
 	bool Decode(void* inbuf, int inbytes, uint8_t *outbuf, int *outbytes);
 	bool IsOK() const;
+	// Drops anything the codec carries over from previous frames.
+	void Flush();
 
 	int GetOutSamples();
 	int GetSourcePos();
@@ -107,6 +112,9 @@ public:
 	u32 AuSetLoopNum(int loop);
 	u32 AuGetLoopNum();
 
+	// Must be called before using decoder directly, since the worker might be using it.
+	void AuDiscardDecodeAhead();
+
 	u32 AuGetInfoToAddStreamData(u32 buff, u32 size, u32 srcPos);
 	u32 AuGetMaxOutputSample() const { return MaxOutputSample; }
 	u32 AuGetSumDecodedSample() const { return SumDecodedSamples; }
@@ -119,6 +127,7 @@ public:
 	void DoState(PointerWrap &p);
 
 	void EatSourceBuff(int amount) {
+		AuDiscardDecodeAhead();
 		sourcebuff.erase(0, amount);
 		AuBufAvailable -= amount;
 	}
@@ -154,7 +163,27 @@ public:
 	int realReadSize; // the really read size from file
 
 private:
+	void AuStartDecodeAhead();
+	void AuDecodeAheadJob();
+	bool AuTakeDecodedAhead(u8 *outbuf, int &pcmframesize, int &srcPos, int &outSamples);
+	void AuUndoDecodeAhead();
+
 	std::string sourcebuff; // source buffer
+
+	// Decodes the next frame on a worker between calls, see AuStartDecodeAhead().
+	DecodeAheadWorker *decodeAhead;
+	bool aheadPending;
+	// The worker decodes from its own copy, since the game may add data meanwhile.
+	std::string aheadSource;
+	std::vector<u8> aheadPcm;
+	int aheadPcmBytes;
+	int aheadSrcPos;
+	int aheadOutSamples;
+	// Largest frame seen so far, used to guess whether the next one is all there.
+	int maxFrameBytes;
+	// The last frame decoded for the game, to get the decoder back to where it was if we
+	// drop a frame the worker decoded.
+	std::string lastFrame;
 };
 
 
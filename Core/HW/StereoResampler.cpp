@@ -0,0 +1,164 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Common/Common.h"
+#include "Core/HW/StereoResampler.h"
+
+#ifdef _M_SSE
+#include <xmmintrin.h>
+#endif
+
+// How far the rate control may stray from the nominal ratio.  Half a percent is about 9 cents
+// of pitch, which nobody will hear, but it's plenty to absorb timing drift.
+static const double MAX_RATE_ADJUST = 0.005;
+// How quickly the fill level average follows the actual fill level, per Resample().
+static const double FILL_SMOOTHING = 0.05;
+
+static const double PI = 3.14159265358979323846;
+
+StereoResampler::StereoResampler() : inRate_(0), outRate_(0) {
+	Clear();
+}
+
+void StereoResampler::Clear() {
+	// Start with silence as history so the first frames have something to the left of them.
+	inputFrames_ = TAPS / 2 - 1;
+	input_.assign(inputFrames_ * 2, 0.0f);
+	pos_ = (double)inputFrames_;
+	ratio_ = 1.0;
+	fillAverage_ = -1.0;
+}
+
+void StereoResampler::BuildFilter(double cutoff) {
+	filter_.resize((PHASES + 1) * TAPS * 2);
+	for (int phase = 0; phase <= PHASES; ++phase) {
+		const double frac = (double)phase / PHASES;
+		float *coefs = &filter_[phase * TAPS * 2];
+
+		double sum = 0.0;
+		double taps[TAPS];
+		for (int k = 0; k < TAPS; ++k) {
+			// Distance from the output position to this input frame.
+			const double x = (double)(k - (TAPS / 2 - 1)) - frac;
+			const double sinc = x == 0.0 ? 1.0 : sin(PI * cutoff * x) / (PI * cutoff * x);
+			// Blackman window over the whole filter.
+			const double w = fabs(x) >= TAPS / 2 ? 0.0 : 0.42 + 0.5 * cos(PI * x / (TAPS / 2)) + 0.08 * cos(2.0 * PI * x / (TAPS / 2));
+			taps[k] = sinc * w;
+			sum += taps[k];
+		}
+		// Normalize so DC passes through at unity gain.
+		for (int k = 0; k < TAPS; ++k) {
+			coefs[k * 2 + 0] = (float)(taps[k] / sum);
+			coefs[k * 2 + 1] = (float)(taps[k] / sum);
+		}
+	}
+}
+
+int StereoResampler::PrepareResample(int outFrames, int inRate, int outRate, int queuedFrames, int targetFrames) {
+	if (inRate != inRate_ || outRate != outRate_) {
+		inRate_ = inRate;
+		outRate_ = outRate;
+		// Keep a little margin below the new Nyquist when going down in rate.
+		BuildFilter(outRate >= inRate ? 1.0 : 0.97 * outRate / inRate);
+	}
+
+	if (fillAverage_ < 0.0)
+		fillAverage_ = queuedFrames;
+	else
+		fillAverage_ += (queuedFrames - fillAverage_) * FILL_SMOOTHING;
+
+	// Fuller than we want means the emulator is producing faster than the host consumes, so eat
+	// input a little faster, and the other way around.
+	const double error = std::max(-1.0, std::min(1.0, (fillAverage_ - targetFrames) / targetFrames));
+	ratio_ = ((double)inRate / outRate) * (1.0 + MAX_RATE_ADJUST * error);
+
+	// The last output frame needs TAPS / 2 frames to the right of its position.
+	const int needed = (int)ceil(pos_ + outFrames * ratio_) + TAPS / 2 - inputFrames_;
+	return std::max(0, needed);
+}
+
+void StereoResampler::Feed(const s16 *stereo, int frames) {
+	if (frames <= 0)
+		return;
+	if ((int)input_.size() < (inputFrames_ + frames) * 2)
+		input_.resize((inputFrames_ + frames) * 2);
+
+	float *dest = &input_[inputFrames_ * 2];
+	for (int i = 0; i < frames * 2; ++i)
+		dest[i] = (float)stereo[i];
+	inputFrames_ += frames;
+}
+
+static inline s16 ClampToS16(float f) {
+	if (f >= 32767.0f)
+		return 32767;
+	if (f <= -32768.0f)
+		return -32768;
+	return (s16)f;
+}
+
+int StereoResampler::Resample(s16 *stereo, int frames) {
+	int produced = 0;
+	for (; produced < frames; ++produced) {
+		const int base = (int)pos_;
+		if (base + TAPS / 2 >= inputFrames_)
+			break;
+
+		const int phase = (int)((pos_ - base) * PHASES + 0.5);
+		const float *in = &input_[(base - (TAPS / 2 - 1)) * 2];
+		const float *coefs = &filter_[phase * TAPS * 2];
+
+#ifdef _M_SSE
+		// Four floats at a time is two stereo frames, so this sums even frames in the low half
+		// and odd frames in the high half.
+		__m128 acc = _mm_mul_ps(_mm_loadu_ps(in), _mm_loadu_ps(coefs));
+		for (int k = 4; k < TAPS * 2; k += 4)
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(in + k), _mm_loadu_ps(coefs + k)));
+		acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+		float result[4];
+		_mm_storeu_ps(result, acc);
+		const float left = result[0];
+		const float right = result[1];
+#else
+		float left = 0.0f;
+		float right = 0.0f;
+		for (int k = 0; k < TAPS * 2; k += 2) {
+			left += in[k] * coefs[k];
+			right += in[k + 1] * coefs[k + 1];
+		}
+#endif
+
+		stereo[produced * 2 + 0] = ClampToS16(left);
+		stereo[produced * 2 + 1] = ClampToS16(right);
+		pos_ += ratio_;
+	}
+
+	// Drop what's no longer needed as history.
+	const int drop = std::min((int)pos_ - (TAPS / 2 - 1), inputFrames_);
+	if (drop > 0) {
+		if (inputFrames_ > drop)
+			memmove(&input_[0], &input_[drop * 2], (inputFrames_ - drop) * 2 * sizeof(float));
+		inputFrames_ -= drop;
+		pos_ -= drop;
+	}
+
+	return produced;
+}
@@ -0,0 +1,66 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+#pragma once
+
+#include <vector>
+
+#include "Common/CommonTypes.h"
+
+// Converts the emulated 44.1 kHz stream to whatever rate the host outputs at, with a polyphase
+// windowed sinc filter.  The ratio is nudged up or down a little depending on how full the queue
+// feeding it is, so if the emulator runs slightly fast or slow (say, paced by the host's vsync
+// instead of audio), we stretch the audio a tiny bit instead of dropping blocks or underrunning.
+//
+// Lives entirely on the host's audio thread.
+class StereoResampler {
+public:
+	StereoResampler();
+
+	void Clear();
+
+	// How many input frames to Feed() before producing outFrames, given the queue fill level.
+	// Also updates the rate control, so call once per Resample().
+	int PrepareResample(int outFrames, int inRate, int outRate, int queuedFrames, int targetFrames);
+	void Feed(const s16 *stereo, int frames);
+	// Returns the number of frames produced, may be less than requested if we're out of input.
+	int Resample(s16 *stereo, int frames);
+
+	double CurrentRatio() const { return ratio_; }
+
+private:
+	void BuildFilter(double cutoff);
+
+	enum {
+		TAPS = 16,
+		PHASE_BITS = 8,
+		PHASES = 1 << PHASE_BITS,
+	};
+
+	// PHASES + 1 sets of TAPS coefficients, each duplicated for left and right.
+	std::vector<float> filter_;
+	// Interleaved stereo input frames.  The first TAPS / 2 - 1 are history from last time.
+	std::vector<float> input_;
+	int inputFrames_;
+	// Position of the next output frame in input_, in frames.
+	double pos_;
+
+	double ratio_;
+	double fillAverage_;
+	int inRate_;
+	int outRate_;
+};
@@ -69,7 +69,7 @@ IdentifiedFileType Identify_File(std::string &filename)
 		}
 		return FILETYPE_PSP_ISO;
 	}
-	else if (!strcasecmp(extension.c_str(),".cso"))
+	else if (!strcasecmp(extension.c_str(),".cso") || !strcasecmp(extension.c_str(),".psz"))
 	{
 		return FILETYPE_PSP_ISO;
 	}
@@ -139,6 +139,10 @@ IdentifiedFileType Identify_File(std::string &filename)
 		}
 		return FILETYPE_UNKNOWN_ELF;
 	}
+	else if (id == 'ZSPP' || id == 'OSIC') {
+		// Compressed images with an unusual extension.
+		return FILETYPE_PSP_ISO;
+	}
 	else if (id == 'PBP\x00') {
 		// Do this PS1 eboot check FIRST before checking other eboot types.
 		// It seems like some are malformed and slip through the PSAR check below.
@@ -15,10 +15,19 @@
 // Official git repository and contact information can be found at
 // https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
 
+#include <algorithm>
+#include <deque>
+#include <functional>
 #include <vector>
 
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 #include "base/timeutil.h"
 #include "i18n/i18n.h"
+#include "thread/thread.h"
+#include "thread/threadutil.h"
 
 #include "Common/StdMutex.h"
 #include "Common/FileUtil.h"
@@ -74,8 +83,7 @@ namespace SaveState
 	CChunkFileReader::Error SaveToRam(std::vector<u8> &data) {
 		SaveStart state;
 		size_t sz = CChunkFileReader::MeasurePtr(state);
-		if (data.size() < sz)
-			data.resize(sz);
+		data.resize(sz);
 		return CChunkFileReader::SavePtr(&data[0], state);
 	}
 
@@ -84,40 +92,91 @@ namespace SaveState
 		return CChunkFileReader::LoadPtr(&data[0], state);
 	}
 
+	// Compares two blocks of a multiple of 16 bytes.
+	static bool BlocksEqual(const u8 *a, const u8 *b, size_t size)
+	{
+#if defined(_M_SSE)
+		for (size_t i = 0; i < size; i += 64)
+		{
+			__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+			eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)), _mm_loadu_si128((const __m128i *)(b + i + 16))));
+			eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)), _mm_loadu_si128((const __m128i *)(b + i + 32))));
+			eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)), _mm_loadu_si128((const __m128i *)(b + i + 48))));
+			if (_mm_movemask_epi8(eq) != 0xFFFF)
+				return false;
+		}
+		return true;
+#else
+		return memcmp(a, b, size) == 0;
+#endif
+	}
+
 	struct StateRingbuffer
 	{
-		StateRingbuffer(int size) : first_(0), next_(0), size_(size), base_(-1)
+		struct Snapshot
+		{
+			std::vector<u8> data;
+			// Uncompressed size.
+			size_t size;
+			int base;
+
+			void Swap(Snapshot &other)
+			{
+				data.swap(other.data);
+				std::swap(size, other.size);
+				std::swap(base, other.base);
+			}
+		};
+
+		StateRingbuffer() : base_(-1), baseUsage_(0), usedBytes_(0)
 		{
-			states_.resize(size);
-			baseMapping_.resize(size);
 		}
 
 		CChunkFileReader::Error Save()
 		{
-			int n = next_++ % size_;
-			if ((next_ % size_) == first_)
-				++first_;
+			double start = real_time_now();
 
-			static std::vector<u8> buffer;
-			std::vector<u8> *compressBuffer = &buffer;
+			std::vector<u8> *compressBuffer = &buffer_;
 			CChunkFileReader::Error err;
 
 			if (base_ == -1 || ++baseUsage_ > BASE_USAGE_INTERVAL)
 			{
 				base_ = (base_ + 1) % ARRAY_SIZE(bases_);
 				baseUsage_ = 0;
+				// Anything diffed against the old contents of this base is useless now.
+				while (!states_.empty() && states_.front().base == base_)
+					DropOldest();
 				err = SaveToRam(bases_[base_]);
 				// Let's not bother savestating twice.
 				compressBuffer = &bases_[base_];
 			}
 			else
-				err = SaveToRam(buffer);
+				err = SaveToRam(buffer_);
 
-			if (err == CChunkFileReader::ERROR_NONE)
-				Compress(states_[n], *compressBuffer, bases_[base_]);
-			else
-				states_[n].clear();
-			baseMapping_[n] = base_;
+			if (err != CChunkFileReader::ERROR_NONE)
+				return err;
+
+			Snapshot snap;
+			snap.base = base_;
+			snap.size = compressBuffer->size();
+			if (!pool_.empty())
+			{
+				snap.data.swap(pool_.back());
+				pool_.pop_back();
+			}
+
+			size_t compressedSize = Compress(scratch_, *compressBuffer, bases_[base_]);
+			snap.data.assign(scratch_.begin(), scratch_.begin() + compressedSize);
+			usedBytes_ += snap.data.capacity();
+			states_.push_back(Snapshot());
+			states_.back().Swap(snap);
+
+			// Always keep the newest, even if it alone is over budget.
+			const size_t budget = (size_t)std::max(g_Config.iRewindMemoryBudgetMB, 0) * 1024 * 1024;
+			while (usedBytes_ > budget && states_.size() > 1)
+				DropOldest();
+
+			DEBUG_LOG(COMMON, "Rewind: saved %d KB as %d KB in %0.2f ms, %d states using %d KB", (int)(compressBuffer->size() / 1024), (int)(compressedSize / 1024), (real_time_now() - start) * 1000.0, (int)states_.size(), (int)(usedBytes_ / 1024));
 			return err;
 		}
 
@@ -127,79 +186,163 @@ namespace SaveState
 			if (Empty())
 				return CChunkFileReader::ERROR_BAD_FILE;
 
-			int n = (--next_ + size_) % size_;
-			if (states_[n].empty())
+			Snapshot &snap = states_.back();
+			bool valid = Decompress(buffer_, snap, bases_[snap.base]);
+			DropNewest();
+			if (!valid)
 				return CChunkFileReader::ERROR_BAD_FILE;
-
-			static std::vector<u8> buffer;
-			Decompress(buffer, states_[n], bases_[baseMapping_[n]]);
-			return LoadFromRam(buffer);
+			return LoadFromRam(buffer_);
 		}
 
-		void Compress(std::vector<u8> &result, const std::vector<u8> &state, const std::vector<u8> &base)
+		// Block format: a flag byte per block, 0 for unchanged from the base, 1 for a raw copy,
+		// or 2 for a snappy compressed copy preceded by its u32 length.  Returns the bytes used.
+		size_t Compress(std::vector<u8> &result, const std::vector<u8> &state, const std::vector<u8> &base)
 		{
-			result.clear();
+			const size_t numBlocks = (state.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			const size_t worstCase = numBlocks * (1 + sizeof(u32)) + snappy_max_compressed_length(BLOCK_SIZE) * numBlocks;
+			// Only grows, so this is a one time cost.
+			if (result.size() < worstCase)
+				result.resize(worstCase);
+
+			u8 *out = &result[0];
 			for (size_t i = 0; i < state.size(); i += BLOCK_SIZE)
 			{
-				int blockSize = std::min(BLOCK_SIZE, (int)(state.size() - i));
-				if (i + blockSize > base.size() || memcmp(&state[i], &base[i], blockSize) != 0)
+				size_t blockSize = std::min((size_t)BLOCK_SIZE, state.size() - i);
+				if (i + blockSize <= base.size())
+				{
+					// The tail block might not be a multiple of 16, just memcmp it.
+					bool same = blockSize == BLOCK_SIZE ? BlocksEqual(&state[i], &base[i], blockSize) : memcmp(&state[i], &base[i], blockSize) == 0;
+					if (same)
+					{
+						*out++ = 0;
+						continue;
+					}
+				}
+
+				if (COMPRESS_CHANGED_BLOCKS)
 				{
-					result.push_back(1);
-					result.insert(result.end(), state.begin() + i, state.begin() +i + blockSize);
+					size_t compLen = snappy_max_compressed_length(blockSize);
+					snappy_compress((const char *)&state[i], blockSize, (char *)out + 1 + sizeof(u32), &compLen);
+					// Only worth it if it saves a decent amount.
+					if (compLen < blockSize - blockSize / 8)
+					{
+						u32 len = (u32)compLen;
+						*out = 2;
+						memcpy(out + 1, &len, sizeof(len));
+						out += 1 + sizeof(u32) + compLen;
+						continue;
+					}
 				}
-				else
-					result.push_back(0);
+
+				*out++ = 1;
+				memcpy(out, &state[i], blockSize);
+				out += blockSize;
 			}
+			return out - &result[0];
 		}
 
-		void Decompress(std::vector<u8> &result, const std::vector<u8> &compressed, const std::vector<u8> &base)
+		bool Decompress(std::vector<u8> &result, const Snapshot &snap, const std::vector<u8> &base)
 		{
-			result.clear();
-			result.reserve(base.size());
-			auto basePos = base.begin();
-			for (size_t i = 0; i < compressed.size(); )
+			result.resize(snap.size);
+			const std::vector<u8> &compressed = snap.data;
+			size_t pos = 0;
+			for (size_t i = 0; i < snap.size; i += BLOCK_SIZE)
 			{
-				if (compressed[i] == 0)
-				{
-					++i;
-					int blockSize = std::min(BLOCK_SIZE, (int)(base.size() - result.size()));
-					result.insert(result.end(), basePos, basePos + blockSize);
-					basePos += blockSize;
-				}
-				else
+				if (pos >= compressed.size())
+					return false;
+
+				size_t blockSize = std::min((size_t)BLOCK_SIZE, snap.size - i);
+				switch (compressed[pos++])
 				{
-					++i;
-					int blockSize = std::min(BLOCK_SIZE, (int)(compressed.size() - i));
-					result.insert(result.end(), compressed.begin() + i, compressed.begin() + i + blockSize);
-					i += blockSize;
-					basePos += blockSize;
+				case 0:
+					if (i + blockSize > base.size())
+						return false;
+					memcpy(&result[i], &base[i], blockSize);
+					break;
+
+				case 1:
+					if (pos + blockSize > compressed.size())
+						return false;
+					memcpy(&result[i], &compressed[pos], blockSize);
+					pos += blockSize;
+					break;
+
+				case 2:
+					{
+						u32 compLen;
+						if (pos + sizeof(compLen) > compressed.size())
+							return false;
+						memcpy(&compLen, &compressed[pos], sizeof(compLen));
+						pos += sizeof(compLen);
+						size_t uncompLen = blockSize;
+						if (pos + compLen > compressed.size())
+							return false;
+						if (snappy_uncompress((const char *)&compressed[pos], compLen, (char *)&result[i], &uncompLen) != SNAPPY_OK || uncompLen != blockSize)
+							return false;
+						pos += compLen;
+					}
+					break;
+
+				default:
+					return false;
 				}
 			}
+			return true;
 		}
 
 		void Clear()
 		{
-			first_ = 0;
-			next_ = 0;
+			while (!states_.empty())
+				DropOldest();
+			base_ = -1;
+			baseUsage_ = 0;
 		}
 
 		bool Empty()
 		{
-			return next_ == first_;
+			return states_.empty();
+		}
+
+	private:
+		void Recycle(Snapshot &snap)
+		{
+			usedBytes_ -= snap.data.capacity();
+			// Keep a few around so we don't reallocate every save.
+			if (pool_.size() < MAX_POOLED_BUFFERS)
+			{
+				pool_.push_back(std::vector<u8>());
+				pool_.back().swap(snap.data);
+			}
+		}
+
+		void DropOldest()
+		{
+			Recycle(states_.front());
+			states_.pop_front();
+		}
+
+		void DropNewest()
+		{
+			Recycle(states_.back());
+			states_.pop_back();
 		}
 
 		static const int BLOCK_SIZE;
 		// TODO: Instead, based on size of compressed state?
 		static const int BASE_USAGE_INTERVAL;
-		typedef std::vector<u8> StateBuffer;
-		int first_;
-		int next_;
-		int size_;
-		std::vector<StateBuffer> states_;
-		StateBuffer bases_[2];
-		std::vector<int> baseMapping_;
+		static const size_t MAX_POOLED_BUFFERS = 4;
+		static const bool COMPRESS_CHANGED_BLOCKS = true;
+
+		std::deque<Snapshot> states_;
+		std::vector<std::vector<u8> > pool_;
+		std::vector<u8> bases_[2];
+		// Reused for saving and restoring the full state, and compressing it.
+		std::vector<u8> buffer_;
+		std::vector<u8> scratch_;
 		int base_;
 		int baseUsage_;
+		// Counts only the snapshots, not the bases or buffers above.
+		size_t usedBytes_;
 	};
 
 	static bool needsProcess = false;
@@ -207,15 +350,48 @@ namespace SaveState
 	static std::recursive_mutex mutex;
 	static bool hasLoadedState = false;
 
-	// TODO: Should this be configurable?
-	static const int REWIND_NUM_STATES = 20;
-	static StateRingbuffer rewindStates(REWIND_NUM_STATES);
+	static StateRingbuffer rewindStates;
 	// TODO: Any reason for this to be configurable?
 	const static float rewindMaxWallFrequency = 1.0f;
 	static float rewindLastTime = 0.0f;
 	const int StateRingbuffer::BLOCK_SIZE = 8192;
 	const int StateRingbuffer::BASE_USAGE_INTERVAL = 15;
 
+	// Serializing the state is quick (it's mostly memcpys of RAM), but compressing and writing
+	// 30+ MB to disk isn't.  So we snapshot on the emu thread and let this thread do the rest.
+	// Only one save is in flight at a time, and it owns saveBuffer until it's joined.
+	static std::thread *saveThread = NULL;
+	static std::vector<u8> saveBuffer;
+
+	static void WaitForSaveThread()
+	{
+		if (saveThread)
+		{
+			saveThread->join();
+			delete saveThread;
+			saveThread = NULL;
+		}
+	}
+
+	static void SaveThreadFunc(Operation op, size_t sz, double snapshotTime, const char *successMessage, const char *failureMessage)
+	{
+		setCurrentThreadName("SaveState");
+
+		double start = real_time_now();
+		CChunkFileReader::Error result = CChunkFileReader::SaveFile(op.filename, REVISION, PPSSPP_GIT_VERSION, &saveBuffer[0], sz);
+		double writeTime = real_time_now() - start;
+
+		bool success = result == CChunkFileReader::ERROR_NONE;
+		if (success)
+			osm.Show(successMessage, 2.0);
+		else
+			osm.Show(failureMessage, 2.0);
+		INFO_LOG(COMMON, "Savestate: %d KB, snapshot %0.2f ms (emu thread), compress and write %0.2f ms", (int)(sz / 1024), snapshotTime * 1000.0, writeTime * 1000.0);
+
+		if (op.callback)
+			op.callback(success, op.cbUserData);
+	}
+
 	void SaveStart::DoState(PointerWrap &p)
 	{
 		auto s = p.Section("SaveStart", 1);
@@ -431,7 +607,6 @@ namespace SaveState
 			return;
 
 		rewindLastTime = time_now();
-		DEBUG_LOG(BOOT, "saving rewind state");
 		rewindStates.Save();
 	}
 
@@ -479,8 +654,14 @@ namespace SaveState
 			switch (op.type)
 			{
 			case SAVESTATE_LOAD:
+				// Might be loading the file we're still writing.
+				WaitForSaveThread();
 				INFO_LOG(COMMON, "Loading state from %s", op.filename.c_str());
-				result = CChunkFileReader::Load(op.filename, REVISION, PPSSPP_GIT_VERSION, state, &reason);
+				{
+					double start = real_time_now();
+					result = CChunkFileReader::Load(op.filename, REVISION_MIN, REVISION, PPSSPP_GIT_VERSION, state, &reason);
+					INFO_LOG(COMMON, "Savestate: load took %0.2f ms", (real_time_now() - start) * 1000.0);
+				}
 				if (result == CChunkFileReader::ERROR_NONE) {
 					osm.Show(s->T("Loaded State"), 2.0);
 					callbackResult = true;
@@ -497,11 +678,20 @@ namespace SaveState
 				break;
 
 			case SAVESTATE_SAVE:
+			{
 				INFO_LOG(COMMON, "Saving state to %s", op.filename.c_str());
-				result = CChunkFileReader::Save(op.filename, REVISION, PPSSPP_GIT_VERSION, state);
+				// The previous save still owns the buffer.
+				WaitForSaveThread();
+				double start = real_time_now();
+				size_t sz = CChunkFileReader::MeasurePtr(state);
+				if (saveBuffer.size() < sz)
+					saveBuffer.resize(sz);
+				result = CChunkFileReader::SavePtr(&saveBuffer[0], state);
+				double snapshotTime = real_time_now() - start;
 				if (result == CChunkFileReader::ERROR_NONE) {
-					osm.Show(s->T("Saved State"), 2.0);
-					callbackResult = true;
+					// The callback is called by the save thread once the file is written.
+					saveThread = new std::thread(std::bind(&SaveThreadFunc, op, sz, snapshotTime, s->T("Saved State"), i18nSaveFailure));
+					continue;
 				} else if (result == CChunkFileReader::ERROR_BROKEN_STATE) {
 					HandleFailure();
 					osm.Show(i18nSaveFailure, 2.0);
@@ -512,6 +702,7 @@ namespace SaveState
 					callbackResult = false;
 				}
 				break;
+			}
 
 			case SAVESTATE_VERIFY:
 				INFO_LOG(COMMON, "Verifying save state system");
@@ -567,4 +758,9 @@ namespace SaveState
 
 		hasLoadedState = false;
 	}
+
+	void Shutdown()
+	{
+		WaitForSaveThread();
+	}
 }
@@ -25,10 +25,15 @@ namespace SaveState
 	typedef void (*Callback)(bool status, void *cbUserData);
 
 	// TODO: Better place for this?
-	const int REVISION = 4;
+	// Revision 5 compresses in independent chunks, which older versions can't read.
+	// Revision 4 states are still loaded.
+	const int REVISION_MIN = 4;
+	const int REVISION = 5;
 	const int SAVESTATESLOTS = 5;
 
 	void Init();
+	// Waits for any save still being written in the background.
+	void Shutdown();
 
 	// Cycle through the 5 savestate slots
 	void NextSlot();
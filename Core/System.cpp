@@ -486,6 +486,8 @@ std::string GetSysDirectory(PSPDirectories directoryType) {
 		return g_Config.memCardDirectory + "PAUTH/";
 	case DIRECTORY_DUMP:
 		return g_Config.memCardDirectory + "PSP/SYSTEM/DUMP/";
+	case DIRECTORY_CACHE:
+		return g_Config.memCardDirectory + "PSP/SYSTEM/CACHE/";
 	// Just return the memory stick root if we run into some sort of problem.
 	default:
 		ERROR_LOG(FILESYS, "Unknown directory type.");
@@ -0,0 +1,157 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+#include <cstring>
+
+#include "Common/MemoryUtil.h"
+#include "GPU/Common/DecodedVertexCache.h"
+#include "GPU/Common/TextureDecoder.h"
+
+// Every this many lookups, check whether the cache is paying for itself.
+static const int WINDOW_LOOKUPS = 1024;
+// If fewer than 1 in this many were hits, hashing costs more than it saves.
+static const int MIN_HIT_RATIO = 8;
+// How many ranges to decode directly before trying again.
+static const int BYPASS_RANGES = 16384;
+
+DecodedVertexCache::DecodedVertexCache() : windowLookups_(0), windowHits_(0), bypassLeft_(0), writePos_(0), useCounter_(0) {
+	table_ = new Entry[TABLE_SIZE];
+	arena_ = (u8 *)AllocateMemoryPages(ARENA_SIZE);
+	Clear();
+}
+
+DecodedVertexCache::~DecodedVertexCache() {
+	delete [] table_;
+	FreeMemoryPages(arena_, ARENA_SIZE);
+}
+
+void DecodedVertexCache::MakeKey(Key &key, const void *src, u32 vertTypeID, int vertexSize, int lowerBound, int upperBound, u32 seed) {
+	key.src = src;
+	key.vertTypeID = vertTypeID;
+	key.lowerBound = (u16)lowerBound;
+	key.upperBound = (u16)upperBound;
+	const u8 *start = (const u8 *)src + vertexSize * lowerBound;
+	key.srcSize = vertexSize * (upperBound - lowerBound + 1);
+	key.hash = DoReliableHash(start, key.srcSize, seed);
+	// A 32-bit hash alone collides too often over the many ranges of a session.
+	key.hash2 = DoReliableHash(start, key.srcSize, seed ^ 0x9E3779B1);
+}
+
+bool DecodedVertexCache::KeyEquals(const Key &a, const Key &b) {
+	return a.src == b.src && a.vertTypeID == b.vertTypeID && a.lowerBound == b.lowerBound &&
+		a.upperBound == b.upperBound && a.srcSize == b.srcSize && a.hash == b.hash && a.hash2 == b.hash2;
+}
+
+bool DecodedVertexCache::Enabled() {
+	if (bypassLeft_ > 0) {
+		bypassLeft_--;
+		return false;
+	}
+	return true;
+}
+
+u32 DecodedVertexCache::Bucket(const Key &key) const {
+	// Only the address and type choose the bucket, the content hash is verified on lookup.
+	// That way a changed vertex buffer lands in the same set and evicts its old version.
+	u32 h = (u32)(uintptr_t)key.src;
+	h ^= key.vertTypeID * 0x9E3779B1;
+	h ^= (key.lowerBound | (key.upperBound << 16)) * 0x85EBCA6B;
+	h ^= h >> 15;
+	return (h & (TABLE_SIZE - 1)) & ~(TABLE_WAYS - 1);
+}
+
+bool DecodedVertexCache::IsLive(const Entry &e) const {
+	return e.size != 0 && e.arenaPos + ARENA_SIZE >= writePos_;
+}
+
+bool DecodedVertexCache::Lookup(const Key &key, u8 *dest, u32 size, u8 *flags) {
+	Entry *set = table_ + Bucket(key);
+	for (int i = 0; i < TABLE_WAYS; ++i) {
+		Entry &e = set[i];
+		if (e.size == size && KeyEquals(e.key, key) && IsLive(e)) {
+			memcpy(dest, arena_ + (e.arenaPos % ARENA_SIZE), size);
+			e.lastUse = ++useCounter_;
+			*flags = e.flags;
+			stats.hits++;
+			stats.bytesReused += size;
+			windowHits_++;
+			windowLookups_++;
+			return true;
+		}
+	}
+	stats.misses++;
+	stats.bytesDecoded += size;
+
+	if (++windowLookups_ >= WINDOW_LOOKUPS) {
+		if (windowHits_ * MIN_HIT_RATIO < windowLookups_)
+			bypassLeft_ = BYPASS_RANGES;
+		windowLookups_ = 0;
+		windowHits_ = 0;
+	}
+	return false;
+}
+
+void DecodedVertexCache::Store(const Key &key, const u8 *data, u32 size, u8 flags) {
+	if (size == 0 || size > ARENA_SIZE / 4) {
+		return;
+	}
+
+	// Pick a slot: a stale one if possible, otherwise evict the least recently used.
+	Entry *set = table_ + Bucket(key);
+	Entry *victim = &set[0];
+	for (int i = 0; i < TABLE_WAYS; ++i) {
+		Entry &e = set[i];
+		if (!IsLive(e) || (e.key.src == key.src && e.key.vertTypeID == key.vertTypeID && e.key.lowerBound == key.lowerBound && e.key.upperBound == key.upperBound)) {
+			victim = &e;
+			break;
+		}
+		if (e.lastUse < victim->lastUse) {
+			victim = &e;
+		}
+	}
+
+	// Never let an allocation straddle the end of the arena, just skip ahead to the start.
+	u32 offset = (u32)(writePos_ % ARENA_SIZE);
+	if (offset + size > ARENA_SIZE) {
+		writePos_ += ARENA_SIZE - offset;
+		offset = 0;
+	}
+
+	memcpy(arena_ + offset, data, size);
+	victim->key = key;
+	victim->arenaPos = writePos_;
+	victim->size = size;
+	victim->flags = flags;
+	victim->lastUse = ++useCounter_;
+
+	// Keep the allocations 16-byte aligned.
+	writePos_ += (size + 15) & ~15;
+}
+
+void DecodedVertexCache::Clear() {
+	memset(table_, 0, sizeof(Entry) * TABLE_SIZE);
+	writePos_ = 0;
+	useCounter_ = 0;
+	windowLookups_ = 0;
+	windowHits_ = 0;
+	bypassLeft_ = 0;
+	ResetStats();
+}
+
+void DecodedVertexCache::ResetStats() {
+	memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+#pragma once
+
+#include "Common/CommonTypes.h"
+
+// Cache of post-decode vertex data, shared across frames.
+//
+// Unlike the VertexArrayInfo tracking in TransformDrawEngine, which only helps when the exact
+// same sequence of draw calls is repeated between flushes, this is keyed per decoded range:
+// (source pointer, vertex type, index range, content hash). It can therefore serve the software
+// transform path and spline/bezier control point normalization too.
+//
+// Storage is a flat, set-associative hash table of entries pointing into a ring-allocated arena.
+// Nothing is ever explicitly freed - when the arena wraps around, old entries simply go stale
+// and their slots are reused.
+//
+// Hashing and storing every range isn't free, so the cache keeps track of how often it's hit
+// and turns itself off for a while when hardly anything is reused (see Enabled()).
+class DecodedVertexCache {
+public:
+	DecodedVertexCache();
+	~DecodedVertexCache();
+
+	struct Key {
+		const void *src;
+		u32 vertTypeID;
+		u16 lowerBound;
+		u16 upperBound;
+		// Bytes of source data covered, and two independent hashes of them.
+		u32 srcSize;
+		u32 hash;
+		u32 hash2;
+	};
+
+	// Computes the key for a range of source vertices. The seed should contain any state
+	// that affects the decoded output but isn't part of the vertex type (like UV prescale).
+	static void MakeKey(Key &key, const void *src, u32 vertTypeID, int vertexSize, int lowerBound, int upperBound, u32 seed);
+
+	// Copies the cached decoded data to dest and returns true if present.
+	bool Lookup(const Key &key, u8 *dest, u32 size, u8 *flags);
+	// Stores size bytes of decoded data. Silently does nothing if too large for the arena.
+	void Store(const Key &key, const u8 *data, u32 size, u8 flags);
+
+	void Clear();
+
+	// Whether it's worth calling MakeKey()/Lookup()/Store() for the next range. When not, just
+	// decode directly.
+	bool Enabled();
+
+	// Statistics, reset by the caller each frame.
+	struct Stats {
+		int hits;
+		int misses;
+		int bytesDecoded;
+		int bytesReused;
+	};
+	Stats stats;
+	void ResetStats();
+
+private:
+	struct Entry {
+		Key key;
+		u64 arenaPos;
+		u32 size;
+		u32 lastUse;
+		u8 flags;
+	};
+
+	enum {
+		TABLE_SIZE = 4096,
+		TABLE_WAYS = 8,
+		ARENA_SIZE = 8 * 1024 * 1024,
+	};
+
+	u32 Bucket(const Key &key) const;
+	bool IsLive(const Entry &e) const;
+	static bool KeyEquals(const Key &a, const Key &b);
+
+	// Recent lookups and hits, to decide when to bypass the cache.
+	int windowLookups_;
+	int windowHits_;
+	// Ranges left to decode without the cache before trying it again.
+	int bypassLeft_;
+
+	Entry *table_;
+	u8 *arena_;
+	// Monotonic position of the next allocation. The actual offset is writePos_ % ARENA_SIZE.
+	u64 writePos_;
+	u32 useCounter_;
+};
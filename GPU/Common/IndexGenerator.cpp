@@ -19,6 +19,10 @@
 
 #include "Common/Common.h"
 
+#if defined(_M_SSE)
+#include <emmintrin.h>
+#endif
+
 // Points don't need indexing...
 static const u8 indexedPrimitiveType[7] = {
 	GE_PRIM_POINTS,
@@ -30,6 +34,108 @@ static const u8 indexedPrimitiveType[7] = {
 	GE_PRIM_RECTANGLES,
 };
 
+#if defined(_M_SSE)
+static inline __m128i LoadIndices8(const u8 *inds) {
+	return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)inds), _mm_setzero_si128());
+}
+
+static inline __m128i LoadIndices8(const u16_le *inds) {
+	return _mm_loadu_si128((const __m128i *)inds);
+}
+
+// Writes a0 b0 c0 a1 b1 c1 ... where each element is a 32-bit pair of indices (24 indices total.)
+// The strip and fan expansions both come out as three pairs per two triangles.
+static inline void StorePairsInterleaved3(u16 *outInds, __m128i a, __m128i b, __m128i c) {
+	const __m128 abLo = _mm_castsi128_ps(_mm_unpacklo_epi32(a, b));  // a0 b0 a1 b1
+	const __m128 caLo = _mm_castsi128_ps(_mm_unpacklo_epi32(c, a));  // c0 a0 c1 a1
+	const __m128 bcLo = _mm_castsi128_ps(_mm_unpacklo_epi32(b, c));  // b0 c0 b1 c1
+	const __m128 abHi = _mm_castsi128_ps(_mm_unpackhi_epi32(a, b));  // a2 b2 a3 b3
+	const __m128 caHi = _mm_castsi128_ps(_mm_unpackhi_epi32(c, a));  // c2 a2 c3 a3
+	const __m128 bcHi = _mm_castsi128_ps(_mm_unpackhi_epi32(b, c));  // b2 c2 b3 c3
+	float *out = (float *)outInds;
+	_mm_storeu_ps(out + 0, _mm_shuffle_ps(abLo, caLo, _MM_SHUFFLE(3, 0, 1, 0)));
+	_mm_storeu_ps(out + 4, _mm_shuffle_ps(bcLo, abHi, _MM_SHUFFLE(1, 0, 3, 2)));
+	_mm_storeu_ps(out + 8, _mm_shuffle_ps(caHi, bcHi, _MM_SHUFFLE(3, 2, 3, 0)));
+}
+#endif
+
+static inline int RoundUpTo(int count, int multiple) {
+	return count <= 0 ? 0 : ((count + multiple - 1) / multiple) * multiple;
+}
+
+// Lists, points and rectangles are already in the order we want, they just need the offset.
+template <typename ITYPE>
+static inline u16 *TranslateWithOffset(u16 *outInds, const ITYPE *inds, int count, int indexOffset) {
+	if (count <= 0)
+		return outInds;
+	int i = 0;
+#if defined(_M_SSE)
+	const __m128i offset = _mm_set1_epi16((s16)indexOffset);
+	for (; i + 8 <= count; i += 8) {
+		_mm_storeu_si128((__m128i *)(outInds + i), _mm_add_epi16(LoadIndices8(inds + i), offset));
+	}
+#endif
+	for (; i < count; i++) {
+		outInds[i] = indexOffset + inds[i];
+	}
+	return outInds + count;
+}
+
+template <typename ITYPE>
+static inline u16 *TranslateStripInds(u16 *outInds, const ITYPE *inds, int numTris, int indexOffset) {
+	int i = 0;
+#if defined(_M_SSE)
+	// Each pair of triangles is (s0 s1 s2) (s1 s3 s2), which as 32-bit pairs is
+	// (s0 s1) (s2 s1) (s3 s2). Eight triangles read ten indices.
+	const __m128i offset = _mm_set1_epi16((s16)indexOffset);
+	const __m128i lowMask = _mm_set1_epi32(0x0000FFFF);
+	for (; i + 8 <= numTris; i += 8) {
+		const __m128i p = _mm_add_epi16(LoadIndices8(inds + i), offset);
+		const __m128i q = _mm_add_epi16(LoadIndices8(inds + i + 2), offset);
+		const __m128i mid = _mm_or_si128(_mm_and_si128(q, lowMask), _mm_andnot_si128(lowMask, p));
+		const __m128i swapped = _mm_or_si128(_mm_slli_epi32(q, 16), _mm_srli_epi32(q, 16));
+		StorePairsInterleaved3(outInds, p, mid, swapped);
+		outInds += 24;
+	}
+#endif
+	// Always starts on an even triangle, so the winding starts over.
+	int wind = 1;
+	for (; i < numTris; i++) {
+		*outInds++ = indexOffset + inds[i];
+		*outInds++ = indexOffset + inds[i + wind];
+		wind ^= 3;  // Toggle between 1 and 2
+		*outInds++ = indexOffset + inds[i + wind];
+	}
+	return outInds;
+}
+
+template <typename ITYPE>
+static inline u16 *TranslateFanInds(u16 *outInds, const ITYPE *inds, int numTris, int indexOffset) {
+	const u16 first = indexOffset + inds[0];
+	int i = 0;
+#if defined(_M_SSE)
+	// Two triangles are (s0 s1 s2) (s0 s2 s3), or as 32-bit pairs (s0 s1) (s2 s0) (s2 s3).
+	const __m128i offset = _mm_set1_epi16((s16)indexOffset);
+	const __m128i lowMask = _mm_set1_epi32(0x0000FFFF);
+	const __m128i firstLo = _mm_and_si128(_mm_set1_epi16((s16)first), lowMask);
+	const __m128i firstHi = _mm_slli_epi32(firstLo, 16);
+	for (; i + 8 <= numTris; i += 8) {
+		const __m128i r = _mm_add_epi16(LoadIndices8(inds + i + 1), offset);
+		const __m128i t = _mm_add_epi16(LoadIndices8(inds + i + 2), offset);
+		const __m128i a = _mm_or_si128(firstLo, _mm_slli_epi32(r, 16));
+		const __m128i b = _mm_or_si128(firstHi, _mm_srli_epi32(r, 16));
+		StorePairsInterleaved3(outInds, a, b, t);
+		outInds += 24;
+	}
+#endif
+	for (; i < numTris; i++) {
+		*outInds++ = first;
+		*outInds++ = indexOffset + inds[i + 1];
+		*outInds++ = indexOffset + inds[i + 2];
+	}
+	return outInds;
+}
+
 void IndexGenerator::Reset() {
 	prim_ = GE_PRIM_INVALID;
 	count_ = 0;
@@ -212,10 +318,7 @@ void IndexGenerator::TranslatePrim(int prim, int numInds, const u16 *inds, int i
 
 void IndexGenerator::TranslatePoints(int numInds, const u8 *inds, int indexOffset) {
 	indexOffset = index_ - indexOffset;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numInds; i++)
-		*outInds++ = indexOffset + inds[i];
-	inds_ = outInds;
+	inds_ = TranslateWithOffset(inds_, inds, numInds, indexOffset);
 	count_ += numInds;
 	prim_ = GE_PRIM_POINTS;
 	seenPrims_ |= (1 << GE_PRIM_POINTS) | SEEN_INDEX8;
@@ -224,10 +327,7 @@ void IndexGenerator::TranslatePoints(int numInds, const u8 *inds, int indexOffse
 void IndexGenerator::TranslatePoints(int numInds, const u16 *_inds, int indexOffset) {
 	indexOffset = index_ - indexOffset;
 	const u16_le *inds = (u16_le*)_inds;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numInds; i++)
-		*outInds++ = indexOffset + inds[i];
-	inds_ = outInds;
+	inds_ = TranslateWithOffset(inds_, inds, numInds, indexOffset);
 	count_ += numInds;
 	prim_ = GE_PRIM_POINTS;
 	seenPrims_ |= (1 << GE_PRIM_POINTS) | SEEN_INDEX16;
@@ -235,30 +335,17 @@ void IndexGenerator::TranslatePoints(int numInds, const u16 *_inds, int indexOff
 
 void IndexGenerator::TranslateList(int numInds, const u8 *inds, int indexOffset) {
 	indexOffset = index_ - indexOffset;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numInds; i += 3) {
-		*outInds++ = indexOffset + inds[i];
-		*outInds++ = indexOffset + inds[i + 1];
-		*outInds++ = indexOffset + inds[i + 2];
-	}
-	inds_ = outInds;
+	// Partial triangles are still written out whole, like they always have been.
+	inds_ = TranslateWithOffset(inds_, inds, RoundUpTo(numInds, 3), indexOffset);
 	count_ += numInds;
 	prim_ = GE_PRIM_TRIANGLES;
 	seenPrims_ |= (1 << GE_PRIM_TRIANGLES) | SEEN_INDEX8;
 }
 
 void IndexGenerator::TranslateStrip(int numInds, const u8 *inds, int indexOffset) {
-	int wind = 1;
 	indexOffset = index_ - indexOffset;
 	int numTris = numInds - 2;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numTris; i++) {
-		*outInds++ = indexOffset + inds[i];
-		*outInds++ = indexOffset + inds[i + wind];
-		wind ^= 3;  // Toggle between 1 and 2
-		*outInds++ = indexOffset + inds[i + wind];
-	}
-	inds_ = outInds;
+	inds_ = TranslateStripInds(inds_, inds, numTris, indexOffset);
 	count_ += numTris * 3;
 	prim_ = GE_PRIM_TRIANGLES;
 	seenPrims_ |= (1 << GE_PRIM_TRIANGLE_STRIP) | SEEN_INDEX8;
@@ -268,13 +355,7 @@ void IndexGenerator::TranslateFan(int numInds, const u8 *inds, int indexOffset)
 	if (numInds <= 0) return;
 	indexOffset = index_ - indexOffset;
 	int numTris = numInds - 2;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numTris; i++) {
-		*outInds++ = indexOffset + inds[0];
-		*outInds++ = indexOffset + inds[i + 1];
-		*outInds++ = indexOffset + inds[i + 2];
-	}
-	inds_ = outInds;
+	inds_ = TranslateFanInds(inds_, inds, numTris, indexOffset);
 	count_ += numTris * 3;
 	prim_ = GE_PRIM_TRIANGLES;
 	seenPrims_ |= (1 << GE_PRIM_TRIANGLE_FAN) | SEEN_INDEX8;
@@ -283,13 +364,7 @@ void IndexGenerator::TranslateFan(int numInds, const u8 *inds, int indexOffset)
 void IndexGenerator::TranslateList(int numInds, const u16 *_inds, int indexOffset) {
 	const u16_le *inds = (u16_le*)_inds;
 	indexOffset = index_ - indexOffset;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numInds; i += 3) {
-		*outInds++ = indexOffset + inds[i];
-		*outInds++ = indexOffset + inds[i + 1];
-		*outInds++ = indexOffset + inds[i + 2];
-	}
-	inds_ = outInds;
+	inds_ = TranslateWithOffset(inds_, inds, RoundUpTo(numInds, 3), indexOffset);
 	count_ += numInds;
 	prim_ = GE_PRIM_TRIANGLES;
 	seenPrims_ |= (1 << GE_PRIM_TRIANGLES) | SEEN_INDEX16;
@@ -297,17 +372,9 @@ void IndexGenerator::TranslateList(int numInds, const u16 *_inds, int indexOffse
 
 void IndexGenerator::TranslateStrip(int numInds, const u16 *_inds, int indexOffset) {
 	const u16_le *inds = (u16_le*)_inds;
-	int wind = 1;
 	indexOffset = index_ - indexOffset;
 	int numTris = numInds - 2;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numTris; i++) {
-		*outInds++ = indexOffset + inds[i];
-		*outInds++ = indexOffset + inds[i + wind];
-		wind ^= 3;  // Toggle between 1 and 2
-		*outInds++ = indexOffset + inds[i + wind];
-	}
-	inds_ = outInds;
+	inds_ = TranslateStripInds(inds_, inds, numTris, indexOffset);
 	count_ += numTris * 3;
 	prim_ = GE_PRIM_TRIANGLES;
 	seenPrims_ |= (1 << GE_PRIM_TRIANGLE_STRIP) | SEEN_INDEX16;
@@ -318,13 +385,7 @@ void IndexGenerator::TranslateFan(int numInds, const u16 *_inds, int indexOffset
 	if (numInds <= 0) return;
 	indexOffset = index_ - indexOffset;
 	int numTris = numInds - 2;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numTris; i++) {
-		*outInds++ = indexOffset + inds[0];
-		*outInds++ = indexOffset + inds[i + 1];
-		*outInds++ = indexOffset + inds[i + 2];
-	}
-	inds_ = outInds;
+	inds_ = TranslateFanInds(inds_, inds, numTris, indexOffset);
 	count_ += numTris * 3;
 	prim_ = GE_PRIM_TRIANGLES;
 	seenPrims_ |= (1 << GE_PRIM_TRIANGLE_FAN) | SEEN_INDEX16;
@@ -332,12 +393,7 @@ void IndexGenerator::TranslateFan(int numInds, const u16 *_inds, int indexOffset
 
 void IndexGenerator::TranslateLineList(int numInds, const u8 *inds, int indexOffset) {
 	indexOffset = index_ - indexOffset;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numInds; i += 2) {
-		*outInds++ = indexOffset + inds[i];
-		*outInds++ = indexOffset + inds[i+1];
-	}
-	inds_ = outInds;
+	inds_ = TranslateWithOffset(inds_, inds, RoundUpTo(numInds, 2), indexOffset);
 	prim_ = GE_PRIM_LINES;
 	seenPrims_ |= (1 << GE_PRIM_LINES) | SEEN_INDEX8;
 }
@@ -359,12 +415,7 @@ void IndexGenerator::TranslateLineStrip(int numInds, const u8 *inds, int indexOf
 void IndexGenerator::TranslateLineList(int numInds, const u16 *_inds, int indexOffset) {
 	indexOffset = index_ - indexOffset;
 	const u16_le *inds = (u16_le*)_inds;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numInds; i += 2) {
-		*outInds++ = indexOffset + inds[i];
-		*outInds++ = indexOffset + inds[i+1];
-	}
-	inds_ = outInds;
+	inds_ = TranslateWithOffset(inds_, inds, RoundUpTo(numInds, 2), indexOffset);
 	count_ += numInds;
 	prim_ = GE_PRIM_LINES;
 	seenPrims_ |= (1 << GE_PRIM_LINES) | SEEN_INDEX16;
@@ -387,12 +438,7 @@ void IndexGenerator::TranslateLineStrip(int numInds, const u16 *_inds, int index
 
 void IndexGenerator::TranslateRectangles(int numInds, const u8 *inds, int indexOffset) {
 	indexOffset = index_ - indexOffset;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numInds; i += 2) {
-		*outInds++ = indexOffset + inds[i];
-		*outInds++ = indexOffset + inds[i+1];
-	}
-	inds_ = outInds;
+	inds_ = TranslateWithOffset(inds_, inds, RoundUpTo(numInds, 2), indexOffset);
 	count_ += numInds;
 	prim_ = GE_PRIM_RECTANGLES;
 	seenPrims_ |= (1 << GE_PRIM_RECTANGLES) | SEEN_INDEX8;
@@ -401,12 +447,7 @@ void IndexGenerator::TranslateRectangles(int numInds, const u8 *inds, int indexO
 void IndexGenerator::TranslateRectangles(int numInds, const u16 *_inds, int indexOffset) {	
 	indexOffset = index_ - indexOffset;
 	const u16_le *inds = (u16_le*)_inds;
-	u16 *outInds = inds_;
-	for (int i = 0; i < numInds; i += 2) {
-		*outInds++ = indexOffset + inds[i];
-		*outInds++ = indexOffset + inds[i+1];
-	}
-	inds_ = outInds;
+	inds_ = TranslateWithOffset(inds_, inds, RoundUpTo(numInds, 2), indexOffset);
 	count_ += numInds * 2;
 	prim_ = GE_PRIM_RECTANGLES;
 	seenPrims_ |= (1 << GE_PRIM_RECTANGLES) | SEEN_INDEX16;
@@ -0,0 +1,752 @@
+// Copyright (c) 2013- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "Common/ThreadPools.h"
+#include "Core/Config.h"
+#include "GPU/GPUState.h"
+#include "GPU/ge_constants.h"
+#include "GPU/Common/SplineCommon.h"
+
+// Here's how to evaluate them fast:
+// http://and-what-happened.blogspot.se/2012/07/evaluating-b-splines-aka-basis-splines.html
+
+enum quality {
+	LOW_QUALITY = 0,
+	MEDIUM_QUALITY = 1,
+	HIGH_QUALITY = 2,
+};
+
+#define START_OPEN 1
+#define END_OPEN 2
+
+// Below this many generated vertices, it's not worth waking up the thread pool.
+static const int MIN_PARALLEL_VERTICES = 1024;
+
+static float lerp(float a, float b, float x) {
+	return a + x * (b - a);
+}
+
+static void lerpColor(const u8 a[4], const u8 b[4], float x, u8 out[4]) {
+	for (int i = 0; i < 4; i++) {
+		out[i] = (float)a[i] + x * ((float)b[i] - (float)a[i]);
+	}
+}
+
+void BezierPatch::sampleColor(float u, float v, u8 color[4]) const {
+	u *= 3.0f;
+	v *= 3.0f;
+	int iu = (int)floorf(u);
+	int iv = (int)floorf(v);
+	int iu2 = iu + 1;
+	int iv2 = iv + 1;
+	float fracU = u - iu;
+	float fracV = v - iv;
+	if (iu2 > 3) iu2 = 3;
+	if (iv2 > 3) iv2 = 3;
+
+	int tl = iu + 4 * iv;
+	int tr = iu2 + 4 * iv;
+	int bl = iu + 4 * iv2;
+	int br = iu2 + 4 * iv2;
+
+	u8 upperColor[4], lowerColor[4];
+	lerpColor(points[tl]->color, points[tr]->color, fracU, upperColor);
+	lerpColor(points[bl]->color, points[br]->color, fracU, lowerColor);
+	lerpColor(upperColor, lowerColor, fracV, color);
+}
+
+void BezierPatch::sampleTexUV(float u, float v, float &tu, float &tv) const {
+	u *= 3.0f;
+	v *= 3.0f;
+	int iu = (int)floorf(u);
+	int iv = (int)floorf(v);
+	int iu2 = iu + 1;
+	int iv2 = iv + 1;
+	float fracU = u - iu;
+	float fracV = v - iv;
+	if (iu2 > 3) iu2 = 3;
+	if (iv2 > 3) iv2 = 3;
+
+	int tl = iu + 4 * iv;
+	int tr = iu2 + 4 * iv;
+	int bl = iu + 4 * iv2;
+	int br = iu2 + 4 * iv2;
+
+	float upperTU = lerp(points[tl]->uv[0], points[tr]->uv[0], fracU);
+	float upperTV = lerp(points[tl]->uv[1], points[tr]->uv[1], fracU);
+	float lowerTU = lerp(points[bl]->uv[0], points[br]->uv[0], fracU);
+	float lowerTV = lerp(points[bl]->uv[1], points[br]->uv[1], fracU);
+	tu = lerp(upperTU, lowerTU, fracV);
+	tv = lerp(upperTV, lowerTV, fracV);
+}
+
+static void CopyQuad(u8 *&dest, const SimpleVertex *v1, const SimpleVertex *v2, const SimpleVertex* v3, const SimpleVertex *v4) {
+	int vertexSize = sizeof(SimpleVertex);
+	memcpy(dest, v1, vertexSize);
+	dest += vertexSize;
+	memcpy(dest, v2, vertexSize);
+	dest += vertexSize;
+	memcpy(dest, v3, vertexSize);
+	dest += vertexSize;
+	memcpy(dest, v4, vertexSize);
+	dest += vertexSize;
+}
+
+static void RunRows(const std::function<void(int,int)> &func, int lower, int upper, bool parallel) {
+	if (parallel) {
+		GlobalThreadPool::Loop(func, lower, upper);
+	} else {
+		func(lower, upper);
+	}
+}
+
+#undef b2
+
+// Bernstein basis functions
+inline float bern0(float x) { return (1 - x) * (1 - x) * (1 - x); }
+inline float bern1(float x) { return 3 * x * (1 - x) * (1 - x); }
+inline float bern2(float x) { return 3 * x * x * (1 - x); }
+inline float bern3(float x) { return x * x * x; }
+
+inline float bern0deriv(float x) { return -3 * (x - 1) * (x - 1); }
+inline float bern1deriv(float x) { return 9 * x * x - 12 * x + 3; }
+inline float bern2deriv(float x) { return 3 * (2 - 3 * x) * x; }
+inline float bern3deriv(float x) { return 3 * x * x; }
+
+static void spline_n_4(int i, float t, float *knot, float *splineVal) {
+	knot += i + 1;
+
+	float t0 = (t - knot[0]);
+	float t1 = (t - knot[1]);
+	float t2 = (t - knot[2]);
+	float f30 = t0/(knot[3]-knot[0]);
+	float f41 = t1/(knot[4]-knot[1]);
+	float f52 = t2/(knot[5]-knot[2]);
+	float f31 = t1/(knot[3]-knot[1]);
+	float f42 = t2/(knot[4]-knot[2]);
+	float f32 = t2/(knot[3]-knot[2]);
+	float a = (1-f30)*(1-f31);
+	float b = (f31*f41);
+	float c = (1-f41)*(1-f42);
+	float d = (f42*f52);
+
+	splineVal[0] = a-(a*f32);
+	splineVal[1] = 1-a-b+((a+b+c-1)*f32);
+	splineVal[2] = b+((1-b-c-d)*f32);
+	splineVal[3] = d*f32;
+}
+
+// knot should be an array sized n + 5  (n + 1 + 1 + degree (cubic))
+static void spline_knot(int n, int type, float *knot) {
+	memset(knot, 0, sizeof(float) * (n + 5));
+	for (int i = 0; i < n - 1; ++i)
+		knot[i + 3] = i;
+
+	if ((type & 1) == 0) {
+		knot[0] = -3;
+		knot[1] = -2;
+		knot[2] = -1;
+	}
+	if ((type & 2) == 0) {
+		knot[n + 2] = n - 1;
+		knot[n + 3] = n;
+		knot[n + 4] = n + 1;
+	} else {
+		knot[n + 2] = n - 2;
+		knot[n + 3] = n - 2;
+		knot[n + 4] = n - 2;
+	}
+}
+
+// Basis weights only depend on the control point count, knot type and tesselation level,
+// so they are computed once per combination rather than once per generated vertex.
+struct SplineWeight {
+	int base;
+	float w[4];
+};
+
+struct BezierWeight {
+	float basis[4];
+	float deriv[4];
+};
+
+typedef std::map<u32, std::vector<SplineWeight> > SplineWeightCache;
+typedef std::map<u32, std::vector<BezierWeight> > BezierWeightCache;
+static SplineWeightCache splineWeightCache;
+static BezierWeightCache bezierWeightCache;
+
+// Not expected to grow large, but don't let a weird game make it grow forever.
+static void TrimWeightCaches() {
+	if (splineWeightCache.size() > 64)
+		splineWeightCache.clear();
+	if (bezierWeightCache.size() > 64)
+		bezierWeightCache.clear();
+}
+
+static const SplineWeight *GetSplineWeights(int n, int type, int divisions) {
+	const u32 key = (n & 0xFF) | ((type & 3) << 8) | (divisions << 16);
+	SplineWeightCache::iterator iter = splineWeightCache.find(key);
+	if (iter != splineWeightCache.end())
+		return &iter->second[0];
+
+	std::vector<SplineWeight> &weights = splineWeightCache[key];
+	weights.resize(divisions + 1);
+
+	std::vector<float> knot(n + 5);
+	spline_knot(n, type, &knot[0]);
+	for (int i = 0; i < divisions + 1; i++) {
+		float t = ((float)i * (float)(n - 2) / (float)(divisions + 0.00001f));  // epsilon to prevent division by 0 in spline_s
+		if (t < 0.0f)
+			t = 0.0f;
+		SplineWeight &sw = weights[i];
+		sw.base = (int)t;
+		spline_n_4(sw.base, t, &knot[0], sw.w);
+		// Degenerate knots can give NaNs - those never contributed, same as non-positive weights.
+		for (int j = 0; j < 4; j++) {
+			if (!(sw.w[j] > 0.0f))
+				sw.w[j] = 0.0f;
+		}
+	}
+	return &weights[0];
+}
+
+static const BezierWeight *GetBezierWeights(int tess) {
+	BezierWeightCache::iterator iter = bezierWeightCache.find(tess);
+	if (iter != bezierWeightCache.end())
+		return &iter->second[0];
+
+	std::vector<BezierWeight> &weights = bezierWeightCache[tess];
+	weights.resize(tess + 1);
+	for (int i = 0; i < tess + 1; i++) {
+		const float x = (float)i / (float)tess;
+		BezierWeight &bw = weights[i];
+		bw.basis[0] = bern0(x);
+		bw.basis[1] = bern1(x);
+		bw.basis[2] = bern2(x);
+		bw.basis[3] = bern3(x);
+		bw.deriv[0] = bern0deriv(x);
+		bw.deriv[1] = bern1deriv(x);
+		bw.deriv[2] = bern2deriv(x);
+		bw.deriv[3] = bern3deriv(x);
+	}
+	return &weights[0];
+}
+
+// All the interpolated attributes of a vertex, padded to 4 floats each so we can blend them with SIMD.
+struct SplineAttribs {
+	float pos[4];
+	float nrm[4];
+	float uv[4];
+	float color[4];
+};
+
+static void LoadAttribs(SplineAttribs &a, const SimpleVertex *v) {
+	a.pos[0] = v->pos.x;
+	a.pos[1] = v->pos.y;
+	a.pos[2] = v->pos.z;
+	a.pos[3] = 0.0f;
+	a.nrm[0] = v->nrm.x;
+	a.nrm[1] = v->nrm.y;
+	a.nrm[2] = v->nrm.z;
+	a.nrm[3] = 0.0f;
+	a.uv[0] = v->uv[0];
+	a.uv[1] = v->uv[1];
+	a.uv[2] = 0.0f;
+	a.uv[3] = 0.0f;
+	for (int i = 0; i < 4; i++)
+		a.color[i] = (float)v->color[i];
+}
+
+// out = a * w[0] + b * w[1] + c * w[2] + d * w[3], for vecs groups of 4 floats.
+static inline void Blend4(float *out, const float *a, const float *b, const float *c, const float *d, const float w[4], int vecs) {
+#if defined(_M_SSE)
+	const __m128 w0 = _mm_set1_ps(w[0]);
+	const __m128 w1 = _mm_set1_ps(w[1]);
+	const __m128 w2 = _mm_set1_ps(w[2]);
+	const __m128 w3 = _mm_set1_ps(w[3]);
+	for (int i = 0; i < vecs * 4; i += 4) {
+		__m128 sum = _mm_mul_ps(_mm_loadu_ps(a + i), w0);
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(b + i), w1));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(c + i), w2));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(d + i), w3));
+		_mm_storeu_ps(out + i, sum);
+	}
+#else
+	for (int i = 0; i < vecs * 4; i++) {
+		out[i] = a[i] * w[0] + b[i] * w[1] + c[i] * w[2] + d[i] * w[3];
+	}
+#endif
+}
+
+static const int ATTRIB_VECS = sizeof(SplineAttribs) / (sizeof(float) * 4);
+
+static void _SplinePatchLowQuality(u8 *&dest, int &count, const SplinePatchLocal &spatch, u32 origVertType) {
+	const float third = 1.0f / 3.0f;
+	// Fast and easy way - just draw the control points, generate some very basic normal vector substitutes.
+	// Very inaccurate but okay for Loco Roco. Maybe should keep it as an option because it's fast.
+
+	const int tile_min_u = (spatch.type_u & START_OPEN) ? 0 : 1;
+	const int tile_min_v = (spatch.type_v & START_OPEN) ? 0 : 1;
+	const int tile_max_u = (spatch.type_u & END_OPEN) ? spatch.count_u - 1 : spatch.count_u - 2;
+	const int tile_max_v = (spatch.type_v & END_OPEN) ? spatch.count_v - 1 : spatch.count_v - 2;
+
+	for (int tile_v = tile_min_v; tile_v < tile_max_v; ++tile_v) {
+		for (int tile_u = tile_min_u; tile_u < tile_max_u; ++tile_u) {
+			int point_index = tile_u + tile_v * spatch.count_u;
+
+			SimpleVertex v0 = *spatch.points[point_index];
+			SimpleVertex v1 = *spatch.points[point_index + 1];
+			SimpleVertex v2 = *spatch.points[point_index + spatch.count_u];
+			SimpleVertex v3 = *spatch.points[point_index + spatch.count_u + 1];
+
+			// Generate UV. TODO: Do this even if UV specified in control points?
+			if ((origVertType & GE_VTYPE_TC_MASK) == 0) {
+				float u = tile_u * third;
+				float v = tile_v * third;
+				v0.uv[0] = u;
+				v0.uv[1] = v;
+				v1.uv[0] = u + third;
+				v1.uv[1] = v;
+				v2.uv[0] = u;
+				v2.uv[1] = v + third;
+				v3.uv[0] = u + third;
+				v3.uv[1] = v + third;
+			}
+
+			// Generate normal if lighting is enabled (otherwise there's no point).
+			// This is a really poor quality algorithm, we get facet normals.
+			if (gstate.isLightingEnabled()) {
+				Vec3Packedf norm = Cross(v1.pos - v0.pos, v2.pos - v0.pos);
+				norm.Normalize();
+				if (gstate.patchfacing & 1)
+					norm *= -1.0f;
+				v0.nrm = norm;
+				v1.nrm = norm;
+				v2.nrm = norm;
+				v3.nrm = norm;
+			}
+
+			CopyQuad(dest, &v0, &v1, &v2, &v3);
+			count += 6;
+		}
+	}
+
+}
+
+struct SplineTesselation {
+	const SplinePatchLocal *spatch;
+	u32 origVertType;
+	int patch_div_s;
+	int patch_div_t;
+	float tu_width;
+	float tv_height;
+	const SplineWeight *u_weights;
+	const SplineWeight *v_weights;
+	// Control points, then the control point rows blended horizontally for every output column.
+	const SplineAttribs *control;
+	SplineAttribs *horiz;
+	SimpleVertex *vertices;
+};
+
+static const SplineAttribs zeroAttribs = {};
+
+// Blends each row of control points horizontally, so that each output vertex only needs to
+// blend four of these vertically instead of touching all 16 control points.
+static void SplineHorizontalRows(const SplineTesselation &t, int lower, int upper) {
+	const SplinePatchLocal &spatch = *t.spatch;
+	// Handle degenerate patches. without this, we may read outside the number of initialized points.
+	const int patch_w = std::min(spatch.count_u, 4);
+
+	for (int row = lower; row < upper; ++row) {
+		const SplineAttribs *controlRow = t.control + row * spatch.count_u;
+		SplineAttribs *out = t.horiz + row * (t.patch_div_s + 1);
+		for (int tile_u = 0; tile_u < t.patch_div_s + 1; ++tile_u) {
+			const SplineWeight &uw = t.u_weights[tile_u];
+			const SplineAttribs *src[4];
+			for (int ii = 0; ii < 4; ++ii)
+				src[ii] = ii < patch_w ? &controlRow[uw.base + ii] : &zeroAttribs;
+			Blend4(out[tile_u].pos, src[0]->pos, src[1]->pos, src[2]->pos, src[3]->pos, uw.w, ATTRIB_VECS);
+		}
+	}
+}
+
+static void SplineVerticalRows(const SplineTesselation &t, int lower, int upper) {
+	const SplinePatchLocal &spatch = *t.spatch;
+	const u32 origVertType = t.origVertType;
+	const int patch_h = std::min(spatch.count_v, 4);
+
+	for (int tile_v = lower; tile_v < upper; ++tile_v) {
+		const SplineWeight &vw = t.v_weights[tile_v];
+		const SplineAttribs *src[4];
+		for (int jj = 0; jj < 4; ++jj)
+			src[jj] = jj < patch_h ? t.horiz + (vw.base + jj) * (t.patch_div_s + 1) : NULL;
+
+		for (int tile_u = 0; tile_u < t.patch_div_s + 1; ++tile_u) {
+			SplineAttribs a;
+			const float *s0 = src[0] ? src[0][tile_u].pos : zeroAttribs.pos;
+			const float *s1 = src[1] ? src[1][tile_u].pos : zeroAttribs.pos;
+			const float *s2 = src[2] ? src[2][tile_u].pos : zeroAttribs.pos;
+			const float *s3 = src[3] ? src[3][tile_u].pos : zeroAttribs.pos;
+			Blend4(a.pos, s0, s1, s2, s3, vw.w, ATTRIB_VECS);
+
+			SimpleVertex *vert = &t.vertices[tile_v * (t.patch_div_s + 1) + tile_u];
+			vert->pos = Vec3Packedf(a.pos);
+			if (origVertType & GE_VTYPE_NRM_MASK) {
+				vert->nrm = Vec3Packedf(a.nrm);
+				vert->nrm.Normalize();
+			} else {
+				vert->nrm.SetZero();
+				vert->nrm.z = 1.0f;
+			}
+			if (origVertType & GE_VTYPE_COL_MASK) {
+				for (int i = 0; i < 4; i++)
+					vert->color[i] = (u8)std::min(std::max(a.color[i], 0.0f), 255.0f);
+			} else {
+				memcpy(vert->color, spatch.points[0]->color, 4);
+			}
+			if (origVertType & GE_VTYPE_TC_MASK) {
+				vert->uv[0] = a.uv[0];
+				vert->uv[1] = a.uv[1];
+			} else {
+				vert->uv[0] = t.tu_width * ((float)tile_u / (float)t.patch_div_s);
+				vert->uv[1] = t.tv_height * ((float)tile_v / (float)t.patch_div_t);
+			}
+		}
+	}
+}
+
+// Hacky normal generation through central difference.
+static void SplineNormalRows(const SplineTesselation &tess, int lower, int upper) {
+	const int patch_div_s = tess.patch_div_s;
+	const int patch_div_t = tess.patch_div_t;
+	SimpleVertex *vertices = tess.vertices;
+
+	for (int v = lower; v < upper; v++) {
+		for (int u = 0; u < patch_div_s + 1; u++) {
+			int l = std::max(0, u - 1);
+			int t = std::max(0, v - 1);
+			int r = std::min(patch_div_s, u + 1);
+			int b = std::min(patch_div_t, v + 1);
+
+			const Vec3Packedf &right = vertices[v * (patch_div_s + 1) + r].pos - vertices[v * (patch_div_s + 1) + l].pos;
+			const Vec3Packedf &down = vertices[b * (patch_div_s + 1) + u].pos - vertices[t * (patch_div_s + 1) + u].pos;
+
+			vertices[v * (patch_div_s + 1) + u].nrm = Cross(right, down).Normalized();
+			if (gstate.patchfacing & 1) {
+				vertices[v * (patch_div_s + 1) + u].nrm *= -1.0f;
+			}
+		}
+	}
+}
+
+static void SplinePatchDivisions(const SplinePatchLocal &spatch, int patch_cap, int &patch_div_s, int &patch_div_t) {
+	// Increase tesselation based on the size. Should be approximately right?
+	// JPCSP is wrong at least because their method results in square loco roco.
+	patch_div_s = (spatch.count_u - 3) * gstate.getPatchDivisionU() / 3;
+	patch_div_t = (spatch.count_v - 3) * gstate.getPatchDivisionV() / 3;
+
+	if (patch_div_s <= 0) patch_div_s = 1;
+	if (patch_div_t <= 0) patch_div_t = 1;
+
+	// TODO: Remove this cap when spline_s has been optimized.
+	if (patch_div_s > patch_cap) patch_div_s = patch_cap;
+	if (patch_div_t > patch_cap) patch_div_t = patch_cap;
+}
+
+static void _SplinePatchFullQuality(u8 *&dest, int &count, const SplinePatchLocal &spatch, u32 origVertType, int patch_cap) {
+	// Full (mostly) correct tessellation of spline patches.
+	int n = spatch.count_u - 1;
+	int m = spatch.count_v - 1;
+
+	int patch_div_s, patch_div_t;
+	SplinePatchDivisions(spatch, patch_cap, patch_div_s, patch_div_t);
+
+	TrimWeightCaches();
+
+	SplineTesselation t;
+	t.spatch = &spatch;
+	t.origVertType = origVertType;
+	t.patch_div_s = patch_div_s;
+	t.patch_div_t = patch_div_t;
+	t.tu_width = 1.0f + (spatch.count_u - 4) * 1.0f / 3.0f;
+	t.tv_height = 1.0f + (spatch.count_v - 4) * 1.0f / 3.0f;
+	t.u_weights = GetSplineWeights(n, spatch.type_u, patch_div_s);
+	t.v_weights = GetSplineWeights(m, spatch.type_v, patch_div_t);
+
+	const int numControl = spatch.count_u * spatch.count_v;
+	SplineAttribs *control = new SplineAttribs[numControl];
+	for (int i = 0; i < numControl; i++)
+		LoadAttribs(control[i], spatch.points[i]);
+	t.control = control;
+	t.horiz = new SplineAttribs[spatch.count_v * (patch_div_s + 1)];
+	t.vertices = new SimpleVertex[(patch_div_s + 1) * (patch_div_t + 1)];
+
+	const bool parallel = (patch_div_s + 1) * (patch_div_t + 1) >= MIN_PARALLEL_VERTICES;
+	RunRows(std::bind(&SplineHorizontalRows, std::cref(t), placeholder::_1, placeholder::_2), 0, spatch.count_v, parallel);
+	RunRows(std::bind(&SplineVerticalRows, std::cref(t), placeholder::_1, placeholder::_2), 0, patch_div_t + 1, parallel);
+	if (gstate.isLightingEnabled() && (origVertType & GE_VTYPE_NRM_MASK) == 0) {
+		RunRows(std::bind(&SplineNormalRows, std::cref(t), placeholder::_1, placeholder::_2), 0, patch_div_t + 1, parallel);
+	}
+
+	delete[] control;
+	delete[] t.horiz;
+
+	// Tesselate. TODO: Use indices so we only need to emit 4 vertices per pair of triangles instead of six.
+	const SimpleVertex *vertices = t.vertices;
+	for (int tile_v = 0; tile_v < patch_div_t; ++tile_v) {
+		for (int tile_u = 0; tile_u < patch_div_s; ++tile_u) {
+			const SimpleVertex *v0 = &vertices[tile_v * (patch_div_s + 1) + tile_u];
+			const SimpleVertex *v1 = &vertices[tile_v * (patch_div_s + 1) + tile_u + 1];
+			const SimpleVertex *v2 = &vertices[(tile_v + 1) * (patch_div_s + 1) + tile_u];
+			const SimpleVertex *v3 = &vertices[(tile_v + 1) * (patch_div_s + 1) + tile_u + 1];
+
+			CopyQuad(dest, v0, v1, v2, v3);
+			count += 6;
+		}
+	}
+
+	delete[] t.vertices;
+}
+
+void TesselateSplinePatch(u8 *&dest, int &count, const SplinePatchLocal &spatch, u32 origVertType) {
+	switch (g_Config.iSplineBezierQuality) {
+	case LOW_QUALITY:
+		_SplinePatchLowQuality(dest, count, spatch, origVertType);
+		break;
+	case MEDIUM_QUALITY:
+		_SplinePatchFullQuality(dest, count, spatch, origVertType, 8);
+		break;
+	case HIGH_QUALITY:
+		_SplinePatchFullQuality(dest, count, spatch, origVertType, 64);
+		break;
+	}
+}
+
+int SplinePatchMaxVertices(const SplinePatchLocal &spatch) {
+	int patch_div_s, patch_div_t;
+	switch (g_Config.iSplineBezierQuality) {
+	case LOW_QUALITY:
+		// At most one quad between each pair of control points.
+		patch_div_s = spatch.count_u - 1;
+		patch_div_t = spatch.count_v - 1;
+		break;
+	case MEDIUM_QUALITY:
+		SplinePatchDivisions(spatch, 8, patch_div_s, patch_div_t);
+		break;
+	case HIGH_QUALITY:
+	default:
+		SplinePatchDivisions(spatch, 64, patch_div_s, patch_div_t);
+		break;
+	}
+	return patch_div_s * patch_div_t * 4;
+}
+
+static void _BezierPatchLowQuality(u8 *&dest, int &count, int tess_u, int tess_v, const BezierPatch &patch, u32 origVertType) {
+	const float third = 1.0f / 3.0f;
+	// Fast and easy way - just draw the control points, generate some very basic normal vector subsitutes.
+	// Very inaccurate though but okay for Loco Roco. Maybe should keep it as an option.
+
+	float u_base = patch.u_index / 3.0f;
+	float v_base = patch.v_index / 3.0f;
+
+	for (int tile_v = 0; tile_v < 3; tile_v++) {
+		for (int tile_u = 0; tile_u < 3; tile_u++) {
+			int point_index = tile_u + tile_v * 4;
+
+			SimpleVertex v0 = *patch.points[point_index];
+			SimpleVertex v1 = *patch.points[point_index + 1];
+			SimpleVertex v2 = *patch.points[point_index + 4];
+			SimpleVertex v3 = *patch.points[point_index + 5];
+
+			// Generate UV. TODO: Do this even if UV specified in control points?
+			if ((origVertType & GE_VTYPE_TC_MASK) == 0) {
+				float u = u_base + tile_u * third;
+				float v = v_base + tile_v * third;
+				v0.uv[0] = u;
+				v0.uv[1] = v;
+				v1.uv[0] = u + third;
+				v1.uv[1] = v;
+				v2.uv[0] = u;
+				v2.uv[1] = v + third;
+				v3.uv[0] = u + third;
+				v3.uv[1] = v + third;
+			}
+
+			// Generate normal if lighting is enabled (otherwise there's no point).
+			// This is a really poor quality algorithm, we get facet normals.
+			if (gstate.isLightingEnabled()) {
+				Vec3Packedf norm = Cross(v1.pos - v0.pos, v2.pos - v0.pos);
+				norm.Normalize();
+				if (gstate.patchfacing & 1)
+					norm *= -1.0f;
+				v0.nrm = norm;
+				v1.nrm = norm;
+				v2.nrm = norm;
+				v3.nrm = norm;
+			}
+
+			CopyQuad(dest, &v0, &v1, &v2, &v3);
+			count += 6;
+		}
+	}
+}
+
+static void _BezierPatchHighQuality(u8 *&dest, int &count, int tess_u, int tess_v, const BezierPatch &patch, u32 origVertType, const BezierWeight *u_weights, const BezierWeight *v_weights) {
+	const float third = 1.0f / 3.0f;
+	// Full correct tesselation of bezier patches.
+	// Note: Does not handle splines correctly.
+
+	// First compute all the vertices and put them in an array
+	SimpleVertex *vertices = new SimpleVertex[(tess_u + 1) * (tess_v + 1)];
+
+	float points[16][4];
+	for (int i = 0; i < 16; i++) {
+		points[i][0] = patch.points[i]->pos.x;
+		points[i][1] = patch.points[i]->pos.y;
+		points[i][2] = patch.points[i]->pos.z;
+		points[i][3] = 0.0f;
+	}
+
+	// Precompute the horizontal curves (and their derivatives) so we only have to evaluate the vertical ones.
+	float (*horiz)[4][4] = new float[tess_u + 1][4][4];
+	float (*horizDeriv)[4][4] = new float[tess_u + 1][4][4];
+	for (int i = 0; i < tess_u + 1; i++) {
+		const BezierWeight &uw = u_weights[i];
+		for (int row = 0; row < 4; row++) {
+			const float *p = points[row * 4];
+			Blend4(horiz[i][row], p, p + 4, p + 8, p + 12, uw.basis, 1);
+			Blend4(horizDeriv[i][row], p, p + 4, p + 8, p + 12, uw.deriv, 1);
+		}
+	}
+
+	bool computeNormals = gstate.isLightingEnabled();
+
+	for (int tile_v = 0; tile_v < tess_v + 1; ++tile_v) {
+		const BezierWeight &vw = v_weights[tile_v];
+		for (int tile_u = 0; tile_u < tess_u + 1; ++tile_u) {
+			float u = ((float)tile_u / (float)tess_u);
+			float v = ((float)tile_v / (float)tess_v);
+
+			const float (*pos)[4] = horiz[tile_u];
+			SimpleVertex &vert = vertices[tile_v * (tess_u + 1) + tile_u];
+
+			if (computeNormals) {
+				const float (*deriv)[4] = horizDeriv[tile_u];
+				float derivU[4], derivV[4];
+				Blend4(derivU, deriv[0], deriv[1], deriv[2], deriv[3], vw.basis, 1);
+				Blend4(derivV, pos[0], pos[1], pos[2], pos[3], vw.deriv, 1);
+
+				// TODO: Interpolate normals instead of generating them, if available?
+				vert.nrm = Cross(Vec3Packedf(derivU), Vec3Packedf(derivV)).Normalized();
+				if (gstate.patchfacing & 1)
+					vert.nrm *= -1.0f;
+			}
+			else {
+				vert.nrm.SetZero();
+			}
+
+			float p[4];
+			Blend4(p, pos[0], pos[1], pos[2], pos[3], vw.basis, 1);
+			vert.pos = Vec3Packedf(p);
+
+			if ((origVertType & GE_VTYPE_TC_MASK) == 0) {
+				// Generate texcoord
+				vert.uv[0] = u + patch.u_index * third;
+				vert.uv[1] = v + patch.v_index * third;
+			} else {
+				// Sample UV from control points
+				patch.sampleTexUV(u, v, vert.uv[0], vert.uv[1]);
+			}
+
+			if (origVertType & GE_VTYPE_COL_MASK) {
+				patch.sampleColor(u, v, vert.color);
+			} else {
+				memcpy(vert.color, patch.points[0]->color, 4);
+			}
+		}
+	}
+	delete[] horiz;
+	delete[] horizDeriv;
+
+	// Tesselate. TODO: Use indices so we only need to emit 4 vertices per pair of triangles instead of six.
+	for (int tile_v = 0; tile_v < tess_v; ++tile_v) {
+		for (int tile_u = 0; tile_u < tess_u; ++tile_u) {
+			const SimpleVertex *v0 = &vertices[tile_v * (tess_u + 1) + tile_u];
+			const SimpleVertex *v1 = &vertices[tile_v * (tess_u + 1) + tile_u + 1];
+			const SimpleVertex *v2 = &vertices[(tile_v + 1) * (tess_u + 1) + tile_u];
+			const SimpleVertex *v3 = &vertices[(tile_v + 1) * (tess_u + 1) + tile_u + 1];
+
+			CopyQuad(dest, v0, v1, v2, v3);
+			count += 6;
+		}
+	}
+
+	delete[] vertices;
+}
+
+struct BezierTesselation {
+	const BezierPatch *patches;
+	u8 *dest;
+	int patchBytes;
+	int tess_u;
+	int tess_v;
+	u32 origVertType;
+	const BezierWeight *u_weights;
+	const BezierWeight *v_weights;
+};
+
+// Every patch produces the same number of vertices, so they can be generated independently.
+static void BezierPatchRange(const BezierTesselation &t, int lower, int upper) {
+	for (int i = lower; i < upper; ++i) {
+		u8 *dest = t.dest + i * t.patchBytes;
+		int count = 0;
+		if (g_Config.iSplineBezierQuality == LOW_QUALITY) {
+			_BezierPatchLowQuality(dest, count, t.tess_u, t.tess_v, t.patches[i], t.origVertType);
+		} else {
+			_BezierPatchHighQuality(dest, count, t.tess_u, t.tess_v, t.patches[i], t.origVertType, t.u_weights, t.v_weights);
+		}
+	}
+}
+
+void TesselateBezierPatches(u8 *&dest, int &count, int tess_u, int tess_v, const BezierPatch *patches, int numPatches, u32 origVertType) {
+	const int quadsPerPatch = g_Config.iSplineBezierQuality == LOW_QUALITY ? 9 : tess_u * tess_v;
+
+	TrimWeightCaches();
+
+	BezierTesselation t;
+	t.patches = patches;
+	t.dest = dest;
+	t.patchBytes = quadsPerPatch * 4 * sizeof(SimpleVertex);
+	t.tess_u = tess_u;
+	t.tess_v = tess_v;
+	t.origVertType = origVertType;
+	t.u_weights = GetBezierWeights(tess_u);
+	t.v_weights = GetBezierWeights(tess_v);
+
+	const bool parallel = numPatches > 1 && numPatches * (tess_u + 1) * (tess_v + 1) >= MIN_PARALLEL_VERTICES;
+	RunRows(std::bind(&BezierPatchRange, std::cref(t), placeholder::_1, placeholder::_2), 0, numPatches, parallel);
+
+	dest += numPatches * t.patchBytes;
+	count += numPatches * quadsPerPatch * 6;
+}
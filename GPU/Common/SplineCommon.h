@@ -27,3 +27,31 @@ struct SimpleVertex {
 	Vec3Packedf nrm;
 	Vec3Packedf pos;
 };
+
+// We decode all vertices into a common format for easy interpolation and stuff.
+struct BezierPatch {
+	SimpleVertex *points[16];
+
+	// These are used to generate UVs.
+	int u_index, v_index;
+
+	// Interpolate colors between control points (bilinear, should be good enough).
+	void sampleColor(float u, float v, u8 color[4]) const;
+	void sampleTexUV(float u, float v, float &tu, float &tv) const;
+};
+
+struct SplinePatchLocal {
+	SimpleVertex **points;
+	int count_u;
+	int count_v;
+	int type_u;
+	int type_v;
+};
+
+// These write quads (4 vertices each, to be drawn with quad indices) to dest and advance it.
+// count is increased by the number of indices needed, 6 per quad.
+// Large patches are split across the global thread pool.
+void TesselateSplinePatch(u8 *&dest, int &count, const SplinePatchLocal &spatch, u32 origVertType);
+// The most vertices TesselateSplinePatch() writes for spatch, to size dest with.
+int SplinePatchMaxVertices(const SplinePatchLocal &spatch);
+void TesselateBezierPatches(u8 *&dest, int &count, int tess_u, int tess_v, const BezierPatch *patches, int numPatches, u32 origVertType);
@@ -26,6 +26,7 @@
 #include "Core/Config.h"
 #include "Core/Reporting.h"
 #include "Core/System.h"
+#include "Core/ELF/ParamSFO.h"
 
 #include "GPU/GPUState.h"
 #include "GPU/ge_constants.h"
@@ -50,6 +51,9 @@ enum {
 	FLAG_ANY_EXECUTE = 4 | 8,
 	FLAG_READS_PC = 16,
 	FLAG_WRITES_PC = 32,
+	// The flush may be deferred until the next draw, as games often set these back right away.
+	// Only for state that's read straight from gstate at flush time, without an execute func.
+	FLAG_DEFERFLUSH = 64,
 };
 
 struct CommandTableEntry {
@@ -117,15 +121,15 @@ static const CommandTableEntry commandTable[] = {
 
 	// These affect the fragment shader so need flushing.
 	{GE_CMD_CLEARMODE, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_TEXTUREMAPENABLE, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_FOGENABLE, FLAG_FLUSHBEFOREONCHANGE},
+	{GE_CMD_TEXTUREMAPENABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_FOGENABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
 	{GE_CMD_TEXMODE, FLAG_FLUSHBEFOREONCHANGE | FLAG_EXECUTEONCHANGE, &GLES_GPU::Execute_TexParamType},
 	{GE_CMD_TEXSHADELS, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_SHADEMODE, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_TEXFUNC, FLAG_FLUSHBEFOREONCHANGE},
+	{GE_CMD_SHADEMODE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_TEXFUNC, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
 	{GE_CMD_COLORTEST, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_ALPHATESTENABLE, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_COLORTESTENABLE, FLAG_FLUSHBEFOREONCHANGE},
+	{GE_CMD_ALPHATESTENABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_COLORTESTENABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
 	{GE_CMD_COLORTESTMASK, FLAG_FLUSHBEFOREONCHANGE | FLAG_EXECUTEONCHANGE, &GLES_GPU::Execute_ColorTestMask},
 
 	// These change the vertex shader so need flushing.
@@ -152,26 +156,26 @@ static const CommandTableEntry commandTable[] = {
 	{GE_CMD_TEXENVCOLOR, FLAG_FLUSHBEFOREONCHANGE | FLAG_EXECUTEONCHANGE, &GLES_GPU::Execute_TexEnvColor},
 
 	// Simple render state changes. Handled in StateMapping.cpp.
-	{GE_CMD_OFFSETX, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_OFFSETY, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_CULL, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_CULLFACEENABLE, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_DITHERENABLE, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_STENCILOP, FLAG_FLUSHBEFOREONCHANGE},
+	{GE_CMD_OFFSETX, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_OFFSETY, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_CULL, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_CULLFACEENABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_DITHERENABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_STENCILOP, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
 	{GE_CMD_STENCILTEST, FLAG_FLUSHBEFOREONCHANGE | FLAG_EXECUTEONCHANGE, &GLES_GPU::Execute_StencilTest},
-	{GE_CMD_STENCILTESTENABLE, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_ALPHABLENDENABLE, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_BLENDMODE, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_BLENDFIXEDA, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_BLENDFIXEDB, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_MASKRGB, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_MASKALPHA, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_ZTEST, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_ZTESTENABLE, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_ZWRITEDISABLE, FLAG_FLUSHBEFOREONCHANGE},
+	{GE_CMD_STENCILTESTENABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_ALPHABLENDENABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_BLENDMODE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_BLENDFIXEDA, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_BLENDFIXEDB, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_MASKRGB, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_MASKALPHA, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_ZTEST, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_ZTESTENABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_ZWRITEDISABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
 #ifndef USING_GLES2
-	{GE_CMD_LOGICOP, FLAG_FLUSHBEFOREONCHANGE},
-	{GE_CMD_LOGICOPENABLE, FLAG_FLUSHBEFOREONCHANGE},
+	{GE_CMD_LOGICOP, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
+	{GE_CMD_LOGICOPENABLE, FLAG_FLUSHBEFOREONCHANGE | FLAG_DEFERFLUSH},
 #else
 	{GE_CMD_LOGICOP, 0},
 	{GE_CMD_LOGICOPENABLE, 0},
@@ -405,6 +409,11 @@ GLES_GPU::GLES_GPU()
 	textureCache_.SetDepalShaderCache(&depalShaderCache_);
 	textureCache_.SetShaderManager(shaderManager_);
 
+	const std::string gameId = g_paramSFO.GetValueString("DISC_ID");
+	if (g_Config.bShaderCache && !gameId.empty()) {
+		shaderManager_->LoadVariantCache(GetSysDirectory(DIRECTORY_CACHE) + gameId + ".glshadercache");
+	}
+
 	// Sanity check gstate
 	if ((int *)&gstate.transferstart - (int *)&gstate != 0xEA) {
 		ERROR_LOG(G3D, "gstate has drifted out of sync!");
@@ -420,6 +429,9 @@ GLES_GPU::GLES_GPU()
 		} else {
 			dupeCheck.insert(cmd);
 		}
+		if ((commandTable[i].flags & FLAG_DEFERFLUSH) && commandTable[i].func) {
+			ERROR_LOG(G3D, "Command table: %02x can't defer flushes, it has an execute func", (int)cmd);
+		}
 		cmdInfo_[cmd].flags |= commandTable[i].flags;
 		cmdInfo_[cmd].func = commandTable[i].func;
 		if (!cmdInfo_[cmd].func) {
@@ -445,6 +457,7 @@ GLES_GPU::GLES_GPU()
 
 GLES_GPU::~GLES_GPU() {
 	framebufferManager_.DestroyAllFBOs();
+	shaderManager_->SaveVariantCache();
 	shaderManager_->ClearCache(true);
 	depalShaderCache_.Clear();
 	delete shaderManager_;
@@ -593,6 +606,13 @@ void GLES_GPU::BeginFrameInternal() {
 	} else if (dumpThisFrame_) {
 		dumpThisFrame_ = false;
 	}
+
+	// Compile shaders recorded on previous runs a bit at a time, so we don't stall at boot.
+	// Keep it to a small slice of each frame, at least one shader gets compiled per frame anyway.
+	if (shaderManager_->HasPendingPrecompile()) {
+		transformDraw_.Flush();
+		shaderManager_->PrecompileVariants(1.0 / 1000.0);
+	}
 	shaderManager_->DirtyShader();
 
 	// Not sure if this is really needed.
@@ -678,6 +698,12 @@ void GLES_GPU::FastRunLoop(DisplayList &list) {
 		const u32 diff = op ^ gstate.cmdmem[cmd];
 		// Inlined CheckFlushOp here to get rid of the dumpThisFrame_ check.
 		if ((cmdFlags & FLAG_FLUSHBEFORE) || (diff && (cmdFlags & FLAG_FLUSHBEFOREONCHANGE))) {
+			// Deferred commands have no execute func, so we can go straight to the next one.
+			if ((cmdFlags & FLAG_DEFERFLUSH) && transformDraw_.DeferStateChange(cmd, gstate.cmdmem[cmd])) {
+				gstate.cmdmem[cmd] = op;
+				list.pc += 4;
+				continue;
+			}
 			transformDraw_.Flush();
 		}
 		gstate.cmdmem[cmd] = op;  // TODO: no need to write if diff==0...
@@ -730,6 +756,9 @@ void GLES_GPU::ProcessEvent(GPUEvent ev) {
 inline void GLES_GPU::CheckFlushOp(int cmd, u32 diff) {
 	const u8 cmdFlags = cmdInfo_[cmd].flags;
 	if ((cmdFlags & FLAG_FLUSHBEFORE) || (diff && (cmdFlags & FLAG_FLUSHBEFOREONCHANGE))) {
+		if ((cmdFlags & FLAG_DEFERFLUSH) && transformDraw_.DeferStateChange(cmd, gstate.cmdmem[cmd])) {
+			return;
+		}
 		if (dumpThisFrame_) {
 			NOTICE_LOG(G3D, "================ FLUSH ================");
 		}
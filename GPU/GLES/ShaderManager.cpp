@@ -26,6 +26,7 @@
 #include <map>
 
 #include "base/logging.h"
+#include "base/timeutil.h"
 #include "math/math_util.h"
 #include "gfx_es2/gl_state.h"
 #include "math/lin/matrix4x4.h"
@@ -626,7 +627,7 @@ void LinkedShader::UpdateUniforms(u32 vertType) {
 	}
 }
 
-ShaderManager::ShaderManager() : lastShader_(NULL), globalDirty_(0xFFFFFFFF), shaderSwitchDirty_(0) {
+ShaderManager::ShaderManager() : lastShader_(NULL), globalDirty_(0xFFFFFFFF), shaderSwitchDirty_(0), precompilePos_(0), precompiling_(false), recordVariants_(false) {
 	codeBuffer_ = new char[16384];
 }
 
@@ -767,6 +768,12 @@ LinkedShader *ShaderManager::ApplyFragmentShader(Shader *vs, int prim, u32 vertT
 		ls = new LinkedShader(vs, fs, vertType, vs->UseHWTransform(), lastShader_);  // This does "use" automatically
 		const LinkedShaderCacheEntry entry(vs, fs, ls);
 		linkedShaderCache_.push_back(entry);
+
+		if (recordVariants_) {
+			ShaderVariant variant;
+			variant.Capture(prim, vertType, CanUseHardwareTransform(prim), lastVSID_, FSID);
+			variantCache_.Record(variant);
+		}
 	} else {
 		ls->use(vertType, lastShader_);
 	}
@@ -774,3 +781,117 @@ LinkedShader *ShaderManager::ApplyFragmentShader(Shader *vs, int prim, u32 vertT
 	lastShader_ = ls;
 	return ls;
 }
+
+void ShaderManager::LoadVariantCache(const std::string &filename) {
+	recordVariants_ = true;
+	precompiling_ = true;
+	precompileQueue_.clear();
+	precompilePos_ = 0;
+	variantCache_.StartLoad(filename);
+}
+
+void ShaderManager::SaveVariantCache() {
+	if (recordVariants_) {
+		variantCache_.Save();
+	}
+}
+
+bool ShaderManager::PrecompileVariant(ShaderVariant &variant) {
+	variant.Swap();
+
+	const bool useHWTransform = CanUseHardwareTransform(variant.prim);
+	VertexShaderID VSID;
+	ComputeVertexShaderID(&VSID, variant.vertType, variant.prim, useHWTransform);
+	FragmentShaderID FSID;
+	ComputeFragmentShaderID(&FSID);
+
+	// If settings or the generators changed since this was recorded, we'd just be compiling
+	// something that will never be used.
+	bool success = false;
+	if (VSID == variant.vsid && FSID == variant.fsid) {
+		Shader *vs = NULL;
+		VSCache::iterator vsIter = vsCache_.find(VSID);
+		if (vsIter == vsCache_.end()) {
+			GenerateVertexShader(variant.prim, variant.vertType, codeBuffer_, useHWTransform);
+			vs = new Shader(codeBuffer_, GL_VERTEX_SHADER, useHWTransform);
+			// Leave the software transform fallback to ApplyVertexShader.
+			if (vs->Failed()) {
+				delete vs;
+				vs = NULL;
+			} else {
+				vsCache_[VSID] = vs;
+			}
+		} else {
+			vs = vsIter->second;
+		}
+
+		Shader *fs = NULL;
+		FSCache::iterator fsIter = fsCache_.find(FSID);
+		if (vs != NULL && fsIter == fsCache_.end()) {
+			GenerateFragmentShader(codeBuffer_);
+			fs = new Shader(codeBuffer_, GL_FRAGMENT_SHADER, useHWTransform);
+			// Don't cache a broken one, the game may never even need it.
+			if (fs->Failed()) {
+				ERROR_LOG(G3D, "Precompiled fragment shader failed to compile");
+				delete fs;
+				fs = NULL;
+			} else {
+				fsCache_[FSID] = fs;
+			}
+		} else if (vs != NULL) {
+			fs = fsIter->second;
+		}
+
+		if (vs != NULL && fs != NULL) {
+			bool linked = false;
+			for (auto iter = linkedShaderCache_.begin(); iter != linkedShaderCache_.end(); ++iter) {
+				if (iter->vs == vs && iter->fs == fs) {
+					linked = true;
+					break;
+				}
+			}
+			if (!linked) {
+				LinkedShader *ls = new LinkedShader(vs, fs, variant.vertType, vs->UseHWTransform(), lastShader_);
+				const LinkedShaderCacheEntry entry(vs, fs, ls);
+				linkedShaderCache_.push_back(entry);
+				// Keep lastShader_ in sync with the enabled vertex attributes.
+				lastShader_ = ls;
+			}
+			success = true;
+		}
+	}
+
+	variant.Swap();
+	return success;
+}
+
+void ShaderManager::PrecompileVariants(double budgetSeconds) {
+	if (!precompiling_) {
+		return;
+	}
+
+	const double start = real_time_now();
+	int compiled = 0;
+	int skipped = 0;
+	do {
+		if (precompilePos_ >= precompileQueue_.size()) {
+			precompileQueue_.clear();
+			precompilePos_ = 0;
+			precompiling_ = variantCache_.TakeLoaded(precompileQueue_);
+			if (precompileQueue_.empty()) {
+				break;
+			}
+		}
+
+		if (PrecompileVariant(precompileQueue_[precompilePos_++])) {
+			compiled++;
+		} else {
+			skipped++;
+		}
+	} while (real_time_now() - start < budgetSeconds);
+
+	if (compiled != 0 || skipped != 0) {
+		DEBUG_LOG(G3D, "Precompiled %d shader variants (%d skipped) in %0.2f ms", compiled, skipped, (real_time_now() - start) * 1000.0);
+		DirtyShader();
+	}
+}
@@ -22,6 +22,7 @@
 #include <map>
 #include "VertexShaderGenerator.h"
 #include "FragmentShaderGenerator.h"
+#include "ShaderVariantCache.h"
 
 class Shader;
 
@@ -193,8 +194,16 @@ public:
 	int NumFragmentShaders() const { return (int)fsCache_.size(); }
 	int NumPrograms() const { return (int)linkedShaderCache_.size(); }
 
+	// Shader variants seen by the game are recorded here and compiled ahead of time on the next run.
+	void LoadVariantCache(const std::string &filename);
+	void SaveVariantCache();
+	bool HasPendingPrecompile() const { return precompiling_; }
+	// Compiles recorded variants until the time budget runs out. Must be called on the GL thread.
+	void PrecompileVariants(double budgetSeconds);
+
 private:
 	void Clear();
+	bool PrecompileVariant(ShaderVariant &variant);
 
 	struct LinkedShaderCacheEntry {
 		LinkedShaderCacheEntry(Shader *vs_, Shader *fs_, LinkedShader *ls_)
@@ -223,4 +232,10 @@ private:
 
 	typedef std::map<VertexShaderID, Shader *> VSCache;
 	VSCache vsCache_;
+
+	ShaderVariantCache variantCache_;
+	std::vector<ShaderVariant> precompileQueue_;
+	size_t precompilePos_;
+	bool precompiling_;
+	bool recordVariants_;
 };
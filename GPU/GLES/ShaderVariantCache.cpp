@@ -0,0 +1,221 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#include "base/logging.h"
+#include "thread/threadutil.h"
+
+#include "Common/FileUtil.h"
+#include "GPU/GPUState.h"
+#include "GPU/GLES/ShaderVariantCache.h"
+
+// Bump this whenever the meaning of the recorded state changes.
+static const u32 SHADERCACHE_MAGIC = 0x43565350;  // PSVC
+static const u32 SHADERCACHE_VERSION = 1;
+
+struct ShaderCacheHeader {
+	u32 magic;
+	u32 version;
+	u32 variantSize;
+	u32 count;
+};
+
+void ShaderVariant::Capture(int prim_, u32 vertType_, bool useHWTransform_, const VertexShaderID &vsid_, const FragmentShaderID &fsid_) {
+	memset(this, 0, sizeof(*this));
+	vsid = vsid_;
+	fsid = fsid_;
+	vertType = vertType_;
+	prim = (u8)prim_;
+	useHWTransform = useHWTransform_ ? 1 : 0;
+	flipTexture = gstate_c.flipTexture ? 1 : 0;
+	needShaderTexClamp = gstate_c.needShaderTexClamp ? 1 : 0;
+	textureFullAlpha = gstate_c.textureFullAlpha ? 1 : 0;
+	vertexFullAlpha = gstate_c.vertexFullAlpha ? 1 : 0;
+	curTextureXOffset = gstate_c.curTextureXOffset;
+	curTextureYOffset = gstate_c.curTextureYOffset;
+	memcpy(cmdmem, gstate.cmdmem, sizeof(cmdmem));
+}
+
+template <typename T>
+static void SwapFlag(u8 &saved, T &current) {
+	const bool temp = current != 0;
+	current = saved != 0;
+	saved = temp ? 1 : 0;
+}
+
+void ShaderVariant::Swap() {
+	SwapFlag(flipTexture, gstate_c.flipTexture);
+	SwapFlag(needShaderTexClamp, gstate_c.needShaderTexClamp);
+	SwapFlag(textureFullAlpha, gstate_c.textureFullAlpha);
+	SwapFlag(vertexFullAlpha, gstate_c.vertexFullAlpha);
+	std::swap(curTextureXOffset, gstate_c.curTextureXOffset);
+	std::swap(curTextureYOffset, gstate_c.curTextureYOffset);
+	for (int i = 0; i < 256; ++i) {
+		std::swap(cmdmem[i], gstate.cmdmem[i]);
+	}
+}
+
+ShaderVariantCache::ShaderVariantCache() : dirty_(false), loadThread_(NULL), loading_(false) {
+}
+
+ShaderVariantCache::~ShaderVariantCache() {
+	JoinLoadThread();
+}
+
+void ShaderVariantCache::JoinLoadThread() {
+	if (loadThread_) {
+		loadThread_->join();
+		delete loadThread_;
+		loadThread_ = NULL;
+	}
+}
+
+void ShaderVariantCache::StartLoad(const std::string &filename) {
+	JoinLoadThread();
+	filename_ = filename;
+	loading_ = true;
+	loadThread_ = new std::thread(std::bind(&ShaderVariantCache::LoadThread, this));
+}
+
+void ShaderVariantCache::LoadThread() {
+	setCurrentThreadName("ShaderCacheLoad");
+
+	std::vector<ShaderVariant> variants;
+	Read(variants);
+
+	lock_guard guard(loadLock_);
+	loaded_.insert(loaded_.end(), variants.begin(), variants.end());
+	loading_ = false;
+}
+
+bool ShaderVariantCache::Load(const std::string &filename) {
+	JoinLoadThread();
+	filename_ = filename;
+
+	std::vector<ShaderVariant> variants;
+	bool success = Read(variants);
+	for (size_t i = 0; i < variants.size(); ++i) {
+		Record(variants[i]);
+	}
+	dirty_ = false;
+	return success;
+}
+
+bool ShaderVariantCache::Read(std::vector<ShaderVariant> &variants) {
+	File::IOFile f(filename_, "rb");
+	if (!f.IsOpen()) {
+		return false;
+	}
+
+	ShaderCacheHeader header;
+	if (!f.ReadArray(&header, 1)) {
+		return false;
+	}
+	if (header.magic != SHADERCACHE_MAGIC || header.version != SHADERCACHE_VERSION || header.variantSize != sizeof(ShaderVariant)) {
+		WARN_LOG(G3D, "Shader cache %s is from a different version, ignoring", filename_.c_str());
+		return false;
+	}
+
+	// Sanity check the count against the file size before trusting it.
+	const u64 expected = sizeof(header) + (u64)header.count * sizeof(ShaderVariant);
+	if (f.GetSize() < expected) {
+		ERROR_LOG(G3D, "Shader cache %s is truncated", filename_.c_str());
+		return false;
+	}
+
+	variants.resize(header.count);
+	if (header.count != 0 && !f.ReadArray(&variants[0], header.count)) {
+		variants.clear();
+		return false;
+	}
+
+	INFO_LOG(G3D, "Loaded %d shader variants from %s", (int)header.count, filename_.c_str());
+	return true;
+}
+
+bool ShaderVariantCache::Save() {
+	if (!dirty_ || filename_.empty()) {
+		return true;
+	}
+
+	// Variants read from the file but not handed out for precompiling yet aren't in variants_.
+	// Wait for the rest of the file too, it's only a quick read, so they don't get lost.
+	JoinLoadThread();
+	std::vector<ShaderVariant> variants = variants_;
+	{
+		lock_guard guard(loadLock_);
+		for (size_t i = 0; i < loaded_.size(); ++i) {
+			if (known_.find(VariantKey(loaded_[i].vsid, loaded_[i].fsid)) == known_.end()) {
+				variants.push_back(loaded_[i]);
+			}
+		}
+	}
+
+	const std::string dir = filename_.substr(0, filename_.find_last_of('/'));
+	if (!File::Exists(dir)) {
+		File::CreateFullPath(dir);
+	}
+
+	File::IOFile f(filename_, "wb");
+	if (!f.IsOpen()) {
+		ERROR_LOG(G3D, "Unable to write shader cache %s", filename_.c_str());
+		return false;
+	}
+
+	ShaderCacheHeader header;
+	header.magic = SHADERCACHE_MAGIC;
+	header.version = SHADERCACHE_VERSION;
+	header.variantSize = sizeof(ShaderVariant);
+	header.count = (u32)variants.size();
+	f.WriteArray(&header, 1);
+	if (!variants.empty()) {
+		f.WriteArray(&variants[0], variants.size());
+	}
+
+	dirty_ = !f.IsGood();
+	return f.IsGood();
+}
+
+bool ShaderVariantCache::TakeLoaded(std::vector<ShaderVariant> &variants) {
+	lock_guard guard(loadLock_);
+	variants.clear();
+
+	// Skip anything the game already hit while we were loading, it's compiled already.
+	for (size_t i = 0; i < loaded_.size(); ++i) {
+		const VariantKey key(loaded_[i].vsid, loaded_[i].fsid);
+		if (known_.find(key) == known_.end()) {
+			known_.insert(key);
+			variants_.push_back(loaded_[i]);
+			variants.push_back(loaded_[i]);
+		}
+	}
+	loaded_.clear();
+	return loading_ || !variants.empty();
+}
+
+void ShaderVariantCache::Record(const ShaderVariant &variant) {
+	const VariantKey key(variant.vsid, variant.fsid);
+	if (known_.find(key) != known_.end()) {
+		return;
+	}
+	known_.insert(key);
+	variants_.push_back(variant);
+	dirty_ = true;
+}
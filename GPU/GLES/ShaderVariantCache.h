@@ -0,0 +1,91 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+#pragma once
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/mutex.h"
+#include "thread/thread.h"
+#include "Common/CommonTypes.h"
+#include "GPU/GLES/VertexShaderGenerator.h"
+#include "GPU/GLES/FragmentShaderGenerator.h"
+
+// Everything the shader generators look at when producing a vertex/fragment shader pair.
+// The generators read gstate directly, so we can't regenerate from the IDs alone - instead we
+// keep a copy of the state that produced them, and temporarily swap it in.
+struct ShaderVariant {
+	VertexShaderID vsid;
+	FragmentShaderID fsid;
+	u32 vertType;
+	u8 prim;
+	u8 useHWTransform;
+	u8 flipTexture;
+	u8 needShaderTexClamp;
+	u8 textureFullAlpha;
+	u8 vertexFullAlpha;
+	u8 pad[2];
+	u32 curTextureXOffset;
+	u32 curTextureYOffset;
+	u32 cmdmem[256];
+
+	void Capture(int prim, u32 vertType, bool useHWTransform, const VertexShaderID &vsid, const FragmentShaderID &fsid);
+	// Exchanges the recorded state with gstate/gstate_c. Call again to swap back.
+	void Swap();
+};
+
+// Records the shader variants a game uses to a file, so they can be compiled at boot next time
+// instead of stuttering the first time each state combination shows up.
+class ShaderVariantCache {
+public:
+	ShaderVariantCache();
+	~ShaderVariantCache();
+
+	// Starts reading the file on a background thread. Use TakeLoaded() to collect the results.
+	void StartLoad(const std::string &filename);
+	// Blocking version, returns false if the file was missing or not compatible.
+	bool Load(const std::string &filename);
+	bool Save();
+
+	// Hands over whatever the background load has produced so far. Returns false once nothing
+	// more is coming.
+	bool TakeLoaded(std::vector<ShaderVariant> &variants);
+
+	void Record(const ShaderVariant &variant);
+	size_t NumVariants() const { return known_.size(); }
+	const std::vector<ShaderVariant> &Variants() const { return variants_; }
+
+private:
+	void LoadThread();
+	void JoinLoadThread();
+	bool Read(std::vector<ShaderVariant> &variants);
+
+	typedef std::pair<VertexShaderID, FragmentShaderID> VariantKey;
+
+	std::string filename_;
+	std::vector<ShaderVariant> variants_;
+	std::set<VariantKey> known_;
+	bool dirty_;
+
+	recursive_mutex loadLock_;
+	std::thread *loadThread_;
+	std::vector<ShaderVariant> loaded_;
+	volatile bool loading_;
+};
@@ -126,6 +126,7 @@ TransformDrawEngine::TransformDrawEngine()
 		framebufferManager_(0),
 		numDrawCalls(0),
 		vertexCountInDrawCalls(0),
+		numPendingState_(0),
 		decodeCounter_(0),
 		uvScale(0),
 		fboTexBound_(false) {
@@ -273,6 +274,9 @@ void TransformDrawEngine::SubmitPrim(void *verts, void *inds, GEPrimitiveType pr
 	if (vertexCount == 0)
 		return;  // we ignore zero-sized draw calls.
 
+	if (numPendingState_)
+		ResolvePendingState();
+
 	if (!indexGen.PrimCompatible(prevPrim_, prim) || numDrawCalls >= MAX_DEFERRED_DRAW_CALLS || vertexCountInDrawCalls + vertexCount > VERTEX_BUFFER_MAX)
 		Flush();
 
@@ -372,7 +376,7 @@ void TransformDrawEngine::DecodeVertsStep() {
 	void *inds = dc.inds;
 	if (indexType == GE_VTYPE_IDX_NONE >> GE_VTYPE_IDX_SHIFT) {
 		// Decode the verts and apply morphing. Simple.
-		dec_->DecodeVerts(decoded + decodedVerts_ * (int)dec_->GetDecVtxFmt().stride,
+		DecodeVertsRange(decoded + decodedVerts_ * (int)dec_->GetDecVtxFmt().stride,
 			dc.verts, indexLowerBound, indexUpperBound);
 		decodedVerts_ += indexUpperBound - indexLowerBound + 1;
 		indexGen.AddPrim(dc.prim, dc.vertexCount);
@@ -424,7 +428,7 @@ void TransformDrawEngine::DecodeVertsStep() {
 
 		const int vertexCount = indexUpperBound - indexLowerBound + 1;
 		// 3. Decode that range of vertex data.
-		dec_->DecodeVerts(decoded + decodedVerts_ * (int)dec_->GetDecVtxFmt().stride,
+		DecodeVertsRange(decoded + decodedVerts_ * (int)dec_->GetDecVtxFmt().stride,
 			dc.verts, indexLowerBound, indexUpperBound);
 		decodedVerts_ += vertexCount;
 
@@ -434,6 +438,52 @@ void TransformDrawEngine::DecodeVertsStep() {
 	}
 }
 
+bool TransformDrawEngine::CanUseDecodedCache(u32 vertType) const {
+	if (!g_Config.bVertexCache)
+		return false;
+	// Morphing and software skinning depend on state that's not part of the key.
+	if (vertType & GE_VTYPE_MORPHCOUNT_MASK)
+		return false;
+	if (g_Config.bSoftwareSkinning && (vertType & GE_VTYPE_WEIGHT_MASK))
+		return false;
+	return true;
+}
+
+u32 TransformDrawEngine::DecodedCacheSeed() const {
+	u32 seed = 0x6C2F1A3B;
+	// With prescaling, the UV scale and offset is baked into the decoded vertices.
+	if (uvScale)
+		seed = DoReliableHash(&gstate_c.uv, sizeof(gstate_c.uv), seed);
+	return seed;
+}
+
+void TransformDrawEngine::DecodeVertsRange(u8 *dest, const void *verts, int lowerBound, int upperBound) {
+	if (!CanUseDecodedCache(lastVType_) || !decodedCache_.Enabled()) {
+		dec_->DecodeVerts(dest, verts, lowerBound, upperBound);
+		return;
+	}
+
+	DecodedVertexCache::Key key;
+	DecodedVertexCache::MakeKey(key, verts, lastVType_, dec_->VertexSize(), lowerBound, upperBound, DecodedCacheSeed());
+	const u32 size = dec_->GetDecVtxFmt().stride * (upperBound - lowerBound + 1);
+
+	u8 flags;
+	if (decodedCache_.Lookup(key, dest, size, &flags)) {
+		if (!(flags & VAI_FLAG_VERTEXFULLALPHA))
+			gstate_c.vertexFullAlpha = false;
+		return;
+	}
+
+	// The decoder clears vertexFullAlpha as it goes, so track it separately for this range.
+	const bool prevFullAlpha = gstate_c.vertexFullAlpha;
+	gstate_c.vertexFullAlpha = true;
+	dec_->DecodeVerts(dest, verts, lowerBound, upperBound);
+	flags = gstate_c.vertexFullAlpha ? VAI_FLAG_VERTEXFULLALPHA : 0;
+	gstate_c.vertexFullAlpha = gstate_c.vertexFullAlpha && prevFullAlpha;
+
+	decodedCache_.Store(key, dest, size, flags);
+}
+
 u32 TransformDrawEngine::ComputeHash() {
 	u32 fullhash = 0;
 	int vertexSize = dec_->GetDecVtxFmt().stride;
@@ -478,6 +528,7 @@ void TransformDrawEngine::ClearTrackedVertexArrays() {
 		delete vai->second;
 	}
 	vai_.clear();
+	decodedCache_.Clear();
 }
 
 void TransformDrawEngine::DecimateTrackedVertexArrays() {
@@ -527,10 +578,61 @@ void TransformDrawEngine::FreeBuffer(GLuint buf) {
 	}
 }
 
+bool TransformDrawEngine::DeferStateChange(u8 cmd, u32 prevValue) {
+	// Nothing queued means the flush is free anyway.
+	if (!numDrawCalls)
+		return false;
+
+	for (int i = 0; i < numPendingState_; ++i) {
+		if (pendingState_[i].cmd == cmd)
+			return true;
+	}
+	if (numPendingState_ >= MAX_PENDING_STATE_CHANGES)
+		return false;
+
+	PendingStateChange &change = pendingState_[numPendingState_++];
+	change.cmd = cmd;
+	change.value = prevValue;
+	return true;
+}
+
+void TransformDrawEngine::ResolvePendingState() {
+	for (int i = 0; i < numPendingState_; ++i) {
+		if (gstate.cmdmem[pendingState_[i].cmd] != pendingState_[i].value) {
+			// A real change, so we have to draw what we have with the old state.
+			DoFlush();
+			return;
+		}
+	}
+
+	// Everything was changed back, so the queued draws can be merged with the next ones.
+	// Deferred commands have no handlers, so there's no derived state to undo either.
+	numPendingState_ = 0;
+	gpuStats.numFlushesAvoided++;
+}
+
+void TransformDrawEngine::SwapPendingState() {
+	// Deferred state has no derived state, the flush reads it straight from gstate.
+	for (int i = 0; i < numPendingState_; ++i) {
+		PendingStateChange &change = pendingState_[i];
+		std::swap(gstate.cmdmem[change.cmd], change.value);
+	}
+}
+
 void TransformDrawEngine::DoFlush() {
 	gpuStats.numFlushes++;
 	gpuStats.numTrackedVertexArrays = (int)vai_.size();
 
+	int drawsBucket = 0;
+	while (drawsBucket < (int)ARRAY_SIZE(gpuStats.drawsPerFlush) - 1 && (2 << drawsBucket) <= numDrawCalls)
+		drawsBucket++;
+	gpuStats.drawsPerFlush[drawsBucket]++;
+
+	// If state changed after the draws were queued, draw them with what they were queued with.
+	const bool restorePendingState = numPendingState_ != 0;
+	if (restorePendingState)
+		SwapPendingState();
+
 	// This is not done on every drawcall, we should collect vertex data
 	// until critical state changes. That's when we draw (flush).
 
@@ -770,6 +872,17 @@ rotateVBO:
 	gstate_c.vertexFullAlpha = true;
 	framebufferManager_->SetColorUpdated();
 
+	gpuStats.numDecodedCacheHits += decodedCache_.stats.hits;
+	gpuStats.numDecodedCacheMisses += decodedCache_.stats.misses;
+	gpuStats.numDecodedBytes += decodedCache_.stats.bytesDecoded;
+	gpuStats.numDecodedBytesReused += decodedCache_.stats.bytesReused;
+	decodedCache_.ResetStats();
+
+	if (restorePendingState) {
+		SwapPendingState();
+		numPendingState_ = 0;
+	}
+
 #ifndef MOBILE_DEVICE
 	host->GPUNotifyDraw();
 #endif
@@ -783,6 +896,8 @@ void TransformDrawEngine::Resized() {
 		delete iter->second;
 	}
 	decoderMap_.clear();
+	// The decoded format may have changed along with the config.
+	decodedCache_.Clear();
 
 	if (g_Config.bPrescaleUV && !uvScale) {
 		uvScale = new UVScale[MAX_DEFERRED_DRAW_CALLS];
@@ -19,6 +19,7 @@
 
 #include <map>
 
+#include "GPU/Common/DecodedVertexCache.h"
 #include "GPU/Common/GPUDebugInterface.h"
 #include "GPU/Common/IndexGenerator.h"
 #include "GPU/GLES/VertexDecoder.h"
@@ -164,6 +165,11 @@ public:
 		DoFlush();
 	}
 
+	// Called instead of Flush() for state changes that games often undo before the next draw.
+	// The queued draws keep the previous value, and if it's restored in time they keep batching.
+	// Returns false if the caller must flush right away instead.
+	bool DeferStateChange(u8 cmd, u32 prevValue);
+
 	bool IsCodePtrVertexDecoder(const u8 *ptr) const;
 
 	// Really just for convenience to share with softgpu.
@@ -172,7 +178,12 @@ public:
 private:
 	void DecodeVerts();
 	void DecodeVertsStep();
+	void DecodeVertsRange(u8 *dest, const void *verts, int lowerBound, int upperBound);
+	bool CanUseDecodedCache(u32 vertType) const;
+	u32 DecodedCacheSeed() const;
 	void DoFlush();
+	void ResolvePendingState();
+	void SwapPendingState();
 	void SoftwareTransformAndDraw(int prim, u8 *decoded, LinkedShader *program, int vertexCount, u32 vertexType, void *inds, int indexType, const DecVtxFormat &decVtxFormat, int maxIndex);
 	void ApplyDrawState(int prim);
 	void ApplyBlendState();
@@ -224,6 +235,9 @@ private:
 
 	std::map<u32, VertexArrayInfo *> vai_;
 
+	// Decoded vertex ranges, reused across frames and draw call sequences.
+	DecodedVertexCache decodedCache_;
+
 	// Fixed index buffer for easy quad generation from spline/bezier
 	u16 *quadIndices_;
 
@@ -241,6 +255,15 @@ private:
 	int numDrawCalls;
 	int vertexCountInDrawCalls;
 
+	// State changed since the queued draws were submitted. Value is what they were submitted with.
+	struct PendingStateChange {
+		u8 cmd;
+		u32 value;
+	};
+	enum { MAX_PENDING_STATE_CHANGES = 16 };
+	PendingStateChange pendingState_[MAX_PENDING_STATE_CHANGES];
+	int numPendingState_;
+
 	int decimationCounter_;
 	int decodeCounter_;
 	u32 dcid_;
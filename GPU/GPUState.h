@@ -501,19 +501,28 @@ struct GPUStatistics {
 		numTextureSwitches = 0;
 		numShaderSwitches = 0;
 		numFlushes = 0;
+		numFlushesAvoided = 0;
 		numTexturesDecoded = 0;
 		numAlphaTestedDraws = 0;
 		numNonAlphaTestedDraws = 0;
+		numDecodedCacheHits = 0;
+		numDecodedCacheMisses = 0;
+		numDecodedBytes = 0;
+		numDecodedBytesReused = 0;
 		msProcessingDisplayLists = 0;
 		vertexGPUCycles = 0;
 		otherGPUCycles = 0;
 		memset(gpuCommandsAtCallLevel, 0, sizeof(gpuCommandsAtCallLevel));
+		memset(drawsPerFlush, 0, sizeof(drawsPerFlush));
 	}
 
 	// Per frame statistics
 	int numDrawCalls;
 	int numCachedDrawCalls;
 	int numFlushes;
+	int numFlushesAvoided;
+	// Histogram by power of two: 1, 2-3, 4-7, ..., 128+.
+	int drawsPerFlush[8];
 	int numVertsSubmitted;
 	int numCachedVertsDrawn;
 	int numUncachedVertsDrawn;
@@ -530,6 +539,11 @@ struct GPUStatistics {
 	int numAlphaTestedDraws;
 	int numNonAlphaTestedDraws;
 
+	int numDecodedCacheHits;
+	int numDecodedCacheMisses;
+	int numDecodedBytes;
+	int numDecodedBytesReused;
+
 	// Total statistics, updated by the GPU core in UpdateStats
 	int numVBlanks;
 	int numFlips;
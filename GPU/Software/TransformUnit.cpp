@@ -15,13 +15,17 @@
 // Official git repository and contact information can be found at
 // https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
 
+#include <algorithm>
+
 #include "Common/MemoryUtil.h"
 #include "Core/Host.h"
 #include "Core/Config.h"
 #include "GPU/GPUState.h"
 #include "GPU/GLES/VertexDecoder.h"
 #include "GPU/GLES/TransformPipeline.h"
+#include "GPU/Common/DecodedVertexCache.h"
 #include "GPU/Common/SplineCommon.h"
+#include "GPU/Common/TextureDecoder.h"
 
 #include "GPU/Software/TransformUnit.h"
 #include "GPU/Software/Clipper.h"
@@ -29,6 +33,39 @@
 
 static u8 buf[65536 * 48];  // yolo
 static bool outside_range_flag = false;
+// Created on first use, so the arena isn't allocated unless the software renderer draws.
+static DecodedVertexCache *decodedCache = NULL;
+
+// Same rules as TransformDrawEngine::CanUseDecodedCache(): morphing and skinning in the decoder
+// depend on state that isn't part of the key, and prescaled UVs on the current UV scale.
+static void DecodeVertsCached(VertexDecoder &vdecoder, u8 *dest, const void *verts, int lowerBound, int upperBound, u32 vertex_type)
+{
+	const bool skinInDecode = g_Config.bSoftwareSkinning && (vertex_type & GE_VTYPE_WEIGHT_MASK);
+	if (!g_Config.bVertexCache || (vertex_type & GE_VTYPE_MORPHCOUNT_MASK) || skinInDecode) {
+		vdecoder.DecodeVerts(dest, verts, lowerBound, upperBound);
+		return;
+	}
+	if (!decodedCache)
+		decodedCache = new DecodedVertexCache();
+	if (!decodedCache->Enabled()) {
+		vdecoder.DecodeVerts(dest, verts, lowerBound, upperBound);
+		return;
+	}
+
+	DecodedVertexCache::Key key;
+	u32 seed = 0x50F7C4E1;
+	if (g_Config.bPrescaleUV)
+		seed = DoReliableHash(&gstate_c.uv, sizeof(gstate_c.uv), seed);
+	const u32 vertTypeID = (vertex_type & 0xFFFFFF) | (gstate.getUVGenMode() << 24);
+	DecodedVertexCache::MakeKey(key, verts, vertTypeID, vdecoder.VertexSize(), lowerBound, upperBound, seed);
+	const u32 size = vdecoder.GetDecVtxFmt().stride * (upperBound - lowerBound + 1);
+
+	u8 flags;
+	if (decodedCache->Lookup(key, dest, size, &flags))
+		return;
+	vdecoder.DecodeVerts(dest, verts, lowerBound, upperBound);
+	decodedCache->Store(key, dest, size, 0);
+}
 
 WorldCoords TransformUnit::ModelToWorld(const ModelCoords& coords)
 {
@@ -109,6 +146,29 @@ ScreenCoords TransformUnit::DrawingToScreen(const DrawingCoords& coords)
 	return ret;
 }
 
+static void ProcessVertex(VertexData &vertex, const float pos[3], bool hasNormal, bool hasColor0)
+{
+	if (!gstate.isModeThrough()) {
+		vertex.modelpos = ModelCoords(pos[0], pos[1], pos[2]);
+		vertex.worldpos = WorldCoords(TransformUnit::ModelToWorld(vertex.modelpos));
+		vertex.clippos = ClipCoords(TransformUnit::ViewToClip(TransformUnit::WorldToView(vertex.worldpos)));
+		vertex.screenpos = ClipToScreenInternal(vertex.clippos);
+
+		if (hasNormal) {
+			vertex.worldnormal = TransformUnit::ModelToWorldNormal(vertex.normal);
+			// TODO: Isn't there a flag that controls whether to normalize the normal?
+			vertex.worldnormal /= vertex.worldnormal.Length();
+		}
+
+		Lighting::Process(vertex, hasColor0);
+	} else {
+		vertex.screenpos.x = (u32)pos[0] * 16 + gstate.getOffsetX16();
+		vertex.screenpos.y = (u32)pos[1] * 16 + gstate.getOffsetY16();
+		vertex.screenpos.z = pos[2];
+		vertex.clippos.w = 1.f;
+	}
+}
+
 static VertexData ReadVertex(VertexReader& vreader)
 {
 	VertexData vertex;
@@ -169,42 +229,30 @@ static VertexData ReadVertex(VertexReader& vreader)
 		vertex.color1 = Vec3<int>(0, 0, 0);
 	}
 
-	if (!gstate.isModeThrough()) {
-		vertex.modelpos = ModelCoords(pos[0], pos[1], pos[2]);
-		vertex.worldpos = WorldCoords(TransformUnit::ModelToWorld(vertex.modelpos));
-		vertex.clippos = ClipCoords(TransformUnit::ViewToClip(TransformUnit::WorldToView(vertex.worldpos)));
-		vertex.screenpos = ClipToScreenInternal(vertex.clippos);
+	ProcessVertex(vertex, pos, vreader.hasNormal(), vreader.hasColor0());
+	return vertex;
+}
 
-		if (vreader.hasNormal()) {
-			vertex.worldnormal = TransformUnit::ModelToWorldNormal(vertex.normal);
-			// TODO: Isn't there a flag that controls whether to normalize the normal?
-			vertex.worldnormal /= vertex.worldnormal.Length();
-		}
+// Tesselated spline vertices always have a normal and a color, see NormalizeVertices.
+static VertexData ReadSimpleVertex(const SimpleVertex &sv)
+{
+	VertexData vertex;
 
-		Lighting::Process(vertex, vreader.hasColor0());
-	} else {
-		vertex.screenpos.x = (u32)pos[0] * 16 + gstate.getOffsetX16();
-		vertex.screenpos.y = (u32)pos[1] * 16 + gstate.getOffsetY16();
-		vertex.screenpos.z = pos[2];
-		vertex.clippos.w = 1.f;
-	}
+	float pos[3] = { sv.pos.x, sv.pos.y, sv.pos.z };
 
-	return vertex;
-}
+	if (!gstate.isModeClear() && gstate.isTextureMapEnabled())
+		vertex.texturecoords = Vec2<float>(sv.uv[0], sv.uv[1]);
 
-#define START_OPEN_U 1
-#define END_OPEN_U 2
-#define START_OPEN_V 4
-#define END_OPEN_V 8
+	vertex.normal = Vec3<float>(sv.nrm.x, sv.nrm.y, sv.nrm.z);
+	if (gstate.areNormalsReversed())
+		vertex.normal = -vertex.normal;
 
-struct SplinePatch {
-	VertexData points[16];
-	int type;
-	int pad[3];
-};
+	vertex.color0 = Vec4<int>(sv.color[0], sv.color[1], sv.color[2], sv.color[3]);
+	vertex.color1 = Vec3<int>(0, 0, 0);
 
-SplinePatch *TransformUnit::patchBuffer_ = 0;
-int TransformUnit::patchBufferSize_ = 0;
+	ProcessVertex(vertex, pos, true, true);
+	return vertex;
+}
 
 void TransformUnit::SubmitSpline(void* control_points, void* indices, int count_u, int count_v, int type_u, int type_v, GEPatchPrimType prim_type, u32 vertex_type)
 {
@@ -212,7 +260,6 @@ void TransformUnit::SubmitSpline(void* control_points, void* indices, int count_
 	vdecoder.SetVertexType(vertex_type);
 	const DecVtxFormat& vtxfmt = vdecoder.GetDecVtxFmt();
 
-	static u8 buf[65536 * 48]; // yolo
 	u16 index_lower_bound = 0;
 	u16 index_upper_bound = count_u * count_v - 1;
 	bool indices_16bit = (vertex_type & GE_VTYPE_IDX_MASK) == GE_VTYPE_IDX_16BIT;
@@ -220,67 +267,102 @@ void TransformUnit::SubmitSpline(void* control_points, void* indices, int count_
 	u16* indices16 = (u16*)indices;
 	if (indices)
 		GetIndexBounds(indices, count_u*count_v, vertex_type, &index_lower_bound, &index_upper_bound);
-	vdecoder.DecodeVerts(buf, control_points, index_lower_bound, index_upper_bound);
 
-	VertexReader vreader(buf, vtxfmt, vertex_type);
+	// Decoding starts at the lower bound.
+	std::vector<u8> decoded((index_upper_bound - index_lower_bound + 1) * vtxfmt.stride);
+	DecodeVertsCached(vdecoder, &decoded[0], control_points, index_lower_bound, index_upper_bound, vertex_type);
+
+	VertexReader vreader(&decoded[0], vtxfmt, vertex_type);
 
-	int num_patches_u = count_u - 3;
-	int num_patches_v = count_v - 3;
+	// Convert the control points to the common format, so the tesselation can be shared with the
+	// hardware renderers. Skinning is done here since the tesselated vertices don't have weights.
+	std::vector<SimpleVertex> simplified_control_points(index_upper_bound + 1);
+	const bool skinning = vertTypeIsSkinningEnabled(vertex_type) && !gstate.isModeThrough();
+	for (int i = index_lower_bound; i <= index_upper_bound; ++i) {
+		vreader.Goto(i - index_lower_bound);
+		SimpleVertex &sv = simplified_control_points[i];
 
-	if (patchBufferSize_ < num_patches_u * num_patches_v) {
-		if (patchBuffer_) {
-			FreeAlignedMemory(patchBuffer_);
+		float pos[3];
+		vreader.ReadPosZ16(pos);
+
+		if (vreader.hasUV()) {
+			vreader.ReadUV(sv.uv);
+		} else {
+			sv.uv[0] = 0.0f;
+			sv.uv[1] = 0.0f;
 		}
-		patchBuffer_ = (SplinePatch *)AllocateAlignedMemory(num_patches_u * num_patches_v, 16);
-		patchBufferSize_ = num_patches_u * num_patches_v;
-	}
-	SplinePatch *patches = patchBuffer_;
 
-	for (int patch_u = 0; patch_u < num_patches_u; ++patch_u) {
-		for (int patch_v = 0; patch_v < num_patches_v; ++patch_v) {
-			SplinePatch& patch = patches[patch_u + patch_v * num_patches_u];
+		Vec3<float> normal(0.0f, 0.0f, 1.0f);
+		if (vreader.hasNormal()) {
+			float nrm[3];
+			vreader.ReadNrm(nrm);
+			normal = Vec3<float>(nrm[0], nrm[1], nrm[2]);
+		}
 
-			for (int point = 0; point < 16; ++point) {
-				int idx = (patch_u + point%4) + (patch_v + point/4) * count_u;
-				if (indices)
-					vreader.Goto(indices_16bit ? indices16[idx] : indices8[idx]);
-				else
-					vreader.Goto(idx);
+		if (skinning) {
+			float W[8] = { 1.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+			vreader.ReadWeights(W);
 
-				patch.points[point] = ReadVertex(vreader);
+			Vec3<float> tmppos(0.f, 0.f, 0.f);
+			Vec3<float> tmpnrm(0.f, 0.f, 0.f);
+			for (int w = 0; w < vertTypeGetNumBoneWeights(vertex_type); ++w) {
+				Mat3x3<float> bone(&gstate.boneMatrix[12*w]);
+				tmppos += (bone * ModelCoords(pos[0], pos[1], pos[2]) * W[w] + Vec3<float>(gstate.boneMatrix[12*w+9], gstate.boneMatrix[12*w+10], gstate.boneMatrix[12*w+11]));
+				tmpnrm += (bone * normal) * W[w];
 			}
-			patch.type = (type_u | (type_v<<2));
-			if (patch_u != 0) patch.type &= ~START_OPEN_U;
-			if (patch_v != 0) patch.type &= ~START_OPEN_V;
-			if (patch_u != num_patches_u-1) patch.type &= ~END_OPEN_U;
-			if (patch_v != num_patches_v-1) patch.type &= ~END_OPEN_V;
+			pos[0] = tmppos.x;
+			pos[1] = tmppos.y;
+			pos[2] = tmppos.z;
+			normal = tmpnrm;
 		}
-	}
 
-	for (int patch_idx = 0; patch_idx < num_patches_u*num_patches_v; ++patch_idx) {
-		SplinePatch& patch = patches[patch_idx];
-
-		// TODO: Should do actual patch subdivision instead of just drawing the control points!
-		const int tile_min_u = (patch.type & START_OPEN_U) ? 0 : 1;
-		const int tile_min_v = (patch.type & START_OPEN_V) ? 0 : 1;
-		const int tile_max_u = (patch.type & END_OPEN_U) ? 3 : 2;
-		const int tile_max_v = (patch.type & END_OPEN_V) ? 3 : 2;
-		for (int tile_u = tile_min_u; tile_u < tile_max_u; ++tile_u) {
-			for (int tile_v = tile_min_v; tile_v < tile_max_v; ++tile_v) {
-				int point_index = tile_u + tile_v*4;
-
-				VertexData v0 = patch.points[point_index];
-				VertexData v1 = patch.points[point_index+1];
-				VertexData v2 = patch.points[point_index+4];
-				VertexData v3 = patch.points[point_index+5];
-
-				// TODO: Backface culling etc
-				Clipper::ProcessTriangle(v0, v1, v2);
-				Clipper::ProcessTriangle(v2, v1, v0);
-				Clipper::ProcessTriangle(v2, v1, v3);
-				Clipper::ProcessTriangle(v3, v1, v2);
-			}
+		if (vreader.hasColor0()) {
+			vreader.ReadColor0_8888(sv.color);
+		} else {
+			sv.color[0] = gstate.getMaterialAmbientR();
+			sv.color[1] = gstate.getMaterialAmbientG();
+			sv.color[2] = gstate.getMaterialAmbientB();
+			sv.color[3] = gstate.getMaterialAmbientA();
 		}
+
+		sv.nrm = Vec3Packedf(normal.x, normal.y, normal.z);
+		sv.pos = Vec3Packedf(pos[0], pos[1], pos[2]);
+	}
+
+	std::vector<SimpleVertex *> points(count_u * count_v);
+	for (int idx = 0; idx < count_u * count_v; idx++) {
+		if (indices)
+			points[idx] = &simplified_control_points[indices_16bit ? indices16[idx] : indices8[idx]];
+		else
+			points[idx] = &simplified_control_points[idx];
+	}
+
+	SplinePatchLocal patch;
+	patch.type_u = type_u;
+	patch.type_v = type_v;
+	patch.count_u = count_u;
+	patch.count_v = count_v;
+	patch.points = &points[0];
+
+	std::vector<SimpleVertex> tesselated(std::max(SplinePatchMaxVertices(patch), 1));
+	u8 *dest = (u8 *)&tesselated[0];
+	int count = 0;
+	TesselateSplinePatch(dest, count, patch, vertex_type);
+
+	// The output is quads, drawn as (0, 2, 1) and (1, 2, 3).
+	const SimpleVertex *quads = &tesselated[0];
+	const int numQuads = count / 6;
+	for (int i = 0; i < numQuads; ++i) {
+		VertexData v0 = ReadSimpleVertex(quads[i * 4 + 0]);
+		VertexData v1 = ReadSimpleVertex(quads[i * 4 + 1]);
+		VertexData v2 = ReadSimpleVertex(quads[i * 4 + 2]);
+		VertexData v3 = ReadSimpleVertex(quads[i * 4 + 3]);
+
+		// TODO: Backface culling etc
+		Clipper::ProcessTriangle(v0, v2, v1);
+		Clipper::ProcessTriangle(v1, v2, v0);
+		Clipper::ProcessTriangle(v1, v2, v3);
+		Clipper::ProcessTriangle(v3, v2, v1);
 	}
 
 	host->GPUNotifyDraw();
@@ -308,7 +390,7 @@ void TransformUnit::SubmitPrimitive(void* vertices, void* indices, u32 prim_type
 	u16* indices16 = (u16*)indices;
 	if (indices)
 		GetIndexBounds(indices, vertex_count, vertex_type, &index_lower_bound, &index_upper_bound);
-	vdecoder.DecodeVerts(buf, vertices, index_lower_bound, index_upper_bound);
+	DecodeVertsCached(vdecoder, buf, vertices, index_lower_bound, index_upper_bound, vertex_type);
 
 	VertexReader vreader(buf, vtxfmt, vertex_type);
 
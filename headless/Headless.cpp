@@ -348,6 +348,8 @@ int main(int argc, const char* argv[])
 	g_Config.bSoftwareSkinning = true;
 	g_Config.bVertexDecoderJit = true;
 	g_Config.bBlockTransferGPU = true;
+	g_Config.iIOCacheSize = 4096;
+	g_Config.bMemoryMapISO = true;
 
 #ifdef _WIN32
 	InitSysDirectories();
@@ -0,0 +1,146 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+// PSZConvert
+//
+// Converts ISO and CSO images to the .psz format, see PSZFileBlockDevice.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "base/NativeApp.h"
+#include "base/timeutil.h"
+#include "Common/CPUDetect.h"
+#include "Common/FileUtil.h"
+#include "Core/Config.h"
+#include "Core/FileSystems/BlockDevices.h"
+
+std::string System_GetProperty(SystemProperty prop) { return ""; }
+int System_GetPropertyInt(SystemProperty prop) { return -1; }
+
+static int printUsage(const char *progname, const char *reason)
+{
+	if (reason != NULL)
+		fprintf(stderr, "Error: %s\n\n", reason);
+	fprintf(stderr, "Converts ISO and CSO images to the PSZ format.\n\n");
+	fprintf(stderr, "Usage: %s [options] input.iso|input.cso output.psz\n\n", progname);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --frame=KB            frame size in KB, a multiple of 2, up to 1024 (default 32)\n");
+	fprintf(stderr, "  --verify              read the output back and compare it to the input\n");
+
+	return 1;
+}
+
+static bool Verify(BlockDevice *source, const char *filename)
+{
+	BlockDevice *converted = constructBlockDevice(filename);
+	if (!converted || converted->GetNumBlocks() != source->GetNumBlocks())
+	{
+		delete converted;
+		return false;
+	}
+
+	const int blocksPerRead = 64;
+	std::vector<u8> a(blocksPerRead * source->GetBlockSize());
+	std::vector<u8> b(a.size());
+	bool same = true;
+	for (u32 block = 0; block < source->GetNumBlocks() && same; block += blocksPerRead)
+	{
+		int count = (int)std::min((u32)blocksPerRead, source->GetNumBlocks() - block);
+		source->ReadBlocks(block, count, &a[0]);
+		converted->ReadBlocks(block, count, &b[0]);
+		same = memcmp(&a[0], &b[0], count * source->GetBlockSize()) == 0;
+		if (!same)
+			fprintf(stderr, "Mismatch in blocks %d-%d\n", block, block + count - 1);
+	}
+	delete converted;
+	return same;
+}
+
+int main(int argc, const char *argv[])
+{
+	const char *input = 0;
+	const char *output = 0;
+	int frameKB = 32;
+	bool verify = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strncmp(argv[i], "--frame=", strlen("--frame=")))
+			frameKB = atoi(argv[i] + strlen("--frame="));
+		else if (!strcmp(argv[i], "--verify"))
+			verify = true;
+		else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+			return printUsage(argv[0], NULL);
+		else if (!input)
+			input = argv[i];
+		else if (!output)
+			output = argv[i];
+		else
+			return printUsage(argv[0], "Too many files specified");
+	}
+
+	if (!input || !output)
+		return printUsage(argv[0], argc <= 1 ? NULL : "Missing input or output file");
+	if (frameKB <= 0 || (frameKB % 2) != 0 || frameKB > 1024)
+		return printUsage(argv[0], "Invalid frame size");
+
+	g_Config.bEnableLogging = false;
+	g_Config.iIOCacheSize = 0;
+	g_Config.bMemoryMapISO = false;
+	g_Config.iNumWorkerThreads = cpu_info.num_cores;
+
+	BlockDevice *source = constructBlockDevice(input);
+	if (!source || source->GetNumBlocks() == 0)
+	{
+		fprintf(stderr, "Unable to open %s\n", input);
+		delete source;
+		return 1;
+	}
+
+	double start = real_time_now();
+	if (!WritePSZImage(source, output, frameKB * 1024))
+	{
+		fprintf(stderr, "Unable to write %s\n", output);
+		delete source;
+		return 1;
+	}
+	double elapsed = real_time_now() - start;
+
+	const u64 inSize = File::GetSize(input);
+	const u64 outSize = File::GetSize(output);
+	printf("%s: %0.1f MB -> %0.1f MB (%0.1f%%) in %0.2f s\n", output, inSize / (1024.0 * 1024.0), outSize / (1024.0 * 1024.0),
+		inSize == 0 ? 0.0 : outSize * 100.0 / inSize, elapsed);
+
+	int result = 0;
+	if (verify)
+	{
+		if (Verify(source, output))
+			printf("Verified OK\n");
+		else
+		{
+			fprintf(stderr, "Verification failed!\n");
+			result = 1;
+		}
+	}
+
+	delete source;
+	return result;
+}
@@ -0,0 +1,593 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+// AudioBench
+//
+// Runs the audio paths - SAS mixing, VAG decoding, ATRAC and MP3 decoding and the sceAudio channel
+// mixer - on their own, without a PSP program driving them, so their cost can be measured in
+// isolation.  Every case prints its speed and a checksum of everything it output.  The checksums
+// can be saved as goldens and compared against later, to make sure an optimization didn't change
+// the output.
+//
+// Only the integer paths go in goldens.  Those must give the same output everywhere, SSE or not,
+// so unittest/AudioBench.golden is checked in:  audioBench --golden=unittest/AudioBench.golden
+// The resampler and the FFmpeg decoders use floats, so theirs would vary by platform.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/NativeApp.h"
+#include "base/timeutil.h"
+#include "file/chunk_file.h"
+#include "Common/FileUtil.h"
+#include "Core/Config.h"
+#include "Core/CoreTiming.h"
+#include "Core/MemMap.h"
+#include "Core/HLE/__sceAudio.h"
+#include "Core/HLE/sceAudio.h"
+#include "Core/HW/SasAudio.h"
+#include "Core/HW/SimpleAudioDec.h"
+
+std::string System_GetProperty(SystemProperty prop) { return ""; }
+int System_GetPropertyInt(SystemProperty prop) { return -1; }
+
+struct BenchResult {
+	std::string name;
+	u64 samples;
+	double seconds;
+	u32 checksum;
+	// Integer only, so the checksum is the same on every platform and build.
+	bool exact;
+};
+
+// Not rand(), so the input (and therefore the goldens) is the same everywhere.
+class BenchRandom {
+public:
+	BenchRandom(u32 seed) : state_(seed) {}
+	u32 Next(u32 range) {
+		state_ = state_ * 1664525 + 1013904223;
+		return (state_ >> 8) % range;
+	}
+
+private:
+	u32 state_;
+};
+
+static u32 Checksum(u32 sum, const s16 *samples, int count) {
+	for (int i = 0; i < count; ++i)
+		sum = (sum ^ (u16)samples[i]) * 16777619;
+	return sum;
+}
+
+static void WriteTestPCM(u32 addr, int samples, float rate) {
+	for (int i = 0; i < samples; ++i)
+		Memory::Write_U16((u16)(s16)(sinf(i * rate) * 12000.0f + sinf(i * rate * 3.1f) * 4000.0f), addr + i * sizeof(s16));
+}
+
+// Random nibbles with the filters and shifts games actually use, and an end marker.
+static void WriteTestVAG(u32 addr, u32 size, BenchRandom &rng) {
+	for (u32 block = 0; block < size / 16; ++block) {
+		const u32 blockAddr = addr + block * 16;
+		Memory::Write_U8((u8)((rng.Next(5) << 4) | rng.Next(13)), blockAddr);
+		Memory::Write_U8(block == size / 16 - 1 ? 7 : 0, blockAddr + 1);
+		for (int i = 2; i < 16; ++i)
+			Memory::Write_U8((u8)rng.Next(256), blockAddr + i);
+	}
+}
+
+// Plays a stream of voice parameter changes through a SasInstance, a grain at a time, like a game
+// calling sceSasCore.  The stream is generated from the seed: voices get keyed on and off with
+// random sounds, pitches, volumes and envelopes, and sometimes bent while playing.
+static BenchResult RunSasStream(const char *name, u32 seed, bool useVag, bool usePcm) {
+	const int grainSize = 256;
+	const int grains = 8000;
+	const u32 vagSizes[] = { 2048, 4096, 16384, 65536 };
+	const int numVags = sizeof(vagSizes) / sizeof(vagSizes[0]);
+	const int pcmSamples = 8192;
+	// 1x, 2x and 0.5x have their own paths, the rest are interpolated.
+	const int exactPitches[] = { 0x1000, 0x2000, 0x0800 };
+
+	BenchRandom rng(seed);
+	u32 addr = PSP_GetUserMemoryBase();
+	const u32 outAddr = addr;
+	addr += grainSize * 2 * sizeof(s16);
+	const u32 pcmAddr = addr;
+	WriteTestPCM(pcmAddr, pcmSamples, 0.05f);
+	addr += pcmSamples * sizeof(s16);
+	u32 vagAddrs[numVags];
+	for (int i = 0; i < numVags; ++i) {
+		vagAddrs[i] = addr;
+		WriteTestVAG(addr, vagSizes[i], rng);
+		addr += vagSizes[i];
+	}
+
+	SasInstance *sas = new SasInstance();
+	sas->SetGrainSize(grainSize);
+
+	BenchResult result;
+	result.name = name;
+	result.samples = 0;
+	result.seconds = 0.0;
+	result.checksum = 0x811C9DC5;
+	result.exact = true;
+	for (int grain = 0; grain < grains; ++grain) {
+		for (int v = 0; v < PSP_SAS_VOICES_MAX; ++v) {
+			SasVoice &voice = sas->voices[v];
+			const u32 event = rng.Next(64);
+			if (event == 0 && !voice.on) {
+				if (useVag && (!usePcm || rng.Next(2) == 0)) {
+					const int which = rng.Next(numVags);
+					voice.type = VOICETYPE_VAG;
+					voice.vagAddr = vagAddrs[which];
+					voice.vagSize = vagSizes[which];
+					voice.loop = rng.Next(4) == 0;
+				} else {
+					voice.type = VOICETYPE_PCM;
+					voice.pcmAddr = pcmAddr;
+					voice.pcmSize = pcmSamples;
+					voice.pcmIndex = 0;
+					voice.pcmLoopPos = 0;
+					voice.loop = rng.Next(2) == 0;
+				}
+				voice.pitch = rng.Next(4) == 0 ? exactPitches[rng.Next(3)] : 0x0400 + rng.Next(0x3C00);
+				voice.volumeLeft = rng.Next(PSP_SAS_VOL_MAX);
+				voice.volumeRight = rng.Next(PSP_SAS_VOL_MAX);
+				voice.effectLeft = rng.Next(PSP_SAS_VOL_MAX / 4);
+				voice.effectRight = rng.Next(PSP_SAS_VOL_MAX / 4);
+				voice.envelope.SetSimpleEnvelope(0x000F | (rng.Next(16) << 8), 0x1FC0 | rng.Next(64));
+				voice.ChangedParams(true);
+				voice.KeyOn();
+			} else if (event == 1 && voice.on) {
+				voice.KeyOff();
+			} else if (event == 2) {
+				// Bends come in a run, like a game sliding the pitch.
+				voice.pitch = std::max(0x0100, std::min(0x4000, voice.pitch + (int)rng.Next(0x200) - 0x100));
+			}
+		}
+
+		const double start = real_time_now();
+		sas->Mix(outAddr);
+		result.seconds += real_time_now() - start;
+
+		result.checksum = Checksum(result.checksum, (const s16 *)Memory::GetPointer(outAddr), grainSize * 2);
+		result.samples += grainSize;
+	}
+
+	delete sas;
+	return result;
+}
+
+// Keys on the same short VAG over and over, like a game firing off a sound effect.  Run once
+// decoding straight from memory and once through the decoded sample cache, which must match.
+static BenchResult RunVagPlays(const char *name, bool useCache) {
+	const int grainSize = 256;
+	const u32 vagSize = 16 * 1024;
+	const int plays = 2000;
+
+	BenchRandom rng(4);
+	const u32 vagAddr = PSP_GetUserMemoryBase();
+	WriteTestVAG(vagAddr, vagSize, rng);
+	VagDecoder::SetCacheEnabled(useCache);
+
+	BenchResult result;
+	result.name = name;
+	result.samples = 0;
+	result.seconds = 0.0;
+	result.checksum = 0x811C9DC5;
+	result.exact = true;
+
+	s16 buffer[grainSize];
+	for (int i = 0; i < plays; ++i) {
+		VagDecoder vag;
+		vag.Start(vagAddr, vagSize, false);
+		while (!vag.End()) {
+			const double start = real_time_now();
+			vag.GetSamples(buffer, grainSize);
+			result.seconds += real_time_now() - start;
+
+			result.checksum = Checksum(result.checksum, buffer, grainSize);
+			result.samples += grainSize;
+		}
+	}
+
+	VagDecoder::SetCacheEnabled(true);
+	VagDecoder::ClearCache();
+	return result;
+}
+
+// Keeps all 32 voices playing a looping PCM sound, at a spread of pitches that includes the 1x, 2x
+// and 0.5x fast paths.  That's the most a game can ask of sceSasCore in one grain.
+static BenchResult RunSasVoices(const char *name) {
+	const int grainSize = 256;
+	const int pcmSamples = 8192;
+	const int grains = 20000;
+	const int pitches[] = { 0x1000, 0x1000, 0x2000, 0x0800, 0x1234, 0x0C00, 0x1800, 0x0F37 };
+
+	const u32 outAddr = PSP_GetUserMemoryBase();
+	const u32 pcmAddr = outAddr + grainSize * 2 * sizeof(s16);
+	WriteTestPCM(pcmAddr, pcmSamples, 0.05f);
+
+	SasInstance *sas = new SasInstance();
+	sas->SetGrainSize(grainSize);
+	for (int v = 0; v < PSP_SAS_VOICES_MAX; ++v) {
+		SasVoice &voice = sas->voices[v];
+		voice.type = VOICETYPE_PCM;
+		voice.pcmAddr = pcmAddr;
+		voice.pcmSize = pcmSamples;
+		voice.pcmIndex = 0;
+		voice.pcmLoopPos = 0;
+		voice.loop = true;
+		voice.pitch = pitches[v % (sizeof(pitches) / sizeof(pitches[0]))];
+		voice.volumeLeft = PSP_SAS_VOL_MAX / 2;
+		voice.volumeRight = PSP_SAS_VOL_MAX / 4;
+		voice.effectLeft = PSP_SAS_VOL_MAX / 8;
+		voice.effectRight = PSP_SAS_VOL_MAX / 8;
+		voice.envelope.SetSimpleEnvelope(0x000F, 0x1FC6);
+		voice.ChangedParams(true);
+		voice.KeyOn();
+	}
+
+	BenchResult result;
+	result.name = name;
+	result.samples = 0;
+	result.seconds = 0.0;
+	result.checksum = 0x811C9DC5;
+	result.exact = true;
+	for (int grain = 0; grain < grains; ++grain) {
+		const double start = real_time_now();
+		sas->Mix(outAddr);
+		result.seconds += real_time_now() - start;
+
+		result.checksum = Checksum(result.checksum, (const s16 *)Memory::GetPointer(outAddr), grainSize * 2);
+		result.samples += grainSize;
+	}
+
+	delete sas;
+	return result;
+}
+
+static bool ReadWholeFile(const char *filename, std::string &data) {
+	File::IOFile f(filename, "rb");
+	if (f.IsOpen()) {
+		data.resize((size_t)f.GetSize());
+		if (!data.empty() && !f.ReadBytes(&data[0], data.size()))
+			data.clear();
+	}
+	if (data.empty()) {
+		fprintf(stderr, "Unable to read %s\n", filename);
+		return false;
+	}
+	return true;
+}
+
+static std::string BaseName(const char *filename) {
+	std::string base = filename;
+	return base.substr(base.find_last_of("/\\") + 1);
+}
+
+// Decodes every frame of an .at3 file, the same kind of RIFF file games hand to sceAtrac.
+static bool RunAtracFile(const char *filename, BenchResult &result) {
+	std::string data;
+	if (!ReadWholeFile(filename, data))
+		return false;
+
+	ChunkFile file((const uint8_t *)&data[0], (int32_t)data.size());
+	int codec = 0;
+	int channels = 0;
+	int sampleRate = 0;
+	int bytesPerFrame = 0;
+	u8 at3Extradata[16];
+	memset(at3Extradata, 0, sizeof(at3Extradata));
+	std::vector<u8> frames;
+	if (file.descend('RIFF')) {
+		file.readInt();  // 'WAVE'
+		if (file.descend('fmt ')) {
+			int temp = file.readInt();
+			codec = (temp & 0xFFFF) == 0xFFFE ? PSP_CODEC_AT3PLUS : ((temp & 0xFFFF) == 0x270 ? PSP_CODEC_AT3 : 0);
+			channels = temp >> 16;
+			sampleRate = file.readInt();
+			file.readInt();  // Average bytes per second.
+			bytesPerFrame = file.readInt() & 0xFFFF;
+			if (codec == PSP_CODEC_AT3 && file.getCurrentChunkSize() >= 32)
+				file.readData(at3Extradata, 16);
+			file.ascend();
+		}
+		if (file.descend('data')) {
+			frames.resize(file.getCurrentChunkSize());
+			if (!frames.empty())
+				file.readData(&frames[0], (int)frames.size());
+			file.ascend();
+		}
+		file.ascend();
+	}
+	if (codec == 0 || bytesPerFrame == 0 || frames.empty()) {
+		fprintf(stderr, "%s is not an ATRAC3 or ATRAC3+ file\n", filename);
+		return false;
+	}
+
+	SimpleAudio decoder(codec, sampleRate, channels);
+	if (codec == PSP_CODEC_AT3)
+		decoder.SetExtraData(&at3Extradata[2], 14, bytesPerFrame);
+
+	result.name = "atrac:" + BaseName(filename);
+	result.samples = 0;
+	result.seconds = 0.0;
+	result.checksum = 0x811C9DC5;
+	result.exact = false;
+
+	// Plenty for a frame of any of them.
+	std::vector<s16> pcm(16 * 1024);
+	for (size_t pos = 0; pos + bytesPerFrame <= frames.size(); pos += bytesPerFrame) {
+		int outBytes = 0;
+		const double start = real_time_now();
+		decoder.Decode(&frames[pos], bytesPerFrame, (uint8_t *)&pcm[0], &outBytes);
+		result.seconds += real_time_now() - start;
+
+		result.checksum = Checksum(result.checksum, &pcm[0], outBytes / sizeof(s16));
+		result.samples += outBytes / (2 * sizeof(s16));
+	}
+	if (result.samples == 0) {
+		fprintf(stderr, "Nothing decoded from %s\n", filename);
+		return false;
+	}
+	return true;
+}
+
+// Decodes every frame of an .mp3 file.  Like sceMp3, this hands the decoder everything that's left
+// and lets it say how much was one frame.
+static bool RunMp3File(const char *filename, BenchResult &result) {
+	std::string data;
+	if (!ReadWholeFile(filename, data))
+		return false;
+
+	// Skip an ID3v2 tag, the decoder only wants frames.
+	size_t pos = 0;
+	if (data.size() >= 10 && !memcmp(&data[0], "ID3", 3))
+		pos = 10 + (((u8)data[6] & 0x7F) << 21 | ((u8)data[7] & 0x7F) << 14 | ((u8)data[8] & 0x7F) << 7 | ((u8)data[9] & 0x7F));
+
+	SimpleAudio decoder(PSP_CODEC_MP3);
+	result.name = "mp3:" + BaseName(filename);
+	result.samples = 0;
+	result.seconds = 0.0;
+	result.checksum = 0x811C9DC5;
+	result.exact = false;
+
+	std::vector<s16> pcm(16 * 1024);
+	while (pos < data.size()) {
+		int outBytes = 0;
+		const double start = real_time_now();
+		const bool decoded = decoder.Decode(&data[pos], (int)(data.size() - pos), (uint8_t *)&pcm[0], &outBytes);
+		result.seconds += real_time_now() - start;
+		// Stops at the end, or at trailing junk like an ID3v1 tag.
+		if (!decoded || decoder.GetSourcePos() <= 0)
+			break;
+		pos += decoder.GetSourcePos();
+
+		result.checksum = Checksum(result.checksum, &pcm[0], outBytes / sizeof(s16));
+		result.samples += outBytes / (2 * sizeof(s16));
+	}
+	if (result.samples == 0) {
+		fprintf(stderr, "Nothing decoded from %s\n", filename);
+		return false;
+	}
+	return true;
+}
+
+// Feeds PCM from several sceAudio channels - full volume stereo, attenuated stereo and mono - through
+// __AudioEnqueue() and __AudioUpdate(), and takes it out the other end.  With resample, that's
+// __AudioMix() like the host's audio callback would, otherwise the mix is taken as is.
+static BenchResult RunAudioChannels(const char *name, bool resample) {
+	const int blocks = 40000;
+	const int hostFrames = 256;
+
+	CoreTiming::Init();
+	__AudioInit();
+
+	struct ChannelSetup {
+		u32 format;
+		int samples;
+		u32 leftVolume;
+		u32 rightVolume;
+	};
+	const ChannelSetup setups[] = {
+		{ PSP_AUDIO_FORMAT_STEREO, 1024, 0x8000, 0x8000 },
+		{ PSP_AUDIO_FORMAT_STEREO, 512, 0x4000, 0x6000 },
+		{ PSP_AUDIO_FORMAT_STEREO, 2048, 0x8000, 0x2000 },
+		{ PSP_AUDIO_FORMAT_MONO, 256, 0x7000, 0x3000 },
+		{ PSP_AUDIO_FORMAT_MONO, 1024, 0x8000, 0x8000 },
+	};
+	const int numChannels = sizeof(setups) / sizeof(setups[0]);
+
+	u32 addr = PSP_GetUserMemoryBase();
+	for (int i = 0; i < numChannels; ++i) {
+		AudioChannel &chan = chans[i];
+		const int values = setups[i].samples * (setups[i].format == PSP_AUDIO_FORMAT_STEREO ? 2 : 1);
+		WriteTestPCM(addr, values, 0.01f * (i + 1));
+		chan.reserved = true;
+		chan.sampleAddress = addr;
+		chan.sampleCount = setups[i].samples;
+		chan.format = setups[i].format;
+		chan.leftVolume = setups[i].leftVolume;
+		chan.rightVolume = setups[i].rightVolume;
+		addr += values * sizeof(s16);
+	}
+
+	BenchResult result;
+	result.name = name;
+	result.samples = 0;
+	result.seconds = 0.0;
+	result.checksum = 0x811C9DC5;
+	result.exact = !resample;
+
+	s16 out[hostFrames * 2];
+	for (int block = 0; block < blocks; ++block) {
+		const double start = real_time_now();
+		for (int i = 0; i < numChannels; ++i) {
+			// Not blocking, so this only takes samples once the channel has played what it had.
+			if (chans[i].sampleQueue.size() == 0)
+				__AudioEnqueue(chans[i], i, false);
+		}
+		__AudioUpdate();
+
+		int produced = 0;
+		// At this latency a block is 64 frames, and the host pulls several at once.
+		if ((block % (hostFrames / 64)) == hostFrames / 64 - 1)
+			produced = resample ? __AudioMix(out, hostFrames, 44100) : __AudioTakeMixed(out, hostFrames);
+		result.seconds += real_time_now() - start;
+
+		if (produced > 0) {
+			result.checksum = Checksum(result.checksum, out, produced * 2);
+			result.samples += produced;
+		}
+	}
+
+	__AudioShutdown();
+	CoreTiming::Shutdown();
+	return result;
+}
+
+static bool LoadGoldens(const char *filename, std::map<std::string, u32> &goldens) {
+	FILE *fp = File::OpenCFile(filename, "r");
+	if (!fp)
+		return false;
+	char line[512];
+	while (fgets(line, sizeof(line), fp)) {
+		// The name comes last, since it may contain spaces.
+		u32 checksum;
+		char name[480];
+		if (sscanf(line, "%08x %479[^\r\n]", &checksum, name) == 2)
+			goldens[name] = checksum;
+	}
+	fclose(fp);
+	return true;
+}
+
+static bool SaveGoldens(const char *filename, const std::vector<BenchResult> &results) {
+	FILE *fp = File::OpenCFile(filename, "w");
+	if (!fp)
+		return false;
+	for (size_t i = 0; i < results.size(); ++i) {
+		if (results[i].exact)
+			fprintf(fp, "%08x %s\n", results[i].checksum, results[i].name.c_str());
+	}
+	fclose(fp);
+	return true;
+}
+
+static int printUsage(const char *progname, const char *reason) {
+	if (reason != NULL)
+		fprintf(stderr, "Error: %s\n\n", reason);
+	fprintf(stderr, "Times SAS mixing, VAG, ATRAC and MP3 decoding and sceAudio mixing outside the emulator.\n\n");
+	fprintf(stderr, "Usage: %s [options] [file.at3|file.mp3...]\n\n", progname);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --golden=FILE         compare output checksums against FILE\n");
+	fprintf(stderr, "  --write-golden=FILE   save output checksums to FILE\n");
+
+	return 1;
+}
+
+int main(int argc, const char *argv[]) {
+	const char *goldenFile = 0;
+	const char *writeGoldenFile = 0;
+	std::vector<const char *> files;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "--golden=", strlen("--golden=")) && strlen(argv[i]) > strlen("--golden="))
+			goldenFile = argv[i] + strlen("--golden=");
+		else if (!strncmp(argv[i], "--write-golden=", strlen("--write-golden=")) && strlen(argv[i]) > strlen("--write-golden="))
+			writeGoldenFile = argv[i] + strlen("--write-golden=");
+		else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+			return printUsage(argv[0], NULL);
+		else if (argv[i][0] == '-')
+			return printUsage(argv[0], "Unknown option");
+		else
+			files.push_back(argv[i]);
+	}
+
+	std::map<std::string, u32> goldens;
+	if (goldenFile && !LoadGoldens(goldenFile, goldens)) {
+		fprintf(stderr, "Unable to read %s\n", goldenFile);
+		return 1;
+	}
+
+	g_Config.bEnableLogging = false;
+	g_Config.bEnableSound = true;
+	g_Config.IaudioLatency = 1;
+	Memory::g_MemorySize = Memory::RAM_NORMAL_SIZE;
+	Memory::Init();
+
+	std::vector<BenchResult> results;
+	results.push_back(RunSasStream("sas pcm", 1, false, true));
+	results.push_back(RunSasStream("sas vag", 2, true, false));
+	results.push_back(RunSasStream("sas mixed", 3, true, true));
+	results.push_back(RunSasVoices("sas 32 voices"));
+	VagDecoder::ClearCache();
+	const BenchResult vagUncached = RunVagPlays("vag uncached", false);
+	const BenchResult vagCached = RunVagPlays("vag cached", true);
+	results.push_back(vagUncached);
+	results.push_back(vagCached);
+	results.push_back(RunAudioChannels("sceAudio mix", false));
+	results.push_back(RunAudioChannels("sceAudio resample", true));
+	Memory::Shutdown();
+
+	int failed = 0;
+	if (vagCached.checksum != vagUncached.checksum) {
+		fprintf(stderr, "Cached VAG output differs from decoding from memory!\n");
+		failed++;
+	}
+	for (size_t i = 0; i < files.size(); ++i) {
+		const std::string name = files[i];
+		const bool isMp3 = name.size() > 4 && !strcasecmp(name.c_str() + name.size() - 4, ".mp3");
+		BenchResult result;
+		if (isMp3 ? RunMp3File(files[i], result) : RunAtracFile(files[i], result))
+			results.push_back(result);
+		else
+			failed++;
+	}
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult &result = results[i];
+		printf("%-24s %10d samples %9.2f ns/sample  %08x", result.name.c_str(), (int)result.samples,
+			result.seconds * 1000000000.0 / std::max(result.samples, (u64)1), result.checksum);
+		if (goldenFile && !result.exact) {
+			printf("  (not exact)");
+		} else if (goldenFile) {
+			auto golden = goldens.find(result.name);
+			if (golden == goldens.end()) {
+				printf("  (no golden)");
+			} else if (golden->second != result.checksum) {
+				printf("  MISMATCH, expected %08x", golden->second);
+				failed++;
+			} else {
+				printf("  ok");
+			}
+		}
+		printf("\n");
+	}
+
+	if (writeGoldenFile && !SaveGoldens(writeGoldenFile, results)) {
+		fprintf(stderr, "Unable to write %s\n", writeGoldenFile);
+		return 1;
+	}
+	return failed == 0 ? 0 : 1;
+}
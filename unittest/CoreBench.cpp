@@ -0,0 +1,424 @@
+// Copyright (c) 2014- PPSSPP Project.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 2.0 or later versions.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License 2.0 for more details.
+
+// A copy of the GPL 2.0 should have been included with the program.
+// If not, see http://www.gnu.org/licenses/
+
+// Official git repository and contact information can be found at
+// https://github.com/hrydgard/ppsspp and http://www.ppsspp.org/.
+
+// CoreBench
+//
+// Times the disc image, shader generation and video paths on real game data, outside the
+// emulator.  The audio paths have their own, AudioBench.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "base/NativeApp.h"
+#include "base/timeutil.h"
+#include "Common/CPUDetect.h"
+#include "Common/FileUtil.h"
+#include "Core/Config.h"
+#include "Core/MemMap.h"
+#include "Core/FileSystems/BlockDevices.h"
+#include "Core/FileSystems/ISOFileSystem.h"
+#include "Core/HW/MediaEngine.h"
+#include "GPU/ge_constants.h"
+#include "GPU/GLES/ShaderVariantCache.h"
+
+std::string System_GetProperty(SystemProperty prop) { return ""; }
+int System_GetPropertyInt(SystemProperty prop) { return -1; }
+
+// Regenerates the GLSL for every recorded variant, without compiling it. Useful for profiling
+// the shader generators against the state combinations real games use.
+static int RunShaderGenBenchmark(const char *filename)
+{
+	ShaderVariantCache cache;
+	if (!cache.Load(filename) || cache.NumVariants() == 0)
+	{
+		fprintf(stderr, "Unable to load any shader variants from %s\n", filename);
+		return 1;
+	}
+
+	std::vector<ShaderVariant> variants = cache.Variants();
+	std::vector<char> buffer(16384);
+	const int iterations = 20;
+	size_t totalBytes = 0;
+	int mismatches = 0;
+
+	double start = real_time_now();
+	for (int iter = 0; iter < iterations; ++iter)
+	{
+		for (size_t i = 0; i < variants.size(); ++i)
+		{
+			ShaderVariant &variant = variants[i];
+			variant.Swap();
+
+			VertexShaderID VSID;
+			ComputeVertexShaderID(&VSID, variant.vertType, variant.prim, variant.useHWTransform != 0);
+			FragmentShaderID FSID;
+			ComputeFragmentShaderID(&FSID);
+			if (iter == 0 && (!(VSID == variant.vsid) || !(FSID == variant.fsid)))
+				mismatches++;
+
+			GenerateVertexShader(variant.prim, variant.vertType, &buffer[0], variant.useHWTransform != 0);
+			totalBytes += strlen(&buffer[0]);
+			GenerateFragmentShader(&buffer[0]);
+			totalBytes += strlen(&buffer[0]);
+
+			variant.Swap();
+		}
+	}
+	double elapsed = real_time_now() - start;
+
+	int generated = iterations * (int)variants.size();
+	printf("%d variants (%d with different IDs under current settings)\n", (int)variants.size(), mismatches);
+	printf("Generated %d shader pairs in %0.2f ms: %0.2f us per pair, %0.2f MB/s of GLSL\n",
+		generated, elapsed * 1000.0, elapsed * 1000000.0 / generated, totalBytes / (1024.0 * 1024.0) / elapsed);
+	return 0;
+}
+
+static u64 ReadAllFiles(ISOFileSystem &fs, const std::string &path, std::vector<u8> &buffer)
+{
+	u64 total = 0;
+	std::vector<PSPFileInfo> files = fs.GetDirListing(path);
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		const std::string filename = path + "/" + files[i].name;
+		if (files[i].type == FILETYPE_DIRECTORY)
+		{
+			total += ReadAllFiles(fs, filename, buffer);
+			continue;
+		}
+
+		u32 handle = fs.OpenFile(filename, FILEACCESS_READ);
+		if (handle == 0)
+			continue;
+		size_t bytes;
+		while ((bytes = fs.ReadFile(handle, &buffer[0], buffer.size())) > 0)
+			total += bytes;
+		fs.CloseFile(handle);
+	}
+	return total;
+}
+
+// Reads the whole disc through ISOFileSystem in game-sized chunks, with the block cache off and on,
+// and memory mapped where supported. The first (untimed) pass is just there so every run sees a
+// warm OS file cache.
+static int RunReadISOBenchmark(const char *filename)
+{
+	const int cacheSizes[] = { 0, 0, 4096, 0 };
+	const bool memoryMap[] = { false, false, false, true };
+	const size_t chunkSizes[] = { 2048 * 4 + 100, 64 * 1024 };
+	g_Config.iNumWorkerThreads = cpu_info.num_cores;
+
+	for (size_t c = 0; c < sizeof(cacheSizes) / sizeof(cacheSizes[0]); ++c)
+	{
+		for (size_t s = 0; s < sizeof(chunkSizes) / sizeof(chunkSizes[0]); ++s)
+		{
+			g_Config.iIOCacheSize = cacheSizes[c];
+			g_Config.bMemoryMapISO = memoryMap[c];
+			BlockDevice *bd = constructBlockDevice(filename);
+			if (!bd)
+			{
+				fprintf(stderr, "Unable to open %s\n", filename);
+				return 1;
+			}
+
+			SequentialHandleAllocator handles;
+			std::vector<u8> buffer(chunkSizes[s]);
+			double start = real_time_now();
+			ISOFileSystem fs(&handles, bd);
+			u64 total = ReadAllFiles(fs, "", buffer);
+			double elapsed = real_time_now() - start;
+
+			// The ISOFileSystem owns the device.
+			if (c == 0)
+				break;
+
+			// Only plain ISOs are mapped, and only on some platforms.
+			if (memoryMap[c] && !bd->PeekBlocks(0, 1))
+				break;
+
+			printf("%s %5d KB, %6d byte reads: %0.1f MB in %0.2f s, %0.1f MB/s",
+				memoryMap[c] ? "Mapped" : "Cache ", cacheSizes[c], (int)chunkSizes[s], total / (1024.0 * 1024.0), elapsed, total / (1024.0 * 1024.0) / elapsed);
+			CachedBlockDevice *cached = dynamic_cast<CachedBlockDevice *>(bd);
+			if (cached)
+				printf(" (%lld hits, %lld misses, %lld device reads)", (long long)cached->HitCount(), (long long)cached->MissCount(), (long long)cached->DeviceReadCount());
+			printf("\n");
+		}
+	}
+	return 0;
+}
+
+// Raw block device throughput, without the cache. Run it on an ISO and a CSO of the same game
+// to compare them.
+static int RunReadBlocksBenchmark(const char *filename)
+{
+	const int blocksPerRead = 64;
+	g_Config.iIOCacheSize = 0;
+	g_Config.bMemoryMapISO = false;
+	g_Config.iNumWorkerThreads = cpu_info.num_cores;
+
+	for (int parallel = 0; parallel < 2; ++parallel)
+	{
+		BlockDevice *bd = constructBlockDevice(filename);
+		if (!bd)
+		{
+			fprintf(stderr, "Unable to open %s\n", filename);
+			return 1;
+		}
+		CISOFileBlockDevice *cso = dynamic_cast<CISOFileBlockDevice *>(bd);
+		if (cso)
+			cso->SetParallelDecompress(parallel != 0);
+		else if (parallel)
+		{
+			delete bd;
+			break;
+		}
+
+		std::vector<u8> buffer(blocksPerRead * bd->GetBlockSize());
+		const u32 numBlocks = bd->GetNumBlocks();
+		double start = real_time_now();
+		for (u32 block = 0; block < numBlocks; block += blocksPerRead)
+		{
+			int count = (int)std::min((u32)blocksPerRead, numBlocks - block);
+			bd->ReadBlocks(block, count, &buffer[0]);
+		}
+		double elapsed = real_time_now() - start;
+
+		const double mb = (double)numBlocks * bd->GetBlockSize() / (1024.0 * 1024.0);
+		printf("%s%s: %0.1f MB in %0.2f s, %0.1f MB/s\n", cso ? "CSO" : "ISO", cso ? (parallel ? " parallel" : " serial") : "", mb, elapsed, mb / elapsed);
+		delete bd;
+	}
+	return 0;
+}
+
+static void ListAllPaths(ISOFileSystem &fs, const std::string &path, std::vector<std::string> &paths)
+{
+	std::vector<PSPFileInfo> files = fs.GetDirListing(path);
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		const std::string filename = path + "/" + files[i].name;
+		paths.push_back(filename);
+		if (files[i].type == FILETYPE_DIRECTORY)
+			ListAllPaths(fs, filename, paths);
+	}
+}
+
+// Resolves every path on the disc, the way sceIoGetstat/sceIoOpen do. The first pass on a freshly
+// mounted disc only has the directory indexes to go on, later passes hit the path cache.
+static int RunLookupISOBenchmark(const char *filename)
+{
+	const int passes = 5;
+	g_Config.iIOCacheSize = 4096;
+	g_Config.bMemoryMapISO = true;
+	g_Config.iNumWorkerThreads = cpu_info.num_cores;
+
+	std::vector<std::string> paths;
+	{
+		BlockDevice *bd = constructBlockDevice(filename);
+		if (!bd)
+		{
+			fprintf(stderr, "Unable to open %s\n", filename);
+			return 1;
+		}
+		SequentialHandleAllocator handles;
+		ISOFileSystem fs(&handles, bd);
+		ListAllPaths(fs, "", paths);
+	}
+	if (paths.empty())
+	{
+		fprintf(stderr, "No files found in %s\n", filename);
+		return 1;
+	}
+
+	// Games aren't consistent about case, so look them up lowercased like many do.
+	for (size_t i = 0; i < paths.size(); ++i)
+		std::transform(paths[i].begin(), paths[i].end(), paths[i].begin(), ::tolower);
+
+	// A fresh mount, so the first pass starts cold.
+	BlockDevice *bd = constructBlockDevice(filename);
+	if (!bd)
+	{
+		fprintf(stderr, "Unable to reopen %s\n", filename);
+		return 1;
+	}
+	SequentialHandleAllocator handles;
+	ISOFileSystem fs(&handles, bd);
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		int missing = 0;
+		double start = real_time_now();
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			if (!fs.GetFileInfo(paths[i]).exists)
+				++missing;
+		}
+		double elapsed = real_time_now() - start;
+
+		printf("%s: %d paths in %0.2f ms, %0.2f us per lookup", pass == 0 ? "Cold  " : "Cached", (int)paths.size(), elapsed * 1000.0, elapsed * 1000000.0 / paths.size());
+		if (missing != 0)
+			printf(" (%d not found!)", missing);
+		printf("\n");
+	}
+	return 0;
+}
+
+// Feeds the stream in like a game's ringbuffer and decodes every frame the way sceMpegAvcDecode
+// does, cycling through the pixel formats.  Between frames, spins for a while to stand in for the
+// rest of the game, which is when decoding ahead gets to run.
+static u32 PlayPMF(const std::vector<u8> &data, u32 frameAddr, bool decodeAhead, int &frames, double &decodeTime)
+{
+	const int ringbufferSize = 0x200 * 2048;
+	const int chunkSize = 16 * 2048;
+	const double gameWork = 0.004;
+	const int modes[] = { GE_CMODE_32BIT_ABGR8888, GE_CMODE_16BIT_BGR5650, GE_CMODE_16BIT_ABGR5551, GE_CMODE_16BIT_ABGR4444 };
+
+	g_Config.bVideoDecodeAhead = decodeAhead;
+	MediaEngine *engine = new MediaEngine();
+	engine->loadStream(&data[0], 2048, ringbufferSize);
+
+	u32 checksum = 0;
+	size_t pos = 0;
+	frames = 0;
+	decodeTime = 0.0;
+	while (true)
+	{
+		bool added = false;
+		while (pos < data.size() && engine->getRemainSize() >= chunkSize)
+		{
+			const int size = (int)std::min((size_t)chunkSize, data.size() - pos);
+			engine->addStreamData(&data[pos], size);
+			pos += size;
+			added = true;
+		}
+
+		const int mode = modes[frames % (sizeof(modes) / sizeof(modes[0]))];
+		double start = real_time_now();
+		bool gotFrame = engine->stepVideo(mode);
+		int written = gotFrame ? engine->writeVideoImage(frameAddr, 512, mode) : 0;
+		decodeTime += real_time_now() - start;
+		if (!gotFrame)
+		{
+			if (engine->IsVideoEnd() || !added)
+				break;
+			continue;
+		}
+
+		const u8 *frame = Memory::GetPointer(frameAddr);
+		for (int i = 0; i < written; ++i)
+			checksum = checksum * 31 + frame[i];
+		++frames;
+
+		const double until = real_time_now() + gameWork;
+		while (real_time_now() < until)
+			continue;
+	}
+
+	delete engine;
+	return checksum;
+}
+
+static int RunPlayPMFBenchmark(const char *filename)
+{
+#ifdef USE_FFMPEG
+	std::vector<u8> data;
+	File::IOFile f(filename, "rb");
+	if (f.IsOpen())
+	{
+		data.resize((size_t)f.GetSize());
+		if (!data.empty() && !f.ReadArray(&data[0], data.size()))
+			data.clear();
+	}
+	if (data.size() < 2048)
+	{
+		fprintf(stderr, "Unable to read %s\n", filename);
+		return 1;
+	}
+
+	Memory::g_MemorySize = Memory::RAM_NORMAL_SIZE;
+	Memory::Init();
+	const u32 frameAddr = PSP_GetUserMemoryBase();
+
+	int inPlaceFrames, aheadFrames;
+	double inPlace, ahead;
+	const u32 inPlaceSum = PlayPMF(data, frameAddr, false, inPlaceFrames, inPlace);
+	const u32 aheadSum = PlayPMF(data, frameAddr, true, aheadFrames, ahead);
+	g_Config.bVideoDecodeAhead = true;
+	Memory::Shutdown();
+
+	if (inPlaceFrames == 0)
+	{
+		fprintf(stderr, "No video frames decoded from %s\n", filename);
+		return 1;
+	}
+
+	printf("Played %d frames of %s\n", inPlaceFrames, filename);
+	printf("  decoding in place: %0.2f ms on the emu thread, %0.2f ms per frame\n", inPlace * 1000.0, inPlace * 1000.0 / inPlaceFrames);
+	printf("  decoding ahead:    %0.2f ms on the emu thread, %0.2f ms per frame\n", ahead * 1000.0, ahead * 1000.0 / std::max(aheadFrames, 1));
+
+	if (aheadFrames != inPlaceFrames || aheadSum != inPlaceSum)
+	{
+		fprintf(stderr, "Decoding ahead gave different frames!\n");
+		return 1;
+	}
+	return 0;
+#else
+	fprintf(stderr, "Playing PMFs requires FFmpeg\n");
+	return 1;
+#endif
+}
+
+static int printUsage(const char *progname, const char *reason)
+{
+	if (reason != NULL)
+		fprintf(stderr, "Error: %s\n\n", reason);
+	fprintf(stderr, "Times disc image, shader generation and video decoding outside the emulator.\n\n");
+	fprintf(stderr, "Usage: %s option\n\n", progname);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --shadergen=FILE      generate all shaders recorded in a shader cache and time it\n");
+	fprintf(stderr, "  --readiso=FILE        read every file in an ISO/CSO with and without the block cache\n");
+	fprintf(stderr, "  --readblocks=FILE     read all blocks of an ISO/CSO, CSOs both serially and in parallel\n");
+	fprintf(stderr, "  --lookupiso=FILE      look up every path in an ISO/CSO, cold and with the path cache\n");
+	fprintf(stderr, "  --playpmf=FILE        play a PMF's video like sceMpeg does, with and without decoding ahead\n");
+
+	return 1;
+}
+
+int main(int argc, const char *argv[])
+{
+	if (argc != 2)
+		return printUsage(argv[0], argc <= 1 ? NULL : "Only one option at a time");
+
+	g_Config.bEnableLogging = false;
+
+	const char *arg = argv[1];
+	if (!strncmp(arg, "--shadergen=", strlen("--shadergen=")) && strlen(arg) > strlen("--shadergen="))
+		return RunShaderGenBenchmark(arg + strlen("--shadergen="));
+	else if (!strncmp(arg, "--readiso=", strlen("--readiso=")) && strlen(arg) > strlen("--readiso="))
+		return RunReadISOBenchmark(arg + strlen("--readiso="));
+	else if (!strncmp(arg, "--readblocks=", strlen("--readblocks=")) && strlen(arg) > strlen("--readblocks="))
+		return RunReadBlocksBenchmark(arg + strlen("--readblocks="));
+	else if (!strncmp(arg, "--lookupiso=", strlen("--lookupiso=")) && strlen(arg) > strlen("--lookupiso="))
+		return RunLookupISOBenchmark(arg + strlen("--lookupiso="));
+	else if (!strncmp(arg, "--playpmf=", strlen("--playpmf=")) && strlen(arg) > strlen("--playpmf="))
+		return RunPlayPMFBenchmark(arg + strlen("--playpmf="));
+	else if (!strcmp(arg, "--help") || !strcmp(arg, "-h"))
+		return printUsage(argv[0], NULL);
+	return printUsage(argv[0], "Unknown option");
+}
@@ -28,9 +28,11 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
+#include <cstring>
 #include <string>
 
 #include "base/NativeApp.h"
+#include "base/timeutil.h"
 #include "Common/CPUDetect.h"
 #include "Common/ArmEmitter.h"
 #include "ext/disarm.h"
@@ -38,6 +40,7 @@
 #include "util/text/parsers.h"
 #include "Core/Config.h"
 #include "Core/MIPS/MIPSVFPUUtils.h"
+#include "GPU/Common/IndexGenerator.h"
 
 #define EXPECT_TRUE(a) if (!(a)) { printf("%s:%i: Test Fail\n", __FUNCTION__, __LINE__); return false; }
 #define EXPECT_FALSE(a) if ((a)) { printf("%s:%i: Test Fail\n", __FUNCTION__, __LINE__); return false; }
@@ -417,6 +420,108 @@ bool TestVFPUSinCos() {
 	return true;
 }
 
+// The straightforward versions, to check the generator against and to compare speed with.
+template <typename ITYPE>
+static u16 *ReferenceStrip(u16 *out, const ITYPE *inds, int numInds, int indexOffset) {
+	int wind = 1;
+	for (int i = 0; i < numInds - 2; i++) {
+		*out++ = indexOffset + inds[i];
+		*out++ = indexOffset + inds[i + wind];
+		wind ^= 3;
+		*out++ = indexOffset + inds[i + wind];
+	}
+	return out;
+}
+
+template <typename ITYPE>
+static u16 *ReferenceFan(u16 *out, const ITYPE *inds, int numInds, int indexOffset) {
+	for (int i = 0; i < numInds - 2; i++) {
+		*out++ = indexOffset + inds[0];
+		*out++ = indexOffset + inds[i + 1];
+		*out++ = indexOffset + inds[i + 2];
+	}
+	return out;
+}
+
+// Checks every primitive the generator translates with SIMD against the reference, for both index
+// sizes.  The lengths cover the SIMD loop with every possible scalar tail after it.
+template <typename ITYPE>
+static bool TestIndexGeneratorPrims(IndexGenerator &gen, const ITYPE *inds, u16 *expected, u16 *actual) {
+	for (int numInds = 2; numInds < 40; numInds++) {
+		gen.Setup(actual);
+		gen.SetIndex(100);
+		gen.TranslatePrim(GE_PRIM_TRIANGLE_STRIP, numInds, inds, 10);
+		u16 *end = ReferenceStrip(expected, inds, numInds, 90);
+		EXPECT_TRUE(gen.VertexCount() == (numInds - 2) * 3);
+		EXPECT_TRUE(memcmp(expected, actual, (end - expected) * sizeof(u16)) == 0);
+
+		gen.Setup(actual);
+		gen.SetIndex(100);
+		gen.TranslatePrim(GE_PRIM_TRIANGLE_FAN, numInds, inds, 10);
+		end = ReferenceFan(expected, inds, numInds, 90);
+		EXPECT_TRUE(gen.VertexCount() == (numInds - 2) * 3);
+		EXPECT_TRUE(memcmp(expected, actual, (end - expected) * sizeof(u16)) == 0);
+
+		const int listInds = numInds - numInds % 3;
+		gen.Setup(actual);
+		gen.SetIndex(100);
+		gen.TranslatePrim(GE_PRIM_TRIANGLES, listInds, inds, 10);
+		for (int i = 0; i < listInds; i++) {
+			expected[i] = 90 + inds[i];
+		}
+		EXPECT_TRUE(gen.VertexCount() == listInds);
+		EXPECT_TRUE(memcmp(expected, actual, listInds * sizeof(u16)) == 0);
+	}
+	return true;
+}
+
+bool TestIndexGenerator() {
+	static u16 inds[1024];
+	static u8 inds8[1024];
+	static u16 expected[65536];
+	static u16 actual[65536];
+	for (int i = 0; i < 1024; i++) {
+		inds[i] = (u16)(i * 7 + (i >> 3));
+		inds8[i] = (u8)(i * 7 + (i >> 3));
+	}
+
+	IndexGenerator gen;
+	if (!TestIndexGeneratorPrims(gen, inds, expected, actual))
+		return false;
+	if (!TestIndexGeneratorPrims(gen, inds8, expected, actual))
+		return false;
+
+	// Typical strip lengths, from sprites to long terrain strips.
+	static const int lengths[] = { 4, 8, 16, 32, 64, 256 };
+	for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+		const int len = lengths[l];
+		const int stripsPerBatch = 65536 / ((len - 2) * 3);
+		const int batches = 2000000 / (len * stripsPerBatch) + 1;
+
+		double start = real_time_now();
+		for (int b = 0; b < batches; b++) {
+			gen.Setup(actual);
+			for (int i = 0; i < stripsPerBatch; i++) {
+				gen.TranslatePrim(GE_PRIM_TRIANGLE_STRIP, len, inds, 0);
+			}
+		}
+		const double genTime = real_time_now() - start;
+
+		start = real_time_now();
+		for (int b = 0; b < batches; b++) {
+			u16 *out = expected;
+			for (int i = 0; i < stripsPerBatch; i++) {
+				out = ReferenceStrip(out, inds, len, 0);
+			}
+		}
+		const double refTime = real_time_now() - start;
+
+		const double mInds = (double)batches * stripsPerBatch * len / 1000000.0;
+		printf("Strip length %3d: %7.1f Minds/s (scalar %7.1f Minds/s)\n", len, mInds / genTime, mInds / refTime);
+	}
+	return true;
+}
+
 int main(int argc, const char *argv[]) {
 	cpu_info.bNEON = true;
 	cpu_info.bVFP = true;
@@ -427,6 +532,7 @@ int main(int argc, const char *argv[]) {
 	//TestSinCos();
 	//TestArmEmitter();
 	TestVFPUSinCos();
+	TestIndexGenerator();
 	//TestMathUtil();
 	//TestParsers();
 	return 0;